@@ -1,7 +1,94 @@
+// `mremap` is a Linux extension.
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#   define _GNU_SOURCE
+#endif
 #include "darray.h"
 #include "dstring.h"
 
+#include <errno.h>
+#include <fcntl.h>
+#include <float.h>
+#include <limits.h>
+#include <math.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+// SIMD fast paths are only compiled in for GNU C compatible compilers targeting
+// x86 with SSE2, which is part of the x86-64 baseline. Every SIMD routine has a
+// scalar fallback.
+#if defined(__SSE2__) && (defined(__GNUC__) || defined(__clang__))
+#   include <emmintrin.h>
+#   define DA_SSE2 1
+#else
+#   define DA_SSE2 0
+#endif
+#if defined(__AVX2__) && DA_SSE2
+#   include <immintrin.h>
+#   define DA_AVX2 1
+#else
+#   define DA_AVX2 0
+#endif
+
+// Routines with an AVX2 variant that pays for itself even when the library is
+// built for an older baseline are compiled for AVX2 with a target attribute,
+// and the variant is picked at runtime.
+#if DA_AVX2
+#   define DA_AVX2_TARGET /* nothing */
+#   define DA_AVX2_VARIANTS 1
+#elif DA_SSE2 && (defined(__x86_64__) || defined(__i386__))
+#   include <immintrin.h>
+#   define DA_AVX2_TARGET __attribute__((target("avx2")))
+#   define DA_AVX2_VARIANTS 1
+#else
+#   define DA_AVX2_VARIANTS 0
+#endif
+
+static inline bool _da_cpu_has_avx2(void)
+{
+#if DA_AVX2
+    return true;
+#elif DA_AVX2_VARIANTS
+    return __builtin_cpu_supports("avx2");
+#else
+    return false;
+#endif
+}
+
+// The same holds for the SSE4.2 crc32 instruction.
+#if defined(__SSE4_2__) && DA_SSE2
+#   include <nmmintrin.h>
+#   define DA_SSE42_TARGET /* nothing */
+#   define DA_SSE42_VARIANTS 1
+#elif DA_SSE2 && (defined(__x86_64__) || defined(__i386__))
+#   include <nmmintrin.h>
+#   define DA_SSE42_TARGET __attribute__((target("sse4.2")))
+#   define DA_SSE42_VARIANTS 1
+#else
+#   define DA_SSE42_VARIANTS 0
+#endif
+
+static inline bool _da_cpu_has_sse42(void)
+{
+#if defined(__SSE4_2__) && DA_SSE2
+    return true;
+#elif DA_SSE42_VARIANTS
+    return __builtin_cpu_supports("sse4.2");
+#else
+    return false;
+#endif
+}
+
 //////////////////////////////////// DARRAY ////////////////////////////////////
+// Every call that modifies the contents of a darray must drop the cached hash
+// and content flags.
+static inline void _da_invalidate_content_cache(void* darr)
+{
+    DA_INVALIDATE_CONTENT_CACHE(darr);
+}
+
 static inline void _da_memswap(void* p1, void* p2, size_t sz)
 {
     char tmp, *a = p1, *b = p2;
@@ -15,30 +102,130 @@ static inline void _da_memswap(void* p1, void* p2, size_t sz)
 
 void* da_alloc(size_t nelem, size_t size)
 {
+    if (size > UINT32_MAX)
+        return NULL;
     size_t capacity = DA_NEW_CAPACITY_FROM_LENGTH(nelem);
     struct _darray* darr = malloc(sizeof(struct _darray) + capacity*size);
     if (darr == NULL)
         return darr;
-    darr->_elemsz = size;
+    darr->_elemsz = (uint32_t)size;
+    darr->_refcount = 0;
     darr->_length = nelem;
     darr->_capacity = capacity;
+    darr->_hash = 0;
     return darr->_data;
 }
 
 void* da_alloc_exact(size_t nelem, size_t size)
 {
+    if (size > UINT32_MAX)
+        return NULL;
     struct _darray* darr = malloc(sizeof(struct _darray) + nelem*size);
     if (darr == NULL)
         return darr;
-    darr->_elemsz = size;
+    darr->_elemsz = (uint32_t)size;
+    darr->_refcount = 0;
     darr->_length = nelem;
     darr->_capacity = nelem;
+    darr->_hash = 0;
     return darr->_data;
 }
 
+// Header fields that are updated from several threads use GNU C atomic
+// builtins. Other compilers serialize the updates with a mutex.
+#if !defined(__GNUC__) && !defined(__clang__)
+static pthread_mutex_t _da_atomic_lock = PTHREAD_MUTEX_INITIALIZER;
+#endif
+
+// Drop the reference to a darray held by one of its owners. Returns true if
+// that was the last reference.
+static inline bool _da_release(void* darr)
+{
+#if defined(__GNUC__) || defined(__clang__)
+    return __atomic_fetch_sub(
+        DA_P_REFCOUNT_FROM_HANDLE(darr), 1, __ATOMIC_ACQ_REL) == 0;
+#else
+    pthread_mutex_lock(&_da_atomic_lock);
+    bool last = (*DA_P_REFCOUNT_FROM_HANDLE(darr))-- == 0;
+    pthread_mutex_unlock(&_da_atomic_lock);
+    return last;
+#endif
+}
+
+// Darrays mapped from files are moved and freed through their mapping. See
+// MAPPED FILES.
+static struct _darray* _da_mapped_realloc(void* darr, size_t capacity);
+static bool _da_unmap_block(void* darr);
+
+// Move an unshared darray to a block with room for `capacity` elements.
+// Returns the header of the new block or NULL on failure.
+static struct _darray* _da_realloc(void* darr, size_t capacity)
+{
+    if (DA_FLAGS_FROM_HANDLE(darr) & DA_FLAG_MAPPED)
+        return _da_mapped_realloc(darr, capacity);
+    return realloc(DA_P_HEAD_FROM_HANDLE(darr),
+        sizeof(struct _darray) + capacity*da_sizeof_elem(darr));
+}
+
+// Free the block of a darray whose last reference was released.
+static void _da_free_block(void* darr)
+{
+    if (DA_FLAGS_FROM_HANDLE(darr) & DA_FLAG_MAPPED)
+        _da_unmap_block(darr);
+    else
+        free(DA_P_HEAD_FROM_HANDLE(darr));
+}
+
+// Copy a shared darray into a new block with room for `capacity` elements and
+// a length of `nelem`, then release the reference to the shared darray.
+// Returns NULL on allocation failure, in which case `darr` is left untouched.
+static void* _da_unshare_with(void* darr, size_t nelem, size_t capacity)
+{
+    struct _darray* head = (struct _darray*)DA_P_HEAD_FROM_HANDLE(darr);
+    struct _darray* copy =
+        malloc(sizeof(struct _darray) + capacity*head->_elemsz);
+    if (copy == NULL)
+        return NULL;
+    size_t ncopy = head->_length < nelem ? head->_length : nelem;
+    copy->_elemsz = head->_elemsz;
+    copy->_refcount = 0;
+    copy->_length = nelem;
+    copy->_capacity = capacity;
+    copy->_hash = 0;
+    memcpy(copy->_data, head->_data, ncopy*head->_elemsz);
+    if (_da_release(darr))
+        _da_free_block(darr);
+    return copy->_data;
+}
+
 void da_free(void* darr)
 {
-    free(DA_P_HEAD_FROM_HANDLE(darr));
+    if (_da_release(darr))
+        _da_free_block(darr);
+}
+
+void* da_share(void* darr)
+{
+#if defined(__GNUC__) || defined(__clang__)
+    __atomic_fetch_add(DA_P_REFCOUNT_FROM_HANDLE(darr), 1, __ATOMIC_RELAXED);
+#else
+    pthread_mutex_lock(&_da_atomic_lock);
+    *DA_P_REFCOUNT_FROM_HANDLE(darr) += 1;
+    pthread_mutex_unlock(&_da_atomic_lock);
+#endif
+    return darr;
+}
+
+void* da_unshare(void* darr)
+{
+    if (!DA_IS_SHARED(darr))
+        return darr;
+    return _da_unshare_with(darr, da_length(darr), da_capacity(darr));
+}
+
+bool da_is_shared(const void* darr)
+{
+    return DA_IS_SHARED(darr);
 }
 
 size_t da_length(const void* darr)
@@ -59,42 +246,63 @@ size_t da_sizeof_elem(const void* darr)
 void* da_resize(void* darr, size_t nelem)
 {
     size_t new_capacity = DA_NEW_CAPACITY_FROM_LENGTH(nelem);
-    size_t new_arr_size =
-        sizeof(struct _darray) + new_capacity*da_sizeof_elem(darr);
-    struct _darray* ptr = realloc(DA_P_HEAD_FROM_HANDLE(darr), new_arr_size);
+    if (DA_IS_SHARED(darr))
+        return _da_unshare_with(darr, nelem, new_capacity);
+    struct _darray* ptr = _da_realloc(darr, new_capacity);
     if (ptr == NULL)
         return NULL;
     ptr->_length = nelem;
     ptr->_capacity = new_capacity;
+    ptr->_hash &= ~(DA_HASH_MASK | DA_FLAGS_CONTENT_MASK);
     return ptr->_data;
 }
 
 void* da_resize_exact(void* darr, size_t nelem)
 {
-    size_t new_arr_size = sizeof(struct _darray) + nelem*da_sizeof_elem(darr);
-    struct _darray* ptr = realloc(DA_P_HEAD_FROM_HANDLE(darr), new_arr_size);
+    if (DA_IS_SHARED(darr))
+        return _da_unshare_with(darr, nelem, nelem);
+    struct _darray* ptr = _da_realloc(darr, nelem);
     if (ptr == NULL)
         return NULL;
     ptr->_length = nelem;
     ptr->_capacity = nelem;
+    ptr->_hash &= ~(DA_HASH_MASK | DA_FLAGS_CONTENT_MASK);
     return ptr->_data;
 }
 
 void* da_reserve(void* darr, size_t nelem)
 {
     size_t min_capacity = da_length(darr) + nelem;
+    if (DA_IS_SHARED(darr))
+    {
+        size_t capacity = da_capacity(darr) >= min_capacity
+            ? da_capacity(darr) : DA_NEW_CAPACITY_FROM_LENGTH(min_capacity);
+        return _da_unshare_with(darr, da_length(darr), capacity);
+    }
     if (da_capacity(darr) >= min_capacity)
         return darr;
     size_t new_capacity = DA_NEW_CAPACITY_FROM_LENGTH(min_capacity);
-    size_t new_arr_size =
-        sizeof(struct _darray) + new_capacity*da_sizeof_elem(darr);
-    struct _darray* ptr = realloc(DA_P_HEAD_FROM_HANDLE(darr), new_arr_size);
+    struct _darray* ptr = _da_realloc(darr, new_capacity);
     if (ptr == NULL)
         return NULL;
     ptr->_capacity = new_capacity;
     return ptr->_data;
 }
 
+// Empty `darr` and make room for `nelem` elements without copying its
+// contents. Returns NULL on allocation failure.
+static void* _da_reuse(void* darr, size_t nelem)
+{
+    if (DA_IS_SHARED(darr))
+    {
+        size_t capacity = da_capacity(darr) >= nelem
+            ? da_capacity(darr) : DA_NEW_CAPACITY_FROM_LENGTH(nelem);
+        return _da_unshare_with(darr, 0, capacity);
+    }
+    *DA_P_LENGTH_FROM_HANDLE(darr) = 0;
+    return da_reserve(darr, nelem);
+}
+
 void* da_insert_arr(void* darr, size_t index, const void* src, size_t nelem)
 {
     darr = da_reserve(darr, nelem);
@@ -111,6 +319,7 @@ void* da_insert_arr(void* darr, size_t index, const void* src, size_t nelem)
         da_sizeof_elem(darr)*nelem
     );
     *DA_P_LENGTH_FROM_HANDLE(darr) += nelem;
+    _da_invalidate_content_cache(darr);
     return darr;
 }
 
@@ -122,6 +331,7 @@ void da_remove_arr(void* darr, size_t index, size_t nelem)
         da_sizeof_elem(darr)*(da_length(darr)-index-nelem)
     );
     *DA_P_LENGTH_FROM_HANDLE(darr) -= nelem;
+    _da_invalidate_content_cache(darr);
 }
 
 void da_swap(void* darr, size_t index_a, size_t index_b)
@@ -132,6 +342,7 @@ void da_swap(void* darr, size_t index_a, size_t index_b)
         ((char*)darr) + (index_b*size),
         size
     );
+    _da_invalidate_content_cache(darr);
 }
 
 void* da_concat(void* dest, const void* src, size_t nelem)
@@ -142,256 +353,6759 @@ void* da_concat(void* dest, const void* src, size_t nelem)
         return NULL;
     memcpy((char*)dest+offset, src, nelem*da_sizeof_elem(dest));
     *DA_P_LENGTH_FROM_HANDLE(dest) += nelem;
+    _da_invalidate_content_cache(dest);
     return dest;
 }
 
-/////////////////////////////////// DSTRING ////////////////////////////////////
-darray(char) dstr_alloc_empty(void)
-{
-    char* dstr = da_alloc(1, sizeof(char));
-    if (dstr == NULL)
-        return NULL;
-    dstr[0] = '\0';
-    return dstr;
-}
+//////////////////////////////////// SORTING ///////////////////////////////////
+// The sorting routines below are written once in terms of a runtime element
+// size and forcibly inlined into call sites that pass a constant size, so each
+// common element size gets its own instantiation with word sized swaps and
+// copies. Comparators passed as constants are inlined the same way.
+#if defined(__GNUC__) || defined(__clang__)
+#   define DA_ALWAYS_INLINE inline __attribute__((always_inline))
+#else
+#   define DA_ALWAYS_INLINE inline
+#endif
 
-darray(char) dstr_alloc_from_cstr(const char* src)
+#define DA_SORT_INSERTION_THRESHOLD 24
+#define DA_SORT_NINTHER_THRESHOLD 128
+#define DA_SORT_PARTIAL_INSERTION_LIMIT 8
+#define DA_SORT_STABLE_RUN 16
+#define DA_SORT_RADIX_THRESHOLD 256
+
+typedef int (*_da_compar_fn)(const void*, const void*);
+
+#define DA_SORT_DISPATCH_SIZE(size, call)                                      \
+do                                                                             \
+{                                                                              \
+    switch (size)                                                              \
+    {                                                                          \
+    case 1:  call(1);  break;                                                  \
+    case 2:  call(2);  break;                                                  \
+    case 4:  call(4);  break;                                                  \
+    case 8:  call(8);  break;                                                  \
+    case 16: call(16); break;                                                  \
+    default: call(size);                                                       \
+    }                                                                          \
+}while(0)
+
+static DA_ALWAYS_INLINE void _da_sort_swap(char* a, char* b, size_t size)
 {
-    size_t src_len_with_nullterm = strlen(src)+1;
-    char* dstr = da_alloc(src_len_with_nullterm, sizeof(char));
-    if (dstr == NULL)
-        return NULL;
-    memcpy(dstr, src, src_len_with_nullterm);
-    return dstr;
+    for (; size >= sizeof(uint64_t); size -= sizeof(uint64_t))
+    {
+        uint64_t wa, wb;
+        memcpy(&wa, a, sizeof(uint64_t));
+        memcpy(&wb, b, sizeof(uint64_t));
+        memcpy(a, &wb, sizeof(uint64_t));
+        memcpy(b, &wa, sizeof(uint64_t));
+        a += sizeof(uint64_t);
+        b += sizeof(uint64_t);
+    }
+    if (size >= sizeof(uint32_t))
+    {
+        uint32_t wa, wb;
+        memcpy(&wa, a, sizeof(uint32_t));
+        memcpy(&wb, b, sizeof(uint32_t));
+        memcpy(a, &wb, sizeof(uint32_t));
+        memcpy(b, &wa, sizeof(uint32_t));
+        a += sizeof(uint32_t);
+        b += sizeof(uint32_t);
+        size -= sizeof(uint32_t);
+    }
+    for (; size > 0; --size)
+    {
+        char tmp = *a;
+        *a++ = *b;
+        *b++ = tmp;
+    }
 }
 
-darray(char) dstr_alloc_from_dstr(const darray(char) src)
+static DA_ALWAYS_INLINE void _da_sort2(char* a, char* b, size_t size,
+    _da_compar_fn compar)
 {
-    size_t src_len_with_nullterm = da_length(src);
-    char* dstr = da_alloc(src_len_with_nullterm, sizeof(char));
-    if (dstr == NULL)
-        return NULL;
-    memcpy(dstr, src, src_len_with_nullterm);
-    return dstr;
+    if (compar(b, a) < 0)
+        _da_sort_swap(a, b, size);
 }
 
-darray(char) dstr_alloc_from_format(const char* format, ...)
+static DA_ALWAYS_INLINE void _da_sort3(char* a, char* b, char* c, size_t size,
+    _da_compar_fn compar)
 {
-    va_list args;
-    va_start(args, format);
-    
-    va_list copy;
-    va_copy(copy, args);
-    size_t size = vsnprintf(NULL, 0, format, copy) + 1 /* +1 for '\0' */;
-    va_end(copy);
-
-    char* dstr = da_alloc(size, sizeof(char));
-    if (dstr == NULL)
-        return NULL;
-    vsprintf(dstr, format, args);
-
-    va_end(args);
-    return dstr;
+    _da_sort2(a, b, size, compar);
+    _da_sort2(b, c, size, compar);
+    _da_sort2(a, b, size, compar);
 }
 
-void dstr_free(darray(char) dstr)
+static DA_ALWAYS_INLINE void _da_insertion_sort(char* begin, char* end,
+    size_t size, _da_compar_fn compar)
 {
-    da_free(dstr);
+    for (char* cur = begin + size; cur < end; cur += size)
+    {
+        for (char* sift = cur; sift > begin && compar(sift, sift-size) < 0;
+            sift -= size)
+        {
+            _da_sort_swap(sift, sift-size, size);
+        }
+    }
 }
 
-darray(char) dstr_reassign_empty(darray(char) allocated_dstr)
+// Insertion sort that gives up once more than a handful of elements had to be
+// moved. Returns true if [begin, end) ended up sorted.
+static DA_ALWAYS_INLINE bool _da_partial_insertion_sort(char* begin, char* end,
+    size_t size, _da_compar_fn compar)
 {
-    *DA_P_LENGTH_FROM_HANDLE(allocated_dstr) = 0;
-    allocated_dstr = da_concat(allocated_dstr, "", 1);
-    return allocated_dstr;
+    size_t moves = 0;
+    for (char* cur = begin + size; cur < end; cur += size)
+    {
+        for (char* sift = cur; sift > begin && compar(sift, sift-size) < 0;
+            sift -= size)
+        {
+            _da_sort_swap(sift, sift-size, size);
+            ++moves;
+        }
+        if (moves > DA_SORT_PARTIAL_INSERTION_LIMIT)
+            return false;
+    }
+    return true;
 }
 
-darray(char) dstr_reassign_from_cstr(darray(char) allocated_dstr,
-    const char* src)
+static DA_ALWAYS_INLINE void _da_heap_sift_down(char* base, size_t root,
+    size_t n, size_t size, _da_compar_fn compar)
 {
-    *DA_P_LENGTH_FROM_HANDLE(allocated_dstr) = 0;
-    allocated_dstr = da_concat(allocated_dstr, src, strlen(src)+1);
-    return allocated_dstr;
+    for (size_t child = 2*root+1; child < n; child = 2*root+1)
+    {
+        if (child+1 < n && compar(base + child*size, base + (child+1)*size) < 0)
+            ++child;
+        if (compar(base + root*size, base + child*size) >= 0)
+            return;
+        _da_sort_swap(base + root*size, base + child*size, size);
+        root = child;
+    }
 }
 
-darray(char) dstr_reassign_from_dstr(darray(char) allocated_dstr,
-    const darray(char) src)
+static DA_ALWAYS_INLINE void _da_heap_sort(char* base, size_t n, size_t size,
+    _da_compar_fn compar)
 {
-    *DA_P_LENGTH_FROM_HANDLE(allocated_dstr) = 0;
-    allocated_dstr = da_concat(allocated_dstr, src, da_length(src));
-    return allocated_dstr;
+    for (size_t i = n/2; i-- > 0;)
+        _da_heap_sift_down(base, i, n, size, compar);
+    for (size_t i = n; i-- > 1;)
+    {
+        _da_sort_swap(base, base + i*size, size);
+        _da_heap_sift_down(base, 0, i, size, compar);
+    }
 }
 
-darray(char) dstr_reassign_from_format(darray(char) allocated_dstr,
-    const char* format, ...)
+// Partition [begin, end) around the pivot stored at `begin`, placing elements
+// equal to the pivot on the right. Returns the final position of the pivot.
+// The caller guarantees an element not less than the pivot sits at `end-1`.
+static DA_ALWAYS_INLINE char* _da_partition_right(char* begin, char* end,
+    size_t size, _da_compar_fn compar, bool* already_partitioned)
 {
-    va_list args;
-    va_start(args, format);
-    
-    va_list copy;
-    va_copy(copy, args);
-    size_t size = vsnprintf(NULL, 0, format, copy) + 1 /* +1 for '\0' */;
-    va_end(copy);
+    char* first = begin;
+    char* last = end;
+    do first += size; while (compar(first, begin) < 0);
+    if (first - size == begin)
+    {
+        while (first < last)
+        {
+            last -= size;
+            if (compar(last, begin) < 0)
+                break;
+        }
+    }
+    else
+    {
+        do last -= size; while (compar(last, begin) >= 0);
+    }
 
-    *DA_P_LENGTH_FROM_HANDLE(allocated_dstr) = 0;
-    allocated_dstr = da_reserve(allocated_dstr, size);
-    if (allocated_dstr == NULL)
-        return NULL;
-    vsprintf(allocated_dstr, format, args);
-    *DA_P_LENGTH_FROM_HANDLE(allocated_dstr) = size;
+    *already_partitioned = first >= last;
+    while (first < last)
+    {
+        _da_sort_swap(first, last, size);
+        do first += size; while (compar(first, begin) < 0);
+        do last -= size; while (compar(last, begin) >= 0);
+    }
 
-    va_end(args);
-    return allocated_dstr;
+    char* pivot = first - size;
+    _da_sort_swap(begin, pivot, size);
+    return pivot;
 }
 
-size_t dstr_length(const darray(char) dstr)
+// Partition [begin, end) around the pivot stored at `begin`, placing elements
+// equal to the pivot on the left. Used when the range is known to contain many
+// elements equal to the pivot, which then never need to be looked at again.
+static DA_ALWAYS_INLINE char* _da_partition_left(char* begin, char* end,
+    size_t size, _da_compar_fn compar)
 {
-    // dstrings always have a null terminator so this should never underflow.
-    return da_length(dstr)-1;
-}
+    char* first = begin;
+    char* last = end;
+    do last -= size; while (compar(begin, last) < 0);
+    if (last + size == end)
+    {
+        while (first < last)
+        {
+            first += size;
+            if (compar(begin, first) < 0)
+                break;
+        }
+    }
+    else
+    {
+        do first += size; while (compar(begin, first) >= 0);
+    }
 
-darray(char) dstr_concat_cstr(darray(char) dest, const char* src)
-{
-    size_t dest_strlen = dstr_length(dest);
-    size_t src_strlen = strlen(src);
-    dest = da_reserve(dest, src_strlen);
-    if (dest == NULL)
-        return NULL;
-    memcpy(dest+dest_strlen, src, src_strlen+1);
-    return dest;
-}
+    while (first < last)
+    {
+        _da_sort_swap(first, last, size);
+        do last -= size; while (compar(begin, last) < 0);
+        do first += size; while (compar(begin, first) >= 0);
+    }
 
-darray(char) dstr_concat_dstr(darray(char) dest, const darray(char) src)
-{
-    size_t dest_strlen = dstr_length(dest);
-    size_t src_strlen = dstr_length(src);
-    dest = da_reserve(dest, src_strlen);
-    if (dest == NULL)
-        return NULL;
-    memcpy(dest+dest_strlen, src, src_strlen+1);
-    return dest;
+    _da_sort_swap(begin, last, size);
+    return last;
 }
 
-int dstr_cmp(const darray(char) s1, const char* s2)
+// Swap elements away from the ends of a range after a badly unbalanced
+// partition so that the next pivot selection sees a different sample.
+static DA_ALWAYS_INLINE void _da_break_patterns(char* begin, char* end,
+    size_t size)
 {
-    while (*s1 == *s2 && *s1 != '\0')
+    size_t len = (end - begin) / size;
+    if (len < DA_SORT_INSERTION_THRESHOLD)
+        return;
+    size_t q = len/4;
+    _da_sort_swap(begin, begin + q*size, size);
+    _da_sort_swap(end - size, end - q*size, size);
+    if (len > DA_SORT_NINTHER_THRESHOLD)
     {
-        s1++;
-        s2++;
+        _da_sort_swap(begin + size, begin + (q+1)*size, size);
+        _da_sort_swap(begin + 2*size, begin + (q+2)*size, size);
+        _da_sort_swap(end - 2*size, end - (q+1)*size, size);
+        _da_sort_swap(end - 3*size, end - (q+2)*size, size);
     }
-    return *s1 - *s2;
 }
 
-int dstr_cmp_case(const darray(char) s1, const char* s2)
+struct _da_sort_range
 {
-    while (tolower(*s1) == tolower(*s2) && *s1 != '\0')
+    char* begin;
+    char* end;
+    int bad_allowed;
+    bool leftmost;
+};
+
+// Pattern-defeating quicksort. The larger side of each partition is deferred
+// on an explicit stack so that the whole sort can be inlined, which bounds the
+// stack at one entry per bit of `size_t`.
+static DA_ALWAYS_INLINE void _da_pdqsort(char* base, size_t n, size_t size,
+    _da_compar_fn compar)
+{
+    if (n < 2)
+        return;
+    struct _da_sort_range stack[sizeof(size_t)*CHAR_BIT + 1];
+    size_t top = 0;
+    int log2n = 0;
+    for (size_t i = n; i > 1; i >>= 1)
+        ++log2n;
+    stack[top++] = (struct _da_sort_range){base, base + n*size, log2n, true};
+
+    while (top > 0)
     {
-        s1++;
-        s2++;
+        struct _da_sort_range r = stack[--top];
+        for (;;)
+        {
+            size_t len = (r.end - r.begin) / size;
+            if (len < DA_SORT_INSERTION_THRESHOLD)
+            {
+                _da_insertion_sort(r.begin, r.end, size, compar);
+                break;
+            }
+
+            char* mid = r.begin + (len/2)*size;
+            if (len > DA_SORT_NINTHER_THRESHOLD)
+            {
+                _da_sort3(r.begin, mid, r.end - size, size, compar);
+                _da_sort3(r.begin + size, mid - size, r.end - 2*size, size,
+                    compar);
+                _da_sort3(r.begin + 2*size, mid + size, r.end - 3*size, size,
+                    compar);
+                _da_sort3(mid - size, mid, mid + size, size, compar);
+                _da_sort_swap(r.begin, mid, size);
+            }
+            else
+            {
+                _da_sort3(mid, r.begin, r.end - size, size, compar);
+            }
+
+            // The element before a range that is not leftmost is the pivot of
+            // an earlier partition. If it equals the new pivot every element
+            // equal to it can be put in place with a single pass.
+            if (!r.leftmost && compar(r.begin - size, r.begin) >= 0)
+            {
+                r.begin = _da_partition_left(r.begin, r.end, size, compar)
+                    + size;
+                continue;
+            }
+
+            bool already_partitioned;
+            char* pivot = _da_partition_right(r.begin, r.end, size, compar,
+                &already_partitioned);
+            struct _da_sort_range left = {r.begin, pivot, r.bad_allowed,
+                r.leftmost};
+            struct _da_sort_range right = {pivot + size, r.end, r.bad_allowed,
+                false};
+            size_t left_len = (left.end - left.begin) / size;
+            size_t right_len = (right.end - right.begin) / size;
+
+            if (left_len < len/8 || right_len < len/8)
+            {
+                if (--r.bad_allowed == 0)
+                {
+                    _da_heap_sort(r.begin, len, size, compar);
+                    break;
+                }
+                left.bad_allowed = right.bad_allowed = r.bad_allowed;
+                _da_break_patterns(left.begin, left.end, size);
+                _da_break_patterns(right.begin, right.end, size);
+            }
+            else if (already_partitioned
+                && _da_partial_insertion_sort(left.begin, left.end, size,
+                    compar)
+                && _da_partial_insertion_sort(right.begin, right.end, size,
+                    compar))
+            {
+                break;
+            }
+
+            if (left_len > right_len)
+            {
+                stack[top++] = left;
+                r = right;
+            }
+            else
+            {
+                stack[top++] = right;
+                r = left;
+            }
+        }
     }
-    return *s1 - *s2;
 }
 
-long dstr_find(darray(char) dstr, const char* substr)
+void da_sort(void* darr, int (*compar)(const void*, const void*))
 {
-    char* loc = strstr(dstr, substr);
-    if (loc == NULL)
-        return -1;
-    return loc - dstr;
+    size_t n = da_length(darr);
+    size_t size = da_sizeof_elem(darr);
+#define DA_SORT_PDQSORT(sz) _da_pdqsort(darr, n, sz, compar)
+    DA_SORT_DISPATCH_SIZE(size, DA_SORT_PDQSORT);
+#undef DA_SORT_PDQSORT
+    _da_invalidate_content_cache(darr);
 }
 
-static const char* _da_strcasestr(const char* haystack, const char* needle)
+static DA_ALWAYS_INLINE void _da_merge(const char* a, const char* a_end,
+    const char* b, const char* b_end, char* out, size_t size,
+    _da_compar_fn compar)
 {
-    const char* currh = haystack;
-    const char* currn = needle;
-    while (1)
+    while (a < a_end && b < b_end)
     {
-        if (*currn == '\0')
-            return haystack;
-        else if (*currh == '\0')
-            return NULL;
-
-        if (tolower(*currh) != tolower(*currn))
+        if (compar(b, a) < 0)
         {
-            haystack = ++currh;
-            currn = needle;
+            memcpy(out, b, size);
+            b += size;
         }
         else
         {
-            currh++;
-            currn++;
+            memcpy(out, a, size);
+            a += size;
         }
+        out += size;
     }
+    memcpy(out, a, a_end - a);
+    memcpy(out + (a_end - a), b, b_end - b);
 }
 
-long dstr_find_case(darray(char) dstr, const char* substr)
+// Bottom-up merge sort of insertion sorted runs, merging back and forth
+// between `base` and `buf`. Runs that are already in order are copied instead
+// of merged.
+static DA_ALWAYS_INLINE void _da_merge_sort(char* base, size_t n, size_t size,
+    _da_compar_fn compar, char* buf)
 {
-    const char* loc = _da_strcasestr(dstr, substr);
-    if (loc == NULL)
-        return -1;
-    return loc - dstr;
-}
+    for (size_t i = 0; i < n; i += DA_SORT_STABLE_RUN)
+    {
+        size_t run_end =
+            i + DA_SORT_STABLE_RUN < n ? i + DA_SORT_STABLE_RUN : n;
+        _da_insertion_sort(base + i*size, base + run_end*size, size, compar);
+    }
 
-darray(char) dstr_replace_all(darray(char) dstr, const char* substr,
-    const char* new_str)
-{
-    size_t substr_len = strlen(substr);
-    size_t new_str_len = strlen(new_str);
-    long loc;
-    while ((loc = dstr_find(dstr, substr)) != -1)
+    char* src = base;
+    char* dst = buf;
+    for (size_t width = DA_SORT_STABLE_RUN; width < n; width *= 2)
     {
-        da_remove_arr(dstr, loc, substr_len);
-        if ((dstr = da_insert_arr(dstr, loc, new_str, new_str_len)) == NULL)
-            return NULL;
+        for (size_t i = 0; i < n; i += 2*width)
+        {
+            size_t mid = i + width < n ? i + width : n;
+            size_t hi = mid + width < n ? mid + width : n;
+            if (mid == hi
+                || compar(src + mid*size, src + (mid-1)*size) >= 0)
+            {
+                memcpy(dst + i*size, src + i*size, (hi-i)*size);
+                continue;
+            }
+            _da_merge(src + i*size, src + mid*size, src + mid*size,
+                src + hi*size, dst + i*size, size, compar);
+        }
+        char* tmp = src;
+        src = dst;
+        dst = tmp;
     }
-    return dstr;
+    if (src != base)
+        memcpy(base, src, n*size);
 }
 
-darray(char) dstr_replace_all_case(darray(char) dstr, const char* substr,
-    const char* new_str)
+static void _da_reverse(char* begin, char* end, size_t size)
 {
-    size_t substr_len = strlen(substr);
-    size_t new_str_len = strlen(new_str);
-    long loc;
-    while ((loc = dstr_find_case(dstr, substr)) != -1)
+    while (begin < end)
     {
-        da_remove_arr(dstr, loc, substr_len);
-        if ((dstr = da_insert_arr(dstr, loc, new_str, new_str_len)) == NULL)
-            return NULL;
+        end -= size;
+        _da_sort_swap(begin, end, size);
+        begin += size;
     }
-    return dstr;
 }
 
-void dstr_transform_lower(darray(char) dstr)
+// Stable in-place merge of the sorted ranges [a, m) and [m, b) using the
+// SymMerge algorithm of Kim and Kutzner. Only used when no merge buffer could
+// be allocated.
+static void _da_sym_merge(char* base, size_t a, size_t m, size_t b,
+    size_t size, _da_compar_fn compar)
 {
-    da_foreach(dstr, c)
-        *c = tolower(*c);
+    if (m - a == 1)
+    {
+        size_t i = m, j = b;
+        while (i < j)
+        {
+            size_t h = i + (j-i)/2;
+            if (compar(base + h*size, base + a*size) < 0)
+                i = h+1;
+            else
+                j = h;
+        }
+        for (size_t k = a; k+1 < i; ++k)
+            _da_sort_swap(base + k*size, base + (k+1)*size, size);
+        return;
+    }
+    if (b - m == 1)
+    {
+        size_t i = a, j = m;
+        while (i < j)
+        {
+            size_t h = i + (j-i)/2;
+            if (compar(base + m*size, base + h*size) >= 0)
+                i = h+1;
+            else
+                j = h;
+        }
+        for (size_t k = m; k > i; --k)
+            _da_sort_swap(base + k*size, base + (k-1)*size, size);
+        return;
+    }
+
+    size_t mid = a + (b-a)/2;
+    size_t n = mid + m;
+    size_t start, r;
+    if (m > mid)
+    {
+        start = n - b;
+        r = mid;
+    }
+    else
+    {
+        start = a;
+        r = m;
+    }
+    size_t p = n - 1;
+    while (start < r)
+    {
+        size_t c = start + (r-start)/2;
+        if (compar(base + (p-c)*size, base + c*size) >= 0)
+            start = c+1;
+        else
+            r = c;
+    }
+
+    size_t end = n - start;
+    if (start < m && m < end)
+    {
+        _da_reverse(base + start*size, base + m*size, size);
+        _da_reverse(base + m*size, base + end*size, size);
+        _da_reverse(base + start*size, base + end*size, size);
+    }
+    if (a < start && start < mid)
+        _da_sym_merge(base, a, start, mid, size, compar);
+    if (mid < end && end < b)
+        _da_sym_merge(base, mid, end, b, size, compar);
 }
 
-void dstr_transform_upper(darray(char) dstr)
+static void _da_stable_sort_in_place(char* base, size_t n, size_t size,
+    _da_compar_fn compar)
 {
-    da_foreach(dstr, c)
-        *c = toupper(*c);
+    for (size_t i = 0; i < n; i += DA_SORT_STABLE_RUN)
+    {
+        size_t run_end =
+            i + DA_SORT_STABLE_RUN < n ? i + DA_SORT_STABLE_RUN : n;
+        _da_insertion_sort(base + i*size, base + run_end*size, size, compar);
+    }
+    for (size_t width = DA_SORT_STABLE_RUN; width < n; width *= 2)
+    {
+        for (size_t i = 0; i + width < n; i += 2*width)
+        {
+            size_t hi = i + 2*width < n ? i + 2*width : n;
+            _da_sym_merge(base, i, i + width, hi, size, compar);
+        }
+    }
+}
+
+void da_sort_stable(void* darr, int (*compar)(const void*, const void*))
+{
+    size_t n = da_length(darr);
+    size_t size = da_sizeof_elem(darr);
+    char* buf = n > DA_SORT_STABLE_RUN ? malloc(n*size) : NULL;
+    if (buf == NULL)
+    {
+        _da_stable_sort_in_place(darr, n, size, compar);
+    }
+    else
+    {
+#define DA_SORT_MERGE_SORT(sz) _da_merge_sort(darr, n, sz, compar, buf)
+        DA_SORT_DISPATCH_SIZE(size, DA_SORT_MERGE_SORT);
+#undef DA_SORT_MERGE_SORT
+        free(buf);
+    }
+    _da_invalidate_content_cache(darr);
+}
+
+static DA_ALWAYS_INLINE uint64_t _da_sort_key_load(const char* p, size_t size)
+{
+    uint8_t k8; uint16_t k16; uint32_t k32; uint64_t k64;
+    switch (size)
+    {
+    case 1: memcpy(&k8, p, 1); return k8;
+    case 2: memcpy(&k16, p, 2); return k16;
+    case 4: memcpy(&k32, p, 4); return k32;
+    default: memcpy(&k64, p, 8); return k64;
+    }
+}
+
+static DA_ALWAYS_INLINE void _da_sort_key_store(char* p, uint64_t key,
+    size_t size)
+{
+    uint8_t k8 = key; uint16_t k16 = key; uint32_t k32 = key;
+    switch (size)
+    {
+    case 1: memcpy(p, &k8, 1); break;
+    case 2: memcpy(p, &k16, 2); break;
+    case 4: memcpy(p, &k32, 4); break;
+    default: memcpy(p, &key, 8);
+    }
+}
+
+#define DA_SORT_DEFINE_KEY_COMPAR(bits)                                        \
+static int _da_sort_key_compar_u##bits(const void* a, const void* b)           \
+{                                                                              \
+    uint##bits##_t ka, kb;                                                     \
+    memcpy(&ka, a, sizeof(ka));                                                \
+    memcpy(&kb, b, sizeof(kb));                                                \
+    return (ka > kb) - (ka < kb);                                              \
+}
+DA_SORT_DEFINE_KEY_COMPAR(8)
+DA_SORT_DEFINE_KEY_COMPAR(16)
+DA_SORT_DEFINE_KEY_COMPAR(32)
+DA_SORT_DEFINE_KEY_COMPAR(64)
+
+// Map keys to unsigned integers of the same width whose order matches the
+// order of the keys (or back when `encode` is false). Signed integers get
+// their sign bit flipped. Negative floats get every bit flipped and positive
+// floats only their sign bit, which orders -NaN < -inf < ... < -0.0 < +0.0
+// < ... < +inf < +NaN.
+static DA_ALWAYS_INLINE void _da_sort_keys_transform(char* keys, size_t n,
+    size_t size, int kind, bool encode)
+{
+    uint64_t sign = (uint64_t)1 << (size*CHAR_BIT - 1);
+    uint64_t mask = sign | (sign - 1);
+    if (kind == DA_SORT_KEY_SIGNED)
+    {
+        for (size_t i = 0; i < n; ++i)
+        {
+            uint64_t k = _da_sort_key_load(keys + i*size, size);
+            _da_sort_key_store(keys + i*size, k ^ sign, size);
+        }
+    }
+    else if (kind == DA_SORT_KEY_FLOAT)
+    {
+        for (size_t i = 0; i < n; ++i)
+        {
+            uint64_t k = _da_sort_key_load(keys + i*size, size);
+            bool flip = encode ? (k & sign) != 0 : (k & sign) == 0;
+            k = flip ? (~k & mask) : (k ^ sign);
+            _da_sort_key_store(keys + i*size, k, size);
+        }
+    }
+}
+
+// LSD radix sort of unsigned keys one byte at a time. Passes in which every
+// key has the same digit are skipped. Returns false if no scratch buffer could
+// be allocated.
+static DA_ALWAYS_INLINE bool _da_radix_sort(char* keys, size_t n, size_t size)
+{
+    size_t counts[sizeof(uint64_t)][UCHAR_MAX+1] = {{0}};
+    for (size_t i = 0; i < n; ++i)
+    {
+        uint64_t k = _da_sort_key_load(keys + i*size, size);
+        for (size_t d = 0; d < size; ++d)
+            counts[d][(k >> (d*CHAR_BIT)) & UCHAR_MAX] += 1;
+    }
+
+    if (size == 1)
+    {
+        char* out = keys;
+        for (size_t digit = 0; digit <= UCHAR_MAX; ++digit)
+        {
+            memset(out, (int)digit, counts[0][digit]);
+            out += counts[0][digit];
+        }
+        return true;
+    }
+
+    char* buf = malloc(n*size);
+    if (buf == NULL)
+        return false;
+    char* src = keys;
+    char* dst = buf;
+    for (size_t d = 0; d < size; ++d)
+    {
+        size_t shift = d*CHAR_BIT;
+        size_t* offsets = counts[d];
+        if (offsets[(_da_sort_key_load(src, size) >> shift) & UCHAR_MAX] == n)
+            continue;
+        size_t sum = 0;
+        for (size_t digit = 0; digit <= UCHAR_MAX; ++digit)
+        {
+            size_t count = offsets[digit];
+            offsets[digit] = sum;
+            sum += count;
+        }
+        for (size_t i = 0; i < n; ++i)
+        {
+            uint64_t k = _da_sort_key_load(src + i*size, size);
+            size_t pos = offsets[(k >> shift) & UCHAR_MAX]++;
+            _da_sort_key_store(dst + pos*size, k, size);
+        }
+        char* tmp = src;
+        src = dst;
+        dst = tmp;
+    }
+    if (src != keys)
+        memcpy(keys, src, n*size);
+    free(buf);
+    return true;
+}
+
+static DA_ALWAYS_INLINE void _da_sort_keys(char* keys, size_t n, size_t size,
+    int kind, _da_compar_fn key_compar)
+{
+    _da_sort_keys_transform(keys, n, size, kind, true);
+    if (n < DA_SORT_RADIX_THRESHOLD || !_da_radix_sort(keys, n, size))
+        _da_pdqsort(keys, n, size, key_compar);
+    _da_sort_keys_transform(keys, n, size, kind, false);
+}
+
+void _da_sort_numeric(void* darr, int kind)
+{
+    size_t n = da_length(darr);
+    switch (da_sizeof_elem(darr))
+    {
+    case 1: _da_sort_keys(darr, n, 1, kind, _da_sort_key_compar_u8); break;
+    case 2: _da_sort_keys(darr, n, 2, kind, _da_sort_key_compar_u16); break;
+    case 4: _da_sort_keys(darr, n, 4, kind, _da_sort_key_compar_u32); break;
+    case 8: _da_sort_keys(darr, n, 8, kind, _da_sort_key_compar_u64); break;
+    }
+    _da_invalidate_content_cache(darr);
+}
+
+// Parallel sort: the array is split into one chunk per thread, the chunks are
+// sorted concurrently, and sorted runs are then merged pairwise back and forth
+// between the darray and a scratch darray. Every merge is cut into independent
+// pieces at merge path split points so that all threads stay busy in every
+// round, including the last one.
+#define DA_SORT_PARALLEL_MIN_CHUNK 65536
+
+// The tasks of every round run on the da_parallel_for pool, whose threads run a
+// range function over index ranges [begin, end). See PARALLEL FOR.
+typedef void (*_da_parallel_range_fn)(size_t, size_t, void*);
+static size_t _da_parallel_thread_limit(void);
+static bool _da_parallel_ranges(size_t n, size_t grain,
+    _da_parallel_range_fn fn, void* ctx);
+
+struct _da_sort_task
+{
+    bool sort; // Sort [a, a_end) in place instead of merging.
+    char* a;
+    char* a_end;
+    char* b;
+    char* b_end;
+    char* out;
+};
+
+struct _da_sort_job
+{
+    struct _da_sort_task* tasks;
+    size_t ntasks;
+    size_t size;
+    _da_compar_fn compar;
+};
+
+static void _da_sort_run_task(const struct _da_sort_job* job,
+    const struct _da_sort_task* task)
+{
+    size_t n = (task->a_end - task->a) / job->size;
+    _da_compar_fn compar = job->compar;
+    if (task->sort)
+    {
+#define DA_SORT_PDQSORT(sz) _da_pdqsort(task->a, n, sz, compar)
+        DA_SORT_DISPATCH_SIZE(job->size, DA_SORT_PDQSORT);
+#undef DA_SORT_PDQSORT
+    }
+    else
+    {
+#define DA_SORT_MERGE(sz) _da_merge(task->a, task->a_end, task->b,             \
+    task->b_end, task->out, sz, compar)
+        DA_SORT_DISPATCH_SIZE(job->size, DA_SORT_MERGE);
+#undef DA_SORT_MERGE
+    }
+}
+
+static void _da_sort_run_tasks(size_t begin, size_t end, void* arg)
+{
+    const struct _da_sort_job* job = arg;
+    for (size_t i = begin; i < end; ++i)
+        _da_sort_run_task(job, &job->tasks[i]);
+}
+
+// Run every task of `job` on the pool and wait for completion. The calling
+// thread runs the tasks itself if the pool has no threads to spare.
+static void _da_sort_run_job(struct _da_sort_job* job)
+{
+    if (!_da_parallel_ranges(job->ntasks, 1, _da_sort_run_tasks, job))
+        _da_sort_run_tasks(0, job->ntasks, job);
+}
+
+// Number of elements of `a` among the first `k` elements of the stable merge
+// of the sorted ranges `a` and `b`.
+static size_t _da_merge_split(const char* a, size_t na, const char* b,
+    size_t nb, size_t k, size_t size, _da_compar_fn compar)
+{
+    size_t lo = k > nb ? k - nb : 0;
+    size_t hi = k < na ? k : na;
+    while (lo < hi)
+    {
+        size_t i = lo + (hi-lo)/2;
+        if (compar(b + (k-i-1)*size, a + i*size) >= 0)
+            lo = i+1;
+        else
+            hi = i;
+    }
+    return lo;
+}
+
+static size_t _da_online_cpus(void)
+{
+    long ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+    return ncpus < 1 ? 1 : (size_t)ncpus;
+}
+
+void da_sort_parallel(void* darr, int (*compar)(const void*, const void*),
+    size_t nthreads)
+{
+    size_t n = da_length(darr);
+    size_t size = da_sizeof_elem(darr);
+    size_t limit = _da_parallel_thread_limit();
+    if (nthreads == 0 || nthreads > limit)
+        nthreads = limit;
+    if (nthreads > n / DA_SORT_PARALLEL_MIN_CHUNK)
+        nthreads = n / DA_SORT_PARALLEL_MIN_CHUNK;
+    if (nthreads < 2)
+    {
+        da_sort(darr, compar);
+        return;
+    }
+
+    char* scratch = da_alloc_exact(n, size);
+    size_t* bounds = malloc((nthreads+1) * sizeof(size_t));
+    struct _da_sort_task* tasks =
+        malloc((nthreads+1) * sizeof(struct _da_sort_task));
+    if (scratch == NULL || bounds == NULL || tasks == NULL)
+    {
+        if (scratch != NULL)
+            da_free(scratch);
+        free(bounds);
+        free(tasks);
+        da_sort(darr, compar);
+        return;
+    }
+
+    struct _da_sort_job job = {tasks, nthreads, size, compar};
+    for (size_t i = 0; i <= nthreads; ++i)
+        bounds[i] = i*(n/nthreads) + (i < n%nthreads ? i : n%nthreads);
+    for (size_t i = 0; i < nthreads; ++i)
+    {
+        tasks[i] = (struct _da_sort_task){.sort = true,
+            .a = (char*)darr + bounds[i]*size,
+            .a_end = (char*)darr + bounds[i+1]*size};
+    }
+    _da_sort_run_job(&job);
+
+    char* src = darr;
+    char* dst = scratch;
+    for (size_t nruns = nthreads; nruns > 1; nruns = (nruns+1)/2)
+    {
+        size_t npairs = nruns/2;
+        job.ntasks = 0;
+        for (size_t p = 0; p < npairs; ++p)
+        {
+            char* a = src + bounds[2*p]*size;
+            char* b = src + bounds[2*p+1]*size;
+            size_t na = bounds[2*p+1] - bounds[2*p];
+            size_t nb = bounds[2*p+2] - bounds[2*p+1];
+            size_t nparts = nthreads/npairs + (p < nthreads%npairs);
+            size_t k0 = 0, i0 = 0;
+            for (size_t part = 1; part <= nparts; ++part)
+            {
+                size_t k1 = part*((na+nb)/nparts)
+                    + (part < (na+nb)%nparts ? part : (na+nb)%nparts);
+                size_t i1 = _da_merge_split(a, na, b, nb, k1, size, compar);
+                tasks[job.ntasks++] = (struct _da_sort_task){.sort = false,
+                    .a = a + i0*size, .a_end = a + i1*size,
+                    .b = b + (k0-i0)*size, .b_end = b + (k1-i1)*size,
+                    .out = dst + (bounds[2*p]+k0)*size};
+                k0 = k1;
+                i0 = i1;
+            }
+        }
+        if (nruns % 2 == 1)
+        {
+            char* last = src + bounds[nruns-1]*size;
+            tasks[job.ntasks++] = (struct _da_sort_task){.sort = false,
+                .a = last, .a_end = src + n*size, .b = last, .b_end = last,
+                .out = dst + bounds[nruns-1]*size};
+        }
+        _da_sort_run_job(&job);
+
+        for (size_t p = 0; p < npairs; ++p)
+            bounds[p+1] = bounds[2*p+2];
+        if (nruns % 2 == 1)
+            bounds[npairs+1] = n;
+        char* tmp = src;
+        src = dst;
+        dst = tmp;
+    }
+
+    if (src != (char*)darr)
+    {
+        job.ntasks = 0;
+        for (size_t t = 0; t < nthreads; ++t)
+        {
+            size_t lo = t*(n/nthreads) + (t < n%nthreads ? t : n%nthreads);
+            size_t hi = lo + n/nthreads + (t < n%nthreads);
+            tasks[job.ntasks++] = (struct _da_sort_task){.sort = false,
+                .a = src + lo*size, .a_end = src + hi*size,
+                .b = src + hi*size, .b_end = src + hi*size,
+                .out = (char*)darr + lo*size};
+        }
+        _da_sort_run_job(&job);
+    }
+
+    da_free(scratch);
+    free(bounds);
+    free(tasks);
+    _da_invalidate_content_cache(darr);
+}
+
+//////////////////////////////// SORTED DARRAYS ////////////////////////////////
+#if defined(__GNUC__) || defined(__clang__)
+#   define DA_PREFETCH(addr) __builtin_prefetch(addr)
+#else
+#   define DA_PREFETCH(addr) ((void)0)
+#endif
+
+// Branchless binary search. The loop always runs ceil(log2(n)) times and the
+// comparison result only selects the next base, which compiles to a
+// conditional move. Both possible next midpoints are prefetched. Returns the
+// index of the first element for which `compar(elem, key) >= 0` (or `> 0`
+// when `upper` is true).
+static size_t _da_bound(const void* darr, const void* key,
+    _da_compar_fn compar, bool upper)
+{
+    size_t n = da_length(darr);
+    size_t size = da_sizeof_elem(darr);
+    const char* base = darr;
+    int threshold = upper ? 0 : -1;
+    if (n == 0)
+        return 0;
+    while (n > 1)
+    {
+        size_t half = n/2;
+        DA_PREFETCH(base + (half/2)*size);
+        DA_PREFETCH(base + (half + half/2)*size);
+        base = compar(base + half*size, key) <= threshold
+            ? base + half*size : base;
+        n -= half;
+    }
+    return (base - (const char*)darr)/size
+        + (compar(base, key) <= threshold);
+}
+
+size_t da_lower_bound(const void* darr, const void* key,
+    int (*compar)(const void*, const void*))
+{
+    return _da_bound(darr, key, compar, false);
+}
+
+size_t da_upper_bound(const void* darr, const void* key,
+    int (*compar)(const void*, const void*))
+{
+    return _da_bound(darr, key, compar, true);
+}
+
+void* da_insert_sorted(void* darr, const void* value,
+    int (*compar)(const void*, const void*))
+{
+    return da_insert_arr(darr, da_upper_bound(darr, value, compar), value, 1);
+}
+
+void da_unique(void* darr, int (*compar)(const void*, const void*))
+{
+    size_t n = da_length(darr);
+    size_t size = da_sizeof_elem(darr);
+    char* base = darr;
+    if (n < 2)
+        return;
+    size_t kept = 1;
+    for (size_t i = 1; i < n; ++i)
+    {
+        if (compar(base + (kept-1)*size, base + i*size) == 0)
+            continue;
+        if (kept != i)
+            memcpy(base + kept*size, base + i*size, size);
+        ++kept;
+    }
+    *DA_P_LENGTH_FROM_HANDLE(darr) = kept;
+    _da_invalidate_content_cache(darr);
+}
+
+// Index of the first element of the sorted range [base, base+n) not less than
+// `key`, found by probing 1, 3, 7, ... elements ahead before binary searching
+// the last gap. Costs O(log d) comparisons where d is the returned index, so
+// stepping through a range one gallop at a time is linear when the elements
+// searched for are dense and logarithmic per element when they are sparse.
+static size_t _da_gallop(const char* base, size_t n, const void* key,
+    size_t size, _da_compar_fn compar)
+{
+    size_t lo = 0;
+    size_t step = 1;
+    size_t hi = 0;
+    while (hi < n && compar(base + hi*size, key) < 0)
+    {
+        lo = hi + 1;
+        hi += step;
+        step *= 2;
+    }
+    if (hi > n)
+        hi = n;
+    while (lo < hi)
+    {
+        size_t mid = lo + (hi-lo)/2;
+        if (compar(base + mid*size, key) < 0)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+void* da_merge(const void* a, const void* b,
+    int (*compar)(const void*, const void*))
+{
+    size_t na = da_length(a);
+    size_t nb = da_length(b);
+    size_t size = da_sizeof_elem(a);
+    char* out = da_alloc(na + nb, size);
+    if (out == NULL)
+        return NULL;
+    const char* a_begin = a;
+    const char* b_begin = b;
+#define DA_MERGE_INTO_OUT(sz) _da_merge(a_begin, a_begin + na*size, b_begin,   \
+    b_begin + nb*size, out, sz, compar)
+    DA_SORT_DISPATCH_SIZE(size, DA_MERGE_INTO_OUT);
+#undef DA_MERGE_INTO_OUT
+    return out;
+}
+
+void* da_intersect(const void* a, const void* b,
+    int (*compar)(const void*, const void*))
+{
+    size_t na = da_length(a);
+    size_t nb = da_length(b);
+    size_t size = da_sizeof_elem(a);
+    char* out = da_alloc(na < nb ? na : nb, size);
+    if (out == NULL)
+        return NULL;
+    const char* pa = a;
+    const char* pb = b;
+    size_t nout = 0;
+
+    // Step through the shorter darray and gallop through the longer one.
+    // Every match consumes one element of each darray.
+    if (na <= nb)
+    {
+        for (size_t i = 0, j = 0; i < na && j < nb; ++i)
+        {
+            j += _da_gallop(pb + j*size, nb - j, pa + i*size, size, compar);
+            if (j < nb && compar(pb + j*size, pa + i*size) == 0)
+            {
+                memcpy(out + (nout++)*size, pa + i*size, size);
+                ++j;
+            }
+        }
+    }
+    else
+    {
+        for (size_t i = 0, j = 0; i < na && j < nb; ++j)
+        {
+            i += _da_gallop(pa + i*size, na - i, pb + j*size, size, compar);
+            if (i < na && compar(pa + i*size, pb + j*size) == 0)
+            {
+                memcpy(out + (nout++)*size, pa + i*size, size);
+                ++i;
+            }
+        }
+    }
+    *DA_P_LENGTH_FROM_HANDLE(out) = nout;
+    return out;
+}
+
+void* da_difference(const void* a, const void* b,
+    int (*compar)(const void*, const void*))
+{
+    size_t na = da_length(a);
+    size_t nb = da_length(b);
+    size_t size = da_sizeof_elem(a);
+    char* out = da_alloc(na, size);
+    if (out == NULL)
+        return NULL;
+    const char* pa = a;
+    const char* pb = b;
+    size_t nout = 0;
+
+    if (na <= nb)
+    {
+        for (size_t i = 0, j = 0; i < na; ++i)
+        {
+            j += _da_gallop(pb + j*size, nb - j, pa + i*size, size, compar);
+            if (j < nb && compar(pb + j*size, pa + i*size) == 0)
+                ++j;
+            else
+                memcpy(out + (nout++)*size, pa + i*size, size);
+        }
+    }
+    else
+    {
+        // Copy the runs of `a` between elements matched by `b` in bulk.
+        size_t i = 0;
+        for (size_t j = 0; j < nb && i < na; ++j)
+        {
+            size_t run = _da_gallop(pa + i*size, na - i, pb + j*size, size,
+                compar);
+            memcpy(out + nout*size, pa + i*size, run*size);
+            nout += run;
+            i += run;
+            if (i < na && compar(pa + i*size, pb + j*size) == 0)
+                ++i;
+        }
+        memcpy(out + nout*size, pa + i*size, (na - i)*size);
+        nout += na - i;
+    }
+    *DA_P_LENGTH_FROM_HANDLE(out) = nout;
+    return out;
+}
+
+static DA_ALWAYS_INLINE uint64_t _da_sort_key_encode(uint64_t k, size_t size,
+    int kind)
+{
+    uint64_t sign = (uint64_t)1 << (size*CHAR_BIT - 1);
+    uint64_t mask = sign | (sign - 1);
+    if (kind == DA_SORT_KEY_SIGNED)
+        return k ^ sign;
+    if (kind == DA_SORT_KEY_FLOAT)
+        return (k & sign) ? (~k & mask) : (k ^ sign);
+    return k;
+}
+
+#define DA_INTERSECT_GALLOP_RATIO 32
+
+// Intersection of darrays of numeric keys without duplicates. Keys are
+// compared by their order preserving unsigned encoding, which makes equal keys
+// bitwise equal. 4 byte keys are intersected four against four with SSE2 and
+// 8 byte keys four against four with AVX2: the block of `a` is compared with
+// every rotation of the block of `b`, matching elements of `a` are written
+// out, and whichever block has the smaller last key is advanced.
+static DA_ALWAYS_INLINE uint64_t _da_key_at(const char* keys, size_t index,
+    size_t size, int kind)
+{
+    return _da_sort_key_encode(_da_sort_key_load(keys + index*size, size),
+        size, kind);
+}
+
+// Index of the first key at or after `index` not less than the encoded key
+// `key`, found by galloping.
+static DA_ALWAYS_INLINE size_t _da_gallop_keys(const char* keys, size_t index,
+    size_t n, uint64_t key, size_t size, int kind)
+{
+    size_t lo = index;
+    size_t hi = index;
+    size_t step = 1;
+    while (hi < n && _da_key_at(keys, hi, size, kind) < key)
+    {
+        lo = hi + 1;
+        hi += step;
+        step *= 2;
+    }
+    if (hi > n)
+        hi = n;
+    while (lo < hi)
+    {
+        size_t mid = lo + (hi-lo)/2;
+        if (_da_key_at(keys, mid, size, kind) < key)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+static DA_ALWAYS_INLINE size_t _da_intersect_keys_scalar(const char* a,
+    size_t na, const char* b, size_t nb, char* out, size_t size, int kind,
+    size_t i, size_t j)
+{
+    size_t nout = 0;
+    while (i < na && j < nb)
+    {
+        uint64_t ka = _da_key_at(a, i, size, kind);
+        uint64_t kb = _da_key_at(b, j, size, kind);
+        if (ka == kb)
+        {
+            memcpy(out + (nout++)*size, a + i*size, size);
+            ++i;
+            ++j;
+        }
+        else if (ka < kb)
+        {
+            i = _da_gallop_keys(a, i+1, na, kb, size, kind);
+        }
+        else
+        {
+            j = _da_gallop_keys(b, j+1, nb, ka, size, kind);
+        }
+    }
+    return nout;
+}
+
+#if DA_SSE2
+static size_t _da_intersect_keys32_sse2(const char* a, size_t na,
+    const char* b, size_t nb, char* out, int kind, size_t* i_out,
+    size_t* j_out)
+{
+    size_t i = 0, j = 0, nout = 0;
+    while (i + 4 <= na && j + 4 <= nb)
+    {
+        __m128i va = _mm_loadu_si128((const __m128i*)(a + i*4));
+        __m128i vb = _mm_loadu_si128((const __m128i*)(b + j*4));
+        __m128i eq = _mm_or_si128(
+            _mm_or_si128(_mm_cmpeq_epi32(va, vb),
+                _mm_cmpeq_epi32(va, _mm_shuffle_epi32(vb, 0x39))),
+            _mm_or_si128(_mm_cmpeq_epi32(va, _mm_shuffle_epi32(vb, 0x4E)),
+                _mm_cmpeq_epi32(va, _mm_shuffle_epi32(vb, 0x93))));
+        unsigned mask = _mm_movemask_ps(_mm_castsi128_ps(eq));
+        for (unsigned k = 0; k < 4; ++k)
+        {
+            memcpy(out + nout*4, a + (i+k)*4, 4);
+            nout += (mask >> k) & 1;
+        }
+        uint64_t a_max = _da_key_at(a, i+3, 4, kind);
+        uint64_t b_max = _da_key_at(b, j+3, 4, kind);
+        i += a_max <= b_max ? 4 : 0;
+        j += b_max <= a_max ? 4 : 0;
+    }
+    *i_out = i;
+    *j_out = j;
+    return nout;
+}
+#endif // DA_SSE2
+
+#if DA_AVX2_VARIANTS
+DA_AVX2_TARGET
+static size_t _da_intersect_keys64_avx2(const char* a, size_t na,
+    const char* b, size_t nb, char* out, int kind, size_t* i_out,
+    size_t* j_out)
+{
+    size_t i = 0, j = 0, nout = 0;
+    while (i + 4 <= na && j + 4 <= nb)
+    {
+        __m256i va = _mm256_loadu_si256((const __m256i*)(a + i*8));
+        __m256i vb = _mm256_loadu_si256((const __m256i*)(b + j*8));
+        __m256i eq = _mm256_or_si256(
+            _mm256_or_si256(_mm256_cmpeq_epi64(va, vb),
+                _mm256_cmpeq_epi64(va, _mm256_permute4x64_epi64(vb, 0x39))),
+            _mm256_or_si256(
+                _mm256_cmpeq_epi64(va, _mm256_permute4x64_epi64(vb, 0x4E)),
+                _mm256_cmpeq_epi64(va, _mm256_permute4x64_epi64(vb, 0x93))));
+        unsigned mask = _mm256_movemask_pd(_mm256_castsi256_pd(eq));
+        for (unsigned k = 0; k < 4; ++k)
+        {
+            memcpy(out + nout*8, a + (i+k)*8, 8);
+            nout += (mask >> k) & 1;
+        }
+        uint64_t a_max = _da_key_at(a, i+3, 8, kind);
+        uint64_t b_max = _da_key_at(b, j+3, 8, kind);
+        i += a_max <= b_max ? 4 : 0;
+        j += b_max <= a_max ? 4 : 0;
+    }
+    *i_out = i;
+    *j_out = j;
+    return nout;
+}
+#endif // DA_AVX2_VARIANTS
+
+void* _da_intersect_numeric(const void* a, const void* b, int kind)
+{
+    size_t na = da_length(a);
+    size_t nb = da_length(b);
+    size_t size = da_sizeof_elem(a);
+    char* out = da_alloc(na < nb ? na : nb, size);
+    if (out == NULL)
+        return NULL;
+    size_t i = 0, j = 0, nout = 0;
+    // Blocks only pay off when the darrays have similar lengths. Otherwise
+    // the scalar loop gallops through the longer darray.
+    bool blocks = na/DA_INTERSECT_GALLOP_RATIO <= nb
+        && nb/DA_INTERSECT_GALLOP_RATIO <= na;
+#if DA_SSE2
+    if (blocks && size == 4)
+        nout = _da_intersect_keys32_sse2(a, na, b, nb, out, kind, &i, &j);
+#endif
+#if DA_AVX2_VARIANTS
+    if (blocks && size == 8 && _da_cpu_has_avx2())
+        nout = _da_intersect_keys64_avx2(a, na, b, nb, out, kind, &i, &j);
+#endif
+    (void)blocks;
+    switch (size)
+    {
+#define DA_INTERSECT_KEYS_SCALAR(sz) nout += _da_intersect_keys_scalar(a, na, \
+    b, nb, out + nout*sz, sz, kind, i, j)
+    case 1:  DA_INTERSECT_KEYS_SCALAR(1); break;
+    case 2:  DA_INTERSECT_KEYS_SCALAR(2); break;
+    case 4:  DA_INTERSECT_KEYS_SCALAR(4); break;
+    default: DA_INTERSECT_KEYS_SCALAR(8); break;
+#undef DA_INTERSECT_KEYS_SCALAR
+    }
+    *DA_P_LENGTH_FROM_HANDLE(out) = nout;
+    return out;
+}
+
+////////////////////////////////// SEARCHING ///////////////////////////////////
+// Elements of 1, 2, 4, and 8 bytes are compared with the value a vector at a
+// time. Matching elements show up as runs of `size` set bits in the byte mask
+// of the comparison, so the first or last set bit divided by `size` is the
+// index of the matching element and the number of set bits divided by `size`
+// is the number of matches. Other element sizes go through memcmp.
+#define DA_FIND_SIMD_SIZE(size) ((size) <= 8 && ((size) & ((size) - 1)) == 0)
+
+static DA_ALWAYS_INLINE size_t _da_find_first_scalar(const char* p, size_t n,
+    size_t size, const void* value)
+{
+    for (size_t i = 0; i < n; ++i)
+    {
+        if (memcmp(p + i*size, value, size) == 0)
+            return i;
+    }
+    return n;
+}
+
+static DA_ALWAYS_INLINE size_t _da_find_last_scalar(const char* p, size_t n,
+    size_t size, const void* value)
+{
+    for (size_t i = n; i > 0; --i)
+    {
+        if (memcmp(p + (i-1)*size, value, size) == 0)
+            return i-1;
+    }
+    return n;
+}
+
+static DA_ALWAYS_INLINE size_t _da_count_scalar(const char* p, size_t n,
+    size_t size, const void* value)
+{
+    size_t count = 0;
+    for (size_t i = 0; i < n; ++i)
+        count += memcmp(p + i*size, value, size) == 0;
+    return count;
+}
+
+#if DA_SSE2
+static DA_ALWAYS_INLINE __m128i _da_find_splat_sse2(const void* value,
+    size_t size)
+{
+    uint64_t v = 0;
+    memcpy(&v, value, size);
+    switch (size)
+    {
+    case 1:  return _mm_set1_epi8((char)v);
+    case 2:  return _mm_set1_epi16((short)v);
+    case 4:  return _mm_set1_epi32((int)v);
+    default: return _mm_set1_epi64x((long long)v);
+    }
+}
+
+// SSE2 has no 64 bit compare. Two 32 bit halves that both compare equal make
+// an equal 64 bit element.
+static DA_ALWAYS_INLINE __m128i _da_find_cmpeq_sse2(const char* p, __m128i v,
+    size_t size)
+{
+    __m128i x = _mm_loadu_si128((const __m128i*)p);
+    __m128i eq;
+    switch (size)
+    {
+    case 1:  return _mm_cmpeq_epi8(x, v);
+    case 2:  return _mm_cmpeq_epi16(x, v);
+    case 4:  return _mm_cmpeq_epi32(x, v);
+    default:
+        eq = _mm_cmpeq_epi32(x, v);
+        return _mm_and_si128(eq, _mm_shuffle_epi32(eq, 0xB1));
+    }
+}
+
+static DA_ALWAYS_INLINE unsigned _da_find_mask_sse2(const char* p, __m128i v,
+    size_t size)
+{
+    return (unsigned)_mm_movemask_epi8(_da_find_cmpeq_sse2(p, v, size));
+}
+
+static DA_ALWAYS_INLINE size_t _da_find_first_sse2(const char* p, size_t n,
+    size_t size, const void* value)
+{
+    __m128i v = _da_find_splat_sse2(value, size);
+    size_t nbytes = n*size, i = 0;
+    for (; i + 64 <= nbytes; i += 64)
+    {
+        uint64_t mask = (uint64_t)_da_find_mask_sse2(p + i, v, size)
+            | (uint64_t)_da_find_mask_sse2(p + i + 16, v, size) << 16
+            | (uint64_t)_da_find_mask_sse2(p + i + 32, v, size) << 32
+            | (uint64_t)_da_find_mask_sse2(p + i + 48, v, size) << 48;
+        if (mask != 0)
+            return (i + __builtin_ctzll(mask)) / size;
+    }
+    for (; i + 16 <= nbytes; i += 16)
+    {
+        unsigned mask = _da_find_mask_sse2(p + i, v, size);
+        if (mask != 0)
+            return (i + __builtin_ctz(mask)) / size;
+    }
+    // The last vector overlaps elements that are known not to match.
+    if (i < nbytes && nbytes >= 16)
+    {
+        unsigned mask = _da_find_mask_sse2(p + nbytes - 16, v, size);
+        return mask != 0 ? (nbytes - 16 + __builtin_ctz(mask)) / size : n;
+    }
+    return i/size + _da_find_first_scalar(p + i, n - i/size, size, value);
+}
+
+static DA_ALWAYS_INLINE size_t _da_find_last_sse2(const char* p, size_t n,
+    size_t size, const void* value)
+{
+    __m128i v = _da_find_splat_sse2(value, size);
+    size_t i = n*size / 16 * 16;
+    size_t tail = _da_find_last_scalar(p + i, n - i/size, size, value);
+    if (tail != n - i/size)
+        return i/size + tail;
+    while (i > 0)
+    {
+        i -= 16;
+        unsigned mask = _da_find_mask_sse2(p + i, v, size);
+        if (mask != 0)
+            return (i + 31 - __builtin_clz(mask)) / size;
+    }
+    return n;
+}
+
+// Matches are counted per byte in 8 bit lanes, which are summed before they
+// can overflow.
+static DA_ALWAYS_INLINE size_t _da_count_sse2(const char* p, size_t n,
+    size_t size, const void* value)
+{
+    __m128i v = _da_find_splat_sse2(value, size);
+    __m128i ones = _mm_set1_epi8(1);
+    size_t nbytes = n*size, i = 0, count = 0;
+    while (i + 16 <= nbytes)
+    {
+        size_t stop = nbytes - i < 255*16 ? nbytes/16*16 : i + 255*16;
+        __m128i acc = _mm_setzero_si128();
+        for (; i < stop; i += 16)
+        {
+            acc = _mm_add_epi8(acc,
+                _mm_and_si128(_da_find_cmpeq_sse2(p + i, v, size), ones));
+        }
+        uint64_t sums[2];
+        _mm_storeu_si128((__m128i*)sums,
+            _mm_sad_epu8(acc, _mm_setzero_si128()));
+        count += sums[0] + sums[1];
+    }
+    return count/size
+        + _da_count_scalar(p + i, n - i/size, size, value);
+}
+#endif // DA_SSE2
+
+#if DA_AVX2_VARIANTS
+DA_AVX2_TARGET
+static DA_ALWAYS_INLINE __m256i _da_find_splat_avx2(const void* value,
+    size_t size)
+{
+    uint64_t v = 0;
+    memcpy(&v, value, size);
+    switch (size)
+    {
+    case 1:  return _mm256_set1_epi8((char)v);
+    case 2:  return _mm256_set1_epi16((short)v);
+    case 4:  return _mm256_set1_epi32((int)v);
+    default: return _mm256_set1_epi64x((long long)v);
+    }
+}
+
+DA_AVX2_TARGET
+static DA_ALWAYS_INLINE __m256i _da_find_cmpeq_avx2(const char* p, __m256i v,
+    size_t size)
+{
+    __m256i x = _mm256_loadu_si256((const __m256i*)p);
+    switch (size)
+    {
+    case 1:  return _mm256_cmpeq_epi8(x, v);
+    case 2:  return _mm256_cmpeq_epi16(x, v);
+    case 4:  return _mm256_cmpeq_epi32(x, v);
+    default: return _mm256_cmpeq_epi64(x, v);
+    }
+}
+
+DA_AVX2_TARGET
+static DA_ALWAYS_INLINE uint32_t _da_find_mask_avx2(const char* p, __m256i v,
+    size_t size)
+{
+    return (uint32_t)_mm256_movemask_epi8(_da_find_cmpeq_avx2(p, v, size));
+}
+
+DA_AVX2_TARGET
+static DA_ALWAYS_INLINE size_t _da_find_first_avx2_impl(const char* p,
+    size_t n, size_t size, const void* value)
+{
+    __m256i v = _da_find_splat_avx2(value, size);
+    size_t nbytes = n*size, i = 0;
+    for (; i + 128 <= nbytes; i += 128)
+    {
+        uint64_t lo = (uint64_t)_da_find_mask_avx2(p + i, v, size)
+            | (uint64_t)_da_find_mask_avx2(p + i + 32, v, size) << 32;
+        uint64_t hi = (uint64_t)_da_find_mask_avx2(p + i + 64, v, size)
+            | (uint64_t)_da_find_mask_avx2(p + i + 96, v, size) << 32;
+        if (lo != 0)
+            return (i + __builtin_ctzll(lo)) / size;
+        if (hi != 0)
+            return (i + 64 + __builtin_ctzll(hi)) / size;
+    }
+    for (; i + 32 <= nbytes; i += 32)
+    {
+        uint32_t mask = _da_find_mask_avx2(p + i, v, size);
+        if (mask != 0)
+            return (i + __builtin_ctz(mask)) / size;
+    }
+    // The last vector overlaps elements that are known not to match.
+    if (i < nbytes && nbytes >= 32)
+    {
+        uint32_t mask = _da_find_mask_avx2(p + nbytes - 32, v, size);
+        return mask != 0 ? (nbytes - 32 + __builtin_ctz(mask)) / size : n;
+    }
+    return i/size + _da_find_first_scalar(p + i, n - i/size, size, value);
+}
+
+DA_AVX2_TARGET
+static DA_ALWAYS_INLINE size_t _da_find_last_avx2_impl(const char* p,
+    size_t n, size_t size, const void* value)
+{
+    __m256i v = _da_find_splat_avx2(value, size);
+    size_t i = n*size / 32 * 32;
+    size_t tail = _da_find_last_scalar(p + i, n - i/size, size, value);
+    if (tail != n - i/size)
+        return i/size + tail;
+    while (i > 0)
+    {
+        i -= 32;
+        uint32_t mask = _da_find_mask_avx2(p + i, v, size);
+        if (mask != 0)
+            return (i + 31 - __builtin_clz(mask)) / size;
+    }
+    return n;
+}
+
+DA_AVX2_TARGET
+static DA_ALWAYS_INLINE size_t _da_count_avx2_impl(const char* p, size_t n,
+    size_t size, const void* value)
+{
+    __m256i v = _da_find_splat_avx2(value, size);
+    __m256i ones = _mm256_set1_epi8(1);
+    size_t nbytes = n*size, i = 0, count = 0;
+    while (i + 32 <= nbytes)
+    {
+        size_t stop = nbytes - i < 255*32 ? nbytes/32*32 : i + 255*32;
+        __m256i acc = _mm256_setzero_si256();
+        for (; i < stop; i += 32)
+        {
+            acc = _mm256_add_epi8(acc,
+                _mm256_and_si256(_da_find_cmpeq_avx2(p + i, v, size), ones));
+        }
+        uint64_t sums[4];
+        _mm256_storeu_si256((__m256i*)sums,
+            _mm256_sad_epu8(acc, _mm256_setzero_si256()));
+        count += (sums[0] + sums[1]) + (sums[2] + sums[3]);
+    }
+    return count/size
+        + _da_count_scalar(p + i, n - i/size, size, value);
+}
+
+// One out of line entry point per operation instantiates the kernel for each
+// element size.
+#define DA_FIND_AVX2_ENTRY(name)                                               \
+DA_AVX2_TARGET                                                                 \
+static size_t name(const char* p, size_t n, size_t size, const void* value)    \
+{                                                                              \
+    switch (size)                                                              \
+    {                                                                          \
+    case 1:  return name##_impl(p, n, 1, value);                               \
+    case 2:  return name##_impl(p, n, 2, value);                               \
+    case 4:  return name##_impl(p, n, 4, value);                               \
+    default: return name##_impl(p, n, 8, value);                               \
+    }                                                                          \
+}
+DA_FIND_AVX2_ENTRY(_da_find_first_avx2)
+DA_FIND_AVX2_ENTRY(_da_find_last_avx2)
+DA_FIND_AVX2_ENTRY(_da_count_avx2)
+#undef DA_FIND_AVX2_ENTRY
+#endif // DA_AVX2_VARIANTS
+
+// Pick the widest kernel for the element size. `op` is one of find_first,
+// find_last, or count.
+#if DA_SSE2
+#   define DA_FIND_SIMD_SSE2(op, sz) return _da_##op##_sse2(p, n, sz, value)
+#else
+#   define DA_FIND_SIMD_SSE2(op, sz) return _da_##op##_scalar(p, n, sz, value)
+#endif
+#if DA_AVX2_VARIANTS
+#   define DA_FIND_SIMD_AVX2(op)                                               \
+    if (DA_FIND_SIMD_SIZE(size) && _da_cpu_has_avx2())                         \
+        return _da_##op##_avx2(p, n, size, value)
+#else
+#   define DA_FIND_SIMD_AVX2(op) (void)0
+#endif
+#define DA_FIND_DISPATCH(op)                                                   \
+do                                                                             \
+{                                                                              \
+    DA_FIND_SIMD_AVX2(op);                                                     \
+    switch (size)                                                              \
+    {                                                                          \
+    case 1:  DA_FIND_SIMD_SSE2(op, 1);                                         \
+    case 2:  DA_FIND_SIMD_SSE2(op, 2);                                         \
+    case 4:  DA_FIND_SIMD_SSE2(op, 4);                                         \
+    case 8:  DA_FIND_SIMD_SSE2(op, 8);                                         \
+    default: return _da_##op##_scalar(p, n, size, value);                      \
+    }                                                                          \
+}while(0)
+
+static size_t _da_find_first(const char* p, size_t n, size_t size,
+    const void* value)
+{
+    DA_FIND_DISPATCH(find_first);
+}
+
+static size_t _da_find_last(const char* p, size_t n, size_t size,
+    const void* value)
+{
+    DA_FIND_DISPATCH(find_last);
+}
+
+static size_t _da_count(const char* p, size_t n, size_t size,
+    const void* value)
+{
+    DA_FIND_DISPATCH(count);
+}
+#undef DA_FIND_DISPATCH
+#undef DA_FIND_SIMD_AVX2
+#undef DA_FIND_SIMD_SSE2
+
+size_t da_find(const void* darr, const void* value)
+{
+    return _da_find_first(darr, da_length(darr), da_sizeof_elem(darr), value);
+}
+
+size_t da_find_last(const void* darr, const void* value)
+{
+    return _da_find_last(darr, da_length(darr), da_sizeof_elem(darr), value);
+}
+
+size_t da_find_range(const void* darr, size_t begin, size_t end,
+    const void* value)
+{
+    size_t size = da_sizeof_elem(darr);
+    return begin + _da_find_first((const char*)darr + begin*size, end - begin,
+        size, value);
+}
+
+size_t da_count(const void* darr, const void* value)
+{
+    return _da_count(darr, da_length(darr), da_sizeof_elem(darr), value);
+}
+
+bool da_contains(const void* darr, const void* value)
+{
+    return da_find(darr, value) != da_length(darr);
+}
+
+///////////////////////////////// PARALLEL FOR /////////////////////////////////
+// da_parallel_for runs on a pool of worker threads owned by the library.
+// Workers are started on first use and live until the process exits. Each
+// loop hands every participating thread a contiguous slice of the darray. A
+// thread works through its slice one grain at a time from the front, and once
+// it runs dry steals the back half of the fullest slice of another thread, so
+// the load evens out when the cost per element varies.
+#define DA_PARALLEL_MAX_THREADS 256
+#define DA_PARALLEL_GRAINS_PER_THREAD 16
+
+
+struct _da_parallel_slice
+{
+    alignas(64) pthread_mutex_t lock; // Own cache line per slice.
+    size_t begin;
+    size_t end;
+    unsigned long start_generation; // Generation a new worker starts after.
+};
+
+static struct
+{
+    pthread_mutex_t submit; // Held for the duration of a loop.
+    pthread_mutex_t lock;   // Protects the fields below.
+    pthread_cond_t start;
+    pthread_cond_t done;
+    size_t nworkers;
+    size_t max_threads;
+    unsigned long generation;
+    size_t remaining;
+    size_t grain;
+    size_t nthreads;
+    _da_parallel_range_fn fn;
+    void* ctx;
+} _da_pool = {
+    .submit = PTHREAD_MUTEX_INITIALIZER,
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .start = PTHREAD_COND_INITIALIZER,
+    .done = PTHREAD_COND_INITIALIZER,
+};
+static struct _da_parallel_slice _da_pool_slices[DA_PARALLEL_MAX_THREADS];
+static pthread_once_t _da_pool_once = PTHREAD_ONCE_INIT;
+
+static void _da_parallel_init(void)
+{
+    for (size_t t = 0; t < DA_PARALLEL_MAX_THREADS; ++t)
+        pthread_mutex_init(&_da_pool_slices[t].lock, NULL);
+}
+
+// Set on pool threads and on a thread while it runs a loop. Loops started
+// from inside a loop body run sequentially instead of waiting on the pool.
+static _Thread_local bool _da_in_parallel_for = false;
+
+// Take the back half of the slice of another thread with the most elements
+// left. Returns false if no slice has any elements left.
+static bool _da_parallel_steal(size_t id, size_t* begin, size_t* end)
+{
+    for (;;)
+    {
+        size_t victim = id;
+        size_t most = 0;
+        for (size_t t = 0; t < _da_pool.nthreads; ++t)
+        {
+            struct _da_parallel_slice* slice = &_da_pool_slices[t];
+            pthread_mutex_lock(&slice->lock);
+            size_t left = slice->end - slice->begin;
+            pthread_mutex_unlock(&slice->lock);
+            if (t != id && left > most)
+            {
+                victim = t;
+                most = left;
+            }
+        }
+        if (most == 0)
+            return false;
+
+        struct _da_parallel_slice* slice = &_da_pool_slices[victim];
+        pthread_mutex_lock(&slice->lock);
+        size_t left = slice->end - slice->begin;
+        if (left > 0)
+        {
+            *end = slice->end;
+            slice->end -= left <= _da_pool.grain ? left : left/2;
+            *begin = slice->end;
+        }
+        pthread_mutex_unlock(&slice->lock);
+        if (left > 0)
+            return true;
+        // The slice ran dry before it could be stolen from. Look again.
+    }
+}
+
+static void _da_parallel_run(size_t id)
+{
+    struct _da_parallel_slice* own = &_da_pool_slices[id];
+    for (;;)
+    {
+        pthread_mutex_lock(&own->lock);
+        size_t begin = own->begin;
+        size_t end = own->end - begin > _da_pool.grain
+            ? begin + _da_pool.grain : own->end;
+        own->begin = end;
+        pthread_mutex_unlock(&own->lock);
+
+        if (begin == end)
+        {
+            if (!_da_parallel_steal(id, &begin, &end))
+                return;
+            pthread_mutex_lock(&own->lock);
+            own->begin = begin;
+            own->end = end;
+            pthread_mutex_unlock(&own->lock);
+            continue;
+        }
+
+        _da_pool.fn(begin, end, _da_pool.ctx);
+    }
+}
+
+static void* _da_parallel_worker(void* arg)
+{
+    size_t id = (uintptr_t)arg;
+    _da_in_parallel_for = true;
+    pthread_mutex_lock(&_da_pool.lock);
+    unsigned long seen = _da_pool_slices[id].start_generation;
+    for (;;)
+    {
+        while (_da_pool.generation == seen)
+            pthread_cond_wait(&_da_pool.start, &_da_pool.lock);
+        seen = _da_pool.generation;
+        if (id >= _da_pool.nthreads)
+            continue;
+        pthread_mutex_unlock(&_da_pool.lock);
+        _da_parallel_run(id);
+        pthread_mutex_lock(&_da_pool.lock);
+        if (--_da_pool.remaining == 0)
+            pthread_cond_signal(&_da_pool.done);
+    }
+    return NULL;
+}
+
+// Start workers until the pool has `nworkers` of them. Must be called with
+// `_da_pool.submit` held. Returns the number of workers in the pool.
+static size_t _da_parallel_grow(size_t nworkers)
+{
+    while (_da_pool.nworkers < nworkers)
+    {
+        size_t id = _da_pool.nworkers + 1;
+        pthread_t thread;
+        _da_pool_slices[id].start_generation = _da_pool.generation;
+        if (pthread_create(&thread, NULL, _da_parallel_worker,
+            (void*)(uintptr_t)id) != 0)
+        {
+            break;
+        }
+        pthread_detach(thread);
+        _da_pool.nworkers += 1;
+    }
+    return _da_pool.nworkers;
+}
+
+// Must be called with `_da_pool.submit` held.
+static size_t _da_parallel_max_threads(void)
+{
+    size_t nthreads = _da_pool.max_threads != 0
+        ? _da_pool.max_threads : _da_online_cpus();
+    return nthreads < DA_PARALLEL_MAX_THREADS
+        ? nthreads : DA_PARALLEL_MAX_THREADS;
+}
+
+// Number of threads, including the calling thread, that a loop started now
+// may use. 1 from inside a loop body, where loops run sequentially.
+static size_t _da_parallel_thread_limit(void)
+{
+    if (_da_in_parallel_for)
+        return 1;
+    pthread_mutex_lock(&_da_pool.submit);
+    size_t nthreads = _da_parallel_max_threads();
+    pthread_mutex_unlock(&_da_pool.submit);
+    return nthreads;
+}
+
+// Run `fn` over the indices [0, n) on the pool. Returns false without calling
+// `fn` if fewer than two threads are available, including when called from
+// inside a loop body, in which case the caller runs the loop itself.
+static bool _da_parallel_ranges(size_t n, size_t grain,
+    _da_parallel_range_fn fn, void* ctx)
+{
+    if (n == 0 || _da_in_parallel_for)
+        return false;
+    pthread_once(&_da_pool_once, _da_parallel_init);
+    pthread_mutex_lock(&_da_pool.submit);
+    size_t nthreads = _da_parallel_max_threads();
+    if (grain == 0)
+        grain = n / (nthreads*DA_PARALLEL_GRAINS_PER_THREAD) + 1;
+    if (nthreads > (n + grain - 1)/grain)
+        nthreads = (n + grain - 1)/grain;
+    if (nthreads > 1)
+        nthreads = _da_parallel_grow(nthreads - 1) + 1;
+    if (nthreads < 2)
+    {
+        pthread_mutex_unlock(&_da_pool.submit);
+        return false;
+    }
+
+    for (size_t t = 0; t < nthreads; ++t)
+    {
+        _da_pool_slices[t].begin = t*(n/nthreads)
+            + (t < n%nthreads ? t : n%nthreads);
+        _da_pool_slices[t].end = _da_pool_slices[t].begin
+            + n/nthreads + (t < n%nthreads);
+    }
+    pthread_mutex_lock(&_da_pool.lock);
+    _da_pool.grain = grain;
+    _da_pool.nthreads = nthreads;
+    _da_pool.fn = fn;
+    _da_pool.ctx = ctx;
+    _da_pool.remaining = nthreads - 1;
+    _da_pool.generation += 1;
+    pthread_cond_broadcast(&_da_pool.start);
+    pthread_mutex_unlock(&_da_pool.lock);
+
+    _da_in_parallel_for = true;
+    _da_parallel_run(0);
+    _da_in_parallel_for = false;
+
+    pthread_mutex_lock(&_da_pool.lock);
+    while (_da_pool.remaining > 0)
+        pthread_cond_wait(&_da_pool.done, &_da_pool.lock);
+    pthread_mutex_unlock(&_da_pool.lock);
+    pthread_mutex_unlock(&_da_pool.submit);
+    return true;
+}
+
+void da_parallel_set_max_threads(size_t nthreads)
+{
+    pthread_mutex_lock(&_da_pool.submit);
+    _da_pool.max_threads = nthreads;
+    pthread_mutex_unlock(&_da_pool.submit);
+}
+
+// Appending threads claim slots by incrementing the length. Claims past the
+// capacity fail and are trimmed off the length by `da_seal`.
+bool da_atomic_append(void* darr, const void* value)
+{
+    struct _darray* head = (struct _darray*)DA_P_HEAD_FROM_HANDLE(darr);
+#if defined(__GNUC__) || defined(__clang__)
+    size_t index = __atomic_fetch_add(&head->_length, 1, __ATOMIC_RELAXED);
+#else
+    pthread_mutex_lock(&_da_atomic_lock);
+    size_t index = head->_length++;
+    pthread_mutex_unlock(&_da_atomic_lock);
+#endif
+    if (index >= head->_capacity)
+        return false;
+    char* dest = head->_data + index*head->_elemsz;
+    switch (head->_elemsz)
+    {
+    case 4: memcpy(dest, value, 4); break;
+    case 8: memcpy(dest, value, 8); break;
+    default: memcpy(dest, value, head->_elemsz); break;
+    }
+    return true;
+}
+
+bool da_seal(void* darr)
+{
+    size_t* length = DA_P_LENGTH_FROM_HANDLE(darr);
+    bool fits = *length <= da_capacity(darr);
+    if (!fits)
+        *length = da_capacity(darr);
+    _da_invalidate_content_cache(darr);
+    return fits;
+}
+
+// Each thread's darray lives in a cell tagged with the owning thread. Threads
+// find their cell through a one entry cache and otherwise search the cells of
+// the collector under a global lock, which only happens on a thread's first
+// call or when it alternates between collectors.
+#define DA_MERGE_PARALLEL_MIN (1 << 22)
+#define DA_MERGE_BLOCK (1 << 20)
+
+struct _da_collector_cell
+{
+    pthread_t owner;
+    void* darr;
+};
+
+static pthread_mutex_t _da_collector_lock = PTHREAD_MUTEX_INITIALIZER;
+static uint64_t _da_collector_next_id = 1;
+static _Thread_local struct
+{
+    uint64_t id;
+    struct _da_collector_cell* cell;
+} _da_collector_cache;
+
+void da_collector_init(struct da_collector* collector, size_t size)
+{
+    collector->_elemsz = size;
+    collector->_locals = NULL;
+    pthread_mutex_lock(&_da_collector_lock);
+    collector->_id = _da_collector_next_id++;
+    pthread_mutex_unlock(&_da_collector_lock);
+}
+
+void da_collector_free(struct da_collector* collector)
+{
+    if (collector->_locals != NULL)
+    {
+        for (size_t i = 0; i < da_length(collector->_locals); ++i)
+        {
+            struct _da_collector_cell* cell = collector->_locals[i];
+            da_free(cell->darr);
+            free(cell);
+        }
+        da_free(collector->_locals);
+    }
+    collector->_locals = NULL;
+    // Threads may still cache cells of the old id.
+    pthread_mutex_lock(&_da_collector_lock);
+    collector->_id = _da_collector_next_id++;
+    pthread_mutex_unlock(&_da_collector_lock);
+}
+
+// Find or create the calling thread's cell. Must hold `_da_collector_lock`.
+static struct _da_collector_cell* _da_collector_find(
+    struct da_collector* collector)
+{
+    pthread_t self = pthread_self();
+    size_t nlocals =
+        collector->_locals == NULL ? 0 : da_length(collector->_locals);
+    for (size_t i = 0; i < nlocals; ++i)
+    {
+        struct _da_collector_cell* cell = collector->_locals[i];
+        if (pthread_equal(cell->owner, self))
+            return cell;
+    }
+
+    void** locals = collector->_locals == NULL
+        ? da_alloc(0, sizeof(void*)) : collector->_locals;
+    if (locals == NULL)
+        return NULL;
+    collector->_locals = locals;
+    struct _da_collector_cell* cell = malloc(sizeof(*cell));
+    void* darr = da_alloc(0, collector->_elemsz);
+    if (cell == NULL || darr == NULL
+        || (locals = da_insert_arr(locals, nlocals, &cell, 1)) == NULL)
+    {
+        free(cell);
+        if (darr != NULL)
+            da_free(darr);
+        return NULL;
+    }
+    collector->_locals = locals;
+    cell->owner = self;
+    cell->darr = darr;
+    return cell;
+}
+
+void** da_collector_local(struct da_collector* collector)
+{
+    if (_da_collector_cache.id != collector->_id)
+    {
+        pthread_mutex_lock(&_da_collector_lock);
+        struct _da_collector_cell* cell = _da_collector_find(collector);
+        pthread_mutex_unlock(&_da_collector_lock);
+        if (cell == NULL)
+            return NULL;
+        _da_collector_cache.id = collector->_id;
+        _da_collector_cache.cell = cell;
+    }
+    return &_da_collector_cache.cell->darr;
+}
+
+struct _da_merge_job
+{
+    char* dest;
+    void* const* cells;
+    const size_t* offsets; // Byte offset of each cell's darray in `dest`.
+    size_t ncells;
+};
+
+// Copy the bytes of blocks [begin, end) of the merged darray.
+static void _da_merge_range(size_t begin, size_t end, void* ctx)
+{
+    struct _da_merge_job* job = ctx;
+    size_t lo = begin*DA_MERGE_BLOCK;
+    size_t hi = end*DA_MERGE_BLOCK;
+    if (hi > job->offsets[job->ncells])
+        hi = job->offsets[job->ncells];
+    for (size_t k = 0; k < job->ncells && lo < hi; ++k)
+    {
+        size_t first = job->offsets[k];
+        size_t last = job->offsets[k+1];
+        if (last <= lo)
+            continue;
+        size_t n = (last < hi ? last : hi) - lo;
+        const struct _da_collector_cell* cell = job->cells[k];
+        memcpy(job->dest + lo, (const char*)cell->darr + (lo - first), n);
+        lo += n;
+    }
+}
+
+void* da_collector_merge(struct da_collector* collector)
+{
+    size_t ncells =
+        collector->_locals == NULL ? 0 : da_length(collector->_locals);
+    size_t total = 0;
+    for (size_t k = 0; k < ncells; ++k)
+    {
+        struct _da_collector_cell* cell = collector->_locals[k];
+        total += da_length(cell->darr);
+    }
+    char* darr = da_alloc_exact(total, collector->_elemsz);
+    if (darr == NULL)
+        return NULL;
+
+    size_t nbytes = total*collector->_elemsz;
+    size_t* offsets = NULL;
+    if (nbytes >= DA_MERGE_PARALLEL_MIN)
+        offsets = malloc((ncells + 1)*sizeof(size_t));
+    bool copied = false;
+    if (offsets != NULL)
+    {
+        offsets[0] = 0;
+        for (size_t k = 0; k < ncells; ++k)
+        {
+            struct _da_collector_cell* cell = collector->_locals[k];
+            offsets[k+1] =
+                offsets[k] + da_length(cell->darr)*collector->_elemsz;
+        }
+        struct _da_merge_job job = {darr, collector->_locals, offsets, ncells};
+        copied = _da_parallel_ranges((nbytes + DA_MERGE_BLOCK - 1)
+            / DA_MERGE_BLOCK, 1, _da_merge_range, &job);
+        free(offsets);
+    }
+    if (!copied)
+    {
+        // The exact capacity leaves room for every element, so concatenating
+        // never reallocates.
+        *DA_P_LENGTH_FROM_HANDLE(darr) = 0;
+        for (size_t k = 0; k < ncells; ++k)
+        {
+            struct _da_collector_cell* cell = collector->_locals[k];
+            darr = da_concat(darr, cell->darr, da_length(cell->darr));
+        }
+    }
+
+    for (size_t k = 0; k < ncells; ++k)
+    {
+        struct _da_collector_cell* cell = collector->_locals[k];
+        *DA_P_LENGTH_FROM_HANDLE(cell->darr) = 0;
+        _da_invalidate_content_cache(cell->darr);
+    }
+    return darr;
+}
+
+struct _da_parallel_for_job
+{
+    char* base;
+    size_t size;
+    void (*fn)(void*, size_t, void*);
+    void* ctx;
+};
+
+static void _da_parallel_for_range(size_t begin, size_t end, void* ctx)
+{
+    struct _da_parallel_for_job* job = ctx;
+    for (size_t i = begin; i < end; ++i)
+        job->fn(job->base + i*job->size, i, job->ctx);
+}
+
+void da_parallel_for(void* darr, void (*fn)(void*, size_t, void*), void* ctx,
+    size_t grain)
+{
+    struct _da_parallel_for_job job = {darr, da_sizeof_elem(darr), fn, ctx};
+    size_t n = da_length(darr);
+    _da_invalidate_content_cache(darr);
+    if (!_da_parallel_ranges(n, grain, _da_parallel_for_range, &job))
+        _da_parallel_for_range(0, n, &job);
+}
+
+////////////////////////////////// RING QUEUE //////////////////////////////////
+// `_head` and `_tail` count every element ever dequeued and enqueued, so the
+// ring holds `_tail - _head` elements and the slot of index `i` is
+// `i & _mask`. Each side keeps a cached copy of the other side's index and only
+// reloads it when the cached copy says the ring is full or empty.
+static inline size_t _da_load_acquire(const size_t* index)
+{
+#if defined(__GNUC__) || defined(__clang__)
+    return __atomic_load_n(index, __ATOMIC_ACQUIRE);
+#else
+    pthread_mutex_lock(&_da_atomic_lock);
+    size_t value = *index;
+    pthread_mutex_unlock(&_da_atomic_lock);
+    return value;
+#endif
+}
+
+static inline void _da_store_release(size_t* index, size_t value)
+{
+#if defined(__GNUC__) || defined(__clang__)
+    __atomic_store_n(index, value, __ATOMIC_RELEASE);
+#else
+    pthread_mutex_lock(&_da_atomic_lock);
+    *index = value;
+    pthread_mutex_unlock(&_da_atomic_lock);
+#endif
+}
+
+bool da_ring_init(struct da_ring* ring, size_t nelem, size_t size)
+{
+    size_t capacity = 1;
+    while (capacity < nelem)
+        capacity <<= 1;
+    ring->_buf = da_alloc_exact(capacity, size);
+    if (ring->_buf == NULL)
+        return false;
+    ring->_mask = capacity - 1;
+    ring->_head = ring->_head_cache = 0;
+    ring->_tail = ring->_tail_cache = 0;
+    return true;
+}
+
+void da_ring_free(struct da_ring* ring)
+{
+    da_free(ring->_buf);
+    ring->_buf = NULL;
+}
+
+size_t da_ring_enqueue(struct da_ring* ring, const void* src, size_t nelem)
+{
+    size_t tail = ring->_tail;
+    size_t capacity = ring->_mask + 1;
+    if (capacity - (tail - ring->_head_cache) < nelem)
+        ring->_head_cache = _da_load_acquire(&ring->_head);
+    size_t space = capacity - (tail - ring->_head_cache);
+    if (nelem > space)
+        nelem = space;
+    if (nelem == 0)
+        return 0;
+
+    size_t size = da_sizeof_elem(ring->_buf);
+    size_t first = tail & ring->_mask;
+    size_t n1 = capacity - first < nelem ? capacity - first : nelem;
+    memcpy((char*)ring->_buf + first*size, src, n1*size);
+    memcpy(ring->_buf, (const char*)src + n1*size, (nelem - n1)*size);
+    _da_store_release(&ring->_tail, tail + nelem);
+    return nelem;
+}
+
+size_t da_ring_dequeue(struct da_ring* ring, void* dest, size_t nelem)
+{
+    size_t head = ring->_head;
+    if (ring->_tail_cache - head < nelem)
+        ring->_tail_cache = _da_load_acquire(&ring->_tail);
+    size_t available = ring->_tail_cache - head;
+    if (nelem > available)
+        nelem = available;
+    if (nelem == 0)
+        return 0;
+
+    size_t size = da_sizeof_elem(ring->_buf);
+    size_t capacity = ring->_mask + 1;
+    size_t first = head & ring->_mask;
+    size_t n1 = capacity - first < nelem ? capacity - first : nelem;
+    memcpy(dest, (const char*)ring->_buf + first*size, n1*size);
+    memcpy((char*)dest + n1*size, ring->_buf, (nelem - n1)*size);
+    _da_store_release(&ring->_head, head + nelem);
+    return nelem;
+}
+
+size_t da_ring_length(const struct da_ring* ring)
+{
+    size_t head = _da_load_acquire(&ring->_head);
+    return _da_load_acquire(&ring->_tail) - head;
+}
+
+/////////////////////////////// CONCURRENT READS ///////////////////////////////
+// Epoch based reclamation. Growth publishes the new handle, tags the old
+// darray with the value of `_epoch` and then increments `_epoch`. A reader
+// stores the epoch it saw in its slot before loading the handle, so a reader
+// whose slot holds an epoch above a retired darray's tag loaded the handle
+// after that darray was replaced. A retired darray is freed once no slot holds
+// an epoch at or below its tag. Unclaimed slots hold `DA_READER_FREE` and
+// slots of readers outside a read hold `DA_READER_IDLE`, below every epoch.
+#define DA_READER_FREE 0
+#define DA_READER_IDLE 1
+#define DA_EPOCH_FIRST 2
+
+struct _da_retired
+{
+    void* darr;
+    size_t epoch;
+};
+
+// Every access that orders a reader against the writer is sequentially
+// consistent. A reader stores its epoch and then loads the handle, and the
+// writer stores the handle and epoch and then loads the reader slots, so
+// either the writer sees the reader's epoch or the reader sees the new handle.
+static inline size_t _da_load_seq_cst(const size_t* index)
+{
+#if defined(__GNUC__) || defined(__clang__)
+    return __atomic_load_n(index, __ATOMIC_SEQ_CST);
+#else
+    pthread_mutex_lock(&_da_atomic_lock);
+    size_t value = *index;
+    pthread_mutex_unlock(&_da_atomic_lock);
+    return value;
+#endif
+}
+
+static inline void _da_store_seq_cst(size_t* index, size_t value)
+{
+#if defined(__GNUC__) || defined(__clang__)
+    __atomic_store_n(index, value, __ATOMIC_SEQ_CST);
+#else
+    pthread_mutex_lock(&_da_atomic_lock);
+    *index = value;
+    pthread_mutex_unlock(&_da_atomic_lock);
+#endif
+}
+
+static inline void* _da_load_handle(void* const* handle)
+{
+#if defined(__GNUC__) || defined(__clang__)
+    return __atomic_load_n(handle, __ATOMIC_SEQ_CST);
+#else
+    pthread_mutex_lock(&_da_atomic_lock);
+    void* darr = *handle;
+    pthread_mutex_unlock(&_da_atomic_lock);
+    return darr;
+#endif
+}
+
+static inline void _da_publish_handle(void** handle, void* darr)
+{
+#if defined(__GNUC__) || defined(__clang__)
+    __atomic_store_n(handle, darr, __ATOMIC_SEQ_CST);
+#else
+    pthread_mutex_lock(&_da_atomic_lock);
+    *handle = darr;
+    pthread_mutex_unlock(&_da_atomic_lock);
+#endif
+}
+
+bool da_concurrent_init(struct da_concurrent* conc, size_t nelem, size_t size)
+{
+    void* darr = da_alloc_exact(nelem, size);
+    void* retired = da_alloc(0, sizeof(struct _da_retired));
+    if (darr == NULL || retired == NULL)
+    {
+        if (darr != NULL)
+            da_free(darr);
+        if (retired != NULL)
+            da_free(retired);
+        return false;
+    }
+    *DA_P_LENGTH_FROM_HANDLE(darr) = 0;
+    conc->_darr = darr;
+    conc->_epoch = DA_EPOCH_FIRST;
+    for (size_t r = 0; r < DA_CONCURRENT_MAX_READERS; ++r)
+        conc->_readers[r]._epoch = DA_READER_FREE;
+    conc->_retired = retired;
+    return true;
+}
+
+void da_concurrent_free(struct da_concurrent* conc)
+{
+    struct _da_retired* retired = conc->_retired;
+    for (size_t i = 0; i < da_length(retired); ++i)
+        da_free(retired[i].darr);
+    da_free(retired);
+    da_free(conc->_darr);
+    conc->_retired = NULL;
+    conc->_darr = NULL;
+}
+
+bool da_concurrent_push(struct da_concurrent* conc, const void* value)
+{
+    void* darr = conc->_darr;
+    size_t length = da_length(darr);
+    size_t size = da_sizeof_elem(darr);
+    if (length < da_capacity(darr))
+    {
+        memcpy((char*)darr + length*size, value, size);
+        _da_invalidate_content_cache(darr);
+        _da_store_release(DA_P_LENGTH_FROM_HANDLE(darr), length + 1);
+        return true;
+    }
+
+    // Reserve the retired entry first so nothing can fail after publishing.
+    void* retired = da_reserve(conc->_retired, 1);
+    if (retired == NULL)
+        return false;
+    conc->_retired = retired;
+    void* grown = da_alloc_exact(DA_NEW_CAPACITY_FROM_LENGTH(length + 1), size);
+    if (grown == NULL)
+        return false;
+    memcpy(grown, darr, length*size);
+    memcpy((char*)grown + length*size, value, size);
+    *DA_P_LENGTH_FROM_HANDLE(grown) = length + 1;
+
+    _da_publish_handle(&conc->_darr, grown);
+    size_t epoch = conc->_epoch;
+    _da_store_seq_cst(&conc->_epoch, epoch + 1);
+    ((struct _da_retired*)retired)[da_length(retired)] =
+        (struct _da_retired){darr, epoch};
+    *DA_P_LENGTH_FROM_HANDLE(retired) += 1;
+    da_concurrent_reclaim(conc);
+    return true;
+}
+
+size_t da_concurrent_reclaim(struct da_concurrent* conc)
+{
+    size_t min_epoch = SIZE_MAX;
+    for (size_t r = 0; r < DA_CONCURRENT_MAX_READERS; ++r)
+    {
+        size_t epoch = _da_load_seq_cst(&conc->_readers[r]._epoch);
+        if (epoch >= DA_EPOCH_FIRST && epoch < min_epoch)
+            min_epoch = epoch;
+    }
+
+    struct _da_retired* retired = conc->_retired;
+    size_t nkept = 0;
+    for (size_t i = 0; i < da_length(retired); ++i)
+    {
+        if (retired[i].epoch < min_epoch)
+            da_free(retired[i].darr);
+        else
+            retired[nkept++] = retired[i];
+    }
+    *DA_P_LENGTH_FROM_HANDLE(retired) = nkept;
+    return nkept;
+}
+
+size_t da_concurrent_register(struct da_concurrent* conc)
+{
+    for (size_t r = 0; r < DA_CONCURRENT_MAX_READERS; ++r)
+    {
+        size_t* slot = &conc->_readers[r]._epoch;
+#if defined(__GNUC__) || defined(__clang__)
+        size_t expected = DA_READER_FREE;
+        if (__atomic_compare_exchange_n(slot, &expected, DA_READER_IDLE, false,
+            __ATOMIC_ACQ_REL, __ATOMIC_RELAXED))
+            return r;
+#else
+        pthread_mutex_lock(&_da_atomic_lock);
+        bool claimed = *slot == DA_READER_FREE;
+        if (claimed)
+            *slot = DA_READER_IDLE;
+        pthread_mutex_unlock(&_da_atomic_lock);
+        if (claimed)
+            return r;
+#endif
+    }
+    return SIZE_MAX;
+}
+
+void da_concurrent_unregister(struct da_concurrent* conc, size_t reader)
+{
+    _da_store_release(&conc->_readers[reader]._epoch, DA_READER_FREE);
+}
+
+const void* da_concurrent_read_begin(struct da_concurrent* conc,
+    size_t reader)
+{
+    size_t epoch = _da_load_seq_cst(&conc->_epoch);
+    _da_store_seq_cst(&conc->_readers[reader]._epoch, epoch);
+    return _da_load_handle(&conc->_darr);
+}
+
+void da_concurrent_read_end(struct da_concurrent* conc, size_t reader)
+{
+    _da_store_release(&conc->_readers[reader]._epoch, DA_READER_IDLE);
+}
+
+size_t da_concurrent_length(const void* darr)
+{
+    return _da_load_acquire(DA_P_LENGTH_FROM_HANDLE(darr));
+}
+
+////////////////////////////// NUMERIC REDUCTIONS //////////////////////////////
+// Every reduction has a kernel over a plain array with an AVX2 variant that is
+// picked at runtime. Darrays that do not fit in the last level cache are cut
+// into fixed blocks that are reduced on the da_parallel_for pool and combined
+// in block order, so a result does not depend on the number of threads.
+#define DA_REDUCE_BLOCK ((size_t)1 << 18)
+#define DA_REDUCE_DEFAULT_CACHE_SIZE ((size_t)32 << 20)
+// argmin and argmax find the block holding the result first and only search
+// that block for the index.
+#define DA_ARG_BLOCK 1024
+
+static size_t _da_reduce_cache_size;
+static pthread_once_t _da_reduce_once = PTHREAD_ONCE_INIT;
+
+static void _da_reduce_init(void)
+{
+    long size = -1;
+#ifdef _SC_LEVEL3_CACHE_SIZE
+    size = sysconf(_SC_LEVEL3_CACHE_SIZE);
+#endif
+    _da_reduce_cache_size = size > 0
+        ? (size_t)size : DA_REDUCE_DEFAULT_CACHE_SIZE;
+}
+
+struct _da_reduce_job
+{
+    void* base;
+    size_t n;
+    void* partials; // One result per block.
+    bool max;
+};
+
+static inline size_t _da_reduce_block_length(const struct _da_reduce_job* job,
+    size_t block)
+{
+    size_t left = job->n - block*DA_REDUCE_BLOCK;
+    return left < DA_REDUCE_BLOCK ? left : DA_REDUCE_BLOCK;
+}
+
+// Reduce the blocks of a job larger than the last level cache with `fn` on the
+// pool, which stores a result of `partial_size` bytes per block. Returns the
+// number of blocks, in which case the caller combines and frees
+// `job->partials`, or 0 if the caller should reduce the elements itself.
+static size_t _da_reduce_blocks(struct _da_reduce_job* job, size_t size,
+    size_t partial_size, _da_parallel_range_fn fn)
+{
+    pthread_once(&_da_reduce_once, _da_reduce_init);
+    if (job->n*size < _da_reduce_cache_size)
+        return 0;
+    size_t nblocks = (job->n + DA_REDUCE_BLOCK - 1) / DA_REDUCE_BLOCK;
+    job->partials = malloc(nblocks*partial_size);
+    if (job->partials == NULL)
+        return 0;
+    if (!_da_parallel_ranges(nblocks, 1, fn, job))
+    {
+        free(job->partials);
+        return 0;
+    }
+    return nblocks;
+}
+
+static long long _da_sum_int_scalar(const int* p, size_t n)
+{
+    long long sum = 0;
+    for (size_t i = 0; i < n; ++i)
+        sum += p[i];
+    return sum;
+}
+
+static double _da_sum_float_scalar(const float* p, size_t n)
+{
+    double s0 = 0, s1 = 0, s2 = 0, s3 = 0;
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4)
+    {
+        s0 += p[i];
+        s1 += p[i+1];
+        s2 += p[i+2];
+        s3 += p[i+3];
+    }
+    for (; i < n; ++i)
+        s0 += p[i];
+    return (s0 + s1) + (s2 + s3);
+}
+
+static double _da_sum_double_scalar(const double* p, size_t n)
+{
+    double s0 = 0, s1 = 0, s2 = 0, s3 = 0;
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4)
+    {
+        s0 += p[i];
+        s1 += p[i+1];
+        s2 += p[i+2];
+        s3 += p[i+3];
+    }
+    for (; i < n; ++i)
+        s0 += p[i];
+    return (s0 + s1) + (s2 + s3);
+}
+
+// NaN elements never replace the running minimum or maximum. Returns false if
+// every element is NaN or there are no elements.
+static bool _da_minmax_int_scalar(const int* p, size_t n, int* min, int* max)
+{
+    int lo = INT_MAX, hi = INT_MIN;
+    for (size_t i = 0; i < n; ++i)
+    {
+        lo = p[i] < lo ? p[i] : lo;
+        hi = p[i] > hi ? p[i] : hi;
+    }
+    *min = lo;
+    *max = hi;
+    return n > 0;
+}
+
+static bool _da_minmax_float_scalar(const float* p, size_t n, float* min,
+    float* max)
+{
+    float lo = INFINITY, hi = -INFINITY;
+    for (size_t i = 0; i < n; ++i)
+    {
+        lo = p[i] < lo ? p[i] : lo;
+        hi = p[i] > hi ? p[i] : hi;
+    }
+    *min = lo;
+    *max = hi;
+    return lo <= hi;
+}
+
+static bool _da_minmax_double_scalar(const double* p, size_t n, double* min,
+    double* max)
+{
+    double lo = INFINITY, hi = -INFINITY;
+    for (size_t i = 0; i < n; ++i)
+    {
+        lo = p[i] < lo ? p[i] : lo;
+        hi = p[i] > hi ? p[i] : hi;
+    }
+    *min = lo;
+    *max = hi;
+    return lo <= hi;
+}
+
+// Integer prefix sums wrap around on overflow.
+static void _da_prefix_sum_int_scalar(int* p, size_t n, int offset)
+{
+    unsigned sum = (unsigned)offset;
+    for (size_t i = 0; i < n; ++i)
+    {
+        sum += (unsigned)p[i];
+        p[i] = (int)sum;
+    }
+}
+
+static void _da_prefix_sum_float_scalar(float* p, size_t n, float offset)
+{
+    for (size_t i = 0; i < n; ++i)
+        p[i] = offset += p[i];
+}
+
+static void _da_prefix_sum_double_scalar(double* p, size_t n, double offset)
+{
+    for (size_t i = 0; i < n; ++i)
+        p[i] = offset += p[i];
+}
+
+#if DA_AVX2_VARIANTS
+DA_AVX2_TARGET
+static long long _da_sum_int_avx2(const int* p, size_t n)
+{
+    __m256i s0 = _mm256_setzero_si256(), s1 = s0, s2 = s0, s3 = s0;
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16)
+    {
+        __m256i a = _mm256_loadu_si256((const __m256i*)(p + i));
+        __m256i b = _mm256_loadu_si256((const __m256i*)(p + i + 8));
+        s0 = _mm256_add_epi64(s0,
+            _mm256_cvtepi32_epi64(_mm256_castsi256_si128(a)));
+        s1 = _mm256_add_epi64(s1,
+            _mm256_cvtepi32_epi64(_mm256_extracti128_si256(a, 1)));
+        s2 = _mm256_add_epi64(s2,
+            _mm256_cvtepi32_epi64(_mm256_castsi256_si128(b)));
+        s3 = _mm256_add_epi64(s3,
+            _mm256_cvtepi32_epi64(_mm256_extracti128_si256(b, 1)));
+    }
+    long long lanes[4];
+    _mm256_storeu_si256((__m256i*)lanes,
+        _mm256_add_epi64(_mm256_add_epi64(s0, s1), _mm256_add_epi64(s2, s3)));
+    return (lanes[0] + lanes[1]) + (lanes[2] + lanes[3])
+        + _da_sum_int_scalar(p + i, n - i);
+}
+
+DA_AVX2_TARGET
+static double _da_sum_float_avx2(const float* p, size_t n)
+{
+    __m256d s0 = _mm256_setzero_pd(), s1 = s0, s2 = s0, s3 = s0;
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16)
+    {
+        __m256 a = _mm256_loadu_ps(p + i);
+        __m256 b = _mm256_loadu_ps(p + i + 8);
+        s0 = _mm256_add_pd(s0, _mm256_cvtps_pd(_mm256_castps256_ps128(a)));
+        s1 = _mm256_add_pd(s1, _mm256_cvtps_pd(_mm256_extractf128_ps(a, 1)));
+        s2 = _mm256_add_pd(s2, _mm256_cvtps_pd(_mm256_castps256_ps128(b)));
+        s3 = _mm256_add_pd(s3, _mm256_cvtps_pd(_mm256_extractf128_ps(b, 1)));
+    }
+    double lanes[4];
+    _mm256_storeu_pd(lanes,
+        _mm256_add_pd(_mm256_add_pd(s0, s1), _mm256_add_pd(s2, s3)));
+    return ((lanes[0] + lanes[1]) + (lanes[2] + lanes[3]))
+        + _da_sum_float_scalar(p + i, n - i);
+}
+
+DA_AVX2_TARGET
+static double _da_sum_double_avx2(const double* p, size_t n)
+{
+    __m256d s0 = _mm256_setzero_pd(), s1 = s0, s2 = s0, s3 = s0;
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16)
+    {
+        s0 = _mm256_add_pd(s0, _mm256_loadu_pd(p + i));
+        s1 = _mm256_add_pd(s1, _mm256_loadu_pd(p + i + 4));
+        s2 = _mm256_add_pd(s2, _mm256_loadu_pd(p + i + 8));
+        s3 = _mm256_add_pd(s3, _mm256_loadu_pd(p + i + 12));
+    }
+    double lanes[4];
+    _mm256_storeu_pd(lanes,
+        _mm256_add_pd(_mm256_add_pd(s0, s1), _mm256_add_pd(s2, s3)));
+    return ((lanes[0] + lanes[1]) + (lanes[2] + lanes[3]))
+        + _da_sum_double_scalar(p + i, n - i);
+}
+
+DA_AVX2_TARGET
+static bool _da_minmax_int_avx2(const int* p, size_t n, int* min, int* max)
+{
+    __m256i lo0 = _mm256_set1_epi32(INT_MAX), lo1 = lo0;
+    __m256i hi0 = _mm256_set1_epi32(INT_MIN), hi1 = hi0;
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16)
+    {
+        __m256i a = _mm256_loadu_si256((const __m256i*)(p + i));
+        __m256i b = _mm256_loadu_si256((const __m256i*)(p + i + 8));
+        lo0 = _mm256_min_epi32(lo0, a);
+        lo1 = _mm256_min_epi32(lo1, b);
+        hi0 = _mm256_max_epi32(hi0, a);
+        hi1 = _mm256_max_epi32(hi1, b);
+    }
+    int lo[8], hi[8];
+    _mm256_storeu_si256((__m256i*)lo, _mm256_min_epi32(lo0, lo1));
+    _mm256_storeu_si256((__m256i*)hi, _mm256_max_epi32(hi0, hi1));
+    _da_minmax_int_scalar(p + i, n - i, min, max);
+    for (size_t k = 0; k < 8; ++k)
+    {
+        *min = lo[k] < *min ? lo[k] : *min;
+        *max = hi[k] > *max ? hi[k] : *max;
+    }
+    return n > 0;
+}
+
+// The second operand of _mm256_min_ps and _mm256_max_ps is returned when the
+// first is NaN, so NaN elements are skipped like in the scalar kernel.
+DA_AVX2_TARGET
+static bool _da_minmax_float_avx2(const float* p, size_t n, float* min,
+    float* max)
+{
+    __m256 lo0 = _mm256_set1_ps(INFINITY), lo1 = lo0;
+    __m256 hi0 = _mm256_set1_ps(-INFINITY), hi1 = hi0;
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16)
+    {
+        __m256 a = _mm256_loadu_ps(p + i);
+        __m256 b = _mm256_loadu_ps(p + i + 8);
+        lo0 = _mm256_min_ps(a, lo0);
+        lo1 = _mm256_min_ps(b, lo1);
+        hi0 = _mm256_max_ps(a, hi0);
+        hi1 = _mm256_max_ps(b, hi1);
+    }
+    float lo[8], hi[8];
+    _mm256_storeu_ps(lo, _mm256_min_ps(lo0, lo1));
+    _mm256_storeu_ps(hi, _mm256_max_ps(hi0, hi1));
+    _da_minmax_float_scalar(p + i, n - i, min, max);
+    for (size_t k = 0; k < 8; ++k)
+    {
+        *min = lo[k] < *min ? lo[k] : *min;
+        *max = hi[k] > *max ? hi[k] : *max;
+    }
+    return *min <= *max;
+}
+
+DA_AVX2_TARGET
+static bool _da_minmax_double_avx2(const double* p, size_t n, double* min,
+    double* max)
+{
+    __m256d lo0 = _mm256_set1_pd(INFINITY), lo1 = lo0;
+    __m256d hi0 = _mm256_set1_pd(-INFINITY), hi1 = hi0;
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8)
+    {
+        __m256d a = _mm256_loadu_pd(p + i);
+        __m256d b = _mm256_loadu_pd(p + i + 4);
+        lo0 = _mm256_min_pd(a, lo0);
+        lo1 = _mm256_min_pd(b, lo1);
+        hi0 = _mm256_max_pd(a, hi0);
+        hi1 = _mm256_max_pd(b, hi1);
+    }
+    double lo[4], hi[4];
+    _mm256_storeu_pd(lo, _mm256_min_pd(lo0, lo1));
+    _mm256_storeu_pd(hi, _mm256_max_pd(hi0, hi1));
+    _da_minmax_double_scalar(p + i, n - i, min, max);
+    for (size_t k = 0; k < 4; ++k)
+    {
+        *min = lo[k] < *min ? lo[k] : *min;
+        *max = hi[k] > *max ? hi[k] : *max;
+    }
+    return *min <= *max;
+}
+
+// Prefix sums of eight (or four) elements are formed in registers by adding
+// shifted copies within each 128 bit lane and then carrying the total of the
+// low lane into the high lane. The running total is broadcast from the last
+// element.
+DA_AVX2_TARGET
+static void _da_prefix_sum_int_avx2(int* p, size_t n, int offset)
+{
+    const __m256i low_last = _mm256_set1_epi32(3);
+    const __m256i last = _mm256_set1_epi32(7);
+    __m256i sum = _mm256_set1_epi32(offset);
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8)
+    {
+        __m256i x = _mm256_loadu_si256((const __m256i*)(p + i));
+        x = _mm256_add_epi32(x, _mm256_slli_si256(x, 4));
+        x = _mm256_add_epi32(x, _mm256_slli_si256(x, 8));
+        x = _mm256_add_epi32(x, _mm256_blend_epi32(_mm256_setzero_si256(),
+            _mm256_permutevar8x32_epi32(x, low_last), 0xF0));
+        x = _mm256_add_epi32(x, sum);
+        _mm256_storeu_si256((__m256i*)(p + i), x);
+        sum = _mm256_permutevar8x32_epi32(x, last);
+    }
+    _da_prefix_sum_int_scalar(p + i, n - i,
+        _mm_cvtsi128_si32(_mm256_castsi256_si128(sum)));
+}
+
+DA_AVX2_TARGET
+static void _da_prefix_sum_float_avx2(float* p, size_t n, float offset)
+{
+    const __m256i low_last = _mm256_set1_epi32(3);
+    const __m256i last = _mm256_set1_epi32(7);
+    __m256 sum = _mm256_set1_ps(offset);
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8)
+    {
+        __m256 x = _mm256_loadu_ps(p + i);
+        x = _mm256_add_ps(x, _mm256_castsi256_ps(
+            _mm256_slli_si256(_mm256_castps_si256(x), 4)));
+        x = _mm256_add_ps(x, _mm256_castsi256_ps(
+            _mm256_slli_si256(_mm256_castps_si256(x), 8)));
+        x = _mm256_add_ps(x, _mm256_blend_ps(_mm256_setzero_ps(),
+            _mm256_permutevar8x32_ps(x, low_last), 0xF0));
+        x = _mm256_add_ps(x, sum);
+        _mm256_storeu_ps(p + i, x);
+        sum = _mm256_permutevar8x32_ps(x, last);
+    }
+    _da_prefix_sum_float_scalar(p + i, n - i,
+        _mm_cvtss_f32(_mm256_castps256_ps128(sum)));
+}
+
+DA_AVX2_TARGET
+static void _da_prefix_sum_double_avx2(double* p, size_t n, double offset)
+{
+    __m256d sum = _mm256_set1_pd(offset);
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4)
+    {
+        __m256d x = _mm256_loadu_pd(p + i);
+        x = _mm256_add_pd(x, _mm256_castsi256_pd(
+            _mm256_slli_si256(_mm256_castpd_si256(x), 8)));
+        x = _mm256_add_pd(x, _mm256_blend_pd(_mm256_setzero_pd(),
+            _mm256_permute4x64_pd(x, 0x55), 0xC));
+        x = _mm256_add_pd(x, sum);
+        _mm256_storeu_pd(p + i, x);
+        sum = _mm256_permute4x64_pd(x, 0xFF);
+    }
+    _da_prefix_sum_double_scalar(p + i, n - i,
+        _mm_cvtsd_f64(_mm256_castpd256_pd128(sum)));
+}
+#endif // DA_AVX2_VARIANTS
+
+// Kernel dispatch, argmin/argmax, and the parallel block reductions are the
+// same for every element type.
+#define DA_NUMERIC_DEFINE(T, S, SUM_T)                                         \
+static SUM_T _da_sum_##S(const T* p, size_t n)                                 \
+{                                                                              \
+    DA_NUMERIC_AVX2(return _da_sum_##S##_avx2(p, n));                          \
+    return _da_sum_##S##_scalar(p, n);                                         \
+}                                                                              \
+                                                                               \
+static bool _da_minmax_##S(const T* p, size_t n, T* min, T* max)               \
+{                                                                              \
+    DA_NUMERIC_AVX2(return _da_minmax_##S##_avx2(p, n, min, max));             \
+    return _da_minmax_##S##_scalar(p, n, min, max);                            \
+}                                                                              \
+                                                                               \
+static void _da_prefix_sum_##S(T* p, size_t n, T offset)                       \
+{                                                                              \
+    DA_NUMERIC_AVX2(_da_prefix_sum_##S##_avx2(p, n, offset); return);          \
+    _da_prefix_sum_##S##_scalar(p, n, offset);                                 \
+}                                                                              \
+                                                                               \
+/* Index of the first smallest, or largest if `max`, element of `p` that is */ \
+/* not NaN. Returns `n` if there is no such element.                        */ \
+static size_t _da_arg_##S(const T* p, size_t n, bool max)                      \
+{                                                                              \
+    size_t best_block = n;                                                     \
+    T best = 0;                                                                \
+    for (size_t b = 0; b < n; b += DA_ARG_BLOCK)                               \
+    {                                                                          \
+        T lo, hi;                                                              \
+        if (!_da_minmax_##S(p + b, n - b < DA_ARG_BLOCK ? n - b                \
+            : DA_ARG_BLOCK, &lo, &hi))                                         \
+        {                                                                      \
+            continue;                                                          \
+        }                                                                      \
+        T value = max ? hi : lo;                                               \
+        if (best_block == n || (max ? value > best : value < best))            \
+        {                                                                      \
+            best = value;                                                      \
+            best_block = b;                                                    \
+        }                                                                      \
+    }                                                                          \
+    if (best_block == n)                                                       \
+        return n;                                                              \
+    size_t i = best_block;                                                     \
+    while (p[i] != best)                                                       \
+        ++i;                                                                   \
+    return i;                                                                  \
+}                                                                              \
+                                                                               \
+struct _da_minmax_##S                                                          \
+{                                                                              \
+    T min, max;                                                                \
+    bool found;                                                                \
+};                                                                             \
+                                                                               \
+static void _da_sum_##S##_blocks(size_t begin, size_t end, void* ctx)          \
+{                                                                              \
+    struct _da_reduce_job* job = ctx;                                          \
+    for (size_t b = begin; b < end; ++b)                                       \
+    {                                                                          \
+        ((SUM_T*)job->partials)[b] = _da_sum_##S((T*)job->base                 \
+            + b*DA_REDUCE_BLOCK, _da_reduce_block_length(job, b));             \
+    }                                                                          \
+}                                                                              \
+                                                                               \
+static void _da_minmax_##S##_blocks(size_t begin, size_t end, void* ctx)       \
+{                                                                              \
+    struct _da_reduce_job* job = ctx;                                          \
+    for (size_t b = begin; b < end; ++b)                                       \
+    {                                                                          \
+        struct _da_minmax_##S* partial =                                       \
+            (struct _da_minmax_##S*)job->partials + b;                         \
+        partial->found = _da_minmax_##S((T*)job->base + b*DA_REDUCE_BLOCK,     \
+            _da_reduce_block_length(job, b), &partial->min, &partial->max);    \
+    }                                                                          \
+}                                                                              \
+                                                                               \
+static void _da_arg_##S##_blocks(size_t begin, size_t end, void* ctx)          \
+{                                                                              \
+    struct _da_reduce_job* job = ctx;                                          \
+    for (size_t b = begin; b < end; ++b)                                       \
+    {                                                                          \
+        size_t length = _da_reduce_block_length(job, b);                       \
+        size_t i = _da_arg_##S((T*)job->base + b*DA_REDUCE_BLOCK, length,      \
+            job->max);                                                         \
+        ((size_t*)job->partials)[b] = i == length                              \
+            ? job->n : b*DA_REDUCE_BLOCK + i;                                  \
+    }                                                                          \
+}                                                                              \
+                                                                               \
+static void _da_prefix_sum_##S##_blocks(size_t begin, size_t end, void* ctx)   \
+{                                                                              \
+    struct _da_reduce_job* job = ctx;                                          \
+    for (size_t b = begin; b < end; ++b)                                       \
+    {                                                                          \
+        _da_prefix_sum_##S((T*)job->base + b*DA_REDUCE_BLOCK,                  \
+            _da_reduce_block_length(job, b), (T)((SUM_T*)job->partials)[b]);   \
+    }                                                                          \
+}                                                                              \
+                                                                               \
+static SUM_T _da_sum_##S##_darray(const T* darr)                               \
+{                                                                              \
+    struct _da_reduce_job job = {(void*)darr, da_length(darr), NULL, false};   \
+    size_t nblocks = _da_reduce_blocks(&job, sizeof(T), sizeof(SUM_T),         \
+        _da_sum_##S##_blocks);                                                 \
+    if (nblocks == 0)                                                          \
+        return _da_sum_##S(darr, job.n);                                       \
+    SUM_T sum = 0;                                                             \
+    for (size_t b = 0; b < nblocks; ++b)                                       \
+        sum += ((SUM_T*)job.partials)[b];                                      \
+    free(job.partials);                                                        \
+    return sum;                                                                \
+}                                                                              \
+                                                                               \
+static bool _da_minmax_##S##_darray(const T* darr, T* min, T* max)             \
+{                                                                              \
+    struct _da_reduce_job job = {(void*)darr, da_length(darr), NULL, false};   \
+    size_t nblocks = _da_reduce_blocks(&job, sizeof(T),                        \
+        sizeof(struct _da_minmax_##S), _da_minmax_##S##_blocks);               \
+    struct _da_minmax_##S* partials = job.partials;                            \
+    bool found = false;                                                        \
+    if (nblocks == 0)                                                          \
+    {                                                                          \
+        T lo, hi;                                                              \
+        found = _da_minmax_##S(darr, job.n, &lo, &hi);                         \
+        if (found)                                                             \
+        {                                                                      \
+            *min = lo;                                                         \
+            *max = hi;                                                         \
+        }                                                                      \
+        return found;                                                          \
+    }                                                                          \
+    for (size_t b = 0; b < nblocks; ++b)                                       \
+    {                                                                          \
+        if (!partials[b].found)                                                \
+            continue;                                                          \
+        if (!found || partials[b].min < *min)                                  \
+            *min = partials[b].min;                                            \
+        if (!found || partials[b].max > *max)                                  \
+            *max = partials[b].max;                                            \
+        found = true;                                                          \
+    }                                                                          \
+    free(partials);                                                            \
+    return found;                                                              \
+}                                                                              \
+                                                                               \
+static size_t _da_arg_##S##_darray(const T* darr, bool max)                    \
+{                                                                              \
+    struct _da_reduce_job job = {(void*)darr, da_length(darr), NULL, max};     \
+    size_t nblocks = _da_reduce_blocks(&job, sizeof(T), sizeof(size_t),        \
+        _da_arg_##S##_blocks);                                                 \
+    if (nblocks == 0)                                                          \
+        return _da_arg_##S(darr, job.n, max);                                  \
+    size_t* partials = job.partials;                                           \
+    size_t best = job.n;                                                       \
+    for (size_t b = 0; b < nblocks; ++b)                                       \
+    {                                                                          \
+        size_t i = partials[b];                                                \
+        if (i != job.n && (best == job.n                                       \
+            || (max ? darr[i] > darr[best] : darr[i] < darr[best])))           \
+        {                                                                      \
+            best = i;                                                          \
+        }                                                                      \
+    }                                                                          \
+    free(partials);                                                            \
+    return best;                                                               \
+}                                                                              \
+                                                                               \
+/* Large darrays are summed block by block first. The exclusive prefix sums */ \
+/* of the block totals are then the offsets the blocks are scanned from.    */ \
+static void _da_prefix_sum_##S##_darray(T* darr)                               \
+{                                                                              \
+    struct _da_reduce_job job = {darr, da_length(darr), NULL, false};          \
+    size_t nblocks = _da_reduce_blocks(&job, sizeof(T), sizeof(SUM_T),         \
+        _da_sum_##S##_blocks);                                                 \
+    if (nblocks == 0)                                                          \
+    {                                                                          \
+        _da_prefix_sum_##S(darr, job.n, 0);                                    \
+        return;                                                                \
+    }                                                                          \
+    SUM_T* offsets = job.partials;                                             \
+    SUM_T sum = 0;                                                             \
+    for (size_t b = 0; b < nblocks; ++b)                                       \
+    {                                                                          \
+        SUM_T total = offsets[b];                                              \
+        offsets[b] = sum;                                                      \
+        sum += total;                                                          \
+    }                                                                          \
+    if (!_da_parallel_ranges(nblocks, 1, _da_prefix_sum_##S##_blocks, &job))   \
+        _da_prefix_sum_##S##_blocks(0, nblocks, &job);                         \
+    free(offsets);                                                             \
+}
+
+#if DA_AVX2_VARIANTS
+#   define DA_NUMERIC_AVX2(stmt) if (_da_cpu_has_avx2()) { stmt; }
+#else
+#   define DA_NUMERIC_AVX2(stmt) /* nothing */
+#endif
+DA_NUMERIC_DEFINE(int, int, long long)
+DA_NUMERIC_DEFINE(float, float, double)
+DA_NUMERIC_DEFINE(double, double, double)
+#undef DA_NUMERIC_AVX2
+#undef DA_NUMERIC_DEFINE
+
+long long da_sum_int(const int* darr)
+{
+    return _da_sum_int_darray(darr);
+}
+
+double da_sum_float(const float* darr)
+{
+    return _da_sum_float_darray(darr);
+}
+
+double da_sum_double(const double* darr)
+{
+    return _da_sum_double_darray(darr);
+}
+
+bool da_minmax_int(const int* darr, int* min, int* max)
+{
+    return _da_minmax_int_darray(darr, min, max);
+}
+
+bool da_minmax_float(const float* darr, float* min, float* max)
+{
+    return _da_minmax_float_darray(darr, min, max);
+}
+
+bool da_minmax_double(const double* darr, double* min, double* max)
+{
+    return _da_minmax_double_darray(darr, min, max);
+}
+
+size_t da_argmin_int(const int* darr)
+{
+    return _da_arg_int_darray(darr, false);
+}
+
+size_t da_argmin_float(const float* darr)
+{
+    return _da_arg_float_darray(darr, false);
+}
+
+size_t da_argmin_double(const double* darr)
+{
+    return _da_arg_double_darray(darr, false);
+}
+
+size_t da_argmax_int(const int* darr)
+{
+    return _da_arg_int_darray(darr, true);
+}
+
+size_t da_argmax_float(const float* darr)
+{
+    return _da_arg_float_darray(darr, true);
+}
+
+size_t da_argmax_double(const double* darr)
+{
+    return _da_arg_double_darray(darr, true);
+}
+
+void da_prefix_sum_int(int* darr)
+{
+    _da_invalidate_content_cache(darr);
+    _da_prefix_sum_int_darray(darr);
+}
+
+void da_prefix_sum_float(float* darr)
+{
+    _da_invalidate_content_cache(darr);
+    _da_prefix_sum_float_darray(darr);
+}
+
+void da_prefix_sum_double(double* darr)
+{
+    _da_invalidate_content_cache(darr);
+    _da_prefix_sum_double_darray(darr);
+}
+
+///////////////////////////// STRUCTURE OF ARRAYS //////////////////////////////
+// Each column of a da_soa is a darray living inside the da_soa's allocation,
+// with its data starting on a cache line. The length and capacity stored in
+// the column headers are kept in step with the da_soa header.
+#define DA_SOA_COLUMN_ALIGN 64
+
+struct _da_soa
+{
+    size_t _ncols, _length, _capacity;
+    void* _cols[];
+};
+
+#define DA_SOA_HEAD_FROM_HANDLE(soa) \
+    ((struct _da_soa*)((char*)(soa) - offsetof(struct _da_soa, _cols)))
+
+static inline size_t _da_soa_align(size_t offset)
+{
+    return (offset + DA_SOA_COLUMN_ALIGN - 1)
+        & ~(size_t)(DA_SOA_COLUMN_ALIGN - 1);
+}
+
+// Offset of the first column header from the start of the allocation.
+static inline size_t _da_soa_columns_offset(size_t ncols)
+{
+    return sizeof(struct _da_soa) + ncols*sizeof(void*);
+}
+
+// Allocate an empty da_soa with room for `capacity` rows. Column `k` holds
+// elements of `sizes[k]` bytes, or of the size of the elements of `like[k]` if
+// `sizes` is NULL.
+static struct _da_soa* _da_soa_new(size_t ncols, const size_t* sizes,
+    void* const* like, size_t capacity)
+{
+    size_t total = _da_soa_columns_offset(ncols);
+    for (size_t k = 0; k < ncols; ++k)
+    {
+        size_t size = sizes != NULL ? sizes[k] : da_sizeof_elem(like[k]);
+        if (size > UINT32_MAX)
+            return NULL;
+        total = _da_soa_align(total + sizeof(struct _darray)) + capacity*size;
+    }
+    struct _da_soa* head = aligned_alloc(DA_SOA_COLUMN_ALIGN,
+        _da_soa_align(total));
+    if (head == NULL)
+        return NULL;
+    head->_ncols = ncols;
+    head->_length = 0;
+    head->_capacity = capacity;
+
+    char* column = (char*)head + _da_soa_columns_offset(ncols);
+    for (size_t k = 0; k < ncols; ++k)
+    {
+        column = (char*)head + _da_soa_align(
+            (size_t)(column - (char*)head) + sizeof(struct _darray));
+        struct _darray* darr = (struct _darray*)DA_P_HEAD_FROM_HANDLE(column);
+        darr->_elemsz =
+            (uint32_t)(sizes != NULL ? sizes[k] : da_sizeof_elem(like[k]));
+        darr->_refcount = 0;
+        darr->_length = 0;
+        darr->_capacity = capacity;
+        darr->_hash = 0;
+        head->_cols[k] = column;
+        column += capacity*darr->_elemsz;
+    }
+    return head;
+}
+
+static void _da_soa_set_length(struct _da_soa* head, size_t length)
+{
+    head->_length = length;
+    for (size_t k = 0; k < head->_ncols; ++k)
+    {
+        *DA_P_LENGTH_FROM_HANDLE(head->_cols[k]) = length;
+        _da_invalidate_content_cache(head->_cols[k]);
+    }
+}
+
+// Move the rows of `soa` that fit into a new allocation of `capacity` rows.
+static void** _da_soa_relocate(void** soa, size_t capacity)
+{
+    struct _da_soa* old = DA_SOA_HEAD_FROM_HANDLE(soa);
+    struct _da_soa* head = _da_soa_new(old->_ncols, NULL, soa, capacity);
+    if (head == NULL)
+        return NULL;
+
+    size_t length = old->_length < capacity ? old->_length : capacity;
+    for (size_t k = 0; k < head->_ncols; ++k)
+    {
+        memcpy(head->_cols[k], old->_cols[k],
+            length*da_sizeof_elem(head->_cols[k]));
+    }
+    _da_soa_set_length(head, length);
+    free(old);
+    return head->_cols;
+}
+
+void** da_soa_alloc(size_t nelem, size_t ncols, const size_t* sizes)
+{
+    struct _da_soa* head =
+        _da_soa_new(ncols, sizes, NULL, DA_NEW_CAPACITY_FROM_LENGTH(nelem));
+    if (head == NULL)
+        return NULL;
+    _da_soa_set_length(head, nelem);
+    return head->_cols;
+}
+
+void da_soa_free(void** soa)
+{
+    free(DA_SOA_HEAD_FROM_HANDLE(soa));
+}
+
+size_t da_soa_length(void* const* soa)
+{
+    return DA_SOA_HEAD_FROM_HANDLE(soa)->_length;
+}
+
+size_t da_soa_capacity(void* const* soa)
+{
+    return DA_SOA_HEAD_FROM_HANDLE(soa)->_capacity;
+}
+
+size_t da_soa_ncols(void* const* soa)
+{
+    return DA_SOA_HEAD_FROM_HANDLE(soa)->_ncols;
+}
+
+void** da_soa_resize(void** soa, size_t nelem)
+{
+    struct _da_soa* head = DA_SOA_HEAD_FROM_HANDLE(soa);
+    size_t new_capacity = DA_NEW_CAPACITY_FROM_LENGTH(nelem);
+    if (new_capacity != head->_capacity)
+    {
+        soa = _da_soa_relocate(soa, new_capacity);
+        if (soa == NULL)
+            return NULL;
+        head = DA_SOA_HEAD_FROM_HANDLE(soa);
+    }
+    _da_soa_set_length(head, nelem);
+    return soa;
+}
+
+void** da_soa_reserve(void** soa, size_t nelem)
+{
+    struct _da_soa* head = DA_SOA_HEAD_FROM_HANDLE(soa);
+    size_t min_capacity = head->_length + nelem;
+    if (head->_capacity >= min_capacity)
+        return soa;
+    return _da_soa_relocate(soa, DA_NEW_CAPACITY_FROM_LENGTH(min_capacity));
+}
+
+void** da_soa_insert(void** soa, size_t index, const void* const* values)
+{
+    soa = da_soa_reserve(soa, 1);
+    if (soa == NULL)
+        return NULL;
+    struct _da_soa* head = DA_SOA_HEAD_FROM_HANDLE(soa);
+    for (size_t k = 0; k < head->_ncols; ++k)
+    {
+        size_t size = da_sizeof_elem(soa[k]);
+        char* column = soa[k];
+        memmove(
+            column + size*(index+1),
+            column + size*index,
+            size*(head->_length-index)
+        );
+        if (values == NULL)
+            memset(column + size*index, 0, size);
+        else
+            memcpy(column + size*index, values[k], size);
+    }
+    _da_soa_set_length(head, head->_length + 1);
+    return soa;
+}
+
+void** da_soa_push(void** soa, const void* const* values)
+{
+    return da_soa_insert(soa, da_soa_length(soa), values);
+}
+
+void da_soa_remove(void** soa, size_t index)
+{
+    struct _da_soa* head = DA_SOA_HEAD_FROM_HANDLE(soa);
+    for (size_t k = 0; k < head->_ncols; ++k)
+    {
+        size_t size = da_sizeof_elem(soa[k]);
+        char* column = soa[k];
+        memmove(
+            column + size*index,
+            column + size*(index+1),
+            size*(head->_length-index-1)
+        );
+    }
+    _da_soa_set_length(head, head->_length - 1);
+}
+
+////////////////////////////// SEGMENTED DARRAYS ///////////////////////////////
+// A da_seg is a darray of segment pointers. Every segment is a darray with the
+// same power of two capacity, every segment but the last is full, and there is
+// always at least one segment.
+#define DA_SEG_DEFAULT_BYTES (1 << 16)
+
+static inline size_t _da_seg_shift(void* const* seg)
+{
+    size_t seg_nelem = da_capacity(seg[0]);
+#if defined(__GNUC__) || defined(__clang__)
+    return (size_t)__builtin_ctzll(seg_nelem);
+#else
+    size_t shift = 0;
+    while ((seg_nelem >> shift) != 1)
+        ++shift;
+    return shift;
+#endif
+}
+
+// Allocate an empty segment of `seg_nelem` elements each of size `size`.
+static void* _da_seg_new_segment(size_t seg_nelem, size_t size)
+{
+    void* segment = da_alloc_exact(seg_nelem, size);
+    if (segment != NULL)
+        *DA_P_LENGTH_FROM_HANDLE(segment) = 0;
+    return segment;
+}
+
+void** da_seg_alloc(size_t nelem, size_t size, size_t seg_nelem)
+{
+    if (seg_nelem == 0)
+        seg_nelem = size != 0 && size < DA_SEG_DEFAULT_BYTES
+            ? DA_SEG_DEFAULT_BYTES/size : 1;
+    size_t rounded = 1;
+    while (rounded < seg_nelem)
+        rounded <<= 1;
+    seg_nelem = rounded;
+
+    size_t nsegs = nelem == 0 ? 1 : (nelem + seg_nelem - 1) / seg_nelem;
+    void** seg = da_alloc(nsegs, sizeof(void*));
+    if (seg == NULL)
+        return NULL;
+    for (size_t s = 0; s < nsegs; ++s)
+    {
+        seg[s] = _da_seg_new_segment(seg_nelem, size);
+        if (seg[s] == NULL)
+        {
+            *DA_P_LENGTH_FROM_HANDLE(seg) = s;
+            da_seg_free(seg);
+            return NULL;
+        }
+        *DA_P_LENGTH_FROM_HANDLE(seg[s]) =
+            s < nsegs - 1 ? seg_nelem : nelem - s*seg_nelem;
+    }
+    return seg;
+}
+
+void da_seg_free(void** seg)
+{
+    for (size_t s = 0; s < da_length(seg); ++s)
+        da_free(seg[s]);
+    da_free(seg);
+}
+
+size_t da_seg_length(void* const* seg)
+{
+    size_t last = da_length(seg) - 1;
+    return (last << _da_seg_shift(seg)) + da_length(seg[last]);
+}
+
+void* da_seg_at(void* const* seg, size_t index)
+{
+    size_t shift = _da_seg_shift(seg);
+    size_t mask = ((size_t)1 << shift) - 1;
+    void* segment = seg[index >> shift];
+    return (char*)segment + (index & mask)*da_sizeof_elem(segment);
+}
+
+// Append a new empty segment to `seg`. Returns the new location of the segment
+// table, or NULL on allocation failure.
+static void** _da_seg_grow(void** seg)
+{
+    void* last = seg[da_length(seg) - 1];
+    void* segment =
+        _da_seg_new_segment(da_capacity(last), da_sizeof_elem(last));
+    if (segment == NULL)
+        return NULL;
+    void** table = da_insert_arr(seg, da_length(seg), &segment, 1);
+    if (table == NULL)
+        da_free(segment);
+    return table;
+}
+
+void** da_seg_push(void** seg, const void* value)
+{
+    struct _darray* last = (struct _darray*)
+        DA_P_HEAD_FROM_HANDLE(seg[*DA_P_LENGTH_FROM_HANDLE(seg) - 1]);
+    if (last->_length == last->_capacity)
+    {
+        seg = _da_seg_grow(seg);
+        if (seg == NULL)
+            return NULL;
+        last = (struct _darray*)
+            DA_P_HEAD_FROM_HANDLE(seg[*DA_P_LENGTH_FROM_HANDLE(seg) - 1]);
+    }
+    // Copies of common element sizes are inlined.
+    char* dest = last->_data + last->_length*last->_elemsz;
+    switch (last->_elemsz)
+    {
+    case 4: memcpy(dest, value, 4); break;
+    case 8: memcpy(dest, value, 8); break;
+    default: memcpy(dest, value, last->_elemsz); break;
+    }
+    last->_length += 1;
+    last->_hash &= ~(DA_HASH_MASK | DA_FLAGS_CONTENT_MASK);
+    return seg;
+}
+
+void da_seg_pop(void** seg)
+{
+    void* last = seg[da_length(seg) - 1];
+    *DA_P_LENGTH_FROM_HANDLE(last) -= 1;
+    _da_invalidate_content_cache(last);
+    if (da_length(last) == 0 && da_length(seg) > 1)
+    {
+        da_free(last);
+        *DA_P_LENGTH_FROM_HANDLE(seg) -= 1;
+    }
+}
+
+void* da_flatten(void* const* seg)
+{
+    size_t size = da_sizeof_elem(seg[0]);
+    char* darr = da_alloc(da_seg_length(seg), size);
+    if (darr == NULL)
+        return NULL;
+    size_t offset = 0;
+    for (size_t s = 0; s < da_length(seg); ++s)
+    {
+        memcpy(darr + offset, seg[s], da_length(seg[s])*size);
+        offset += da_length(seg[s])*size;
+    }
+    return darr;
+}
+
+////////////////////////// DELTA COMPRESSED INTEGERS ///////////////////////////
+// Bit-packed integers are stored least significant bit first: value `i` of
+// width `w` occupies bits [i*w, (i+1)*w) of the byte string, counting from the
+// least significant bit of the first byte. Unpacking loads eight bytes at a
+// time, so packed buffers keep DA_PACK_SLACK zeroed bytes past their end.
+#define DA_PACK_SLACK 16
+
+static inline uint64_t _da_load_le64(const unsigned char* p)
+{
+    uint64_t value;
+    memcpy(&value, p, sizeof(value));
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    value = __builtin_bswap64(value);
+#endif
+    return value;
+}
+
+static inline uint64_t _da_width_mask(unsigned width)
+{
+    return width < 64 ? ((uint64_t)1 << width) - 1 : ~(uint64_t)0;
+}
+
+// Number of bits needed to hold every bit set in `bits`.
+static inline unsigned _da_bit_width(uint64_t bits)
+{
+    return bits == 0 ? 0 : 64 - (unsigned)__builtin_clzll(bits);
+}
+
+// Pack the `n` values of `src`, each less than 2^`width`, into `dest`, which
+// must hold (n*width + 7)/8 bytes.
+static void _da_pack_bits(const uint64_t* src, size_t n, unsigned width,
+    unsigned char* dest)
+{
+    uint64_t acc = 0;
+    unsigned nbits = 0;
+    for (size_t i = 0; i < n; ++i)
+    {
+        acc |= src[i] << nbits;
+        nbits += width;
+        if (nbits >= 64)
+        {
+            for (unsigned b = 0; b < 8; ++b)
+                *dest++ = (unsigned char)(acc >> 8*b);
+            nbits -= 64;
+            acc = nbits != 0 ? src[i] >> (width - nbits) : 0;
+        }
+    }
+    for (unsigned b = 0; 8*b < nbits; ++b)
+        *dest++ = (unsigned char)(acc >> 8*b);
+}
+
+static void _da_unpack_bits_scalar(const unsigned char* src, size_t first,
+    size_t n, unsigned width, uint64_t* dest)
+{
+    uint64_t mask = _da_width_mask(width);
+    size_t bit = first*width;
+    for (size_t i = 0; i < n; ++i, bit += width)
+    {
+        const unsigned char* p = src + bit/8;
+        unsigned shift = bit % 8;
+        uint64_t value = _da_load_le64(p) >> shift;
+        if (shift + width > 64)
+            value |= (uint64_t)p[8] << (64 - shift);
+        dest[i] = value & mask;
+    }
+}
+
+#if DA_AVX2_VARIANTS
+// Gather four values at a time. Only for widths of at most 57 bits, where
+// every value lies within the eight bytes starting at its first byte. Returns
+// the number of values unpacked, a multiple of four.
+DA_AVX2_TARGET
+static size_t _da_unpack_bits_avx2(const unsigned char* src, size_t first,
+    size_t n, unsigned width, uint64_t* dest)
+{
+    long long w = (long long)width;
+    __m256i mask = _mm256_set1_epi64x((long long)_da_width_mask(width));
+    __m256i bits = _mm256_add_epi64(_mm256_set1_epi64x((long long)first*w),
+        _mm256_setr_epi64x(0, w, 2*w, 3*w));
+    __m256i step = _mm256_set1_epi64x(4*w);
+    __m256i seven = _mm256_set1_epi64x(7);
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4)
+    {
+        __m256i words = _mm256_i64gather_epi64((const long long*)src,
+            _mm256_srli_epi64(bits, 3), 1);
+        __m256i values =
+            _mm256_srlv_epi64(words, _mm256_and_si256(bits, seven));
+        _mm256_storeu_si256((__m256i*)(dest + i),
+            _mm256_and_si256(values, mask));
+        bits = _mm256_add_epi64(bits, step);
+    }
+    return i;
+}
+#endif // DA_AVX2_VARIANTS
+
+// Unpack the `n` values starting at index `first` of the values of width
+// `width` packed in `src` into `dest`.
+static void _da_unpack_bits(const unsigned char* src, size_t first, size_t n,
+    unsigned width, uint64_t* dest)
+{
+    size_t i = 0;
+#if DA_AVX2_VARIANTS
+    if (width <= 57 && _da_cpu_has_avx2())
+        i = _da_unpack_bits_avx2(src, first, n, width, dest);
+#endif
+    _da_unpack_bits_scalar(src, first + i, n - i, width, dest + i);
+}
+
+void da_delta_init(struct da_delta* delta)
+{
+    delta->_length = 0;
+    delta->_bytes = NULL;
+    delta->_blocks = NULL;
+}
+
+void da_delta_free(struct da_delta* delta)
+{
+    if (delta->_bytes != NULL)
+        da_free(delta->_bytes);
+    if (delta->_blocks != NULL)
+        da_free(delta->_blocks);
+    da_delta_init(delta);
+}
+
+static size_t _da_delta_nblocks(const struct da_delta* delta)
+{
+    return delta->_length / DA_DELTA_BLOCK_SIZE;
+}
+
+// Pack the full block in `_tail` onto the end of `_bytes`. Returns false on
+// allocation failure, in which case `delta` is left untouched.
+static bool _da_delta_pack_tail(struct da_delta* delta)
+{
+    uint64_t diffs[DA_DELTA_BLOCK_SIZE - 1];
+    uint64_t bits = 0;
+    for (size_t i = 1; i < DA_DELTA_BLOCK_SIZE; ++i)
+    {
+        diffs[i-1] = delta->_tail[i] - delta->_tail[i-1];
+        bits |= diffs[i-1];
+    }
+    unsigned width = _da_bit_width(bits);
+    size_t nbytes = ((DA_DELTA_BLOCK_SIZE - 1)*width + 7)/8;
+
+    if (delta->_bytes == NULL)
+    {
+        delta->_bytes = da_alloc(0, sizeof(unsigned char));
+        if (delta->_bytes == NULL)
+            return false;
+    }
+    if (delta->_blocks == NULL)
+    {
+        delta->_blocks = da_alloc(0, sizeof(struct _da_delta_block));
+        if (delta->_blocks == NULL)
+            return false;
+    }
+    unsigned char* bytes = da_reserve(delta->_bytes, nbytes + DA_PACK_SLACK);
+    if (bytes == NULL)
+        return false;
+    delta->_bytes = bytes;
+    struct _da_delta_block block = {delta->_tail[0], da_length(bytes), width};
+    struct _da_delta_block* blocks = da_push(delta->_blocks, block);
+    if (blocks == NULL)
+        return false;
+    delta->_blocks = blocks;
+
+    memset(bytes + block.offset, 0, nbytes + DA_PACK_SLACK);
+    _da_pack_bits(diffs, DA_DELTA_BLOCK_SIZE - 1, width, bytes + block.offset);
+    *DA_P_LENGTH_FROM_HANDLE(bytes) += nbytes;
+    return true;
+}
+
+bool da_delta_push(struct da_delta* delta, uint64_t value)
+{
+    size_t i = delta->_length % DA_DELTA_BLOCK_SIZE;
+    delta->_tail[i] = value;
+    if (i == DA_DELTA_BLOCK_SIZE - 1 && !_da_delta_pack_tail(delta))
+        return false;
+    delta->_length += 1;
+    return true;
+}
+
+size_t da_delta_length(const struct da_delta* delta)
+{
+    return delta->_length;
+}
+
+size_t da_delta_footprint(const struct da_delta* delta)
+{
+    size_t nbytes = sizeof(*delta);
+    if (delta->_bytes != NULL)
+        nbytes += sizeof(struct _darray) + da_capacity(delta->_bytes);
+    if (delta->_blocks != NULL)
+        nbytes += sizeof(struct _darray)
+            + da_capacity(delta->_blocks)*sizeof(struct _da_delta_block);
+    return nbytes;
+}
+
+// Decode the packed block `b` of `delta` into `dest`.
+static void _da_delta_decode_block(const struct da_delta* delta, size_t b,
+    uint64_t* dest)
+{
+    const struct _da_delta_block* block = &delta->_blocks[b];
+    _da_unpack_bits(delta->_bytes + block->offset, 0, DA_DELTA_BLOCK_SIZE - 1,
+        block->width, dest + 1);
+    uint64_t value = block->first;
+    dest[0] = value;
+    for (size_t i = 1; i < DA_DELTA_BLOCK_SIZE; ++i)
+    {
+        value += dest[i];
+        dest[i] = value;
+    }
+}
+
+uint64_t* da_delta_decode(const struct da_delta* delta)
+{
+    uint64_t* values = da_alloc_exact(delta->_length, sizeof(uint64_t));
+    if (values == NULL)
+        return NULL;
+    size_t nblocks = _da_delta_nblocks(delta);
+    for (size_t b = 0; b < nblocks; ++b)
+        _da_delta_decode_block(delta, b, values + b*DA_DELTA_BLOCK_SIZE);
+    memcpy(values + nblocks*DA_DELTA_BLOCK_SIZE, delta->_tail,
+        delta->_length % DA_DELTA_BLOCK_SIZE * sizeof(uint64_t));
+    return values;
+}
+
+size_t da_delta_lower_bound(const struct da_delta* delta, uint64_t value)
+{
+    // Find the number of blocks whose first value is less than `value`. The
+    // result is in the last of them or starts the block after it.
+    size_t nblocks = _da_delta_nblocks(delta);
+    size_t lo = 0;
+    size_t hi = nblocks;
+    while (lo < hi)
+    {
+        size_t mid = lo + (hi - lo)/2;
+        if (delta->_blocks[mid].first < value)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    if (lo > 0)
+    {
+        // Decode one difference at a time and stop at the first match.
+        const struct _da_delta_block* block = &delta->_blocks[lo - 1];
+        const unsigned char* src = delta->_bytes + block->offset;
+        uint64_t current = block->first;
+        uint64_t diff;
+        for (size_t i = 1; i < DA_DELTA_BLOCK_SIZE; ++i)
+        {
+            _da_unpack_bits_scalar(src, i - 1, 1, block->width, &diff);
+            current += diff;
+            if (current >= value)
+                return (lo - 1)*DA_DELTA_BLOCK_SIZE + i;
+        }
+    }
+    if (lo < nblocks)
+        return lo*DA_DELTA_BLOCK_SIZE;
+    size_t i = 0;
+    while (i < delta->_length % DA_DELTA_BLOCK_SIZE && delta->_tail[i] < value)
+        ++i;
+    return nblocks*DA_DELTA_BLOCK_SIZE + i;
+}
+
+void da_delta_iter_init(struct da_delta_iter* iter,
+    const struct da_delta* delta, size_t index)
+{
+    iter->_delta = delta;
+    iter->_index = index;
+    iter->_block = SIZE_MAX;
+}
+
+void da_delta_iter_seek(struct da_delta_iter* iter, size_t index)
+{
+    iter->_index = index;
+}
+
+size_t da_delta_iter_next_block(struct da_delta_iter* iter,
+    const uint64_t** values)
+{
+    const struct da_delta* delta = iter->_delta;
+    if (iter->_index >= delta->_length)
+        return 0;
+    size_t b = iter->_index / DA_DELTA_BLOCK_SIZE;
+    size_t i = iter->_index % DA_DELTA_BLOCK_SIZE;
+    size_t n;
+    if (b == _da_delta_nblocks(delta))
+    {
+        *values = delta->_tail + i;
+        n = delta->_length % DA_DELTA_BLOCK_SIZE - i;
+    }
+    else
+    {
+        if (b != iter->_block)
+        {
+            _da_delta_decode_block(delta, b, iter->_values);
+            iter->_block = b;
+        }
+        *values = iter->_values + i;
+        n = DA_DELTA_BLOCK_SIZE - i;
+    }
+    iter->_index += n;
+    return n;
+}
+
+bool da_delta_iter_next(struct da_delta_iter* iter, uint64_t* value)
+{
+    const struct da_delta* delta = iter->_delta;
+    if (iter->_index >= delta->_length)
+        return false;
+    size_t b = iter->_index / DA_DELTA_BLOCK_SIZE;
+    size_t i = iter->_index % DA_DELTA_BLOCK_SIZE;
+    if (b == _da_delta_nblocks(delta))
+    {
+        *value = delta->_tail[i];
+    }
+    else
+    {
+        if (b != iter->_block)
+        {
+            _da_delta_decode_block(delta, b, iter->_values);
+            iter->_block = b;
+        }
+        *value = iter->_values[i];
+    }
+    iter->_index += 1;
+    return true;
+}
+
+///////////////////////////// BIT-PACKED INTEGERS //////////////////////////////
+// Widening repacks this many values at a time. Chunks start at multiples of
+// eight values and so on whole bytes at any width.
+#define DA_PACK_CHUNK 256
+
+static inline void _da_store_le64(unsigned char* p, uint64_t value)
+{
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    value = __builtin_bswap64(value);
+#endif
+    memcpy(p, &value, sizeof(value));
+}
+
+static inline size_t _da_packed_nbytes(size_t n, unsigned width)
+{
+    return (n*width + 7)/8;
+}
+
+// Make room for `nbytes` bytes of packed values plus the slack read past them
+// by unpacking. Bytes past the packed values are kept zeroed.
+static bool _da_packed_reserve(struct da_packed* packed, size_t nbytes)
+{
+    unsigned char* bytes = packed->_bytes;
+    if (bytes == NULL)
+    {
+        bytes = da_alloc(0, sizeof(unsigned char));
+        if (bytes == NULL)
+            return false;
+        memset(bytes, 0, da_capacity(bytes));
+        packed->_bytes = bytes;
+    }
+    size_t capacity = da_capacity(bytes);
+    if (capacity >= nbytes + DA_PACK_SLACK)
+        return true;
+    bytes = da_reserve(bytes, nbytes + DA_PACK_SLACK - da_length(bytes));
+    if (bytes == NULL)
+        return false;
+    memset(bytes + capacity, 0, da_capacity(bytes) - capacity);
+    packed->_bytes = bytes;
+    return true;
+}
+
+static void _da_packed_store(unsigned char* bytes, size_t index,
+    unsigned width, uint64_t value)
+{
+    size_t bit = index*width;
+    unsigned char* p = bytes + bit/8;
+    unsigned shift = bit % 8;
+    uint64_t mask = _da_width_mask(width);
+    _da_store_le64(p, (_da_load_le64(p) & ~(mask << shift)) | value << shift);
+    if (shift + width > 64)
+    {
+        unsigned char high = (unsigned char)((1u << (shift + width - 64)) - 1);
+        p[8] = (unsigned char)((p[8] & ~high) | value >> (64 - shift));
+    }
+}
+
+void da_packed_init(struct da_packed* packed, unsigned width)
+{
+    packed->_length = 0;
+    packed->_width = width;
+    packed->_bytes = NULL;
+}
+
+void da_packed_free(struct da_packed* packed)
+{
+    if (packed->_bytes != NULL)
+        da_free(packed->_bytes);
+    da_packed_init(packed, packed->_width);
+}
+
+size_t da_packed_length(const struct da_packed* packed)
+{
+    return packed->_length;
+}
+
+unsigned da_packed_width(const struct da_packed* packed)
+{
+    return packed->_width;
+}
+
+size_t da_packed_footprint(const struct da_packed* packed)
+{
+    size_t nbytes = sizeof(*packed);
+    if (packed->_bytes != NULL)
+        nbytes += sizeof(struct _darray) + da_capacity(packed->_bytes);
+    return nbytes;
+}
+
+uint64_t da_packed_get(const struct da_packed* packed, size_t index)
+{
+    uint64_t value;
+    _da_unpack_bits_scalar(packed->_bytes, index, 1, packed->_width, &value);
+    return value;
+}
+
+bool da_packed_set(struct da_packed* packed, size_t index, uint64_t value)
+{
+    if (_da_bit_width(value) > packed->_width
+        && !da_packed_widen(packed, _da_bit_width(value)))
+        return false;
+    _da_packed_store(packed->_bytes, index, packed->_width, value);
+    return true;
+}
+
+bool da_packed_push(struct da_packed* packed, uint64_t value)
+{
+    if (_da_bit_width(value) > packed->_width
+        && !da_packed_widen(packed, _da_bit_width(value)))
+        return false;
+    size_t nbytes = _da_packed_nbytes(packed->_length + 1, packed->_width);
+    if (!_da_packed_reserve(packed, nbytes))
+        return false;
+    _da_packed_store(packed->_bytes, packed->_length, packed->_width, value);
+    *DA_P_LENGTH_FROM_HANDLE(packed->_bytes) = nbytes;
+    packed->_length += 1;
+    return true;
+}
+
+bool da_packed_widen(struct da_packed* packed, unsigned width)
+{
+    if (width <= packed->_width)
+        return true;
+    size_t n = packed->_length;
+    if (n == 0)
+    {
+        packed->_width = width;
+        return true;
+    }
+    if (!_da_packed_reserve(packed, _da_packed_nbytes(n, width)))
+        return false;
+    // Repack from the back. Every value is at least as far into the buffer
+    // in the new width as in the old one, so a chunk is only overwritten
+    // after it has been unpacked.
+    unsigned char* bytes = packed->_bytes;
+    uint64_t values[DA_PACK_CHUNK];
+    size_t begin = (n - 1) / DA_PACK_CHUNK * DA_PACK_CHUNK;
+    while (true)
+    {
+        size_t count = n - begin < DA_PACK_CHUNK ? n - begin : DA_PACK_CHUNK;
+        _da_unpack_bits(bytes, begin, count, packed->_width, values);
+        _da_pack_bits(values, count, width, bytes + begin/8*width);
+        if (begin == 0)
+            break;
+        begin -= DA_PACK_CHUNK;
+    }
+    *DA_P_LENGTH_FROM_HANDLE(bytes) = _da_packed_nbytes(n, width);
+    packed->_width = width;
+    return true;
+}
+
+uint64_t* da_packed_unpack(const struct da_packed* packed)
+{
+    uint64_t* values = da_alloc_exact(packed->_length, sizeof(uint64_t));
+    if (values == NULL)
+        return NULL;
+    if (packed->_length != 0)
+        _da_unpack_bits(packed->_bytes, 0, packed->_length, packed->_width,
+            values);
+    return values;
+}
+
+/////////////////////////////////// DSTRING ////////////////////////////////////
+#define DSTR_FORMAT_BUF_SIZE 256
+
+// Copy the first `len` characters of a shared dstring followed by formatted
+// output. The output is measured before copying, so on failure NULL is returned
+// and the reference to the shared dstring is kept.
+static darray(char) _dstr_unshare_vformat(darray(char) dstr, size_t len,
+    const char* format, va_list args)
+{
+    va_list copy;
+    va_copy(copy, args);
+    int n = vsnprintf(NULL, 0, format, copy);
+    va_end(copy);
+    if (n < 0)
+        return NULL;
+    size_t nelem = len + (size_t)n + 1;
+    dstr = _da_unshare_with(dstr, nelem, DA_NEW_CAPACITY_FROM_LENGTH(nelem));
+    if (dstr == NULL)
+        return NULL;
+    vsnprintf(dstr+len, n+1, format, args);
+    return dstr;
+}
+
+// Append formatted output to `dstr`. Output is written directly into the spare
+// capacity of `dstr`, so `vsnprintf` only runs a second time when the output
+// did not fit and the dstring had to grow.
+static darray(char) _dstr_append_vformat(darray(char) dstr, const char* format,
+    va_list args)
+{
+    if (DA_IS_SHARED(dstr))
+        return _dstr_unshare_vformat(dstr, dstr_length(dstr), format, args);
+    size_t len = dstr_length(dstr);
+    size_t avail = da_capacity(dstr) - len;
+
+    va_list copy;
+    va_copy(copy, args);
+    int n = vsnprintf(dstr+len, avail, format, copy);
+    va_end(copy);
+    if (n < 0)
+    {
+        dstr[len] = '\0';
+        return NULL;
+    }
+
+    if ((size_t)n >= avail)
+    {
+        dstr[len] = '\0';
+        dstr = da_reserve(dstr, n);
+        if (dstr == NULL)
+            return NULL;
+        vsnprintf(dstr+len, n+1, format, args);
+    }
+    *DA_P_LENGTH_FROM_HANDLE(dstr) += n;
+    _da_invalidate_content_cache(dstr);
+    return dstr;
+}
+
+darray(char) dstr_alloc_empty(void)
+{
+    char* dstr = da_alloc(1, sizeof(char));
+    if (dstr == NULL)
+        return NULL;
+    dstr[0] = '\0';
+    return dstr;
+}
+
+darray(char) dstr_alloc_from_cstr(const char* src)
+{
+    size_t src_len_with_nullterm = strlen(src)+1;
+    char* dstr = da_alloc(src_len_with_nullterm, sizeof(char));
+    if (dstr == NULL)
+        return NULL;
+    memcpy(dstr, src, src_len_with_nullterm);
+    return dstr;
+}
+
+darray(char) dstr_alloc_from_dstr(const darray(char) src)
+{
+    size_t src_len_with_nullterm = da_length(src);
+    char* dstr = da_alloc(src_len_with_nullterm, sizeof(char));
+    if (dstr == NULL)
+        return NULL;
+    memcpy(dstr, src, src_len_with_nullterm);
+    return dstr;
+}
+
+darray(char) dstr_alloc_from_format(const char* format, ...)
+{
+    va_list args;
+    va_start(args, format);
+
+    // Format into a stack buffer first so that short outputs only go through
+    // vsnprintf once and the dstring is allocated at its final size.
+    char buf[DSTR_FORMAT_BUF_SIZE];
+    va_list copy;
+    va_copy(copy, args);
+    int n = vsnprintf(buf, sizeof(buf), format, copy);
+    va_end(copy);
+    if (n < 0)
+    {
+        va_end(args);
+        return NULL;
+    }
+
+    size_t size = (size_t)n + 1 /* +1 for '\0' */;
+    char* dstr = da_alloc(size, sizeof(char));
+    if (dstr == NULL)
+    {
+        va_end(args);
+        return NULL;
+    }
+    if (size <= sizeof(buf))
+        memcpy(dstr, buf, size);
+    else
+        vsnprintf(dstr, size, format, args);
+
+    va_end(args);
+    return dstr;
+}
+
+void dstr_free(darray(char) dstr)
+{
+    da_free(dstr);
+}
+
+darray(char) dstr_reassign_empty(darray(char) allocated_dstr)
+{
+    // Reserving all of the room up front means da_concat cannot fail after a
+    // shared dstring has been released.
+    allocated_dstr = _da_reuse(allocated_dstr, 1);
+    if (allocated_dstr == NULL)
+        return NULL;
+    allocated_dstr = da_concat(allocated_dstr, "", 1);
+    return allocated_dstr;
+}
+
+darray(char) dstr_reassign_from_cstr(darray(char) allocated_dstr,
+    const char* src)
+{
+    size_t nelem = strlen(src)+1;
+    allocated_dstr = _da_reuse(allocated_dstr, nelem);
+    if (allocated_dstr == NULL)
+        return NULL;
+    allocated_dstr = da_concat(allocated_dstr, src, nelem);
+    return allocated_dstr;
+}
+
+darray(char) dstr_reassign_from_dstr(darray(char) allocated_dstr,
+    const darray(char) src)
+{
+    size_t nelem = da_length(src);
+    allocated_dstr = _da_reuse(allocated_dstr, nelem);
+    if (allocated_dstr == NULL)
+        return NULL;
+    allocated_dstr = da_concat(allocated_dstr, src, nelem);
+    return allocated_dstr;
+}
+
+darray(char) dstr_reassign_from_format(darray(char) allocated_dstr,
+    const char* format, ...)
+{
+    va_list args;
+    va_start(args, format);
+
+    if (DA_IS_SHARED(allocated_dstr))
+        allocated_dstr = _dstr_unshare_vformat(allocated_dstr, 0, format, args);
+    else
+    {
+        *DA_P_LENGTH_FROM_HANDLE(allocated_dstr) = 1;
+        allocated_dstr[0] = '\0';
+        _da_invalidate_content_cache(allocated_dstr);
+        allocated_dstr = _dstr_append_vformat(allocated_dstr, format, args);
+    }
+
+    va_end(args);
+    return allocated_dstr;
+}
+
+size_t dstr_length(const darray(char) dstr)
+{
+    // dstrings always have a null terminator so this should never underflow.
+    return da_length(dstr)-1;
+}
+
+darray(char) dstr_concat_cstr(darray(char) dest, const char* src)
+{
+    size_t dest_strlen = dstr_length(dest);
+    size_t src_strlen = strlen(src);
+    // `src` may point into `dest`, which can move when it is grown.
+    uintptr_t src_addr = (uintptr_t)src;
+    uintptr_t dest_addr = (uintptr_t)dest;
+    bool aliased = src_addr >= dest_addr && src_addr <= dest_addr + dest_strlen;
+    size_t offset = src_addr - dest_addr;
+    dest = da_reserve(dest, src_strlen);
+    if (dest == NULL)
+        return NULL;
+    if (aliased)
+        src = dest + offset;
+    memcpy(dest+dest_strlen, src, src_strlen);
+    dest[dest_strlen+src_strlen] = '\0';
+    *DA_P_LENGTH_FROM_HANDLE(dest) += src_strlen;
+    _da_invalidate_content_cache(dest);
+    return dest;
+}
+
+darray(char) dstr_concat_dstr(darray(char) dest, const darray(char) src)
+{
+    size_t dest_strlen = dstr_length(dest);
+    size_t src_strlen = dstr_length(src);
+    bool self = src == dest;
+    dest = da_reserve(dest, src_strlen);
+    if (dest == NULL)
+        return NULL;
+    if (self)
+        src = dest;
+    memcpy(dest+dest_strlen, src, src_strlen);
+    dest[dest_strlen+src_strlen] = '\0';
+    *DA_P_LENGTH_FROM_HANDLE(dest) += src_strlen;
+    _da_invalidate_content_cache(dest);
+    return dest;
+}
+
+darray(char) dstr_append_format(darray(char) dest, const char* format, ...)
+{
+    va_list args;
+    va_start(args, format);
+    dest = _dstr_append_vformat(dest, format, args);
+    va_end(args);
+    return dest;
+}
+
+// Copy `len` bytes without calling `memcpy` for short fragments. Fragments of
+// up to 16 bytes are copied with two possibly overlapping loads and stores.
+static inline void _dstr_copy_fragment(char* dest, const char* src, size_t len)
+{
+    if (len >= 8 && len <= 16)
+    {
+        uint64_t head, tail;
+        memcpy(&head, src, 8);
+        memcpy(&tail, src+len-8, 8);
+        memcpy(dest, &head, 8);
+        memcpy(dest+len-8, &tail, 8);
+    }
+    else if (len >= 4 && len < 8)
+    {
+        uint32_t head, tail;
+        memcpy(&head, src, 4);
+        memcpy(&tail, src+len-4, 4);
+        memcpy(dest, &head, 4);
+        memcpy(dest+len-4, &tail, 4);
+    }
+    else if (len < 4)
+    {
+        for (size_t i = 0; i < len; ++i)
+            dest[i] = src[i];
+    }
+    else
+    {
+        memcpy(dest, src, len);
+    }
+}
+
+// Lengths of the first parts are remembered between the sizing pass and the
+// copying pass of `dstr_join` so that `strlen` runs once per part.
+#define DSTR_JOIN_LENGTH_CACHE_SIZE 256
+
+darray(char) dstr_join(const char* const* parts, size_t nparts,
+    const char* sep)
+{
+    size_t lengths[DSTR_JOIN_LENGTH_CACHE_SIZE];
+    size_t sep_len = strlen(sep);
+    size_t total = nparts == 0 ? 0 : (nparts-1)*sep_len;
+    for (size_t i = 0; i < nparts; ++i)
+    {
+        size_t len = strlen(parts[i]);
+        if (i < DSTR_JOIN_LENGTH_CACHE_SIZE)
+            lengths[i] = len;
+        total += len;
+    }
+
+    char* dstr = da_alloc(total+1, sizeof(char));
+    if (dstr == NULL)
+        return NULL;
+    char* p = dstr;
+    for (size_t i = 0; i < nparts; ++i)
+    {
+        if (i != 0)
+        {
+            _dstr_copy_fragment(p, sep, sep_len);
+            p += sep_len;
+        }
+        size_t len = i < DSTR_JOIN_LENGTH_CACHE_SIZE ?
+            lengths[i] : strlen(parts[i]);
+        _dstr_copy_fragment(p, parts[i], len);
+        p += len;
+    }
+    *p = '\0';
+    return dstr;
+}
+
+void dstr_builder_init(struct dstr_builder* builder)
+{
+    builder->_pieces = NULL;
+    builder->_length = 0;
+}
+
+void dstr_builder_free(struct dstr_builder* builder)
+{
+    if (builder->_pieces != NULL)
+        da_free(builder->_pieces);
+    dstr_builder_init(builder);
+}
+
+void dstr_builder_clear(struct dstr_builder* builder)
+{
+    if (builder->_pieces != NULL)
+        *DA_P_LENGTH_FROM_HANDLE(builder->_pieces) = 0;
+    builder->_length = 0;
+}
+
+bool dstr_builder_append(struct dstr_builder* builder, const char* src,
+    size_t len)
+{
+    struct _dstr_builder_piece* pieces = builder->_pieces;
+    if (pieces == NULL)
+        pieces = da_alloc(0, sizeof(struct _dstr_builder_piece));
+    else
+        pieces = da_reserve(pieces, 1);
+    if (pieces == NULL)
+        return false;
+    size_t npieces = da_length(pieces);
+    pieces[npieces]._data = src;
+    pieces[npieces]._length = len;
+    *DA_P_LENGTH_FROM_HANDLE(pieces) = npieces + 1;
+    builder->_pieces = pieces;
+    builder->_length += len;
+    return true;
+}
+
+bool dstr_builder_append_cstr(struct dstr_builder* builder, const char* src)
+{
+    return dstr_builder_append(builder, src, strlen(src));
+}
+
+bool dstr_builder_append_dstr(struct dstr_builder* builder,
+    const darray(char) src)
+{
+    return dstr_builder_append(builder, src, dstr_length(src));
+}
+
+size_t dstr_builder_length(const struct dstr_builder* builder)
+{
+    return builder->_length;
+}
+
+darray(char) dstr_builder_build(const struct dstr_builder* builder)
+{
+    char* dstr = da_alloc(builder->_length+1, sizeof(char));
+    if (dstr == NULL)
+        return NULL;
+    char* p = dstr;
+    size_t npieces = builder->_pieces == NULL ? 0 : da_length(builder->_pieces);
+    for (size_t i = 0; i < npieces; ++i)
+    {
+        _dstr_copy_fragment(p, builder->_pieces[i]._data,
+            builder->_pieces[i]._length);
+        p += builder->_pieces[i]._length;
+    }
+    *p = '\0';
+    return dstr;
+}
+
+// Two character decimal representation of every number in [0, 99]. Digits are
+// generated two at a time from this table instead of one at a time with `%`.
+static const char _dstr_digit_pairs[201] =
+    "00010203040506070809101112131415161718192021222324252627282930313233343536"
+    "37383940414243444546474849505152535455565758596061626364656667686970717273"
+    "7475767778798081828384858687888990919293949596979899";
+
+static inline int _dstr_count_digits_u64(uint64_t n)
+{
+    int ndigits = 1;
+    for (;;)
+    {
+        if (n < 10) return ndigits;
+        if (n < 100) return ndigits + 1;
+        if (n < 1000) return ndigits + 2;
+        if (n < 10000) return ndigits + 3;
+        n /= 10000;
+        ndigits += 4;
+    }
+}
+
+// Write the `ndigits` decimal digits of `n` backwards ending at `end`.
+static inline void _dstr_write_u64(char* end, uint64_t n)
+{
+    while (n >= 100)
+    {
+        unsigned i = (unsigned)(n % 100) * 2;
+        n /= 100;
+        *--end = _dstr_digit_pairs[i+1];
+        *--end = _dstr_digit_pairs[i];
+    }
+    if (n >= 10)
+    {
+        *--end = _dstr_digit_pairs[n*2+1];
+        *--end = _dstr_digit_pairs[n*2];
+    }
+    else
+    {
+        *--end = (char)('0' + n);
+    }
+}
+
+static darray(char) _dstr_append_u64(darray(char) dest, uint64_t value,
+    bool negative)
+{
+    size_t len = dstr_length(dest);
+    int ndigits = _dstr_count_digits_u64(value);
+    dest = da_reserve(dest, ndigits + negative);
+    if (dest == NULL)
+        return NULL;
+    char* p = dest + len;
+    if (negative)
+        *p++ = '-';
+    _dstr_write_u64(p+ndigits, value);
+    p[ndigits] = '\0';
+    *DA_P_LENGTH_FROM_HANDLE(dest) += ndigits + negative;
+    _da_invalidate_content_cache(dest);
+    return dest;
+}
+
+darray(char) dstr_append_i64(darray(char) dest, int64_t value)
+{
+    // Negate in unsigned arithmetic so that INT64_MIN does not overflow.
+    if (value < 0)
+        return _dstr_append_u64(dest, -(uint64_t)value, true);
+    return _dstr_append_u64(dest, (uint64_t)value, false);
+}
+
+darray(char) dstr_append_u64(darray(char) dest, uint64_t value)
+{
+    return _dstr_append_u64(dest, value, false);
+}
+
+// Shortest round-trip double to string conversion using the Grisu2 algorithm
+// by Florian Loitsch, "Printing Floating-Point Numbers Quickly and Accurately
+// with Integers" (PLDI 2010). Grisu2 always produces digits that parse back to
+// the exact same double and produces the shortest such digits for all but a
+// small fraction of a percent of inputs.
+struct _dstr_diyfp
+{
+    uint64_t f;
+    int e;
+};
+
+#define DSTR_DP_SIGNIFICAND_SIZE 52
+#define DSTR_DP_EXPONENT_BIAS (0x3FF + DSTR_DP_SIGNIFICAND_SIZE)
+#define DSTR_DP_MIN_EXPONENT (-DSTR_DP_EXPONENT_BIAS)
+#define DSTR_DP_EXPONENT_MASK 0x7FF0000000000000ULL
+#define DSTR_DP_SIGNIFICAND_MASK 0x000FFFFFFFFFFFFFULL
+#define DSTR_DP_HIDDEN_BIT 0x0010000000000000ULL
+
+static inline struct _dstr_diyfp _dstr_diyfp_from_double(double d)
+{
+    uint64_t bits;
+    memcpy(&bits, &d, sizeof(bits));
+    int biased_e = (int)((bits & DSTR_DP_EXPONENT_MASK) >>
+        DSTR_DP_SIGNIFICAND_SIZE);
+    uint64_t significand = bits & DSTR_DP_SIGNIFICAND_MASK;
+    if (biased_e != 0)
+        return (struct _dstr_diyfp){significand + DSTR_DP_HIDDEN_BIT,
+            biased_e - DSTR_DP_EXPONENT_BIAS};
+    return (struct _dstr_diyfp){significand, DSTR_DP_MIN_EXPONENT + 1};
+}
+
+static inline struct _dstr_diyfp _dstr_diyfp_mul(struct _dstr_diyfp a,
+    struct _dstr_diyfp b)
+{
+    const uint64_t M32 = 0xFFFFFFFFULL;
+    uint64_t ah = a.f >> 32, al = a.f & M32;
+    uint64_t bh = b.f >> 32, bl = b.f & M32;
+    uint64_t hh = ah*bh, hl = ah*bl, lh = al*bh, ll = al*bl;
+    uint64_t mid = (ll >> 32) + (hl & M32) + (lh & M32);
+    mid += 1ULL << 31; // round
+    return (struct _dstr_diyfp){hh + (hl >> 32) + (lh >> 32) + (mid >> 32),
+        a.e + b.e + 64};
+}
+
+static inline struct _dstr_diyfp _dstr_diyfp_normalize(struct _dstr_diyfp x)
+{
+    while (!(x.f & (DSTR_DP_HIDDEN_BIT << 1)))
+    {
+        x.f <<= 1;
+        x.e--;
+    }
+    x.f <<= 64 - DSTR_DP_SIGNIFICAND_SIZE - 2;
+    x.e -= 64 - DSTR_DP_SIGNIFICAND_SIZE - 2;
+    return x;
+}
+
+// Normalized 64-bit significands and binary exponents of 10^k for
+// k = -348, -340, ..., 340.
+static const uint64_t _dstr_cached_powers_f[] = {
+    0xFA8FD5A0081C0288ULL, 0xBAAEE17FA23EBF76ULL, 0x8B16FB203055AC76ULL,
+    0xCF42894A5DCE35EAULL, 0x9A6BB0AA55653B2DULL, 0xE61ACF033D1A45DFULL,
+    0xAB70FE17C79AC6CAULL, 0xFF77B1FCBEBCDC4FULL, 0xBE5691EF416BD60CULL,
+    0x8DD01FAD907FFC3CULL, 0xD3515C2831559A83ULL, 0x9D71AC8FADA6C9B5ULL,
+    0xEA9C227723EE8BCBULL, 0xAECC49914078536DULL, 0x823C12795DB6CE57ULL,
+    0xC21094364DFB5637ULL, 0x9096EA6F3848984FULL, 0xD77485CB25823AC7ULL,
+    0xA086CFCD97BF97F4ULL, 0xEF340A98172AACE5ULL, 0xB23867FB2A35B28EULL,
+    0x84C8D4DFD2C63F3BULL, 0xC5DD44271AD3CDBAULL, 0x936B9FCEBB25C996ULL,
+    0xDBAC6C247D62A584ULL, 0xA3AB66580D5FDAF6ULL, 0xF3E2F893DEC3F126ULL,
+    0xB5B5ADA8AAFF80B8ULL, 0x87625F056C7C4A8BULL, 0xC9BCFF6034C13053ULL,
+    0x964E858C91BA2655ULL, 0xDFF9772470297EBDULL, 0xA6DFBD9FB8E5B88FULL,
+    0xF8A95FCF88747D94ULL, 0xB94470938FA89BCFULL, 0x8A08F0F8BF0F156BULL,
+    0xCDB02555653131B6ULL, 0x993FE2C6D07B7FACULL, 0xE45C10C42A2B3B06ULL,
+    0xAA242499697392D3ULL, 0xFD87B5F28300CA0EULL, 0xBCE5086492111AEBULL,
+    0x8CBCCC096F5088CCULL, 0xD1B71758E219652CULL, 0x9C40000000000000ULL,
+    0xE8D4A51000000000ULL, 0xAD78EBC5AC620000ULL, 0x813F3978F8940984ULL,
+    0xC097CE7BC90715B3ULL, 0x8F7E32CE7BEA5C70ULL, 0xD5D238A4ABE98068ULL,
+    0x9F4F2726179A2245ULL, 0xED63A231D4C4FB27ULL, 0xB0DE65388CC8ADA8ULL,
+    0x83C7088E1AAB65DBULL, 0xC45D1DF942711D9AULL, 0x924D692CA61BE758ULL,
+    0xDA01EE641A708DEAULL, 0xA26DA3999AEF774AULL, 0xF209787BB47D6B85ULL,
+    0xB454E4A179DD1877ULL, 0x865B86925B9BC5C2ULL, 0xC83553C5C8965D3DULL,
+    0x952AB45CFA97A0B3ULL, 0xDE469FBD99A05FE3ULL, 0xA59BC234DB398C25ULL,
+    0xF6C69A72A3989F5CULL, 0xB7DCBF5354E9BECEULL, 0x88FCF317F22241E2ULL,
+    0xCC20CE9BD35C78A5ULL, 0x98165AF37B2153DFULL, 0xE2A0B5DC971F303AULL,
+    0xA8D9D1535CE3B396ULL, 0xFB9B7CD9A4A7443CULL, 0xBB764C4CA7A44410ULL,
+    0x8BAB8EEFB6409C1AULL, 0xD01FEF10A657842CULL, 0x9B10A4E5E9913129ULL,
+    0xE7109BFBA19C0C9DULL, 0xAC2820D9623BF429ULL, 0x80444B5E7AA7CF85ULL,
+    0xBF21E44003ACDD2DULL, 0x8E679C2F5E44FF8FULL, 0xD433179D9C8CB841ULL,
+    0x9E19DB92B4E31BA9ULL, 0xEB96BF6EBADF77D9ULL, 0xAF87023B9BF0EE6BULL
+};
+static const int16_t _dstr_cached_powers_e[] = {
+    -1220, -1193, -1166, -1140, -1113, -1087, -1060, -1034, -1007, -980,
+    -954, -927, -901, -874, -847, -821, -794, -768, -741, -715,
+    -688, -661, -635, -608, -582, -555, -529, -502, -475, -449,
+    -422, -396, -369, -343, -316, -289, -263, -236, -210, -183,
+    -157, -130, -103, -77, -50, -24, 3, 30, 56, 83,
+    109, 136, 162, 189, 216, 242, 269, 295, 322, 348,
+    375, 402, 428, 455, 481, 508, 534, 561, 588, 614,
+    641, 667, 694, 720, 747, 774, 800, 827, 853, 880,
+    907, 933, 960, 986, 1013, 1039, 1066
+};
+
+static const uint64_t _dstr_pow10_u64[] = {
+    1ULL, 10ULL, 100ULL, 1000ULL, 10000ULL, 100000ULL, 1000000ULL,
+    10000000ULL, 100000000ULL, 1000000000ULL, 10000000000ULL,
+    100000000000ULL, 1000000000000ULL, 10000000000000ULL,
+    100000000000000ULL, 1000000000000000ULL, 10000000000000000ULL,
+    100000000000000000ULL, 1000000000000000000ULL,
+    10000000000000000000ULL
+};
+
+static inline void _dstr_grisu_round(char* buf, int len, uint64_t delta,
+    uint64_t rest, uint64_t ten_kappa, uint64_t wp_w)
+{
+    while (rest < wp_w && delta - rest >= ten_kappa &&
+        (rest + ten_kappa < wp_w || wp_w - rest > rest + ten_kappa - wp_w))
+    {
+        buf[len-1]--;
+        rest += ten_kappa;
+    }
+}
+
+static inline void _dstr_grisu_digit_gen(struct _dstr_diyfp w,
+    struct _dstr_diyfp mp, uint64_t delta, char* buf, int* len, int* k)
+{
+    const struct _dstr_diyfp one = {1ULL << -mp.e, mp.e};
+    const uint64_t wp_w = mp.f - w.f;
+    uint32_t p1 = (uint32_t)(mp.f >> -one.e);
+    uint64_t p2 = mp.f & (one.f - 1);
+    int kappa = _dstr_count_digits_u64(p1);
+    *len = 0;
+
+    while (kappa > 0)
+    {
+        uint32_t div = (uint32_t)_dstr_pow10_u64[kappa-1];
+        uint32_t d = p1 / div;
+        p1 %= div;
+        if (d || *len)
+            buf[(*len)++] = (char)('0' + d);
+        kappa--;
+        uint64_t tmp = ((uint64_t)p1 << -one.e) + p2;
+        if (tmp <= delta)
+        {
+            *k += kappa;
+            _dstr_grisu_round(buf, *len, delta, tmp,
+                _dstr_pow10_u64[kappa] << -one.e, wp_w);
+            return;
+        }
+    }
+
+    for (;;)
+    {
+        p2 *= 10;
+        delta *= 10;
+        char d = (char)(p2 >> -one.e);
+        if (d || *len)
+            buf[(*len)++] = (char)('0' + d);
+        p2 &= one.f - 1;
+        kappa--;
+        if (p2 < delta)
+        {
+            *k += kappa;
+            int index = -kappa;
+            _dstr_grisu_round(buf, *len, delta, p2, one.f,
+                wp_w * (index < 20 ? _dstr_pow10_u64[index] : 0));
+            return;
+        }
+    }
+}
+
+// Generate the shortest digits of positive, finite, non-zero `value` into `buf`
+// such that value == digits * 10^k.
+static inline int _dstr_grisu2(double value, char* buf, int* k)
+{
+    const struct _dstr_diyfp v = _dstr_diyfp_from_double(value);
+
+    struct _dstr_diyfp w_p = _dstr_diyfp_normalize(
+        (struct _dstr_diyfp){(v.f << 1) + 1, v.e - 1});
+    struct _dstr_diyfp w_m = (v.f == DSTR_DP_HIDDEN_BIT)
+        ? (struct _dstr_diyfp){(v.f << 2) - 1, v.e - 2}
+        : (struct _dstr_diyfp){(v.f << 1) - 1, v.e - 1};
+    w_m.f <<= w_m.e - w_p.e;
+    w_m.e = w_p.e;
+
+    // Cached power c such that the product w_p*c has a binary exponent in
+    // [-60, -32].
+    double dk = (-61 - w_p.e) * 0.30102999566398114 + 347;
+    int ik = (int)dk;
+    if (ik != dk)
+        ik++;
+    unsigned index = (unsigned)((ik >> 3) + 1);
+    *k = -(-348 + (int)index*8);
+    const struct _dstr_diyfp c_mk =
+        {_dstr_cached_powers_f[index], _dstr_cached_powers_e[index]};
+
+    struct _dstr_diyfp vn = v;
+    while (!(vn.f & DSTR_DP_HIDDEN_BIT))
+    {
+        vn.f <<= 1;
+        vn.e--;
+    }
+    vn.f <<= 64 - DSTR_DP_SIGNIFICAND_SIZE - 1;
+    vn.e -= 64 - DSTR_DP_SIGNIFICAND_SIZE - 1;
+
+    const struct _dstr_diyfp w = _dstr_diyfp_mul(vn, c_mk);
+    struct _dstr_diyfp wp = _dstr_diyfp_mul(w_p, c_mk);
+    struct _dstr_diyfp wm = _dstr_diyfp_mul(w_m, c_mk);
+    wm.f++;
+    wp.f--;
+    int len;
+    _dstr_grisu_digit_gen(w, wp, wp.f - wm.f, buf, &len, k);
+    return len;
+}
+
+// Format `len` digits in `buf` with decimal exponent `k` into `out` using the
+// same layout as `%g`: positional notation for moderate exponents and
+// `d.ddde+XX` otherwise. Returns the number of characters written.
+static inline int _dstr_format_decimal(char* out, const char* buf, int len,
+    int k)
+{
+    int kk = len + k; // Position of the decimal point.
+    char* p = out;
+    if (0 <= k && kk <= 21)
+    {
+        // 1234e7 -> 12340000000
+        memcpy(p, buf, len);
+        memset(p+len, '0', k);
+        p += kk;
+    }
+    else if (0 < kk && kk <= 21)
+    {
+        // 1234e-2 -> 12.34
+        memcpy(p, buf, kk);
+        p[kk] = '.';
+        memcpy(p+kk+1, buf+kk, len-kk);
+        p += len + 1;
+    }
+    else if (-6 < kk && kk <= 0)
+    {
+        // 1234e-6 -> 0.001234
+        *p++ = '0';
+        *p++ = '.';
+        memset(p, '0', -kk);
+        memcpy(p-kk, buf, len);
+        p += len - kk;
+    }
+    else
+    {
+        // 1234e30 -> 1.234e+33
+        *p++ = buf[0];
+        if (len > 1)
+        {
+            *p++ = '.';
+            memcpy(p, buf+1, len-1);
+            p += len - 1;
+        }
+        int exp10 = kk - 1;
+        *p++ = 'e';
+        *p++ = exp10 < 0 ? '-' : '+';
+        if (exp10 < 0)
+            exp10 = -exp10;
+        if (exp10 >= 100)
+        {
+            *p++ = (char)('0' + exp10/100);
+            exp10 %= 100;
+        }
+        *p++ = _dstr_digit_pairs[exp10*2];
+        *p++ = _dstr_digit_pairs[exp10*2+1];
+    }
+    return (int)(p - out);
+}
+
+// Longest output of _dstr_format_f64: "-0.00000" + 17 digits, or
+// "-d." + 16 digits + "e-308".
+#define DSTR_F64_MAX_CHARS 32
+
+static int _dstr_format_f64(char* out, double value)
+{
+    char* p = out;
+    if (isnan(value))
+    {
+        memcpy(p, "nan", 3);
+        return 3;
+    }
+    if (signbit(value))
+    {
+        *p++ = '-';
+        value = -value;
+    }
+    if (isinf(value))
+    {
+        memcpy(p, "inf", 3);
+        return (int)(p - out) + 3;
+    }
+    if (value == 0.0)
+    {
+        *p++ = '0';
+        return (int)(p - out);
+    }
+    char digits[24];
+    int k;
+    int len = _dstr_grisu2(value, digits, &k);
+    return (int)(p - out) + _dstr_format_decimal(p, digits, len, k);
+}
+
+darray(char) dstr_append_f64(darray(char) dest, double value)
+{
+    size_t len = dstr_length(dest);
+    dest = da_reserve(dest, DSTR_F64_MAX_CHARS);
+    if (dest == NULL)
+        return NULL;
+    int n = _dstr_format_f64(dest+len, value);
+    dest[len+n] = '\0';
+    *DA_P_LENGTH_FROM_HANDLE(dest) += n;
+    _da_invalidate_content_cache(dest);
+    return dest;
+}
+
+// SWAR (SIMD within a register) helpers that check and convert eight ASCII
+// digits at a time. See Lemire, "Number Parsing at a Gigabyte per Second".
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#   define DSTR_SWAR_DIGITS 1
+#else
+#   define DSTR_SWAR_DIGITS 0
+#endif
+
+static inline bool _dstr_is_eight_digits(uint64_t chunk)
+{
+    return !(((chunk + 0x4646464646464646ULL) |
+        (chunk - 0x3030303030303030ULL)) & 0x8080808080808080ULL);
+}
+
+static inline uint32_t _dstr_parse_eight_digits(uint64_t chunk)
+{
+    const uint64_t mask = 0x000000FF000000FFULL;
+    const uint64_t mul1 = 0x000F424000000064ULL; // 100 + (1000000 << 32)
+    const uint64_t mul2 = 0x0000271000000001ULL; // 1 + (10000 << 32)
+    chunk -= 0x3030303030303030ULL;
+    chunk = (chunk * 10) + (chunk >> 8);
+    chunk = (((chunk & mask) * mul1) + (((chunk >> 16) & mask) * mul2)) >> 32;
+    return (uint32_t)chunk;
+}
+
+// Accumulate the run of decimal digits at the start of `src` into `*value`,
+// setting `*overflow` if the result does not fit in 64 bits. Returns the number
+// of digit characters consumed.
+static inline size_t _dstr_parse_digits(const char* src, size_t len,
+    uint64_t* value, bool* overflow)
+{
+    size_t i = 0;
+    uint64_t v = *value;
+#if DSTR_SWAR_DIGITS
+    while (len - i >= 8 && v <= (UINT64_MAX - 99999999) / 100000000)
+    {
+        uint64_t chunk;
+        memcpy(&chunk, src+i, sizeof(chunk));
+        if (!_dstr_is_eight_digits(chunk))
+            break;
+        v = v*100000000 + _dstr_parse_eight_digits(chunk);
+        i += 8;
+    }
+#endif
+    for (; i < len && (unsigned)(src[i] - '0') < 10; ++i)
+    {
+        unsigned d = (unsigned)(src[i] - '0');
+        if (v > (UINT64_MAX - d) / 10)
+            *overflow = true;
+        else
+            v = v*10 + d;
+    }
+    *value = v;
+    return i;
+}
+
+size_t dstr_parse_i64(const char* src, size_t len, int64_t* value)
+{
+    size_t i = 0;
+    bool negative = false;
+    if (i < len && (src[i] == '-' || src[i] == '+'))
+        negative = src[i++] == '-';
+
+    uint64_t u = 0;
+    bool overflow = false;
+    size_t ndigits = _dstr_parse_digits(src+i, len-i, &u, &overflow);
+    if (ndigits == 0 || overflow)
+        return 0;
+
+    if (negative)
+    {
+        if (u > (uint64_t)INT64_MAX + 1)
+            return 0;
+        *value = u == (uint64_t)INT64_MAX + 1 ? INT64_MIN : -(int64_t)u;
+    }
+    else
+    {
+        if (u > INT64_MAX)
+            return 0;
+        *value = (int64_t)u;
+    }
+    return i + ndigits;
+}
+
+// Fall back to `strtod` on a null terminated copy of the first `len` characters
+// of `src`.
+static size_t _dstr_parse_f64_slow(const char* src, size_t len, double* value)
+{
+    if (len == 0 || isspace((unsigned char)src[0]))
+        return 0;
+    char buf[64];
+    char* str = len < sizeof(buf) ? buf : malloc(len+1);
+    if (str == NULL)
+        return 0;
+    memcpy(str, src, len);
+    str[len] = '\0';
+
+    char* end;
+    double d = strtod(str, &end);
+    size_t n = end - str;
+    if (str != buf)
+        free(str);
+    if (n == 0)
+        return 0;
+    *value = d;
+    return n;
+}
+
+static const double _dstr_pow10_f64[] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+// Convert m*10^exp10 to the nearest double using 64-bit DiyFp arithmetic with
+// the cached powers of ten used by Grisu. The error introduced by the inexact
+// multiplications is tracked in units of 1/8th ulp and `false` is returned
+// whenever the error makes the correctly rounded result ambiguous.
+// Adapted from the DiyFpStrtod routine of the double-conversion library.
+static bool _dstr_diyfp_to_double(uint64_t m, int exp10, double* value)
+{
+    const int denormal_exponent = -DSTR_DP_EXPONENT_BIAS + 1;
+    const int max_exponent = 0x7FF - DSTR_DP_EXPONENT_BIAS;
+    if (m == 0 || exp10 < -348 || exp10 > 340)
+        return false;
+
+    struct _dstr_diyfp input = {m, 0};
+    int error = 0;
+    while (!(input.f & 0x8000000000000000ULL))
+    {
+        input.f <<= 1;
+        input.e--;
+    }
+
+    unsigned index = (unsigned)(exp10 + 348) / 8;
+    int adjustment = exp10 - (-348 + (int)index*8);
+    if (adjustment != 0)
+    {
+        // 10^adjustment for adjustment in [1, 7] is exact in a DiyFp.
+        struct _dstr_diyfp adjust = {_dstr_pow10_u64[adjustment], 0};
+        while (!(adjust.f & 0x8000000000000000ULL))
+        {
+            adjust.f <<= 1;
+            adjust.e--;
+        }
+        input = _dstr_diyfp_mul(input, adjust);
+        error += 4;
+    }
+    const struct _dstr_diyfp cached =
+        {_dstr_cached_powers_f[index], _dstr_cached_powers_e[index]};
+    input = _dstr_diyfp_mul(input, cached);
+    error += 4 /* cached power */ + (error != 0) + 4 /* multiplication */;
+
+    int old_e = input.e;
+    while (!(input.f & 0x8000000000000000ULL))
+    {
+        input.f <<= 1;
+        input.e--;
+    }
+    error <<= old_e - input.e;
+
+    int magnitude = 64 + input.e;
+    int significand_size = magnitude >= denormal_exponent + 53 ? 53
+        : magnitude <= denormal_exponent ? 0 : magnitude - denormal_exponent;
+    int precision_bits_count = 64 - significand_size;
+    if (precision_bits_count + 3 >= 64)
+    {
+        int shift = precision_bits_count + 3 - 64 + 1;
+        input.f >>= shift;
+        input.e += shift;
+        error = (error >> shift) + 1 + 4;
+        precision_bits_count -= shift;
+    }
+    uint64_t precision_bits =
+        (input.f & ((1ULL << precision_bits_count) - 1)) * 8;
+    uint64_t half_way = (1ULL << (precision_bits_count - 1)) * 8;
+    if (half_way - error < precision_bits && precision_bits < half_way + error)
+        return false;
+
+    uint64_t f = input.f >> precision_bits_count;
+    int e = input.e + precision_bits_count;
+    if (precision_bits >= half_way + error)
+        f++;
+    while (f > (DSTR_DP_HIDDEN_BIT << 1) - 1)
+    {
+        f >>= 1;
+        e++;
+    }
+
+    uint64_t bits;
+    if (e >= max_exponent)
+    {
+        bits = DSTR_DP_EXPONENT_MASK;
+    }
+    else if (e < denormal_exponent)
+    {
+        bits = 0;
+    }
+    else
+    {
+        while (e > denormal_exponent && !(f & DSTR_DP_HIDDEN_BIT))
+        {
+            f <<= 1;
+            e--;
+        }
+        uint64_t biased_e =
+            (e == denormal_exponent && !(f & DSTR_DP_HIDDEN_BIT))
+            ? 0 : (uint64_t)(e + DSTR_DP_EXPONENT_BIAS);
+        bits = (f & DSTR_DP_SIGNIFICAND_MASK) |
+            (biased_e << DSTR_DP_SIGNIFICAND_SIZE);
+    }
+    memcpy(value, &bits, sizeof(bits));
+    return true;
+}
+
+size_t dstr_parse_f64(const char* src, size_t len, double* value)
+{
+    size_t i = 0;
+    bool negative = false;
+    if (i < len && (src[i] == '-' || src[i] == '+'))
+        negative = src[i++] == '-';
+
+    uint64_t mantissa = 0;
+    bool overflow = false;
+    size_t nint = _dstr_parse_digits(src+i, len-i, &mantissa, &overflow);
+    i += nint;
+    size_t nfrac = 0;
+    if (i < len && src[i] == '.')
+    {
+        nfrac = _dstr_parse_digits(src+i+1, len-i-1, &mantissa, &overflow);
+        i += 1 + nfrac;
+    }
+    // Infinity, NaN, and hexadecimal floats are left to strtod.
+    if (nint + nfrac == 0 || (nint == 1 && i < len && (src[i] | 0x20) == 'x'))
+        return _dstr_parse_f64_slow(src, len < 64 ? len : 64, value);
+
+    long exp10 = -(long)nfrac;
+    if (i < len && (src[i] | 0x20) == 'e')
+    {
+        size_t j = i + 1;
+        bool exp_negative = false;
+        if (j < len && (src[j] == '-' || src[j] == '+'))
+            exp_negative = src[j++] == '-';
+        if (j < len && (unsigned)(src[j] - '0') < 10)
+        {
+            long e = 0;
+            for (; j < len && (unsigned)(src[j] - '0') < 10; ++j)
+            {
+                if (e < 100000)
+                    e = e*10 + (src[j] - '0');
+            }
+            exp10 += exp_negative ? -e : e;
+            i = j;
+        }
+    }
+
+#if FLT_EVAL_METHOD == 0
+    // Clinger's fast path: both the mantissa and the power of ten are exactly
+    // representable so a single correctly rounded operation gives the answer.
+    if (!overflow && mantissa <= (1ULL << 53) && exp10 >= -22 && exp10 <= 22)
+    {
+        double d = (double)mantissa;
+        if (exp10 < 0)
+            d /= _dstr_pow10_f64[-exp10];
+        else
+            d *= _dstr_pow10_f64[exp10];
+        *value = negative ? -d : d;
+        return i;
+    }
+#endif
+    double d;
+    if (!overflow && exp10 >= INT_MIN/2 && exp10 <= INT_MAX/2
+        && _dstr_diyfp_to_double(mantissa, (int)exp10, &d))
+    {
+        *value = negative ? -d : d;
+        return i;
+    }
+    return _dstr_parse_f64_slow(src, i, value);
+}
+
+int dstr_cmp(const darray(char) s1, const char* s2)
+{
+    while (*s1 == *s2 && *s1 != '\0')
+    {
+        s1++;
+        s2++;
+    }
+    return *s1 - *s2;
+}
+
+int dstr_cmp_case(const darray(char) s1, const char* s2)
+{
+    while (tolower(*s1) == tolower(*s2) && *s1 != '\0')
+    {
+        s1++;
+        s2++;
+    }
+    return *s1 - *s2;
+}
+
+long dstr_find(darray(char) dstr, const char* substr)
+{
+    char* loc = strstr(dstr, substr);
+    if (loc == NULL)
+        return -1;
+    return loc - dstr;
+}
+
+static const char* _da_strcasestr(const char* haystack, const char* needle)
+{
+    const char* currh = haystack;
+    const char* currn = needle;
+    while (1)
+    {
+        if (*currn == '\0')
+            return haystack;
+        else if (*currh == '\0')
+            return NULL;
+
+        if (tolower(*currh) != tolower(*currn))
+        {
+            haystack = ++currh;
+            currn = needle;
+        }
+        else
+        {
+            currh++;
+            currn++;
+        }
+    }
+}
+
+long dstr_find_case(darray(char) dstr, const char* substr)
+{
+    const char* loc = _da_strcasestr(dstr, substr);
+    if (loc == NULL)
+        return -1;
+    return loc - dstr;
+}
+
+darray(char) dstr_replace_all(darray(char) dstr, const char* substr,
+    const char* new_str)
+{
+    dstr = da_unshare(dstr);
+    if (dstr == NULL)
+        return NULL;
+    size_t substr_len = strlen(substr);
+    size_t new_str_len = strlen(new_str);
+    long loc;
+    while ((loc = dstr_find(dstr, substr)) != -1)
+    {
+        da_remove_arr(dstr, loc, substr_len);
+        if ((dstr = da_insert_arr(dstr, loc, new_str, new_str_len)) == NULL)
+            return NULL;
+    }
+    return dstr;
+}
+
+darray(char) dstr_replace_all_case(darray(char) dstr, const char* substr,
+    const char* new_str)
+{
+    dstr = da_unshare(dstr);
+    if (dstr == NULL)
+        return NULL;
+    size_t substr_len = strlen(substr);
+    size_t new_str_len = strlen(new_str);
+    long loc;
+    while ((loc = dstr_find_case(dstr, substr)) != -1)
+    {
+        da_remove_arr(dstr, loc, substr_len);
+        if ((dstr = da_insert_arr(dstr, loc, new_str, new_str_len)) == NULL)
+            return NULL;
+    }
+    return dstr;
+}
+
+// Flip the case of every byte of `str` in the range [`lo`, `hi`]. Chunks of
+// pure ASCII are handled 16 or 32 bytes at a time. Chunks containing non-ASCII
+// bytes are handed to the locale aware `fallback` one byte at a time.
+static void _dstr_transform_case(char* str, size_t len, char lo, char hi,
+    int (*fallback)(int))
+{
+    size_t i = 0;
+#if DA_AVX2
+    const __m256i lo32 = _mm256_set1_epi8((char)(lo-1));
+    const __m256i hi32 = _mm256_set1_epi8((char)(hi+1));
+    const __m256i flip32 = _mm256_set1_epi8(0x20);
+    for (; i + 32 <= len; i += 32)
+    {
+        __m256i chunk = _mm256_loadu_si256((const __m256i*)(str+i));
+        if (_mm256_movemask_epi8(chunk) != 0)
+        {
+            for (size_t j = i; j < i + 32; ++j)
+                str[j] = (char)fallback((unsigned char)str[j]);
+            continue;
+        }
+        __m256i in_range = _mm256_and_si256(
+            _mm256_cmpgt_epi8(chunk, lo32), _mm256_cmpgt_epi8(hi32, chunk));
+        chunk = _mm256_xor_si256(chunk, _mm256_and_si256(in_range, flip32));
+        _mm256_storeu_si256((__m256i*)(str+i), chunk);
+    }
+#endif
+#if DA_SSE2
+    const __m128i lo16 = _mm_set1_epi8((char)(lo-1));
+    const __m128i hi16 = _mm_set1_epi8((char)(hi+1));
+    const __m128i flip16 = _mm_set1_epi8(0x20);
+    for (; i + 16 <= len; i += 16)
+    {
+        __m128i chunk = _mm_loadu_si128((const __m128i*)(str+i));
+        if (_mm_movemask_epi8(chunk) != 0)
+        {
+            for (size_t j = i; j < i + 16; ++j)
+                str[j] = (char)fallback((unsigned char)str[j]);
+            continue;
+        }
+        __m128i in_range = _mm_and_si128(
+            _mm_cmpgt_epi8(chunk, lo16), _mm_cmpgt_epi8(hi16, chunk));
+        chunk = _mm_xor_si128(chunk, _mm_and_si128(in_range, flip16));
+        _mm_storeu_si128((__m128i*)(str+i), chunk);
+    }
+#endif
+#if !DA_SSE2
+    (void)lo;
+    (void)hi;
+#endif
+    for (; i < len; ++i)
+        str[i] = (char)fallback((unsigned char)str[i]);
+}
+
+void dstr_transform_lower(darray(char) dstr)
+{
+    _dstr_transform_case(dstr, dstr_length(dstr), 'A', 'Z', tolower);
+    _da_invalidate_content_cache(dstr);
+}
+
+void dstr_transform_upper(darray(char) dstr)
+{
+    _dstr_transform_case(dstr, dstr_length(dstr), 'a', 'z', toupper);
+    _da_invalidate_content_cache(dstr);
+}
+
+#if DA_SSE2
+// Mask with bit i set when byte i of `chunk` is one of " \t\n\v\f\r".
+static inline unsigned _dstr_ascii_space_mask(__m128i chunk)
+{
+    __m128i space = _mm_cmpeq_epi8(chunk, _mm_set1_epi8(' '));
+    __m128i ctrl = _mm_and_si128(
+        _mm_cmpgt_epi8(chunk, _mm_set1_epi8('\t'-1)),
+        _mm_cmpgt_epi8(_mm_set1_epi8('\r'+1), chunk));
+    return (unsigned)_mm_movemask_epi8(_mm_or_si128(space, ctrl));
+}
+#endif
+
+// Number of whitespace characters at the front of the `len` characters at
+// `str`. The SIMD loop skips ASCII whitespace and `isspace` has the final say
+// on whatever byte stopped it.
+static size_t _dstr_count_leading_space(const char* str, size_t len)
+{
+    size_t i = 0;
+#if DA_SSE2
+    for (; i + 16 <= len; i += 16)
+    {
+        unsigned mask = _dstr_ascii_space_mask(
+            _mm_loadu_si128((const __m128i*)(str+i)));
+        if (mask != 0xFFFF)
+        {
+            i += __builtin_ctz(~mask);
+            break;
+        }
+    }
+#endif
+    while (i < len && isspace((unsigned char)str[i]))
+        ++i;
+    return i;
+}
+
+// Number of whitespace characters at the back of the `len` characters at
+// `str`.
+static size_t _dstr_count_trailing_space(const char* str, size_t len)
+{
+    size_t end = len;
+#if DA_SSE2
+    for (; end >= 16; end -= 16)
+    {
+        unsigned mask = _dstr_ascii_space_mask(
+            _mm_loadu_si128((const __m128i*)(str+end-16)));
+        if (mask != 0xFFFF)
+        {
+            end -= 16 - (32 - __builtin_clz(~mask & 0xFFFF));
+            break;
+        }
+    }
+#endif
+    while (end > 0 && isspace((unsigned char)str[end-1]))
+        --end;
+    return len - end;
+}
+
+darray(char) dstr_trim(darray(char) dstr)
+{
+    dstr = da_unshare(dstr);
+    if (dstr == NULL)
+        return NULL;
+    size_t len = dstr_length(dstr);
+    size_t lead = _dstr_count_leading_space(dstr, len);
+    size_t trail = _dstr_count_trailing_space(dstr+lead, len-lead);
+    size_t new_len = len - lead - trail;
+
+    // Move the remaining characters to the front in a single pass.
+    if (lead != 0)
+        memmove(dstr, dstr+lead, new_len);
+    dstr[new_len] = '\0';
+    *DA_P_LENGTH_FROM_HANDLE(dstr) = new_len + 1;
+    _da_invalidate_content_cache(dstr);
+    return dstr;
+}
+
+/////////////////////// SMALL STRING OPTIMIZED DSTRINGS ////////////////////////
+// Invariants: a string is stored inline if and only if its length is at most
+// DSTR_SSO_INLINE_CAPACITY, and every inline byte past the string's null
+// terminator (other than the tag byte) is zero. Together these let two inline
+// strings be compared for equality with one fixed-size memcmp.
+#define DSTR_SSO_TAG(sso) \
+    (((const unsigned char*)(sso)->_u._inline)[DSTR_SSO_SIZE-1])
+
+static inline bool _dstr_sso_is_heap(const struct dstr_sso* sso)
+{
+    return DSTR_SSO_TAG(sso) == DSTR_SSO_HEAP_TAG;
+}
+
+static inline void _dstr_sso_set_inline(struct dstr_sso* sso, const char* src,
+    size_t len)
+{
+    char tmp[DSTR_SSO_SIZE] = {0};
+    memcpy(tmp, src, len);
+    tmp[DSTR_SSO_SIZE-1] = (char)(DSTR_SSO_INLINE_CAPACITY - len);
+    memcpy(sso->_u._inline, tmp, DSTR_SSO_SIZE);
+}
+
+static inline void _dstr_sso_set_heap(struct dstr_sso* sso,
+    darray(char) heap)
+{
+    memset(sso->_u._inline, 0, DSTR_SSO_SIZE);
+    sso->_u._heap = heap;
+    sso->_u._inline[DSTR_SSO_SIZE-1] = (char)DSTR_SSO_HEAP_TAG;
+}
+
+// Allocate a dstring holding a copy of the `len` characters at `src`.
+static darray(char) _dstr_alloc_from_chars(const char* src, size_t len)
+{
+    char* dstr = da_alloc(len+1, sizeof(char));
+    if (dstr == NULL)
+        return NULL;
+    memcpy(dstr, src, len);
+    dstr[len] = '\0';
+    return dstr;
+}
+
+static bool _dstr_sso_init_from_chars(struct dstr_sso* sso, const char* src,
+    size_t len)
+{
+    if (len <= DSTR_SSO_INLINE_CAPACITY)
+    {
+        _dstr_sso_set_inline(sso, src, len);
+        return true;
+    }
+    darray(char) heap = _dstr_alloc_from_chars(src, len);
+    if (heap == NULL)
+    {
+        dstr_sso_init(sso);
+        return false;
+    }
+    _dstr_sso_set_heap(sso, heap);
+    return true;
+}
+
+void dstr_sso_init(struct dstr_sso* sso)
+{
+    _dstr_sso_set_inline(sso, "", 0);
+}
+
+bool dstr_sso_from_cstr(struct dstr_sso* sso, const char* src)
+{
+    return _dstr_sso_init_from_chars(sso, src, strlen(src));
+}
+
+bool dstr_sso_from_dstr(struct dstr_sso* sso, const darray(char) src)
+{
+    return _dstr_sso_init_from_chars(sso, src, dstr_length(src));
+}
+
+darray(char) dstr_sso_to_dstr(const struct dstr_sso* sso)
+{
+    return _dstr_alloc_from_chars(dstr_sso_cstr(sso), dstr_sso_length(sso));
+}
+
+darray(char) dstr_sso_release(struct dstr_sso* sso)
+{
+    darray(char) dstr;
+    if (_dstr_sso_is_heap(sso))
+        dstr = sso->_u._heap;
+    else if ((dstr = dstr_sso_to_dstr(sso)) == NULL)
+        return NULL;
+    dstr_sso_init(sso);
+    return dstr;
+}
+
+void dstr_sso_free(struct dstr_sso* sso)
+{
+    if (_dstr_sso_is_heap(sso))
+        da_free(sso->_u._heap);
+    dstr_sso_init(sso);
+}
+
+bool dstr_sso_assign(struct dstr_sso* sso, const char* src, size_t len)
+{
+    if (len <= DSTR_SSO_INLINE_CAPACITY)
+    {
+        // Copy out of `src` before releasing any heap memory it may be in.
+        char tmp[DSTR_SSO_INLINE_CAPACITY];
+        memcpy(tmp, src, len);
+        if (_dstr_sso_is_heap(sso))
+            da_free(sso->_u._heap);
+        _dstr_sso_set_inline(sso, tmp, len);
+        return true;
+    }
+
+    if (_dstr_sso_is_heap(sso) && da_capacity(sso->_u._heap) > len)
+    {
+        darray(char) heap = sso->_u._heap;
+        memmove(heap, src, len);
+        heap[len] = '\0';
+        *DA_P_LENGTH_FROM_HANDLE(heap) = len + 1;
+        return true;
+    }
+
+    darray(char) heap = _dstr_alloc_from_chars(src, len);
+    if (heap == NULL)
+        return false;
+    if (_dstr_sso_is_heap(sso))
+        da_free(sso->_u._heap);
+    _dstr_sso_set_heap(sso, heap);
+    return true;
+}
+
+bool dstr_sso_append(struct dstr_sso* sso, const char* src, size_t len)
+{
+    size_t old_len = dstr_sso_length(sso);
+    size_t new_len = old_len + len;
+    if (new_len <= DSTR_SSO_INLINE_CAPACITY)
+    {
+        char tmp[DSTR_SSO_INLINE_CAPACITY];
+        memcpy(tmp, sso->_u._inline, old_len);
+        memcpy(tmp+old_len, src, len);
+        _dstr_sso_set_inline(sso, tmp, new_len);
+        return true;
+    }
+
+    if (!_dstr_sso_is_heap(sso))
+    {
+        // Promote to the heap. Both copies are made before the inline buffer
+        // is overwritten, so `src` may point into it.
+        darray(char) heap = da_alloc(new_len+1, sizeof(char));
+        if (heap == NULL)
+            return false;
+        memcpy(heap, sso->_u._inline, old_len);
+        memcpy(heap+old_len, src, len);
+        heap[new_len] = '\0';
+        _dstr_sso_set_heap(sso, heap);
+        return true;
+    }
+
+    darray(char) heap = sso->_u._heap;
+    uintptr_t src_addr = (uintptr_t)src;
+    uintptr_t heap_addr = (uintptr_t)heap;
+    bool aliased = src_addr >= heap_addr && src_addr < heap_addr + old_len;
+    size_t offset = src_addr - heap_addr;
+    heap = da_reserve(heap, len);
+    if (heap == NULL)
+        return false;
+    if (aliased)
+        src = heap + offset;
+    memmove(heap+old_len, src, len);
+    heap[new_len] = '\0';
+    *DA_P_LENGTH_FROM_HANDLE(heap) = new_len + 1;
+    sso->_u._heap = heap;
+    return true;
+}
+
+const char* dstr_sso_cstr(const struct dstr_sso* sso)
+{
+    return _dstr_sso_is_heap(sso) ? sso->_u._heap : sso->_u._inline;
+}
+
+size_t dstr_sso_length(const struct dstr_sso* sso)
+{
+    return _dstr_sso_is_heap(sso) ? dstr_length(sso->_u._heap)
+        : (size_t)(DSTR_SSO_INLINE_CAPACITY - DSTR_SSO_TAG(sso));
+}
+
+bool dstr_sso_is_inline(const struct dstr_sso* sso)
+{
+    return !_dstr_sso_is_heap(sso);
+}
+
+int dstr_sso_cmp(const struct dstr_sso* s1, const struct dstr_sso* s2)
+{
+    size_t len1 = dstr_sso_length(s1);
+    size_t len2 = dstr_sso_length(s2);
+    int cmp = memcmp(dstr_sso_cstr(s1), dstr_sso_cstr(s2),
+        len1 < len2 ? len1 : len2);
+    if (cmp != 0)
+        return cmp;
+    return (len1 > len2) - (len1 < len2);
+}
+
+bool dstr_sso_equal(const struct dstr_sso* s1, const struct dstr_sso* s2)
+{
+    bool heap1 = _dstr_sso_is_heap(s1);
+    if (heap1 != _dstr_sso_is_heap(s2))
+        return false;
+    if (!heap1)
+        return memcmp(s1->_u._inline, s2->_u._inline, DSTR_SSO_SIZE) == 0;
+    size_t len = dstr_length(s1->_u._heap);
+    return len == dstr_length(s2->_u._heap)
+        && memcmp(s1->_u._heap, s2->_u._heap, len) == 0;
+}
+
+///////////////////////////// HASHING AND INTERNING ////////////////////////////
+// `dstr_hash` follows the structure of XXH3. Inputs of up to
+// `DSTR_HASH_SHORT_MAX` bytes are mixed 16 bytes at a time with 64x64->128 bit
+// multiplies. Longer inputs are consumed in 64 byte stripes by eight independent
+// 64 bit accumulators that only need 32x32->64 bit multiplies, which SSE2 and
+// AVX2 provide. The scalar and SIMD paths compute the same value.
+#define DSTR_HASH_STRIPE_SIZE 64
+#define DSTR_HASH_STRIPES_PER_BLOCK 16
+#define DSTR_HASH_BLOCK_SIZE (DSTR_HASH_STRIPE_SIZE*DSTR_HASH_STRIPES_PER_BLOCK)
+#define DSTR_HASH_SHORT_MAX 128
+
+#define DSTR_HASH_PRIME32_1 0x9E3779B1U
+#define DSTR_HASH_PRIME32_2 0x85EBCA77U
+#define DSTR_HASH_PRIME32_3 0xC2B2AE3DU
+#define DSTR_HASH_PRIME64_1 0x9E3779B185EBCA87ULL
+#define DSTR_HASH_PRIME64_2 0xC2B2AE3D27D4EB4FULL
+#define DSTR_HASH_PRIME64_3 0x165667B19E3779F9ULL
+#define DSTR_HASH_PRIME64_4 0x85EBCA77C2B2AE63ULL
+#define DSTR_HASH_PRIME64_5 0x27D4EB2F165667C5ULL
+
+// Random keys mixed into the input. Stripe `s` of a block is keyed with words
+// [s, s+8) so that reordering stripes changes the hash.
+static const uint64_t _dstr_hash_secret[26] = {
+    0xDAEB8EBD244A330CULL, 0x685BD8519D0023DBULL, 0x959EF8713231C2CAULL,
+    0xD1EA2FA4DD9AF44CULL, 0xA402CBA46B82BDDDULL, 0x4F7580CD7B17A39EULL,
+    0xC8B045B99D6FB286ULL, 0xCECA0CA0C351E0A7ULL, 0x38987F53584DF3C8ULL,
+    0xBB74476EE0B6E30FULL, 0x9474C83868219521ULL, 0xA309F5FBA2117B34ULL,
+    0xF901131499F29AADULL, 0x6568525F65BE34AEULL, 0xE61C980E7426B628ULL,
+    0xF330A10B9EFE9904ULL, 0x39381640553D574DULL, 0x0E6C783BD0D3AAC1ULL,
+    0x992877185800058AULL, 0xE2B445A3CB88BB30ULL, 0x42381838BF9D61AFULL,
+    0x475B2AF9C112B40FULL, 0x9D73761A2479742FULL, 0xA5869770CC27FDBAULL,
+    0x0CE9FCBA3E066D3AULL, 0x40254DFC5F952DDAULL
+};
+
+static inline uint64_t _dstr_read64(const char* p)
+{
+    uint64_t value;
+    memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+static inline uint32_t _dstr_read32(const char* p)
+{
+    uint32_t value;
+    memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+// Multiply `a` and `b` to 128 bits and fold the halves together with xor.
+static inline uint64_t _dstr_mul128_fold64(uint64_t a, uint64_t b)
+{
+#if defined(__SIZEOF_INT128__)
+    unsigned __int128 product = (unsigned __int128)a * b;
+    return (uint64_t)product ^ (uint64_t)(product >> 64);
+#else
+    uint64_t a_lo = (uint32_t)a, a_hi = a >> 32;
+    uint64_t b_lo = (uint32_t)b, b_hi = b >> 32;
+    uint64_t lo_lo = a_lo * b_lo;
+    uint64_t hi_lo = a_hi * b_lo;
+    uint64_t lo_hi = a_lo * b_hi;
+    uint64_t hi_hi = a_hi * b_hi;
+    uint64_t cross = (lo_lo >> 32) + (uint32_t)hi_lo + lo_hi;
+    uint64_t upper = (hi_lo >> 32) + (cross >> 32) + hi_hi;
+    uint64_t lower = (cross << 32) | (uint32_t)lo_lo;
+    return lower ^ upper;
+#endif
+}
+
+static inline uint64_t _dstr_hash_avalanche(uint64_t h)
+{
+    h ^= h >> 37;
+    h *= 0x165667919E3779F9ULL;
+    h ^= h >> 32;
+    return h;
+}
+
+static inline uint64_t _dstr_hash_mix16(const char* p, const uint64_t* key)
+{
+    return _dstr_mul128_fold64(
+        _dstr_read64(p) ^ key[0],
+        _dstr_read64(p+8) ^ key[1]
+    );
+}
+
+static uint64_t _dstr_hash_short(const char* p, size_t len)
+{
+    const uint64_t* secret = _dstr_hash_secret;
+    if (len > 16)
+    {
+        uint64_t h = len * DSTR_HASH_PRIME64_1;
+        size_t nchunks = (len-1) / 16;
+        for (size_t i = 0; i < nchunks; ++i)
+            h += _dstr_hash_mix16(p + 16*i, secret + 2*i);
+        // The last 16 bytes may overlap the final chunk.
+        h += _dstr_hash_mix16(p + len - 16, secret + 16);
+        return _dstr_hash_avalanche(h);
+    }
+
+    uint64_t lo, hi;
+    if (len >= 8)
+    {
+        lo = _dstr_read64(p);
+        hi = _dstr_read64(p + len - 8);
+    }
+    else if (len >= 4)
+    {
+        lo = _dstr_read32(p);
+        hi = _dstr_read32(p + len - 4);
+    }
+    else if (len > 0)
+    {
+        lo = ((uint64_t)(unsigned char)p[0] << 16)
+            | ((uint64_t)(unsigned char)p[len>>1] << 8)
+            | (uint64_t)(unsigned char)p[len-1];
+        hi = 0;
+    }
+    else
+    {
+        lo = hi = 0;
+    }
+    uint64_t h = _dstr_mul128_fold64(lo ^ secret[20], hi ^ secret[21] ^ len);
+    return _dstr_hash_avalanche(h + len * DSTR_HASH_PRIME64_2);
+}
+
+// For each 64 bit lane i: acc[i^1] += data[i] and
+// acc[i] += lo32(data[i]^key[i]) * hi32(data[i]^key[i]).
+static inline void _dstr_hash_accumulate(uint64_t* acc, const char* p,
+    const uint64_t* key)
+{
+#if DA_AVX2
+    __m256i* xacc = (__m256i*)acc;
+    for (int i = 0; i < 2; ++i)
+    {
+        __m256i data = _mm256_loadu_si256((const __m256i*)p + i);
+        __m256i k = _mm256_loadu_si256((const __m256i*)key + i);
+        __m256i keyed = _mm256_xor_si256(data, k);
+        __m256i keyed_hi = _mm256_shuffle_epi32(keyed, _MM_SHUFFLE(0, 3, 0, 1));
+        __m256i product = _mm256_mul_epu32(keyed, keyed_hi);
+        __m256i swapped = _mm256_shuffle_epi32(data, _MM_SHUFFLE(1, 0, 3, 2));
+        __m256i sum = _mm256_add_epi64(xacc[i], swapped);
+        xacc[i] = _mm256_add_epi64(product, sum);
+    }
+#elif DA_SSE2
+    __m128i* xacc = (__m128i*)acc;
+    for (int i = 0; i < 4; ++i)
+    {
+        __m128i data = _mm_loadu_si128((const __m128i*)p + i);
+        __m128i k = _mm_loadu_si128((const __m128i*)key + i);
+        __m128i keyed = _mm_xor_si128(data, k);
+        __m128i keyed_hi = _mm_shuffle_epi32(keyed, _MM_SHUFFLE(0, 3, 0, 1));
+        __m128i product = _mm_mul_epu32(keyed, keyed_hi);
+        __m128i swapped = _mm_shuffle_epi32(data, _MM_SHUFFLE(1, 0, 3, 2));
+        __m128i sum = _mm_add_epi64(xacc[i], swapped);
+        xacc[i] = _mm_add_epi64(product, sum);
+    }
+#else
+    for (int i = 0; i < 8; ++i)
+    {
+        uint64_t data = _dstr_read64(p + 8*i);
+        uint64_t keyed = data ^ key[i];
+        acc[i^1] += data;
+        acc[i] += (keyed & 0xFFFFFFFF) * (keyed >> 32);
+    }
+#endif
+}
+
+// Fold the high bits of each accumulator back into its low bits once per block
+// so that long inputs keep mixing well.
+static inline void _dstr_hash_scramble(uint64_t* acc, const uint64_t* key)
+{
+#if DA_AVX2
+    __m256i* xacc = (__m256i*)acc;
+    __m256i prime = _mm256_set1_epi32((int)DSTR_HASH_PRIME32_1);
+    for (int i = 0; i < 2; ++i)
+    {
+        __m256i a = xacc[i];
+        a = _mm256_xor_si256(a, _mm256_srli_epi64(a, 47));
+        a = _mm256_xor_si256(a, _mm256_loadu_si256((const __m256i*)key + i));
+        __m256i a_hi = _mm256_shuffle_epi32(a, _MM_SHUFFLE(0, 3, 0, 1));
+        __m256i lo = _mm256_mul_epu32(a, prime);
+        __m256i hi = _mm256_mul_epu32(a_hi, prime);
+        xacc[i] = _mm256_add_epi64(lo, _mm256_slli_epi64(hi, 32));
+    }
+#elif DA_SSE2
+    __m128i* xacc = (__m128i*)acc;
+    __m128i prime = _mm_set1_epi32((int)DSTR_HASH_PRIME32_1);
+    for (int i = 0; i < 4; ++i)
+    {
+        __m128i a = xacc[i];
+        a = _mm_xor_si128(a, _mm_srli_epi64(a, 47));
+        a = _mm_xor_si128(a, _mm_loadu_si128((const __m128i*)key + i));
+        __m128i a_hi = _mm_shuffle_epi32(a, _MM_SHUFFLE(0, 3, 0, 1));
+        __m128i lo = _mm_mul_epu32(a, prime);
+        __m128i hi = _mm_mul_epu32(a_hi, prime);
+        xacc[i] = _mm_add_epi64(lo, _mm_slli_epi64(hi, 32));
+    }
+#else
+    for (int i = 0; i < 8; ++i)
+    {
+        uint64_t a = acc[i];
+        a ^= a >> 47;
+        a ^= key[i];
+        acc[i] = a * DSTR_HASH_PRIME32_1;
+    }
+#endif
+}
+
+static uint64_t _dstr_hash_long(const char* p, size_t len)
+{
+    const uint64_t* secret = _dstr_hash_secret;
+    alignas(32) uint64_t acc[8] = {
+        DSTR_HASH_PRIME32_3, DSTR_HASH_PRIME64_1,
+        DSTR_HASH_PRIME64_2, DSTR_HASH_PRIME64_3,
+        DSTR_HASH_PRIME64_4, DSTR_HASH_PRIME32_2,
+        DSTR_HASH_PRIME64_5, DSTR_HASH_PRIME32_1
+    };
+
+    size_t nblocks = (len-1) / DSTR_HASH_BLOCK_SIZE;
+    for (size_t b = 0; b < nblocks; ++b)
+    {
+        const char* block = p + b*DSTR_HASH_BLOCK_SIZE;
+        for (size_t s = 0; s < DSTR_HASH_STRIPES_PER_BLOCK; ++s)
+            _dstr_hash_accumulate(acc, block + s*DSTR_HASH_STRIPE_SIZE,
+                secret + s);
+        _dstr_hash_scramble(acc, secret + DSTR_HASH_STRIPES_PER_BLOCK);
+    }
+
+    // Remaining whole stripes, then the last 64 bytes which may overlap them.
+    const char* tail = p + nblocks*DSTR_HASH_BLOCK_SIZE;
+    size_t nstripes = ((len-1) - nblocks*DSTR_HASH_BLOCK_SIZE)
+        / DSTR_HASH_STRIPE_SIZE;
+    for (size_t s = 0; s < nstripes; ++s)
+        _dstr_hash_accumulate(acc, tail + s*DSTR_HASH_STRIPE_SIZE, secret + s);
+    _dstr_hash_accumulate(acc, p + len - DSTR_HASH_STRIPE_SIZE, secret + 18);
+
+    uint64_t h = len * DSTR_HASH_PRIME64_1;
+    for (int i = 0; i < 4; ++i)
+        h += _dstr_mul128_fold64(acc[2*i] ^ secret[2*i+1],
+            acc[2*i+1] ^ secret[2*i+2]);
+    return _dstr_hash_avalanche(h);
+}
+
+// Hashes are cut to 60 bits so that they fit in the header next to the flags.
+static inline uint64_t _dstr_hash_chars(const char* src, size_t len)
+{
+    if (len <= DSTR_HASH_SHORT_MAX)
+        return _dstr_hash_short(src, len) & DA_HASH_MASK;
+    return _dstr_hash_long(src, len) & DA_HASH_MASK;
+}
+
+uint64_t dstr_hash(const darray(char) dstr)
+{
+    uint64_t cached = *DA_P_HASH_FROM_HANDLE(dstr) & DA_HASH_MASK;
+    if (cached != 0)
+        return cached;
+    return _dstr_hash_chars(dstr, dstr_length(dstr));
+}
+
+uint64_t dstr_hash_cached(darray(char) dstr)
+{
+    uint64_t* cache = DA_P_HASH_FROM_HANDLE(dstr);
+    if ((*cache & DA_HASH_MASK) != 0)
+        return *cache & DA_HASH_MASK;
+    uint64_t hash = _dstr_hash_chars(dstr, dstr_length(dstr));
+    // Other owners of a shared dstring may be reading the header.
+    if (!DA_IS_SHARED(dstr))
+        *cache |= hash;
+    return hash;
+}
+
+void dstr_invalidate_cache(darray(char) dstr)
+{
+    _da_invalidate_content_cache(dstr);
+}
+
+#define DSTR_INTERN_POOL_MIN_SLOTS 64
+
+// Interned dstrings always carry their hash in the header, so lookups compare
+// hashes before touching string contents and growing never rehashes.
+static inline uint64_t _dstr_interned_hash(const darray(char) dstr)
+{
+    return *DA_P_HASH_FROM_HANDLE(dstr) & DA_HASH_MASK;
+}
+
+// Index of the slot holding `src` or of the empty slot where it belongs.
+static size_t _dstr_intern_pool_probe(const struct dstr_intern_pool* pool,
+    const char* src, size_t len, uint64_t hash)
+{
+    size_t mask = da_length(pool->_slots) - 1;
+    for (size_t i = hash & mask;; i = (i+1) & mask)
+    {
+        const darray(char) dstr = pool->_slots[i];
+        if (dstr == NULL)
+            return i;
+        if (_dstr_interned_hash(dstr) == hash && dstr_length(dstr) == len
+            && memcmp(dstr, src, len) == 0)
+            return i;
+    }
+}
+
+static bool _dstr_intern_pool_grow(struct dstr_intern_pool* pool)
+{
+    size_t old_nslots = pool->_slots == NULL ? 0 : da_length(pool->_slots);
+    size_t new_nslots = old_nslots == 0 ?
+        DSTR_INTERN_POOL_MIN_SLOTS : old_nslots*2;
+    darray(darray(char)) slots = da_alloc_exact(new_nslots, sizeof(char*));
+    if (slots == NULL)
+        return false;
+    memset(slots, 0, new_nslots*sizeof(char*));
+
+    size_t mask = new_nslots - 1;
+    for (size_t i = 0; i < old_nslots; ++i)
+    {
+        darray(char) dstr = pool->_slots[i];
+        if (dstr == NULL)
+            continue;
+        size_t j = _dstr_interned_hash(dstr) & mask;
+        while (slots[j] != NULL)
+            j = (j+1) & mask;
+        slots[j] = dstr;
+    }
+    if (pool->_slots != NULL)
+        da_free(pool->_slots);
+    pool->_slots = slots;
+    return true;
+}
+
+void dstr_intern_pool_init(struct dstr_intern_pool* pool)
+{
+    pool->_slots = NULL;
+    pool->_count = 0;
+}
+
+void dstr_intern_pool_free(struct dstr_intern_pool* pool)
+{
+    if (pool->_slots != NULL)
+    {
+        size_t nslots = da_length(pool->_slots);
+        for (size_t i = 0; i < nslots; ++i)
+        {
+            if (pool->_slots[i] != NULL)
+                dstr_free(pool->_slots[i]);
+        }
+        da_free(pool->_slots);
+    }
+    dstr_intern_pool_init(pool);
+}
+
+const darray(char) dstr_intern(struct dstr_intern_pool* pool, const char* src,
+    size_t len)
+{
+    uint64_t hash = _dstr_hash_chars(src, len);
+    size_t slot = 0;
+    if (pool->_slots != NULL)
+    {
+        slot = _dstr_intern_pool_probe(pool, src, len, hash);
+        if (pool->_slots[slot] != NULL)
+            return pool->_slots[slot];
+    }
+
+    // Keep the table at most half full.
+    if (pool->_slots == NULL || (pool->_count+1)*2 > da_length(pool->_slots))
+    {
+        if (!_dstr_intern_pool_grow(pool))
+            return NULL;
+        slot = _dstr_intern_pool_probe(pool, src, len, hash);
+    }
+
+    darray(char) dstr = da_alloc_exact(len+1, sizeof(char));
+    if (dstr == NULL)
+        return NULL;
+    memcpy(dstr, src, len);
+    dstr[len] = '\0';
+    *DA_P_HASH_FROM_HANDLE(dstr) |= hash;
+    pool->_slots[slot] = dstr;
+    pool->_count += 1;
+    return dstr;
 }
 
-darray(char) dstr_trim(darray(char) dstr)
+size_t dstr_intern_pool_count(const struct dstr_intern_pool* pool)
 {
-    size_t n;
-    char* tmp;
-
-    // Trim leading whitespace.
-    n = 0;
-    tmp = dstr;
-    while (isspace(*tmp++))
-        ++n;
-    da_remove_arr(dstr, 0, n);
-
-    // Trim trailing whitespace.
-    n = 0;
-    tmp = dstr + dstr_length(dstr) - 1;
-    while (isspace(*tmp--))
-        n++;
-    da_remove_arr(dstr, dstr_length(dstr)-n, n);
+    return pool->_count;
+}
 
-    return dstr;
+size_t dstr_intern_pool_bytes(const struct dstr_intern_pool* pool)
+{
+    if (pool->_slots == NULL)
+        return 0;
+    size_t nslots = da_length(pool->_slots);
+    size_t bytes = sizeof(struct _darray) + nslots*sizeof(char*);
+    for (size_t i = 0; i < nslots; ++i)
+    {
+        if (pool->_slots[i] != NULL)
+            bytes += sizeof(struct _darray) + da_capacity(pool->_slots[i]);
+    }
+    return bytes;
+}
+
+//////////////////////////////////// UTF-8 /////////////////////////////////////
+// Content flags kept in the top bits of the header hash word.
+#define DSTR_FLAG_UTF8  (UINT64_C(1) << 60) // Contents are valid UTF-8.
+#define DSTR_FLAG_ASCII (UINT64_C(1) << 61) // Contents are ASCII.
+
+// Scalar validation following the well-formed byte sequence table of the
+// Unicode standard (Table 3-7). Runs of ASCII are skipped 16 or 8 bytes at a
+// time.
+static bool _dstr_utf8_validate_scalar(const char* src, size_t len,
+    bool* is_ascii)
+{
+    const unsigned char* s = (const unsigned char*)src;
+    size_t i = 0;
+    while (i < len)
+    {
+#if DA_SSE2
+        while (i+16 <= len
+            && _mm_movemask_epi8(_mm_loadu_si128((const __m128i*)(s+i))) == 0)
+            i += 16;
+#else
+        while (i+8 <= len
+            && (_dstr_read64((const char*)s+i) & 0x8080808080808080ULL) == 0)
+            i += 8;
+#endif
+        if (i == len)
+            break;
+        unsigned char c = s[i];
+        if (c < 0x80)
+        {
+            i += 1;
+            continue;
+        }
+        *is_ascii = false;
+
+        size_t ncont;
+        unsigned char lo = 0x80, hi = 0xBF;
+        if (c >= 0xC2 && c <= 0xDF)
+            ncont = 1;
+        else if (c >= 0xE0 && c <= 0xEF)
+            ncont = 2;
+        else if (c >= 0xF0 && c <= 0xF4)
+            ncont = 3;
+        else
+            return false;
+        if (c == 0xE0)
+            lo = 0xA0; // Overlong.
+        else if (c == 0xED)
+            hi = 0x9F; // Surrogate.
+        else if (c == 0xF0)
+            lo = 0x90; // Overlong.
+        else if (c == 0xF4)
+            hi = 0x8F; // Larger than U+10FFFF.
+
+        if (len-i-1 < ncont)
+            return false;
+        if (s[i+1] < lo || s[i+1] > hi)
+            return false;
+        for (size_t k = 2; k <= ncont; ++k)
+        {
+            if ((s[i+k] & 0xC0) != 0x80)
+                return false;
+        }
+        i += ncont + 1;
+    }
+    return true;
+}
+
+#if DA_AVX2_VARIANTS
+// Lookup table validation from Keiser and Lemire, "Validating UTF-8 In Less
+// Than One Instruction Per Byte". Each error in a two byte window is detected
+// by three 16 entry table lookups indexed by the high nibble of the first
+// byte, the low nibble of the first byte, and the high nibble of the second
+// byte. Errors are only reported if a bit survives all three lookups.
+#define DSTR_UTF8_TOO_SHORT  (1<<0) // 11______ 0_______ or 11______ 11______
+#define DSTR_UTF8_TOO_LONG   (1<<1) // 0_______ 10______
+#define DSTR_UTF8_OVERLONG_3 (1<<2) // 11100000 100_____
+#define DSTR_UTF8_TOO_LARGE  (1<<3) // 11110100 1001____ and above
+#define DSTR_UTF8_SURROGATE  (1<<4) // 11101101 101_____
+#define DSTR_UTF8_OVERLONG_2 (1<<5) // 1100000_ 10______
+#define DSTR_UTF8_TOO_LARGE_1000 (1<<6) // 11110101 1000____ and above
+#define DSTR_UTF8_OVERLONG_4 (1<<6) // 11110000 1000____
+#define DSTR_UTF8_TWO_CONTS  (1<<7) // 10______ 10______
+#define DSTR_UTF8_CARRY (DSTR_UTF8_TOO_SHORT | DSTR_UTF8_TOO_LONG \
+    | DSTR_UTF8_TWO_CONTS)
+
+#define DSTR_UTF8_TABLE(...) _mm256_setr_epi8(__VA_ARGS__, __VA_ARGS__)
+
+DA_AVX2_TARGET
+static inline __m256i _dstr_utf8_prev_avx2(__m256i input, __m256i prev_input,
+    int n)
+{
+    // Bytes of `input` shifted forward by `n` with the last `n` bytes of
+    // `prev_input` shifted in. `n` is always a constant after inlining.
+    __m256i carried = _mm256_permute2x128_si256(prev_input, input, 0x21);
+    switch (n)
+    {
+    case 1:  return _mm256_alignr_epi8(input, carried, 15);
+    case 2:  return _mm256_alignr_epi8(input, carried, 14);
+    default: return _mm256_alignr_epi8(input, carried, 13);
+    }
+}
+
+DA_AVX2_TARGET
+static inline __m256i _dstr_utf8_high_nibbles_avx2(__m256i v)
+{
+    return _mm256_and_si256(_mm256_srli_epi16(v, 4), _mm256_set1_epi8(0x0F));
+}
+
+DA_AVX2_TARGET
+static inline __m256i _dstr_utf8_check_special_cases_avx2(__m256i input,
+    __m256i prev1)
+{
+    const __m256i byte_1_high_table = DSTR_UTF8_TABLE(
+        // 0_______ ________ <ASCII in byte 1>
+        DSTR_UTF8_TOO_LONG, DSTR_UTF8_TOO_LONG,
+        DSTR_UTF8_TOO_LONG, DSTR_UTF8_TOO_LONG,
+        DSTR_UTF8_TOO_LONG, DSTR_UTF8_TOO_LONG,
+        DSTR_UTF8_TOO_LONG, DSTR_UTF8_TOO_LONG,
+        // 10______ ________ <continuation in byte 1>
+        DSTR_UTF8_TWO_CONTS, DSTR_UTF8_TWO_CONTS,
+        DSTR_UTF8_TWO_CONTS, DSTR_UTF8_TWO_CONTS,
+        // 1100____ ________ <two byte lead in byte 1>
+        DSTR_UTF8_TOO_SHORT | DSTR_UTF8_OVERLONG_2,
+        // 1101____ ________ <two byte lead in byte 1>
+        DSTR_UTF8_TOO_SHORT,
+        // 1110____ ________ <three byte lead in byte 1>
+        DSTR_UTF8_TOO_SHORT | DSTR_UTF8_OVERLONG_3 | DSTR_UTF8_SURROGATE,
+        // 1111____ ________ <four+ byte lead in byte 1>
+        DSTR_UTF8_TOO_SHORT | DSTR_UTF8_TOO_LARGE | DSTR_UTF8_TOO_LARGE_1000
+            | DSTR_UTF8_OVERLONG_4
+    );
+    const __m256i byte_1_low_table = DSTR_UTF8_TABLE(
+        // ____0000 ________
+        DSTR_UTF8_CARRY | DSTR_UTF8_OVERLONG_3 | DSTR_UTF8_OVERLONG_2
+            | DSTR_UTF8_OVERLONG_4,
+        // ____0001 ________
+        DSTR_UTF8_CARRY | DSTR_UTF8_OVERLONG_2,
+        // ____001_ ________
+        DSTR_UTF8_CARRY,
+        DSTR_UTF8_CARRY,
+        // ____0100 ________
+        DSTR_UTF8_CARRY | DSTR_UTF8_TOO_LARGE,
+        // ____0101 ________
+        DSTR_UTF8_CARRY | DSTR_UTF8_TOO_LARGE | DSTR_UTF8_TOO_LARGE_1000,
+        // ____011_ ________
+        DSTR_UTF8_CARRY | DSTR_UTF8_TOO_LARGE | DSTR_UTF8_TOO_LARGE_1000,
+        DSTR_UTF8_CARRY | DSTR_UTF8_TOO_LARGE | DSTR_UTF8_TOO_LARGE_1000,
+        // ____1___ ________
+        DSTR_UTF8_CARRY | DSTR_UTF8_TOO_LARGE | DSTR_UTF8_TOO_LARGE_1000,
+        DSTR_UTF8_CARRY | DSTR_UTF8_TOO_LARGE | DSTR_UTF8_TOO_LARGE_1000,
+        DSTR_UTF8_CARRY | DSTR_UTF8_TOO_LARGE | DSTR_UTF8_TOO_LARGE_1000,
+        DSTR_UTF8_CARRY | DSTR_UTF8_TOO_LARGE | DSTR_UTF8_TOO_LARGE_1000,
+        DSTR_UTF8_CARRY | DSTR_UTF8_TOO_LARGE | DSTR_UTF8_TOO_LARGE_1000,
+        // ____1101 ________
+        DSTR_UTF8_CARRY | DSTR_UTF8_TOO_LARGE | DSTR_UTF8_TOO_LARGE_1000
+            | DSTR_UTF8_SURROGATE,
+        DSTR_UTF8_CARRY | DSTR_UTF8_TOO_LARGE | DSTR_UTF8_TOO_LARGE_1000,
+        DSTR_UTF8_CARRY | DSTR_UTF8_TOO_LARGE | DSTR_UTF8_TOO_LARGE_1000
+    );
+    const __m256i byte_2_high_table = DSTR_UTF8_TABLE(
+        // ________ 0_______ <ASCII in byte 2>
+        DSTR_UTF8_TOO_SHORT, DSTR_UTF8_TOO_SHORT,
+        DSTR_UTF8_TOO_SHORT, DSTR_UTF8_TOO_SHORT,
+        DSTR_UTF8_TOO_SHORT, DSTR_UTF8_TOO_SHORT,
+        DSTR_UTF8_TOO_SHORT, DSTR_UTF8_TOO_SHORT,
+        // ________ 1000____
+        DSTR_UTF8_TOO_LONG | DSTR_UTF8_OVERLONG_2 | DSTR_UTF8_TWO_CONTS
+            | DSTR_UTF8_OVERLONG_3 | DSTR_UTF8_TOO_LARGE_1000
+            | DSTR_UTF8_OVERLONG_4,
+        // ________ 1001____
+        DSTR_UTF8_TOO_LONG | DSTR_UTF8_OVERLONG_2 | DSTR_UTF8_TWO_CONTS
+            | DSTR_UTF8_OVERLONG_3 | DSTR_UTF8_TOO_LARGE,
+        // ________ 101_____
+        DSTR_UTF8_TOO_LONG | DSTR_UTF8_OVERLONG_2 | DSTR_UTF8_TWO_CONTS
+            | DSTR_UTF8_SURROGATE | DSTR_UTF8_TOO_LARGE,
+        DSTR_UTF8_TOO_LONG | DSTR_UTF8_OVERLONG_2 | DSTR_UTF8_TWO_CONTS
+            | DSTR_UTF8_SURROGATE | DSTR_UTF8_TOO_LARGE,
+        // ________ 11______
+        DSTR_UTF8_TOO_SHORT, DSTR_UTF8_TOO_SHORT,
+        DSTR_UTF8_TOO_SHORT, DSTR_UTF8_TOO_SHORT
+    );
+
+    __m256i byte_1_high = _mm256_shuffle_epi8(byte_1_high_table,
+        _dstr_utf8_high_nibbles_avx2(prev1));
+    __m256i byte_1_low = _mm256_shuffle_epi8(byte_1_low_table,
+        _mm256_and_si256(prev1, _mm256_set1_epi8(0x0F)));
+    __m256i byte_2_high = _mm256_shuffle_epi8(byte_2_high_table,
+        _dstr_utf8_high_nibbles_avx2(input));
+    return _mm256_and_si256(_mm256_and_si256(byte_1_high, byte_1_low),
+        byte_2_high);
+}
+
+DA_AVX2_TARGET
+static inline __m256i _dstr_utf8_check_multibyte_avx2(__m256i input,
+    __m256i prev_input)
+{
+    __m256i prev1 = _dstr_utf8_prev_avx2(input, prev_input, 1);
+    __m256i special_cases = _dstr_utf8_check_special_cases_avx2(input, prev1);
+
+    // The third and fourth bytes of three and four byte sequences must be
+    // continuations. The special cases marked them as TWO_CONTS, so the two
+    // must agree.
+    __m256i prev2 = _dstr_utf8_prev_avx2(input, prev_input, 2);
+    __m256i prev3 = _dstr_utf8_prev_avx2(input, prev_input, 3);
+    __m256i is_third_byte = _mm256_subs_epu8(prev2,
+        _mm256_set1_epi8((char)(0xE0-1)));
+    __m256i is_fourth_byte = _mm256_subs_epu8(prev3,
+        _mm256_set1_epi8((char)(0xF0-1)));
+    __m256i must_be_continuation = _mm256_cmpgt_epi8(
+        _mm256_or_si256(is_third_byte, is_fourth_byte),
+        _mm256_setzero_si256());
+    __m256i must_be_continuation_80 = _mm256_and_si256(must_be_continuation,
+        _mm256_set1_epi8((char)0x80));
+    return _mm256_xor_si256(must_be_continuation_80, special_cases);
+}
+
+// Nonzero where a sequence starting in the last three bytes of `input` would
+// continue past the end of `input`.
+DA_AVX2_TARGET
+static inline __m256i _dstr_utf8_is_incomplete_avx2(__m256i input)
+{
+    const __m256i max_value = _mm256_setr_epi8(
+        -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+        -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+        (char)(0xF0-1), (char)(0xE0-1), (char)(0xC0-1)
+    );
+    return _mm256_subs_epu8(input, max_value);
+}
+
+DA_AVX2_TARGET
+static bool _dstr_utf8_validate_avx2(const char* src, size_t len,
+    bool* is_ascii)
+{
+    __m256i error = _mm256_setzero_si256();
+    __m256i prev_input = _mm256_setzero_si256();
+    __m256i prev_incomplete = _mm256_setzero_si256();
+    alignas(32) char tail[32] = {0};
+
+    for (size_t i = 0; i < len; i += 32)
+    {
+        __m256i input;
+        if (len-i >= 32)
+        {
+            input = _mm256_loadu_si256((const __m256i*)(src+i));
+        }
+        else
+        {
+            // Zero padding is ASCII, so a sequence cut off by the end of the
+            // string is reported as TOO_SHORT.
+            memcpy(tail, src+i, len-i);
+            input = _mm256_load_si256((const __m256i*)tail);
+        }
+
+        if (_mm256_movemask_epi8(input) == 0)
+        {
+            error = _mm256_or_si256(error, prev_incomplete);
+        }
+        else
+        {
+            *is_ascii = false;
+            error = _mm256_or_si256(error,
+                _dstr_utf8_check_multibyte_avx2(input, prev_input));
+            prev_incomplete = _dstr_utf8_is_incomplete_avx2(input);
+        }
+        prev_input = input;
+    }
+    error = _mm256_or_si256(error, prev_incomplete);
+    return _mm256_testz_si256(error, error);
+}
+#endif // DA_AVX2_VARIANTS
+
+bool dstr_utf8_validate(darray(char) dstr)
+{
+    uint64_t* flags = DA_P_HASH_FROM_HANDLE(dstr);
+    if (*flags & DSTR_FLAG_UTF8)
+        return true;
+
+    size_t len = dstr_length(dstr);
+    bool is_ascii = true;
+    bool valid;
+#if DA_AVX2_VARIANTS
+    if (_da_cpu_has_avx2())
+        valid = _dstr_utf8_validate_avx2(dstr, len, &is_ascii);
+    else
+#endif
+        valid = _dstr_utf8_validate_scalar(dstr, len, &is_ascii);
+
+    // Other owners of a shared dstring may be reading the header.
+    if (valid && !DA_IS_SHARED(dstr))
+        *flags |= DSTR_FLAG_UTF8 | (is_ascii ? DSTR_FLAG_ASCII : 0);
+    return valid;
+}
+
+// UTF-8 codepoints are counted by counting the bytes that are not continuation
+// bytes (10______). As signed chars continuation bytes are [-128, -65].
+static inline bool _dstr_utf8_is_lead(char c)
+{
+    return (signed char)c > -65;
+}
+
+#if DA_SSE2
+static inline int _dstr_utf8_count_leads_sse2(const char* src)
+{
+    __m128i chunk = _mm_loadu_si128((const __m128i*)src);
+    __m128i leads = _mm_cmpgt_epi8(chunk, _mm_set1_epi8(-65));
+    return __builtin_popcount((unsigned)_mm_movemask_epi8(leads));
+}
+#endif
+
+size_t dstr_utf8_count(const darray(char) dstr)
+{
+    size_t len = dstr_length(dstr);
+    if (DA_FLAGS_FROM_HANDLE(dstr) & DSTR_FLAG_ASCII)
+        return len;
+
+    size_t count = 0;
+    size_t i = 0;
+#if DA_SSE2
+    for (; i+16 <= len; i += 16)
+        count += _dstr_utf8_count_leads_sse2(dstr+i);
+#endif
+    for (; i < len; ++i)
+        count += _dstr_utf8_is_lead(dstr[i]);
+    return count;
+}
+
+long dstr_utf8_index(const darray(char) dstr, size_t index)
+{
+    size_t len = dstr_length(dstr);
+    if (DA_FLAGS_FROM_HANDLE(dstr) & DSTR_FLAG_ASCII)
+        return index < len ? (long)index : -1;
+
+    // Skip whole chunks that end before the target codepoint, then scan.
+    size_t remaining = index;
+    size_t i = 0;
+#if DA_SSE2
+    for (; i+16 <= len; i += 16)
+    {
+        size_t nleads = (size_t)_dstr_utf8_count_leads_sse2(dstr+i);
+        if (nleads > remaining)
+            break;
+        remaining -= nleads;
+    }
+#endif
+    for (; i < len; ++i)
+    {
+        if (!_dstr_utf8_is_lead(dstr[i]))
+            continue;
+        if (remaining == 0)
+            return (long)i;
+        remaining -= 1;
+    }
+    return -1;
+}
+
+//////////////////////////////// SERIALIZATION /////////////////////////////////
+// Headers and data are handed to `writev` together so that the data is never
+// copied into a staging buffer. `writev` and `read` may move fewer bytes than
+// asked for, so both are called in a loop.
+#ifdef IOV_MAX
+#   define DA_IOV_MAX IOV_MAX
+#else
+#   define DA_IOV_MAX 16
+#endif
+#define DA_READ_CHUNK_MAX ((size_t)1 << 30)
+
+struct _da_file_header
+{
+    char magic[4];
+    uint32_t version;
+    uint64_t flags;
+    uint64_t elemsz;
+    uint64_t length;
+    uint64_t checksum;
+};
+
+struct _da_container_header
+{
+    char magic[4];
+    uint32_t version;
+    uint64_t count;
+};
+
+static bool _da_writev_all(int fd, struct iovec* iov, size_t iovcnt)
+{
+    while (iovcnt > 0)
+    {
+        ssize_t nwritten = writev(fd, iov,
+            (int)(iovcnt < DA_IOV_MAX ? iovcnt : DA_IOV_MAX));
+        if (nwritten < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            return false;
+        }
+        size_t n = (size_t)nwritten;
+        while (iovcnt > 0 && n >= iov->iov_len)
+        {
+            n -= iov->iov_len;
+            ++iov;
+            --iovcnt;
+        }
+        if (iovcnt > 0)
+        {
+            iov->iov_base = (char*)iov->iov_base + n;
+            iov->iov_len -= n;
+        }
+    }
+    return true;
+}
+
+// Returns false on a read error or if the file ends before `nbytes` are read.
+static bool _da_read_all(int fd, void* dest, size_t nbytes)
+{
+    while (nbytes > 0)
+    {
+        ssize_t nread = read(fd, dest,
+            nbytes < DA_READ_CHUNK_MAX ? nbytes : DA_READ_CHUNK_MAX);
+        if (nread < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            return false;
+        }
+        if (nread == 0)
+            return false;
+        dest = (char*)dest + nread;
+        nbytes -= (size_t)nread;
+    }
+    return true;
+}
+
+// File checksums are CRC-32C so that they never change with `dstr_hash`. The
+// scalar version processes 8 bytes per step with eight 256 entry tables.
+#define DA_CRC32C_POLY 0x82F63B78u
+
+static uint32_t _da_crc32c_table[8][256];
+static pthread_once_t _da_crc32c_once = PTHREAD_ONCE_INIT;
+
+static void _da_crc32c_init(void)
+{
+    for (uint32_t i = 0; i < 256; ++i)
+    {
+        uint32_t crc = i;
+        for (int k = 0; k < 8; ++k)
+            crc = crc & 1 ? (crc >> 1) ^ DA_CRC32C_POLY : crc >> 1;
+        _da_crc32c_table[0][i] = crc;
+    }
+    for (int t = 1; t < 8; ++t)
+    {
+        for (uint32_t i = 0; i < 256; ++i)
+        {
+            uint32_t prev = _da_crc32c_table[t-1][i];
+            _da_crc32c_table[t][i] =
+                (prev >> 8) ^ _da_crc32c_table[0][prev & 0xFF];
+        }
+    }
+}
+
+static uint32_t _da_crc32c_scalar(uint32_t crc, const unsigned char* p,
+    size_t len)
+{
+    pthread_once(&_da_crc32c_once, _da_crc32c_init);
+    for (; len >= 8; p += 8, len -= 8)
+    {
+        uint32_t lo = crc ^ ((uint32_t)p[0] | (uint32_t)p[1] << 8
+            | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24);
+        crc = _da_crc32c_table[7][lo & 0xFF]
+            ^ _da_crc32c_table[6][(lo >> 8) & 0xFF]
+            ^ _da_crc32c_table[5][(lo >> 16) & 0xFF]
+            ^ _da_crc32c_table[4][lo >> 24]
+            ^ _da_crc32c_table[3][p[4]] ^ _da_crc32c_table[2][p[5]]
+            ^ _da_crc32c_table[1][p[6]] ^ _da_crc32c_table[0][p[7]];
+    }
+    for (; len > 0; ++p, --len)
+        crc = (crc >> 8) ^ _da_crc32c_table[0][(crc ^ *p) & 0xFF];
+    return crc;
+}
+
+#if DA_SSE42_VARIANTS
+DA_SSE42_TARGET
+static uint32_t _da_crc32c_sse42(uint32_t crc, const unsigned char* p,
+    size_t len)
+{
+#if defined(__x86_64__)
+    uint64_t crc64 = crc;
+    for (; len >= 8; p += 8, len -= 8)
+    {
+        uint64_t word;
+        memcpy(&word, p, 8);
+        crc64 = _mm_crc32_u64(crc64, word);
+    }
+    crc = (uint32_t)crc64;
+#endif
+    for (; len >= 4; p += 4, len -= 4)
+    {
+        uint32_t word;
+        memcpy(&word, p, 4);
+        crc = _mm_crc32_u32(crc, word);
+    }
+    for (; len > 0; ++p, --len)
+        crc = _mm_crc32_u8(crc, *p);
+    return crc;
+}
+#endif // DA_SSE42_VARIANTS
+
+static uint32_t _da_crc32c(const void* src, size_t len)
+{
+    uint32_t crc = 0xFFFFFFFFu;
+#if DA_SSE42_VARIANTS
+    if (_da_cpu_has_sse42())
+        return ~_da_crc32c_sse42(crc, src, len);
+#endif
+    return ~_da_crc32c_scalar(crc, src, len);
+}
+
+static void _da_file_header_init(struct _da_file_header* header,
+    const void* darr, unsigned flags)
+{
+    size_t nbytes = da_length(darr)*da_sizeof_elem(darr);
+    memcpy(header->magic, "DARR", 4);
+    header->version = DA_FILE_VERSION;
+    header->flags = flags & DA_FILE_CHECKSUM;
+    header->elemsz = da_sizeof_elem(darr);
+    header->length = da_length(darr);
+    header->checksum = flags & DA_FILE_CHECKSUM
+        ? _da_crc32c(darr, nbytes) : 0;
+}
+
+bool da_write_fd(const void* darr, int fd, unsigned flags)
+{
+    struct _da_file_header header;
+    _da_file_header_init(&header, darr, flags);
+    struct iovec iov[2] = {
+        {&header, sizeof(header)},
+        {(void*)darr, da_length(darr)*da_sizeof_elem(darr)}
+    };
+    return _da_writev_all(fd, iov, 2);
+}
+
+void* da_read_fd(int fd)
+{
+    struct _da_file_header header;
+    if (!_da_read_all(fd, &header, sizeof(header))
+        || memcmp(header.magic, "DARR", 4) != 0
+        || header.version != DA_FILE_VERSION
+        || header.elemsz == 0 || header.elemsz > UINT32_MAX
+        || header.length > (SIZE_MAX - sizeof(struct _darray))/header.elemsz)
+        return NULL;
+    void* darr = da_alloc_exact(header.length, header.elemsz);
+    if (darr == NULL)
+        return NULL;
+    size_t nbytes = header.length*header.elemsz;
+    if (!_da_read_all(fd, darr, nbytes)
+        || ((header.flags & DA_FILE_CHECKSUM)
+            && _da_crc32c(darr, nbytes) != header.checksum))
+    {
+        da_free(darr);
+        return NULL;
+    }
+    return darr;
+}
+
+bool da_write_many_fd(void* const* darrs, int fd, unsigned flags)
+{
+    size_t count = da_length(darrs);
+    struct _da_container_header container;
+    memcpy(container.magic, "DACN", 4);
+    container.version = DA_FILE_VERSION;
+    container.count = count;
+    struct _da_file_header* headers =
+        da_alloc(count, sizeof(struct _da_file_header));
+    struct iovec* iov = da_alloc(1 + 2*count, sizeof(struct iovec));
+    bool success = headers != NULL && iov != NULL;
+    if (success)
+    {
+        iov[0] = (struct iovec){&container, sizeof(container)};
+        for (size_t i = 0; i < count; ++i)
+        {
+            _da_file_header_init(&headers[i], darrs[i], flags);
+            iov[1 + 2*i] = (struct iovec){&headers[i], sizeof(headers[i])};
+            iov[2 + 2*i] = (struct iovec){darrs[i],
+                da_length(darrs[i])*da_sizeof_elem(darrs[i])};
+        }
+        success = _da_writev_all(fd, iov, 1 + 2*count);
+    }
+    if (headers != NULL)
+        da_free(headers);
+    if (iov != NULL)
+        da_free(iov);
+    return success;
+}
+
+void** da_read_many_fd(int fd)
+{
+    struct _da_container_header container;
+    if (!_da_read_all(fd, &container, sizeof(container))
+        || memcmp(container.magic, "DACN", 4) != 0
+        || container.version != DA_FILE_VERSION)
+        return NULL;
+    void** darrs = da_alloc(0, sizeof(void*));
+    if (darrs == NULL)
+        return NULL;
+    for (uint64_t i = 0; i < container.count; ++i)
+    {
+        void* darr = da_read_fd(fd);
+        void** grown = darr == NULL
+            ? NULL : da_insert_arr(darrs, da_length(darrs), &darr, 1);
+        if (grown == NULL)
+        {
+            if (darr != NULL)
+                da_free(darr);
+            for (size_t k = 0; k < da_length(darrs); ++k)
+                da_free(darrs[k]);
+            da_free(darrs);
+            return NULL;
+        }
+        darrs = grown;
+    }
+    return darrs;
+}
+
+///////////////////////////////// MAPPED FILES /////////////////////////////////
+// Every mapping is recorded with its size and file descriptor so that it can be
+// grown, synced, and unmapped from its handle alone. Read only mappings close
+// their file descriptor right away and record -1. The file is larger than the
+// mapping if shrinking it failed.
+struct _da_mapping
+{
+    struct _darray* head;
+    size_t size;
+    size_t file_size;
+    int fd;
+};
+
+static pthread_mutex_t _da_mappings_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct _da_mapping* _da_mappings = NULL;
+
+// Must hold `_da_mappings_lock`.
+static struct _da_mapping* _da_mapping_find(const struct _darray* head)
+{
+    size_t nmappings = _da_mappings == NULL ? 0 : da_length(_da_mappings);
+    for (size_t i = 0; i < nmappings; ++i)
+    {
+        if (_da_mappings[i].head == head)
+            return &_da_mappings[i];
+    }
+    return NULL;
+}
+
+// Map `size` bytes of the file of `fd`. Returns the header of the darray in
+// the file or NULL if the file does not hold a darray of `elemsz` elements.
+static struct _darray* _da_map_fd(int fd, size_t size, size_t elemsz,
+    bool writable)
+{
+    if (size < sizeof(struct _darray))
+        return NULL;
+    struct _darray* head = mmap(NULL, size, PROT_READ | PROT_WRITE,
+        writable ? MAP_SHARED : MAP_PRIVATE, fd, 0);
+    if (head == MAP_FAILED)
+        return NULL;
+    if (head->_elemsz != elemsz || head->_length > head->_capacity
+        || head->_capacity > (size - sizeof(struct _darray))/elemsz)
+    {
+        munmap(head, size);
+        return NULL;
+    }
+    // The cached hash may be stale if the file was changed by other means, and
+    // the other owners of a darray that was shared when it was unmapped are
+    // gone.
+    head->_refcount = 0;
+    head->_hash = DA_FLAG_MAPPED;
+    return head;
+}
+
+void* da_map_file(const char* path, size_t size, unsigned flags)
+{
+    bool writable = flags & (DA_MAP_READ_WRITE | DA_MAP_CREATE);
+    int fd = open(path, !writable ? O_RDONLY
+        : flags & DA_MAP_CREATE ? O_RDWR | O_CREAT : O_RDWR, 0644);
+    if (fd < 0 || size == 0 || size > UINT32_MAX)
+    {
+        if (fd >= 0)
+            close(fd);
+        return NULL;
+    }
+
+    struct stat st;
+    struct _darray* head = NULL;
+    size_t map_size = 0;
+    if (fstat(fd, &st) == 0)
+    {
+        map_size = (size_t)st.st_size;
+        if (map_size == 0 && (flags & DA_MAP_CREATE))
+        {
+            struct _darray empty = {._elemsz = (uint32_t)size};
+            struct iovec iov = {&empty, sizeof(empty)};
+            if (_da_writev_all(fd, &iov, 1))
+                map_size = sizeof(empty);
+        }
+        head = _da_map_fd(fd, map_size, size, writable);
+    }
+
+    pthread_mutex_lock(&_da_mappings_lock);
+    struct _da_mapping mapping =
+        {head, map_size, map_size, writable ? fd : -1};
+    struct _da_mapping* mappings = head == NULL ? NULL : _da_mappings == NULL
+        ? da_alloc(0, sizeof(struct _da_mapping)) : _da_mappings;
+    if (mappings != NULL)
+    {
+        _da_mappings = mappings;
+        mappings = da_insert_arr(mappings, da_length(mappings), &mapping, 1);
+    }
+    if (mappings != NULL)
+        _da_mappings = mappings;
+    pthread_mutex_unlock(&_da_mappings_lock);
+
+    if (mappings == NULL)
+    {
+        if (head != NULL)
+            munmap(head, map_size);
+        close(fd);
+        return NULL;
+    }
+    if (!writable)
+        close(fd);
+    return head->_data;
+}
+
+// Grow the file before the mapping and shrink it after, so that the mapping
+// never extends past the end of the file.
+static struct _darray* _da_mapped_realloc(void* darr, size_t capacity)
+{
+    struct _darray* head = (struct _darray*)DA_P_HEAD_FROM_HANDLE(darr);
+    size_t new_size = sizeof(struct _darray) + capacity*head->_elemsz;
+    void* map = MAP_FAILED;
+    pthread_mutex_lock(&_da_mappings_lock);
+    struct _da_mapping* mapping = _da_mapping_find(head);
+    if (mapping != NULL && mapping->fd >= 0
+        && (new_size <= mapping->file_size
+            || ftruncate(mapping->fd, (off_t)new_size) == 0))
+    {
+        if (new_size > mapping->file_size)
+            mapping->file_size = new_size;
+#if defined(__linux__)
+        map = mremap(head, mapping->size, new_size, MREMAP_MAYMOVE);
+#else
+        map = mmap(NULL, new_size, PROT_READ | PROT_WRITE, MAP_SHARED,
+            mapping->fd, 0);
+        if (map != MAP_FAILED)
+            munmap(head, mapping->size);
+#endif
+        if (map != MAP_FAILED)
+        {
+            // If the file cannot be shrunk it keeps its larger size, which
+            // still holds the darray.
+            if (new_size < mapping->file_size
+                && ftruncate(mapping->fd, (off_t)new_size) == 0)
+                mapping->file_size = new_size;
+            mapping->head = map;
+            mapping->size = new_size;
+        }
+    }
+    pthread_mutex_unlock(&_da_mappings_lock);
+    return map == MAP_FAILED ? NULL : map;
+}
+
+bool da_sync(void* darr)
+{
+    struct _darray* head = (struct _darray*)DA_P_HEAD_FROM_HANDLE(darr);
+    bool success = false;
+    pthread_mutex_lock(&_da_mappings_lock);
+    struct _da_mapping* mapping = _da_mapping_find(head);
+    if (mapping != NULL)
+        success = mapping->fd < 0 || msync(head, mapping->size, MS_SYNC) == 0;
+    pthread_mutex_unlock(&_da_mappings_lock);
+    return success;
+}
+
+// Unmap the block of a mapped darray whose last reference was released.
+static bool _da_unmap_block(void* darr)
+{
+    struct _darray* head = (struct _darray*)DA_P_HEAD_FROM_HANDLE(darr);
+    pthread_mutex_lock(&_da_mappings_lock);
+    struct _da_mapping* mapping = _da_mapping_find(head);
+    struct _da_mapping found = {NULL, 0, 0, -1};
+    if (mapping != NULL)
+    {
+        found = *mapping;
+        *mapping = _da_mappings[da_length(_da_mappings) - 1];
+        *DA_P_LENGTH_FROM_HANDLE(_da_mappings) -= 1;
+    }
+    pthread_mutex_unlock(&_da_mappings_lock);
+    if (found.head == NULL)
+        return false;
+    bool success = munmap(found.head, found.size) == 0;
+    if (found.fd >= 0)
+        close(found.fd);
+    return success;
+}
+
+bool da_unmap(void* darr)
+{
+    struct _darray* head = (struct _darray*)DA_P_HEAD_FROM_HANDLE(darr);
+    pthread_mutex_lock(&_da_mappings_lock);
+    bool mapped = _da_mapping_find(head) != NULL;
+    pthread_mutex_unlock(&_da_mappings_lock);
+    if (!mapped)
+        return false;
+    // Like `da_free`, only the last owner of a shared darray unmaps it.
+    if (!_da_release(darr))
+        return true;
+    return _da_unmap_block(darr);
+}
+
+/////////////////////////////// BUFFERED READING ///////////////////////////////
+bool da_reader_init(struct da_reader* reader, int fd)
+{
+    reader->_buf = da_alloc_exact(DA_READER_BUFFER_SIZE, sizeof(char));
+    if (reader->_buf == NULL)
+        return false;
+    reader->_fd = fd;
+    reader->_begin = 0;
+    reader->_end = 0;
+    reader->_eof = false;
+    reader->_failed = false;
+    return true;
+}
+
+void da_reader_free(struct da_reader* reader)
+{
+    da_free(reader->_buf);
+    reader->_buf = NULL;
+    reader->_begin = 0;
+    reader->_end = 0;
+}
+
+bool da_reader_failed(const struct da_reader* reader)
+{
+    return reader->_failed;
+}
+
+// Read up to `nbytes` bytes from the file descriptor of `reader` into `dest`.
+// Returns the number of bytes read, or 0 at the end of the input or on error.
+static size_t _da_reader_read(struct da_reader* reader, void* dest,
+    size_t nbytes)
+{
+    if (reader->_eof || reader->_failed)
+        return 0;
+    while (true)
+    {
+        ssize_t nread = read(reader->_fd, dest,
+            nbytes < DA_READ_CHUNK_MAX ? nbytes : DA_READ_CHUNK_MAX);
+        if (nread > 0)
+            return (size_t)nread;
+        if (nread < 0 && errno == EINTR)
+            continue;
+        if (nread < 0)
+            reader->_failed = true;
+        else
+            reader->_eof = true;
+        return 0;
+    }
+}
+
+// Refill the buffer of `reader` once it has been consumed. Returns false at
+// the end of the input or on error.
+static bool _da_reader_fill(struct da_reader* reader)
+{
+    reader->_begin = 0;
+    reader->_end = _da_reader_read(reader, reader->_buf, DA_READER_BUFFER_SIZE);
+    return reader->_end != 0;
+}
+
+size_t da_read_chunk(struct da_reader* reader, void** darr, size_t nelem)
+{
+    size_t size = da_sizeof_elem(*darr);
+    void* chunk = _da_reuse(*darr, nelem);
+    if (chunk == NULL)
+    {
+        reader->_failed = true;
+        return 0;
+    }
+    *darr = chunk;
+    char* dest = chunk;
+    size_t nbytes = nelem*size;
+    size_t ncopied = 0;
+    while (ncopied < nbytes)
+    {
+        if (reader->_begin == reader->_end)
+        {
+            // Bypass the buffer when it would only add a copy.
+            if (nbytes - ncopied >= DA_READER_BUFFER_SIZE)
+            {
+                size_t nread =
+                    _da_reader_read(reader, dest+ncopied, nbytes-ncopied);
+                if (nread == 0)
+                    break;
+                ncopied += nread;
+                continue;
+            }
+            if (!_da_reader_fill(reader))
+                break;
+        }
+        size_t n = reader->_end - reader->_begin;
+        if (n > nbytes - ncopied)
+            n = nbytes - ncopied;
+        memcpy(dest+ncopied, reader->_buf+reader->_begin, n);
+        reader->_begin += n;
+        ncopied += n;
+    }
+    *DA_P_LENGTH_FROM_HANDLE(chunk) = ncopied/size;
+    _da_invalidate_content_cache(chunk);
+    return ncopied/size;
+}
+
+bool dstr_read_line(struct da_reader* reader, darray(char)* dstr)
+{
+    // An unshared dstring always has room for its null terminator, so only a
+    // shared one can fail here, and it is then left untouched.
+    darray(char) line = _da_reuse(*dstr, 1);
+    if (line == NULL)
+    {
+        reader->_failed = true;
+        return false;
+    }
+    bool read_any = false;
+    bool found = false;
+    while (!found)
+    {
+        if (reader->_begin == reader->_end && !_da_reader_fill(reader))
+            break;
+        const char* begin = reader->_buf + reader->_begin;
+        size_t nbuffered = reader->_end - reader->_begin;
+        const char* newline = memchr(begin, '\n', nbuffered);
+        size_t n = newline != NULL ? (size_t)(newline - begin) : nbuffered;
+        // The capacity reserved so far always leaves room for the null
+        // terminator, so `line` stays a valid dstring if this fails.
+        darray(char) grown = da_reserve(line, n+1);
+        if (grown == NULL)
+        {
+            reader->_failed = true;
+            break;
+        }
+        line = grown;
+        memcpy(line+da_length(line), begin, n);
+        *DA_P_LENGTH_FROM_HANDLE(line) += n;
+        reader->_begin += n + (newline != NULL);
+        read_any = true;
+        found = newline != NULL;
+    }
+    line[da_length(line)] = '\0';
+    *DA_P_LENGTH_FROM_HANDLE(line) += 1;
+    _da_invalidate_content_cache(line);
+    *dstr = line;
+    return read_any && !reader->_failed;
 }
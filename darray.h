@@ -28,6 +28,7 @@
 #include <stddef.h>
 #include <stdlib.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <string.h>
 
 #if defined(__GNUC__) || defined(__clang__) // GNU C compiler attributes
@@ -61,7 +62,8 @@
  * @param nelem : Initial number of elements in the darray.
  * @param size : `sizeof` each element.
  *
- * @return Pointer to a new darray on success. `NULL` on allocation failure.
+ * @return Pointer to a new darray on success. `NULL` on allocation failure or
+ *  if `size` is larger than `UINT32_MAX`.
  */
 void* da_alloc(size_t nelem, size_t size) DA_WARN_UNUSED_RESULT;
 
@@ -72,17 +74,63 @@ void* da_alloc(size_t nelem, size_t size) DA_WARN_UNUSED_RESULT;
  * @param nelem : Initial number of elements in the darray.
  * @param size : `sizeof` each element.
  *
- * @return Pointer to a new darray on success. `NULL` on allocation failure.
+ * @return Pointer to a new darray on success. `NULL` on allocation failure or
+ *  if `size` is larger than `UINT32_MAX`.
  */
 void* da_alloc_exact(size_t nelem, size_t size) DA_WARN_UNUSED_RESULT;
 
 /**@function
- * @brief Free a darray.
+ * @brief Free a darray. If the darray is shared, only the reference held by
+ *  `darr` is released and the memory is freed by the last owner.
  *
  * @param darr : Target darray to be freed.
  */
 void da_free(void* darr);
 
+/**@function
+ * @brief Share a darray without copying it. The returned handle is the same as
+ *  `darr` and must be freed with `da_free` like any other darray. Functions
+ *  that return a new darray handle (`da_push`, `da_insert`, `da_insert_arr`,
+ *  `da_concat`, `da_resize`, `da_resize_exact`, `da_reserve`) copy a shared
+ *  darray before modifying it, so other owners keep seeing the old contents.
+ *
+ * @param darr : Target darray.
+ *
+ * @return `darr`.
+ *
+ * @note Functions that modify a darray in place without returning a handle
+ *  (`da_pop`, `da_remove`, `da_remove_arr`, `da_swap`, `da_fill`, the sorting
+ *  functions, element assignment, ...) must not be called on a shared darray.
+ *  Call `da_unshare` first.
+ * @note Handles may be shared and freed from several threads at once. Give
+ *  every other thread its own handle from `da_share` rather than the handle
+ *  of the owner that modifies the darray, and only read through it. Cached
+ *  dstring data (`dstr_hash_cached`, `dstr_utf8_validate`) is not stored
+ *  while a dstring is shared, so those functions are safe to call on it.
+ */
+void* da_share(void* darr);
+
+/**@function
+ * @brief Get a handle to a darray that has no other owners, copying the
+ *  darray if it is shared.
+ *
+ * @param darr : Target darray. If `da_unshare` copies the darray, the
+ *  reference held by `darr` is released.
+ *
+ * @return `darr` if it has no other owners, otherwise a copy of `darr`.
+ *  `NULL` on allocation failure, in which case `darr` is left untouched.
+ */
+void* da_unshare(void* darr) DA_WARN_UNUSED_RESULT;
+
+/**@function
+ * @brief Returns `true` if a darray has more than one owner.
+ *
+ * @param darr : Target darray.
+ *
+ * @return `true` if `darr` is shared.
+ */
+bool da_is_shared(const void* darr);
+
 /**@function
  * @brief Returns the number of elements in a darray.
  *
@@ -257,6 +305,8 @@ void* da_insert_arr(void* darr, size_t index, const void* src, size_t nelem)
  * @note Affects the length of the darray.
  * @note `da_remove_arr` will never reallocate memory, so removing is always
  *  allocation-safe.
+ * @note `da_remove_arr` modifies `darr` in place and does not support shared
+ *  darrays. Call `da_unshare` first.
  */
 void da_remove_arr(void* darr, size_t index, size_t nelem);
 
@@ -276,6 +326,8 @@ void da_remove_arr(void* darr, size_t index, size_t nelem);
  *  may be faster than da_swap in many cases as optimizations including full
  *  word assignment and large scale memcopy generated by the compiler almost
  *  always outperform a byte by byte swap.
+ * @note `da_swap` modifies `darr` in place and does not support shared
+ *  darrays. Call `da_unshare` first.
  */
 void da_swap(void* darr, size_t index_a, size_t index_b);
 
@@ -306,6 +358,9 @@ void* da_concat(void* dest, const void* src, size_t nelem)
  *
  * @param darr : Target darray.
  * @param value : Value to fill the array with.
+ *
+ * @note `da_fill` modifies `darr` in place and does not support shared
+ *  darrays. Call `da_unshare` first.
  */
 #define /* void */da_fill(/* ELEM_TYPE* */darr, /* ELEM_TYPE */value)          \
                                                            _da_fill(darr, value)
@@ -321,76 +376,1475 @@ void* da_concat(void* dest, const void* src, size_t nelem)
 #define da_foreach(/* ELEM_TYPE* */darr, itername)                             \
                                                      _da_foreach(darr, itername)
 
-/////////////////////////////////// INTERNAL ///////////////////////////////////
-struct _darray
+/**@function
+ * @brief Returns the index of the first element of `darr` equal to `value`,
+ *  or `da_length(darr)` if there is no such element.
+ *
+ * @param darr : Target darray.
+ * @param value : Pointer to a value of the element type of `darr`.
+ *
+ * @note Elements are compared byte by byte with `da_sizeof_elem(darr)` bytes
+ *  of `value`, as with `memcmp`. Elements of 1, 2, 4, and 8 bytes are compared
+ *  many at a time with SIMD instructions where available.
+ */
+size_t da_find(const void* darr, const void* value);
+
+/**@function
+ * @brief Returns the index of the last element of `darr` equal to `value`,
+ *  or `da_length(darr)` if there is no such element. Elements are compared as
+ *  in `da_find`.
+ *
+ * @param darr : Target darray.
+ * @param value : Pointer to a value of the element type of `darr`.
+ */
+size_t da_find_last(const void* darr, const void* value);
+
+/**@function
+ * @brief Returns the index of the first element in the index range
+ *  [`begin`, `end`) of `darr` equal to `value`, or `end` if there is no such
+ *  element. Elements are compared as in `da_find`.
+ *
+ * @param darr : Target darray.
+ * @param begin : Index of the first element searched.
+ * @param end : Index one past the last element searched. Must not be less
+ *  than `begin` or greater than `da_length(darr)`.
+ * @param value : Pointer to a value of the element type of `darr`.
+ */
+size_t da_find_range(const void* darr, size_t begin, size_t end,
+    const void* value);
+
+/**@function
+ * @brief Returns the number of elements of `darr` equal to `value`. Elements
+ *  are compared as in `da_find`.
+ *
+ * @param darr : Target darray.
+ * @param value : Pointer to a value of the element type of `darr`.
+ */
+size_t da_count(const void* darr, const void* value);
+
+/**@function
+ * @brief Returns `true` if an element of `darr` is equal to `value`.
+ *  Elements are compared as in `da_find`.
+ *
+ * @param darr : Target darray.
+ * @param value : Pointer to a value of the element type of `darr`.
+ */
+bool da_contains(const void* darr, const void* value);
+
+/**@function
+ * @brief Sort the elements of `darr` in ascending order according to
+ *  `compar`. The sort is not stable.
+ *
+ * @param darr : Target darray.
+ * @param compar : Comparison function with the same semantics as the
+ *  comparison function of `qsort`.
+ *
+ * @note `da_sort` is a pattern-defeating quicksort. Sorted, reverse sorted,
+ *  and mostly equal inputs are sorted in linear time, and the worst case is
+ *  O(n log n).
+ */
+void da_sort(void* darr, int (*compar)(const void*, const void*));
+
+/**@function
+ * @brief Sort the elements of `darr` in ascending order according to
+ *  `compar`. Elements that compare equal keep their relative order.
+ *
+ * @param darr : Target darray.
+ * @param compar : Comparison function with the same semantics as the
+ *  comparison function of `qsort`.
+ *
+ * @note `da_sort_stable` allocates a scratch buffer the size of `darr`. If the
+ *  allocation fails it falls back to a slower in-place merge sort.
+ */
+void da_sort_stable(void* darr, int (*compar)(const void*, const void*));
+
+/**@function
+ * @brief Sort the elements of `darr` in ascending order according to
+ *  `compar` using up to `nthreads` threads. The sort is not stable.
+ *
+ * @param darr : Target darray.
+ * @param compar : Comparison function with the same semantics as the
+ *  comparison function of `qsort`. Must be safe to call concurrently.
+ * @param nthreads : Maximum number of threads to sort with, including the
+ *  calling thread. If `nthreads` is 0, or larger than the limit set with
+ *  `da_parallel_set_max_threads`, that limit is used.
+ *
+ * @note Chunks of `darr` are sorted concurrently and then merged in parallel
+ *  through a scratch darray the size of `darr`. Small darrays, and darrays
+ *  for which no scratch darray can be allocated, are sorted by `da_sort` on
+ *  the calling thread.
+ * @note The work runs on the `da_parallel_for` thread pool. A call from inside
+ *  the body of a `da_parallel_for` loop sorts on the calling thread.
+ * @note Programs using `da_sort_parallel` must be linked with `-pthread`.
+ */
+void da_sort_parallel(void* darr, int (*compar)(const void*, const void*),
+    size_t nthreads);
+
+/**@macro
+ * @brief Sort the elements of `darr` in ascending order. The element type of
+ *  `darr` must be an integer type or `float`/`double`, which is detected at
+ *  compile time.
+ *
+ * @param darr : Target darray.
+ *
+ * @note Sorting is done with an LSD radix sort and no comparisons. Floating
+ *  point values are ordered -NaN < -inf < ... < -0.0 < +0.0 < ... < +inf < NaN.
+ */
+#define /* void */da_sort_numeric(/* ELEM_TYPE* */darr)                       \
+                               _da_sort_numeric(darr, DA_SORT_KEY_KIND(*(darr)))
+
+/**@function
+ * @brief Returns the index of the first element of the sorted darray `darr`
+ *  that does not compare less than `key`, or `da_length(darr)` if there is no
+ *  such element.
+ *
+ * @param darr : Target darray, sorted according to `compar`.
+ * @param key : Pointer to a value of the element type of `darr`.
+ * @param compar : Comparison function with the same semantics as the
+ *  comparison function of `qsort`.
+ *
+ * @return Index at which `key` could be inserted without breaking the order
+ *  of `darr`, before any elements equal to `key`.
+ */
+size_t da_lower_bound(const void* darr, const void* key,
+    int (*compar)(const void*, const void*));
+
+/**@function
+ * @brief Returns the index of the first element of the sorted darray `darr`
+ *  that compares greater than `key`, or `da_length(darr)` if there is no such
+ *  element.
+ *
+ * @param darr : Target darray, sorted according to `compar`.
+ * @param key : Pointer to a value of the element type of `darr`.
+ * @param compar : Comparison function with the same semantics as the
+ *  comparison function of `qsort`.
+ *
+ * @return Index at which `key` could be inserted without breaking the order
+ *  of `darr`, after any elements equal to `key`.
+ */
+size_t da_upper_bound(const void* darr, const void* key,
+    int (*compar)(const void*, const void*));
+
+/**@function
+ * @brief Insert the value pointed to by `value` into the sorted darray `darr`,
+ *  after any elements equal to it.
+ *
+ * @param darr : Target darray, sorted according to `compar`. Upon function
+ *  completion, `darr` may or may not point to its previous block on the heap,
+ *  potentially breaking references.
+ * @param value : Pointer to the value to insert. Must not point into `darr`.
+ * @param compar : Comparison function with the same semantics as the
+ *  comparison function of `qsort`.
+ *
+ * @return Pointer to the new location of the darray upon successful function
+ *  completion. If `da_insert_sorted` returns `NULL` reallocation failed and
+ *  `darr` is left untouched.
+ *
+ * @note Affects the length of the darray.
+ */
+void* da_insert_sorted(void* darr, const void* value,
+    int (*compar)(const void*, const void*)) DA_WARN_UNUSED_RESULT;
+
+/**@function
+ * @brief Remove all but the first element from every run of consecutive
+ *  elements of `darr` that compare equal. Removes all duplicates from a
+ *  sorted darray.
+ *
+ * @param darr : Target darray.
+ * @param compar : Comparison function with the same semantics as the
+ *  comparison function of `qsort`.
+ *
+ * @note Affects the length of the darray.
+ * @note `da_unique` will never reallocate memory.
+ */
+void da_unique(void* darr, int (*compar)(const void*, const void*));
+
+/**@function
+ * @brief Merge the sorted darrays `a` and `b` into a new sorted darray. Of
+ *  elements that compare equal, those from `a` come first.
+ *
+ * @param a : First sorted darray.
+ * @param b : Second sorted darray with the same element type as `a`.
+ * @param compar : Comparison function with the same semantics as the
+ *  comparison function of `qsort`.
+ *
+ * @return Pointer to a new darray on success. `NULL` on allocation failure.
+ */
+void* da_merge(const void* a, const void* b,
+    int (*compar)(const void*, const void*)) DA_WARN_UNUSED_RESULT;
+
+/**@function
+ * @brief Create a new sorted darray of the elements of the sorted darray `a`
+ *  that have an equal element in the sorted darray `b`. Each element of `b`
+ *  matches at most one element of `a`.
+ *
+ * @param a : First sorted darray.
+ * @param b : Second sorted darray with the same element type as `a`.
+ * @param compar : Comparison function with the same semantics as the
+ *  comparison function of `qsort`.
+ *
+ * @return Pointer to a new darray on success. `NULL` on allocation failure.
+ *
+ * @note The shorter darray is stepped through while the longer darray is
+ *  searched with galloping search, so intersecting a small darray with a
+ *  large one takes O(m log(n/m)) comparisons.
+ */
+void* da_intersect(const void* a, const void* b,
+    int (*compar)(const void*, const void*)) DA_WARN_UNUSED_RESULT;
+
+/**@function
+ * @brief Create a new sorted darray of the elements of the sorted darray `a`
+ *  that do not have an equal element in the sorted darray `b`. Each element
+ *  of `b` removes at most one element of `a`.
+ *
+ * @param a : First sorted darray.
+ * @param b : Second sorted darray with the same element type as `a`.
+ * @param compar : Comparison function with the same semantics as the
+ *  comparison function of `qsort`.
+ *
+ * @return Pointer to a new darray on success. `NULL` on allocation failure.
+ */
+void* da_difference(const void* a, const void* b,
+    int (*compar)(const void*, const void*)) DA_WARN_UNUSED_RESULT;
+
+/**@macro
+ * @brief Create a new sorted darray of the elements of `a` that are also in
+ *  `b`. `a` and `b` must hold the same integer type or `float`/`double`, be
+ *  sorted in the order of `da_sort_numeric`, and contain no duplicates.
+ *
+ * @param a : First sorted darray.
+ * @param b : Second sorted darray.
+ *
+ * @return Pointer to a new darray on success. `NULL` on allocation failure.
+ *
+ * @note 4 and 8 byte keys are intersected in blocks with SIMD instructions
+ *  where available. Floating point keys are equal only if they are bitwise
+ *  equal.
+ */
+#define /* ELEM_TYPE* */da_intersect_numeric(/* ELEM_TYPE* */a,                \
+    /* ELEM_TYPE* */b)                                                         \
+                             _da_intersect_numeric(a, b, DA_SORT_KEY_KIND(*(a)))
+
+/**@function
+ * @brief Call `fn` on every element of `darr` using the library's pool of
+ *  worker threads. `fn` receives a pointer to the element, the index of the
+ *  element, and `ctx`. Calls for different elements may happen concurrently
+ *  and in any order. `da_parallel_for` returns once every call has returned.
+ *
+ * @param darr : Target darray.
+ * @param fn : Function called for every element.
+ * @param ctx : Passed through to `fn`.
+ * @param grain : Number of consecutive elements a thread processes before it
+ *  checks for other work. Should be large enough that a grain of work costs
+ *  well over a microsecond. If `grain` is 0 a grain is picked from the length
+ *  of `darr`.
+ *
+ * @note Every thread starts with a contiguous slice of `darr`. Threads that
+ *  finish early steal work from the threads with the most work left.
+ * @note Pool threads are started on first use and live until the process
+ *  exits. Loops from different threads run one at a time. A call to
+ *  `da_parallel_for` from inside `fn` runs on the calling thread.
+ * @note Programs using `da_parallel_for` must be linked with `-pthread`.
+ */
+void da_parallel_for(void* darr, void (*fn)(void*, size_t, void*), void* ctx,
+    size_t grain);
+
+/**@function
+ * @brief Limit the number of threads used by `da_parallel_for`,
+ *  `da_sort_parallel`, and the numeric reductions, including the calling
+ *  thread.
+ *
+ * @param nthreads : Maximum number of threads. If `nthreads` is 0, which is
+ *  the default, one thread per online CPU is used.
+ */
+void da_parallel_set_max_threads(size_t nthreads);
+
+/**@function
+ * @brief Append a value to a darray from any number of threads at once without
+ *  locking. Slots are claimed from the capacity reserved beforehand with
+ *  `da_reserve` and the darray is never reallocated.
+ *
+ * @param darr : Target darray.
+ * @param value : Pointer to the value to be appended.
+ *
+ * @return `true` if the value was appended. `false` if the capacity of `darr`
+ *  is used up, in which case `value` is not stored and the slot claimed for it
+ *  is discarded. The length of `darr` then counts the discarded slot until
+ *  `da_seal` fixes it up.
+ *
+ * @note While appends are in progress the length of `darr` counts claimed
+ *  slots and may exceed its capacity. No other function may be called on
+ *  `darr` until every append has returned and `da_seal` has been called.
+ * @note Values appended by different threads are stored in the order their
+ *  slots were claimed.
+ */
+bool da_atomic_append(void* darr, const void* value);
+
+/**@function
+ * @brief End a series of `da_atomic_append` calls, setting the length of a
+ *  darray to the number of values that were appended.
+ *
+ * @param darr : Target darray. Every `da_atomic_append` call on `darr` must
+ *  have returned, and the appending threads must have been joined or
+ *  otherwise synchronized with the calling thread.
+ *
+ * @return `true` if every append succeeded. `false` if some values were
+ *  dropped because the capacity of `darr` was used up.
+ */
+bool da_seal(void* darr);
+
+/* A `struct da_collector` gives every thread that collects into it a private
+ * darray, so threads can push results without contending with each other.
+ * `da_collector_merge` then concatenates the private darrays into one.
+ */
+struct da_collector
 {
-    size_t _elemsz, _length, _capacity;
-    alignas(alignof(max_align_t)) char _data[];
+    size_t _elemsz;
+    uint64_t _id; // Identifies the collector in per-thread lookup caches.
+    darray(void*) _locals; // Per-thread darrays. NULL until first use.
 };
 
-#define DA_CAPACITY_FACTOR 1.3
-#define DA_CAPACITY_MIN 10
-#define DA_NEW_CAPACITY_FROM_LENGTH(length) ((length) < DA_CAPACITY_MIN ? \
-    DA_CAPACITY_MIN : ((length)*DA_CAPACITY_FACTOR))
+/**@function
+ * @brief Initialize `collector` for elements of size `size`. Never allocates
+ *  memory.
+ *
+ * @param collector : Uninitialized collector.
+ * @param size : `sizeof` each element.
+ */
+void da_collector_init(struct da_collector* collector, size_t size);
 
-#define DA_P_HEAD_FROM_HANDLE(darr_h) (((char*)darr_h)-sizeof(struct _darray))
-#define DA_P_SIZEOF_ELEM_FROM_HANDLE(darr_h) ((size_t*) \
-    (DA_P_HEAD_FROM_HANDLE(darr_h) + offsetof(struct _darray, _elemsz)))
-#define DA_P_LENGTH_FROM_HANDLE(darr_h) ((size_t*) \
-    (DA_P_HEAD_FROM_HANDLE(darr_h) + offsetof(struct _darray, _length)))
-#define DA_P_CAPACITY_FROM_HANDLE(darr_h) ((size_t*) \
-    (DA_P_HEAD_FROM_HANDLE(darr_h) + offsetof(struct _darray, _capacity)))
+/**@function
+ * @brief Free the memory owned by `collector`, including every per-thread
+ *  darray. `collector` is left empty and may be reused.
+ *
+ * @param collector : Target collector. No thread may be using it.
+ */
+void da_collector_free(struct da_collector* collector);
 
-// The following macros use GNU C and are only avaliable for compatible vendors.
-#if defined(__GNUC__) || defined(__clang__) // GNU C compilers
+/**@function
+ * @brief Get the calling thread's private darray of a collector, creating it
+ *  on first use.
+ *
+ * @param collector : Target collector.
+ *
+ * @return Pointer to the handle of the calling thread's darray, which the
+ *  thread may update freely, e.g. `*local = da_push(*local, value)`. `NULL` on
+ *  allocation failure.
+ *
+ * @note Only the first call from each thread takes a lock.
+ */
+void** da_collector_local(struct da_collector* collector);
 
-#define /* ELEM_TYPE* */_da_push(/* ELEM_TYPE* */darr, /* ELEM_TYPE */value)   \
-({                                                                             \
-    __auto_type _darr = darr;                                                  \
-    __auto_type _value = value;                                                \
-    if (*DA_P_LENGTH_FROM_HANDLE(_darr) == *DA_P_CAPACITY_FROM_HANDLE(_darr))  \
-    {                                                                          \
-        _darr = da_reserve(_darr, 1);                                          \
-        if (_darr != NULL)                                                     \
-            _darr[(*DA_P_LENGTH_FROM_HANDLE(_darr))++] = _value;               \
-    }                                                                          \
-    else                                                                       \
-    {                                                                          \
-        _darr[(*DA_P_LENGTH_FROM_HANDLE(_darr))++] = _value;                   \
-    }                                                                          \
-    /* return */_darr;                                                         \
-})
+/**@function
+ * @brief Concatenate the elements of every per-thread darray of a collector
+ *  into a new darray, ordered by thread and then by position. The per-thread
+ *  darrays are emptied and keep their memory for reuse.
+ *
+ * @param collector : Target collector. No thread may be modifying its
+ *  per-thread darray.
+ *
+ * @return Pointer to a new darray with a capacity of exactly the number of
+ *  collected elements on success. `NULL` on allocation failure, in which case
+ *  `collector` is left untouched.
+ *
+ * @note Large merges are copied on the threads used by `da_parallel_for`.
+ */
+void* da_collector_merge(struct da_collector* collector)
+    DA_WARN_UNUSED_RESULT;
 
-#define /* ELEM_TYPE */_da_pop(/* ELEM_TYPE* */darr)                           \
-({                                                                             \
-    __auto_type _darr = darr;                                                  \
-    /* return */(_darr)[--(*DA_P_LENGTH_FROM_HANDLE(_darr))];                  \
-})
+/* A `struct da_ring` is a bounded lock-free queue between exactly one producer
+ * thread and one consumer thread, stored in a darray buffer with a power of
+ * two capacity. The fields written by the producer, the fields written by the
+ * consumer, and the fields that never change each sit on their own cache line.
+ * Allocate rings with static or automatic storage duration or with
+ * `aligned_alloc` so that the alignment is respected.
+ */
+#define DA_CACHE_LINE_SIZE 64
 
-#define _da_move_and_insert(darr, index, value)                                \
-memmove(                                                                       \
-    darr+index+1,                                                              \
-    darr+index,                                                                \
-    (*DA_P_SIZEOF_ELEM_FROM_HANDLE(darr)) *                                    \
-        ((*DA_P_LENGTH_FROM_HANDLE(darr))-index)                               \
-);                                                                             \
-darr[index] = value;                                                           \
-(*DA_P_LENGTH_FROM_HANDLE(darr))++;                                            \
+struct da_ring
+{
+    alignas(DA_CACHE_LINE_SIZE) size_t _tail; // Written by the producer.
+    size_t _head_cache; // Producer's last view of `_head`.
+    alignas(DA_CACHE_LINE_SIZE) size_t _head; // Written by the consumer.
+    size_t _tail_cache; // Consumer's last view of `_tail`.
+    alignas(DA_CACHE_LINE_SIZE) void* _buf; // darray storage.
+    size_t _mask;
+};
 
-#define /* ELEM_TYPE* */_da_insert(/* ELEM_TYPE* */darr, /* size_t */index,    \
-    /* ELEM_TYPE */value)                                                      \
-({                                                                             \
-    __auto_type _darr = darr;                                                  \
-    size_t _index = index;                                                     \
-    __auto_type _value = value;                                                \
-    if (*DA_P_LENGTH_FROM_HANDLE(_darr) == *DA_P_CAPACITY_FROM_HANDLE(_darr))  \
-    {                                                                          \
-        _darr = da_reserve(_darr, 1);                                          \
-        if (_darr != NULL)                                                     \
-            _da_move_and_insert(_darr, _index, _value);                        \
+/**@function
+ * @brief Initialize `ring` to hold up to `nelem` elements, rounded up to a
+ *  power of two, each of size `size`.
+ *
+ * @param ring : Uninitialized ring.
+ * @param nelem : Minimum capacity of the ring.
+ * @param size : `sizeof` each element.
+ *
+ * @return `true` on success. `false` on allocation failure.
+ */
+bool da_ring_init(struct da_ring* ring, size_t nelem, size_t size);
+
+/**@function
+ * @brief Free the memory owned by `ring`. Elements still in the ring are
+ *  dropped.
+ *
+ * @param ring : Target ring. Neither thread may be using it.
+ */
+void da_ring_free(struct da_ring* ring);
+
+/**@function
+ * @brief Append up to `nelem` elements to the back of a ring. Called only by
+ *  the producer thread. Never blocks.
+ *
+ * @param ring : Target ring.
+ * @param src : Array of `nelem` elements.
+ * @param nelem : Number of elements to append.
+ *
+ * @return Number of elements appended, which is less than `nelem` if the ring
+ *  is full.
+ */
+size_t da_ring_enqueue(struct da_ring* ring, const void* src, size_t nelem);
+
+/**@function
+ * @brief Remove up to `nelem` elements from the front of a ring. Called only
+ *  by the consumer thread. Never blocks.
+ *
+ * @param ring : Target ring.
+ * @param dest : Array with room for `nelem` elements.
+ * @param nelem : Maximum number of elements to remove.
+ *
+ * @return Number of elements removed and copied to `dest`, which is less than
+ *  `nelem` if the ring has fewer elements.
+ */
+size_t da_ring_dequeue(struct da_ring* ring, void* dest, size_t nelem);
+
+/**@function
+ * @brief Returns the number of elements in a ring. The result may be out of
+ *  date by the time it is returned if the other thread is active.
+ *
+ * @param ring : Target ring.
+ *
+ * @return Number of elements in `ring`.
+ */
+size_t da_ring_length(const struct da_ring* ring);
+
+/* A `struct da_concurrent` holds a darray that one writer thread grows while
+ * any number of reader threads read it without locking. Growth copies the
+ * elements into a new darray and publishes its handle, and the old darray is
+ * retired and freed once no reader can still be reading it. Readers register
+ * once, then bracket each read between `da_concurrent_read_begin` and
+ * `da_concurrent_read_end`, which never block or retry. Like `struct da_ring`,
+ * a `struct da_concurrent` must be allocated with its alignment respected.
+ */
+#define DA_CONCURRENT_MAX_READERS 64
+
+struct da_concurrent
+{
+    alignas(DA_CACHE_LINE_SIZE) void* _darr; // Published handle.
+    size_t _epoch; // Incremented on every growth.
+    struct
+    {
+        alignas(DA_CACHE_LINE_SIZE) size_t _epoch;
+    } _readers[DA_CONCURRENT_MAX_READERS];
+    alignas(DA_CACHE_LINE_SIZE) void* _retired; // Written by the writer only.
+};
+
+/**@function
+ * @brief Initialize `conc` with an empty darray with room for `nelem`
+ *  elements each of size `size`.
+ *
+ * @param conc : Uninitialized concurrent darray.
+ * @param nelem : Initial capacity.
+ * @param size : `sizeof` each element.
+ *
+ * @return `true` on success. `false` on allocation failure.
+ */
+bool da_concurrent_init(struct da_concurrent* conc, size_t nelem, size_t size);
+
+/**@function
+ * @brief Free the darray and every retired darray of `conc`.
+ *
+ * @param conc : Target concurrent darray. No reader may be reading it.
+ */
+void da_concurrent_free(struct da_concurrent* conc);
+
+/**@function
+ * @brief Append the value pointed to by `value` to `conc`. Called only by the
+ *  writer thread. If the darray is full its elements are copied to a larger
+ *  darray, which is published to readers, and the old darray is retired.
+ *
+ * @param conc : Target concurrent darray.
+ * @param value : Pointer to the value to append.
+ *
+ * @return `true` on success. `false` on allocation failure, in which case
+ *  `conc` is left untouched.
+ */
+bool da_concurrent_push(struct da_concurrent* conc, const void* value);
+
+/**@function
+ * @brief Free the retired darrays of `conc` that no reader can still be
+ *  reading. Called only by the writer thread. `da_concurrent_push` calls it
+ *  whenever it retires a darray.
+ *
+ * @param conc : Target concurrent darray.
+ *
+ * @return Number of retired darrays that are still waiting on readers.
+ */
+size_t da_concurrent_reclaim(struct da_concurrent* conc);
+
+/**@function
+ * @brief Claim a reader slot of `conc` for the calling thread.
+ *
+ * @param conc : Target concurrent darray.
+ *
+ * @return Index of the claimed slot, to be passed to the other reader
+ *  functions. `SIZE_MAX` if all `DA_CONCURRENT_MAX_READERS` slots are taken.
+ */
+size_t da_concurrent_register(struct da_concurrent* conc);
+
+/**@function
+ * @brief Give back a reader slot claimed with `da_concurrent_register`.
+ *
+ * @param conc : Target concurrent darray.
+ * @param reader : Slot index. Must not be inside a read.
+ */
+void da_concurrent_unregister(struct da_concurrent* conc, size_t reader);
+
+/**@function
+ * @brief Start a read of `conc`. The returned darray and its elements stay
+ *  valid until the matching `da_concurrent_read_end`.
+ *
+ * @param conc : Target concurrent darray.
+ * @param reader : Slot index of the calling thread.
+ *
+ * @return Handle to the current darray of `conc`.
+ *
+ * @note Readers may only read elements below `da_concurrent_length` of the
+ *  returned handle. Use `da_concurrent_length` instead of `da_length`, and do
+ *  not pass the handle to other darray functions while the writer is active.
+ */
+const void* da_concurrent_read_begin(struct da_concurrent* conc,
+    size_t reader);
+
+/**@function
+ * @brief End a read started with `da_concurrent_read_begin`.
+ *
+ * @param conc : Target concurrent darray.
+ * @param reader : Slot index of the calling thread.
+ */
+void da_concurrent_read_end(struct da_concurrent* conc, size_t reader);
+
+/**@function
+ * @brief Returns the number of elements in a darray returned by
+ *  `da_concurrent_read_begin`. Elements below this length have been fully
+ *  written by the writer.
+ *
+ * @param darr : Handle returned by `da_concurrent_read_begin`.
+ *
+ * @return Number of elements in `darr`.
+ */
+size_t da_concurrent_length(const void* darr);
+
+/**@function
+ * @brief Sum the elements of a numeric darray. `da_sum_float` adds in double
+ *  precision.
+ *
+ * @param darr : Target darray.
+ *
+ * @return The sum of the elements of `darr`. `0` if `darr` is empty.
+ *
+ * @note Elements are added in a different order than a sequential loop would
+ *  add them, so floating point sums may differ in the last bits.
+ * @note `da_sum_int` does not check for overflow of `long long`.
+ * @note Darrays larger than the last level cache are split between the
+ *  threads used by `da_parallel_for`. This holds for the min/max, arg, and
+ *  prefix sum functions below as well.
+ */
+long long da_sum_int(const int* darr);
+double da_sum_float(const float* darr);
+double da_sum_double(const double* darr);
+
+/**@function
+ * @brief Find the smallest and largest elements of a numeric darray. NaN
+ *  elements are skipped.
+ *
+ * @param darr : Target darray.
+ * @param min : Set to the smallest element.
+ * @param max : Set to the largest element.
+ *
+ * @return `true` on success. `false` if `darr` has no elements that are not
+ *  NaN, in which case `*min` and `*max` are left unchanged.
+ */
+bool da_minmax_int(const int* darr, int* min, int* max);
+bool da_minmax_float(const float* darr, float* min, float* max);
+bool da_minmax_double(const double* darr, double* min, double* max);
+
+/**@function
+ * @brief Find the index of the first smallest element of a numeric darray.
+ *  NaN elements are skipped.
+ *
+ * @param darr : Target darray.
+ *
+ * @return Index of the first smallest element. `da_length(darr)` if `darr`
+ *  has no elements that are not NaN.
+ */
+size_t da_argmin_int(const int* darr);
+size_t da_argmin_float(const float* darr);
+size_t da_argmin_double(const double* darr);
+
+/**@function
+ * @brief Find the index of the first largest element of a numeric darray.
+ *  NaN elements are skipped.
+ *
+ * @param darr : Target darray.
+ *
+ * @return Index of the first largest element. `da_length(darr)` if `darr`
+ *  has no elements that are not NaN.
+ */
+size_t da_argmax_int(const int* darr);
+size_t da_argmax_float(const float* darr);
+size_t da_argmax_double(const double* darr);
+
+/**@function
+ * @brief Replace every element of a numeric darray with the sum of itself and
+ *  all elements before it (an inclusive scan).
+ *
+ * @param darr : Target darray.
+ *
+ * @note `da_prefix_sum_int` wraps around on overflow.
+ * @note Floating point sums are formed in a different order than a
+ *  sequential loop would form them and may differ in the last bits.
+ */
+void da_prefix_sum_int(int* darr);
+void da_prefix_sum_float(float* darr);
+void da_prefix_sum_double(double* darr);
+
+/* DA_SOA MEMORY LAYOUT
+ * ====================
+ * +--------+---------+-----+-----------+----------+-----+-------------+-----+
+ * | header | cols[0] | ... | cols[n-1] | column 0 | ... | column n-1  | ... |
+ * +--------+---------+-----+-----------+----------+-----+-------------+-----+
+ *          ^
+ *          Handle to the da_soa points to the table of column pointers.
+ *
+ * A da_soa (structure of arrays) stores the fields of each row in separate
+ * columns that share one length and capacity, all in a single allocation.
+ * `soa[col]` is a darray holding column `col`, aligned to a cache line, that
+ * may be passed to any darray function that does not change its length or
+ * capacity. Columns must never be freed, resized or pushed to directly.
+ */
+
+/**@function
+ * @brief Allocate a da_soa of `nelem` rows with `ncols` columns.
+ *
+ * @param nelem : Initial number of rows in the da_soa.
+ * @param ncols : Number of columns.
+ * @param sizes : `sizeof` the elements of each of the `ncols` columns.
+ *
+ * @return Pointer to a new da_soa on success. `NULL` on allocation failure or
+ *  if any of `sizes` is larger than `UINT32_MAX`.
+ */
+void** da_soa_alloc(size_t nelem, size_t ncols, const size_t* sizes)
+    DA_WARN_UNUSED_RESULT;
+
+/**@function
+ * @brief Free a da_soa and all of its columns.
+ *
+ * @param soa : Target da_soa to be freed.
+ */
+void da_soa_free(void** soa);
+
+/**@function
+ * @brief Returns the number of rows in a da_soa.
+ *
+ * @param soa : Target da_soa.
+ *
+ * @return Number of rows in `soa`.
+ */
+size_t da_soa_length(void* const* soa);
+
+/**@function
+ * @brief Returns the maximum number of rows a da_soa can hold without
+ *  requiring memory reallocation.
+ *
+ * @param soa : Target da_soa.
+ *
+ * @return Total number of allocated rows in `soa`.
+ */
+size_t da_soa_capacity(void* const* soa);
+
+/**@function
+ * @brief Returns the number of columns in a da_soa.
+ *
+ * @param soa : Target da_soa.
+ *
+ * @return Number of columns in `soa`.
+ */
+size_t da_soa_ncols(void* const* soa);
+
+/**@function
+ * @brief Change the number of rows of a da_soa to `nelem`. Data in rows with
+ *  indices >= `nelem` may be lost when downsizing.
+ *
+ * @param soa : Target da_soa. Upon function completion, `soa` and its columns
+ *  may or may not point to their previous blocks on the heap, potentially
+ *  breaking references.
+ * @param nelem : New number of rows.
+ *
+ * @return Pointer to the new location of the da_soa upon successful function
+ *  completion. If `da_soa_resize` returns `NULL` reallocation failed and `soa`
+ *  is left untouched.
+ */
+void** da_soa_resize(void** soa, size_t nelem) DA_WARN_UNUSED_RESULT;
+
+/**@function
+ * @brief Guarantee that at least `nelem` rows beyond the current length of a
+ *  da_soa can be inserted/pushed without requiring memory reallocation.
+ *
+ * @param soa : Target da_soa. Upon function completion, `soa` and its columns
+ *  may or may not point to their previous blocks on the heap, potentially
+ *  breaking references.
+ * @param nelem : Number of additional rows that may be inserted.
+ *
+ * @return Pointer to the new location of the da_soa upon successful function
+ *  completion. If `da_soa_reserve` returns `NULL` reallocation failed and
+ *  `soa` is left untouched.
+ */
+void** da_soa_reserve(void** soa, size_t nelem) DA_WARN_UNUSED_RESULT;
+
+/**@function
+ * @brief Insert a row at the back of a da_soa.
+ *
+ * @param soa : Target da_soa. Upon function completion, `soa` and its columns
+ *  may or may not point to their previous blocks on the heap, potentially
+ *  breaking references.
+ * @param values : Array of `da_soa_ncols(soa)` pointers, one to the value of
+ *  each column. If `values` is `NULL` the new row is zeroed.
+ *
+ * @return Pointer to the new location of the da_soa upon successful function
+ *  completion. If `da_soa_push` returns `NULL` reallocation failed and `soa`
+ *  is left untouched.
+ */
+void** da_soa_push(void** soa, const void* const* values)
+    DA_WARN_UNUSED_RESULT;
+
+/**@function
+ * @brief Insert a row into a da_soa at the specified index, moving all rows at
+ *  or after `index` back by one.
+ *
+ * @param soa : Target da_soa. Upon function completion, `soa` and its columns
+ *  may or may not point to their previous blocks on the heap, potentially
+ *  breaking references.
+ * @param index : Index of the new row. May be equal to `da_soa_length(soa)`.
+ * @param values : Array of `da_soa_ncols(soa)` pointers, one to the value of
+ *  each column. If `values` is `NULL` the new row is zeroed.
+ *
+ * @return Pointer to the new location of the da_soa upon successful function
+ *  completion. If `da_soa_insert` returns `NULL` reallocation failed and `soa`
+ *  is left untouched.
+ */
+void** da_soa_insert(void** soa, size_t index, const void* const* values)
+    DA_WARN_UNUSED_RESULT;
+
+/**@function
+ * @brief Remove the row at `index` from a da_soa, moving all rows after it
+ *  forward by one.
+ *
+ * @param soa : Target da_soa.
+ * @param index : Index of the row to remove.
+ */
+void da_soa_remove(void** soa, size_t index);
+
+/* DA_SEG MEMORY LAYOUT
+ * ====================
+ * +--------+--------+-----+--------------+
+ * | header | seg[0] | ... | seg[nsegs-1] |
+ * +--------+--------+-----+--------------+
+ *          ^   |
+ *          |   +--> +--------+---------+-----+------------------------+
+ *          |        | header | data[0] | ... | data[seg_nelem-1]      |
+ *          |        +--------+---------+-----+------------------------+
+ *          Handle to the da_seg points to the first segment pointer.
+ *
+ * A da_seg (segmented darray) is a darray of segments, each of which is a
+ * darray with a capacity of the same power of two. Element `i` lives in segment
+ * `i / seg_nelem` at index `i % seg_nelem`, so indexing is a shift and a mask.
+ * Every segment but the last is full. Growing a da_seg allocates new segments
+ * and never moves existing elements, so pointers to elements stay valid until
+ * the elements are popped. `da_length(seg)` is the number of segments, and
+ * `seg[s]` may be passed to any darray function that does not change its
+ * length or capacity to process one segment at a time.
+ */
+
+/**@function
+ * @brief Allocate a da_seg of `nelem` elements each of size `size`.
+ *
+ * @param nelem : Initial number of elements in the da_seg.
+ * @param size : `sizeof` each element.
+ * @param seg_nelem : Number of elements in each segment, rounded up to a power
+ *  of two. If `seg_nelem` is `0`, segments of about 64 KiB are used.
+ *
+ * @return Pointer to a new da_seg on success. `NULL` on allocation failure.
+ */
+void** da_seg_alloc(size_t nelem, size_t size, size_t seg_nelem)
+    DA_WARN_UNUSED_RESULT;
+
+/**@function
+ * @brief Free a da_seg and all of its segments.
+ *
+ * @param seg : Target da_seg to be freed.
+ */
+void da_seg_free(void** seg);
+
+/**@function
+ * @brief Returns the number of elements in a da_seg.
+ *
+ * @param seg : Target da_seg.
+ *
+ * @return Number of elements in `seg`.
+ */
+size_t da_seg_length(void* const* seg);
+
+/**@function
+ * @brief Returns a pointer to the element at `index` of a da_seg.
+ *
+ * @param seg : Target da_seg.
+ * @param index : Index of the element. Must be less than `da_seg_length(seg)`.
+ *
+ * @return Pointer to the element at `index`.
+ */
+void* da_seg_at(void* const* seg, size_t index);
+
+/**@function
+ * @brief Insert a value at the back of a da_seg. Existing elements are never
+ *  moved.
+ *
+ * @param seg : Target da_seg. Upon function completion, the segment table of
+ *  `seg` may or may not point to its previous block on the heap. Pointers to
+ *  elements remain valid.
+ * @param value : Pointer to the value to be pushed.
+ *
+ * @return Pointer to the new location of the da_seg upon successful function
+ *  completion. If `da_seg_push` returns `NULL` allocation failed and `seg` is
+ *  left untouched.
+ */
+void** da_seg_push(void** seg, const void* value) DA_WARN_UNUSED_RESULT;
+
+/**@function
+ * @brief Remove the last element of a da_seg. Segments that become empty are
+ *  freed, except for the first segment.
+ *
+ * @param seg : Target da_seg. Must not be empty.
+ */
+void da_seg_pop(void** seg);
+
+/**@function
+ * @brief Copy the elements of a da_seg into a new contiguous darray.
+ *
+ * @param seg : Target da_seg.
+ *
+ * @return Pointer to a new darray with the elements of `seg` on success.
+ *  `NULL` on allocation failure.
+ */
+void* da_flatten(void* const* seg) DA_WARN_UNUSED_RESULT;
+
+/* A `struct da_delta` stores a sequence of `uint64_t` in blocks of
+ * `DA_DELTA_BLOCK_SIZE` values. A full block keeps its first value in a block
+ * table and the differences between consecutive values bit-packed at the
+ * width of the largest difference in the block, so sorted IDs with small gaps
+ * take a byte or two per value instead of eight. The last, partly filled block
+ * is kept unpacked until it is full. Differences are taken modulo 2^64, so any
+ * sequence can be stored, but a block with a decreasing value is stored at
+ * full width.
+ */
+#define DA_DELTA_BLOCK_SIZE 128
+
+struct _da_delta_block
+{
+    uint64_t first; // First value of the block.
+    size_t offset; // Offset of the packed differences in `_bytes`.
+    unsigned width; // Bits per difference.
+};
+
+struct da_delta
+{
+    size_t _length;
+    unsigned char* _bytes; // Packed differences. NULL until the first block.
+    struct _da_delta_block* _blocks; // NULL until the first block.
+    uint64_t _tail[DA_DELTA_BLOCK_SIZE]; // Values of the last block.
+};
+
+/* A `struct da_delta_iter` decodes a `struct da_delta` a block at a time when
+ * it first visits a value of the block. Values pushed after the iterator was
+ * initialized are visited too.
+ */
+struct da_delta_iter
+{
+    const struct da_delta* _delta;
+    size_t _index; // Index of the next value.
+    size_t _block; // Block decoded into `_values`. SIZE_MAX if none.
+    uint64_t _values[DA_DELTA_BLOCK_SIZE];
+};
+
+/**@function
+ * @brief Initialize `delta` as an empty sequence. Never allocates memory.
+ *
+ * @param delta : Uninitialized `struct da_delta`.
+ */
+void da_delta_init(struct da_delta* delta);
+
+/**@function
+ * @brief Free the memory owned by `delta`. `delta` is left empty and may be
+ *  reused.
+ *
+ * @param delta : Target `struct da_delta`.
+ */
+void da_delta_free(struct da_delta* delta);
+
+/**@function
+ * @brief Append `value` to the back of `delta`. Every `DA_DELTA_BLOCK_SIZE`th
+ *  push packs the block it completes.
+ *
+ * @param delta : Target `struct da_delta`.
+ * @param value : Value to append.
+ *
+ * @return `true` on success. `false` on allocation failure, in which case
+ *  `delta` is left untouched.
+ */
+bool da_delta_push(struct da_delta* delta, uint64_t value);
+
+/**@function
+ * @brief Returns the number of values in `delta`.
+ *
+ * @param delta : Target `struct da_delta`.
+ *
+ * @return Number of values in `delta`.
+ */
+size_t da_delta_length(const struct da_delta* delta);
+
+/**@function
+ * @brief Returns the number of bytes of memory used by `delta`, including
+ *  the `struct da_delta` itself and the unused capacity of its buffers.
+ *
+ * @param delta : Target `struct da_delta`.
+ *
+ * @return Memory footprint of `delta` in bytes.
+ */
+size_t da_delta_footprint(const struct da_delta* delta);
+
+/**@function
+ * @brief Decode the values of `delta` into a new darray.
+ *
+ * @param delta : Target `struct da_delta`.
+ *
+ * @return Pointer to a new darray of `uint64_t` with a capacity of exactly
+ *  `da_delta_length(delta)` on success. `NULL` on allocation failure.
+ */
+uint64_t* da_delta_decode(const struct da_delta* delta) DA_WARN_UNUSED_RESULT;
+
+/**@function
+ * @brief Returns the index of the first value of `delta` that is not less than
+ *  `value`, or `da_delta_length(delta)` if there is none. Binary searches the
+ *  first values of the blocks and then decodes a single block.
+ *
+ * @param delta : Target `struct da_delta`. Must be sorted in ascending order.
+ * @param value : Value to search for.
+ *
+ * @return Index of the first value not less than `value`.
+ */
+size_t da_delta_lower_bound(const struct da_delta* delta, uint64_t value);
+
+/**@function
+ * @brief Initialize `iter` to iterate over `delta` from index `index`.
+ *
+ * @param iter : Uninitialized iterator.
+ * @param delta : Target `struct da_delta`.
+ * @param index : Index of the first value to visit. May be
+ *  `da_delta_length(delta)`.
+ */
+void da_delta_iter_init(struct da_delta_iter* iter,
+    const struct da_delta* delta, size_t index);
+
+/**@function
+ * @brief Move `iter` to index `index`. Blocks before the block of `index` are
+ *  skipped without being decoded.
+ *
+ * @param iter : Target iterator.
+ * @param index : Index of the next value to visit. May be
+ *  `da_delta_length(delta)`.
+ */
+void da_delta_iter_seek(struct da_delta_iter* iter, size_t index);
+
+/**@function
+ * @brief Get the next value of an iterator.
+ *
+ * @param iter : Target iterator.
+ * @param value : Set to the next value.
+ *
+ * @return `true` if a value was stored in `*value`. `false` once every value
+ *  has been visited.
+ */
+bool da_delta_iter_next(struct da_delta_iter* iter, uint64_t* value);
+
+/**@function
+ * @brief Get the values of an iterator from its position to the end of the
+ *  block it is in with one call, decoding the block if needed. Much faster
+ *  than `da_delta_iter_next` for scans.
+ *
+ * @param iter : Target iterator.
+ * @param values : Set to the first of the returned values. They remain valid
+ *  until the next call with `iter` or the next push to its `struct da_delta`.
+ *
+ * @return Number of values in `*values`, at most `DA_DELTA_BLOCK_SIZE`. 0
+ *  once every value has been visited.
+ */
+size_t da_delta_iter_next_block(struct da_delta_iter* iter,
+    const uint64_t** values);
+
+/* A `struct da_packed` stores unsigned integers of up to `width` bits in
+ * `width` bits each, packed back to back, so a column of values that fit in
+ * k bits takes k/8 bytes per value instead of a whole word. Any value can be
+ * read or written in O(1). Storing a value that does not fit widens every
+ * value in a single pass.
+ */
+struct da_packed
+{
+    size_t _length;
+    unsigned _width; // Bits per value, from 1 to 64.
+    unsigned char* _bytes; // Packed values. NULL until the first push.
+};
+
+/**@function
+ * @brief Initialize `packed` as an empty array of `width` bit values. Never
+ *  allocates memory.
+ *
+ * @param packed : Uninitialized `struct da_packed`.
+ * @param width : Initial number of bits per value, from 1 to 64.
+ */
+void da_packed_init(struct da_packed* packed, unsigned width);
+
+/**@function
+ * @brief Free the memory owned by `packed`. `packed` is left empty with its
+ *  current width and may be reused.
+ *
+ * @param packed : Target `struct da_packed`.
+ */
+void da_packed_free(struct da_packed* packed);
+
+/**@function
+ * @brief Returns the number of values in `packed`.
+ *
+ * @param packed : Target `struct da_packed`.
+ *
+ * @return Number of values in `packed`.
+ */
+size_t da_packed_length(const struct da_packed* packed);
+
+/**@function
+ * @brief Returns the number of bits each value of `packed` is stored in.
+ *
+ * @param packed : Target `struct da_packed`.
+ *
+ * @return Bits per value.
+ */
+unsigned da_packed_width(const struct da_packed* packed);
+
+/**@function
+ * @brief Returns the number of bytes of memory used by `packed`, including
+ *  the `struct da_packed` itself and the unused capacity of its buffer.
+ *
+ * @param packed : Target `struct da_packed`.
+ *
+ * @return Memory footprint of `packed` in bytes.
+ */
+size_t da_packed_footprint(const struct da_packed* packed);
+
+/**@function
+ * @brief Returns the value at `index` of `packed`.
+ *
+ * @param packed : Target `struct da_packed`.
+ * @param index : Index of the value. Must be less than
+ *  `da_packed_length(packed)`.
+ *
+ * @return Value at `index`.
+ */
+uint64_t da_packed_get(const struct da_packed* packed, size_t index);
+
+/**@function
+ * @brief Replace the value at `index` of `packed` with `value`, widening
+ *  `packed` first if `value` does not fit in its width.
+ *
+ * @param packed : Target `struct da_packed`.
+ * @param index : Index of the value. Must be less than
+ *  `da_packed_length(packed)`.
+ * @param value : New value.
+ *
+ * @return `true` on success. `false` if widening failed to allocate memory,
+ *  in which case `packed` is left untouched.
+ */
+bool da_packed_set(struct da_packed* packed, size_t index, uint64_t value);
+
+/**@function
+ * @brief Append `value` to the back of `packed`, widening `packed` first if
+ *  `value` does not fit in its width.
+ *
+ * @param packed : Target `struct da_packed`.
+ * @param value : Value to append.
+ *
+ * @return `true` on success. `false` on allocation failure, in which case
+ *  the values of `packed` are left untouched but its width may have grown.
+ */
+bool da_packed_push(struct da_packed* packed, uint64_t value);
+
+/**@function
+ * @brief Repack every value of `packed` in `width` bits, in a single pass
+ *  from the back of the array that needs no second buffer.
+ *
+ * @param packed : Target `struct da_packed`.
+ * @param width : New number of bits per value, at most 64. Widths no greater
+ *  than the current width leave `packed` untouched.
+ *
+ * @return `true` on success. `false` on allocation failure, in which case
+ *  `packed` is left untouched.
+ */
+bool da_packed_widen(struct da_packed* packed, unsigned width);
+
+/**@function
+ * @brief Unpack the values of `packed` into a new darray. Uses AVX2 gathers
+ *  when available.
+ *
+ * @param packed : Target `struct da_packed`.
+ *
+ * @return Pointer to a new darray of `uint64_t` with a capacity of exactly
+ *  `da_packed_length(packed)` on success. `NULL` on allocation failure.
+ */
+uint64_t* da_packed_unpack(const struct da_packed* packed)
+    DA_WARN_UNUSED_RESULT;
+
+/* DARRAY FILE FORMAT
+ * ==================
+ * +--------+---------+-------+--------+--------+----------+---------+-----+
+ * | "DARR" | version | flags | elemsz | length | checksum | data[0] | ... |
+ * +--------+---------+-------+--------+--------+----------+---------+-----+
+ *   4 B      4 B       8 B     8 B      8 B      8 B
+ *
+ * `da_write_fd` writes a 40 byte header followed by the raw elements of a
+ * darray. Integers are stored in the byte order of the writing machine, and a
+ * reader with another byte order rejects the file because the version does not
+ * match. `checksum` is the CRC-32C of the data, zero extended to 64 bits, if
+ * `DA_FILE_CHECKSUM` is set in `flags` and `0` otherwise. CRC-32C is the
+ * Castagnoli CRC with the reflected polynomial 0x82F63B78, an initial value of
+ * 0xFFFFFFFF, and a final xor with 0xFFFFFFFF. Its check value for the bytes
+ * of "123456789" is 0xE3069283.
+ *
+ * A container file written by `da_write_many_fd` starts with "DACN", the
+ * version, and the number of darrays as a 64 bit integer, followed by each
+ * darray in the format above.
+ */
+#define DA_FILE_VERSION 3
+#define DA_FILE_CHECKSUM 0x1u
+
+/**@function
+ * @brief Write a darray to the file descriptor `fd` with a single `writev` of
+ *  its header and data, without copying the data.
+ *
+ * @param darr : Target darray.
+ * @param fd : File descriptor open for writing.
+ * @param flags : `DA_FILE_CHECKSUM` to store a checksum of the data, or `0`.
+ *
+ * @return `true` on success. `false` if writing failed, in which case `errno`
+ *  is set by `writev`.
+ */
+bool da_write_fd(const void* darr, int fd, unsigned flags);
+
+/**@function
+ * @brief Read a darray written by `da_write_fd` from the file descriptor `fd`.
+ *  The data is read straight into a darray of exactly the stored length.
+ *
+ * @param fd : File descriptor open for reading.
+ *
+ * @return Pointer to a new darray on success. `NULL` if reading failed, the
+ *  file ended early, the header is not valid, the checksum does not match, or
+ *  allocation failed.
+ */
+void* da_read_fd(int fd) DA_WARN_UNUSED_RESULT;
+
+/**@function
+ * @brief Write several darrays to the file descriptor `fd` as one container
+ *  with as few `writev` calls as possible.
+ *
+ * @param darrs : Darray of handles to the darrays to write.
+ * @param fd : File descriptor open for writing.
+ * @param flags : `DA_FILE_CHECKSUM` to store a checksum of each darray, or `0`.
+ *
+ * @return `true` on success. `false` if writing failed or allocation failed.
+ */
+bool da_write_many_fd(void* const* darrs, int fd, unsigned flags);
+
+/**@function
+ * @brief Read a container written by `da_write_many_fd` from the file
+ *  descriptor `fd`.
+ *
+ * @param fd : File descriptor open for reading.
+ *
+ * @return Darray of handles to new darrays in the order they were written on
+ *  success. `NULL` on failure, in which case nothing is left allocated. Each
+ *  darray and then the returned darray must be freed with `da_free`.
+ */
+void** da_read_many_fd(int fd) DA_WARN_UNUSED_RESULT;
+
+/* A mapped darray lives in a file laid out exactly like a darray in memory: a
+ * darray header followed by `capacity` elements. `da_map_file` maps the file
+ * and returns an ordinary handle, so the contents are paged in lazily on first
+ * access instead of being read at startup. Read only mappings are private to
+ * the process, so changes to them are never written to the file, and they
+ * cannot be resized. Read-write
+ * mappings are shared with the file, and growing them with `da_reserve`,
+ * `da_resize`, or any function built on them extends the file with `ftruncate`
+ * and the mapping with `mremap`. Use `da_sync` and `da_unmap` on mapped
+ * darrays in place of `da_free`. The header stores sizes in native byte order
+ * and width, so files are only portable between machines of the same kind.
+ */
+#define DA_MAP_READ_ONLY  0x0u
+#define DA_MAP_READ_WRITE 0x1u
+#define DA_MAP_CREATE     0x2u
+
+/**@function
+ * @brief Map the darray stored in the file at `path`.
+ *
+ * @param path : Path of the file.
+ * @param size : `sizeof` each element. Must match the element size stored in
+ *  the file.
+ * @param flags : `DA_MAP_READ_ONLY` or `DA_MAP_READ_WRITE`, optionally ored
+ *  with `DA_MAP_CREATE` to create an empty darray if the file does not exist
+ *  or is empty. `DA_MAP_CREATE` implies `DA_MAP_READ_WRITE`.
+ *
+ * @return Pointer to the mapped darray on success. `NULL` if the file could
+ *  not be opened or mapped, or does not hold a darray of elements of size
+ *  `size`.
+ */
+void* da_map_file(const char* path, size_t size, unsigned flags)
+    DA_WARN_UNUSED_RESULT;
+
+/**@function
+ * @brief Write the changes made to a darray mapped read-write back to its
+ *  file and wait for the write to complete.
+ *
+ * @param darr : Darray returned by `da_map_file`.
+ *
+ * @return `true` on success or if `darr` is mapped read only. `false` if
+ *  `msync` failed.
+ */
+bool da_sync(void* darr);
+
+/**@function
+ * @brief Unmap a darray returned by `da_map_file` and close its file. Changes
+ *  to a darray mapped read-write reach the file eventually even without
+ *  `da_sync`. If the darray is shared, only the reference held by `darr` is
+ *  released and the darray is unmapped by the last owner, as with `da_free`.
+ *
+ * @param darr : Darray returned by `da_map_file`.
+ *
+ * @return `true` on success. `false` if `darr` is not a mapped darray or
+ *  `munmap` failed.
+ */
+bool da_unmap(void* darr);
+
+/* A `struct da_reader` reads a file descriptor through a large buffer so that
+ * callers can take input a line or a chunk at a time without a system call per
+ * read. `da_read_chunk` and `dstr_read_line` copy out of the buffer straight
+ * into the caller's darray, reusing its capacity across calls.
+ */
+#define DA_READER_BUFFER_SIZE (1 << 18)
+
+struct da_reader
+{
+    int _fd;
+    char* _buf; // Darray of DA_READER_BUFFER_SIZE bytes.
+    size_t _begin, _end; // Unread bytes of `_buf`.
+    bool _eof;
+    bool _failed;
+};
+
+/**@function
+ * @brief Initialize `reader` to read from the file descriptor `fd`.
+ *
+ * @param reader : Uninitialized reader.
+ * @param fd : File descriptor open for reading. Not closed by the reader.
+ *
+ * @return `true` on success. `false` on allocation failure, in which case
+ *  `reader` need not be freed.
+ */
+bool da_reader_init(struct da_reader* reader, int fd);
+
+/**@function
+ * @brief Free the buffer of `reader`. Input buffered but not yet read is lost.
+ *
+ * @param reader : Target reader.
+ */
+void da_reader_free(struct da_reader* reader);
+
+/**@function
+ * @brief Returns `true` if a read from the file descriptor of `reader` or an
+ *  allocation made while reading from it failed, as opposed to the input
+ *  having ended.
+ *
+ * @param reader : Target reader.
+ *
+ * @return `true` if reading stopped because of an error.
+ */
+bool da_reader_failed(const struct da_reader* reader);
+
+/**@function
+ * @brief Replace the contents of `*darr` with the next `nelem` elements of
+ *  input. Reads of at least a buffer's worth of bytes go directly into
+ *  `*darr`.
+ *
+ * @param reader : Target reader.
+ * @param darr : Pointer to the handle of the darray to fill. Its capacity is
+ *  reused and grown only if it holds fewer than `nelem` elements, so
+ *  `*darr` may change.
+ * @param nelem : Maximum number of elements to read.
+ *
+ * @return Number of elements read, which is also the new length of `*darr`.
+ *  Fewer than `nelem` only at the end of the input or on failure. A partial
+ *  element at the end of the input is dropped.
+ */
+size_t da_read_chunk(struct da_reader* reader, void** darr, size_t nelem);
+
+/////////////////////////////////// INTERNAL ///////////////////////////////////
+// The header is kept at 32 bytes. The element size shares a word with the
+// reference count, and the flags live in the top bits of the cached hash.
+struct _darray
+{
+    uint32_t _elemsz;
+    uint32_t _refcount; // Number of owners besides the first. See `da_share`.
+    size_t _length, _capacity;
+    uint64_t _hash; // Cached hash in the low 60 bits (0 if none), then flags.
+    alignas(alignof(max_align_t)) char _data[];
+};
+
+#define DA_CAPACITY_FACTOR 1.3
+#define DA_CAPACITY_MIN 10
+#define DA_NEW_CAPACITY_FROM_LENGTH(length) ((length) < DA_CAPACITY_MIN ? \
+    DA_CAPACITY_MIN : ((length)*DA_CAPACITY_FACTOR))
+
+#define DA_P_HEAD_FROM_HANDLE(darr_h) (((char*)darr_h)-sizeof(struct _darray))
+#define DA_P_SIZEOF_ELEM_FROM_HANDLE(darr_h) ((uint32_t*) \
+    (DA_P_HEAD_FROM_HANDLE(darr_h) + offsetof(struct _darray, _elemsz)))
+#define DA_P_LENGTH_FROM_HANDLE(darr_h) ((size_t*) \
+    (DA_P_HEAD_FROM_HANDLE(darr_h) + offsetof(struct _darray, _length)))
+#define DA_P_CAPACITY_FROM_HANDLE(darr_h) ((size_t*) \
+    (DA_P_HEAD_FROM_HANDLE(darr_h) + offsetof(struct _darray, _capacity)))
+#define DA_P_HASH_FROM_HANDLE(darr_h) ((uint64_t*) \
+    (DA_P_HEAD_FROM_HANDLE(darr_h) + offsetof(struct _darray, _hash)))
+#define DA_P_REFCOUNT_FROM_HANDLE(darr_h) ((uint32_t*) \
+    (DA_P_HEAD_FROM_HANDLE(darr_h) + offsetof(struct _darray, _refcount)))
+
+// A darray is shared while it has more than one owner. Shared darrays must be
+// copied before they are modified.
+#if defined(__GNUC__) || defined(__clang__)
+#   define DA_IS_SHARED(darr_h) (__atomic_load_n(                              \
+        DA_P_REFCOUNT_FROM_HANDLE(darr_h), __ATOMIC_ACQUIRE) != 0)
+#else
+#   define DA_IS_SHARED(darr_h) (*DA_P_REFCOUNT_FROM_HANDLE(darr_h) != 0)
+#endif
+
+// The top 4 bits of `_hash` hold flags. Bits 60 to 62 describe the contents of
+// the darray and are cleared together with the cached hash whenever the
+// contents change.
+#define DA_HASH_MASK          ((UINT64_C(1) << 60) - 1)
+#define DA_FLAGS_CONTENT_MASK (UINT64_C(7) << 60)
+#define DA_FLAGS_FROM_HANDLE(darr_h)                                           \
+    (*DA_P_HASH_FROM_HANDLE(darr_h) & ~DA_HASH_MASK)
+#define DA_INVALIDATE_CONTENT_CACHE(darr_h)                                    \
+    (*DA_P_HASH_FROM_HANDLE(darr_h) &= ~(DA_HASH_MASK | DA_FLAGS_CONTENT_MASK))
+
+// Set on darrays whose memory is mapped from a file by `da_map_file`.
+#define DA_FLAG_MAPPED (UINT64_C(1) << 63)
+
+#define DA_SORT_KEY_UNSIGNED 0
+#define DA_SORT_KEY_SIGNED   1
+#define DA_SORT_KEY_FLOAT    2
+#define DA_SORT_KEY_KIND(value) _Generic((value),                              \
+    char:               (char)-1 < 0 ? DA_SORT_KEY_SIGNED                     \
+                                     : DA_SORT_KEY_UNSIGNED,                   \
+    signed char:        DA_SORT_KEY_SIGNED,                                    \
+    unsigned char:      DA_SORT_KEY_UNSIGNED,                                  \
+    short:              DA_SORT_KEY_SIGNED,                                    \
+    unsigned short:     DA_SORT_KEY_UNSIGNED,                                  \
+    int:                DA_SORT_KEY_SIGNED,                                    \
+    unsigned int:       DA_SORT_KEY_UNSIGNED,                                  \
+    long:               DA_SORT_KEY_SIGNED,                                    \
+    unsigned long:      DA_SORT_KEY_UNSIGNED,                                  \
+    long long:          DA_SORT_KEY_SIGNED,                                    \
+    unsigned long long: DA_SORT_KEY_UNSIGNED,                                  \
+    float:              DA_SORT_KEY_FLOAT,                                     \
+    double:             DA_SORT_KEY_FLOAT)
+void _da_sort_numeric(void* darr, int kind);
+void* _da_intersect_numeric(const void* a, const void* b, int kind)
+    DA_WARN_UNUSED_RESULT;
+
+// The following macros use GNU C and are only avaliable for compatible vendors.
+#if defined(__GNUC__) || defined(__clang__) // GNU C compilers
+
+#define /* ELEM_TYPE* */_da_push(/* ELEM_TYPE* */darr, /* ELEM_TYPE */value)   \
+({                                                                             \
+    __auto_type _darr = darr;                                                  \
+    __auto_type _value = value;                                                \
+    if (*DA_P_LENGTH_FROM_HANDLE(_darr) == *DA_P_CAPACITY_FROM_HANDLE(_darr)   \
+        || DA_IS_SHARED(_darr))                                                \
+    {                                                                          \
+        _darr = da_reserve(_darr, 1);                                          \
+        if (_darr != NULL)                                                     \
+        {                                                                      \
+            DA_INVALIDATE_CONTENT_CACHE(_darr);                                \
+            _darr[(*DA_P_LENGTH_FROM_HANDLE(_darr))++] = _value;               \
+        }                                                                      \
+    }                                                                          \
+    else                                                                       \
+    {                                                                          \
+        DA_INVALIDATE_CONTENT_CACHE(_darr);                                    \
+        _darr[(*DA_P_LENGTH_FROM_HANDLE(_darr))++] = _value;                   \
+    }                                                                          \
+    /* return */_darr;                                                         \
+})
+
+#define /* ELEM_TYPE */_da_pop(/* ELEM_TYPE* */darr)                           \
+({                                                                             \
+    __auto_type _darr = darr;                                                  \
+    DA_INVALIDATE_CONTENT_CACHE(_darr);                                        \
+    /* return */(_darr)[--(*DA_P_LENGTH_FROM_HANDLE(_darr))];                  \
+})
+
+#define _da_move_and_insert(darr, index, value)                                \
+memmove(                                                                       \
+    darr+index+1,                                                              \
+    darr+index,                                                                \
+    (*DA_P_SIZEOF_ELEM_FROM_HANDLE(darr)) *                                    \
+        ((*DA_P_LENGTH_FROM_HANDLE(darr))-index)                               \
+);                                                                             \
+darr[index] = value;                                                           \
+(*DA_P_LENGTH_FROM_HANDLE(darr))++;                                            \
+
+#define /* ELEM_TYPE* */_da_insert(/* ELEM_TYPE* */darr, /* size_t */index,    \
+    /* ELEM_TYPE */value)                                                      \
+({                                                                             \
+    __auto_type _darr = darr;                                                  \
+    size_t _index = index;                                                     \
+    __auto_type _value = value;                                                \
+    if (*DA_P_LENGTH_FROM_HANDLE(_darr) == *DA_P_CAPACITY_FROM_HANDLE(_darr)   \
+        || DA_IS_SHARED(_darr))                                                \
+    {                                                                          \
+        _darr = da_reserve(_darr, 1);                                          \
+        if (_darr != NULL)                                                     \
+        {                                                                      \
+            DA_INVALIDATE_CONTENT_CACHE(_darr);                                \
+            _da_move_and_insert(_darr, _index, _value);                        \
+        }                                                                      \
     }                                                                          \
     else                                                                       \
     {                                                                          \
+        DA_INVALIDATE_CONTENT_CACHE(_darr);                                    \
         _da_move_and_insert(_darr, _index, _value);                            \
     }                                                                          \
     /* return */_darr;                                                         \
@@ -401,6 +1855,7 @@ darr[index] = value;                                                           \
     __auto_type _darr = darr;                                                  \
     size_t _index = index;                                                     \
     __auto_type _rtn_val = _darr[_index];                                      \
+    DA_INVALIDATE_CONTENT_CACHE(_darr);                                        \
     memmove(                                                                   \
         _darr+_index,                                                          \
         _darr+_index+1,                                                        \
@@ -417,6 +1872,7 @@ do                                                                             \
     __auto_type _darr = darr;                                                  \
     __auto_type _value = value;                                                \
     size_t _len = *DA_P_LENGTH_FROM_HANDLE(_darr);                             \
+    DA_INVALIDATE_CONTENT_CACHE(_darr);                                        \
     for (size_t _indx = 0; _indx < _len; ++_indx)                              \
         _darr[_indx] = _value;                                                 \
 }while(0)
@@ -25,6 +25,7 @@
 
 #include "darray.h"
 #include <stdarg.h>
+#include <stdint.h>
 #include <stdio.h>
 
 /**@function
@@ -166,6 +167,236 @@ darray(char) dstr_concat_cstr(darray(char) dest, const char* src)
 darray(char) dstr_concat_dstr(darray(char) dest, const darray(char) src)
     DA_WARN_UNUSED_RESULT;
 
+/**@function
+ * @brief Append `sprintf` style formatted output to dstring `dest`. Output is
+ *  written directly into the unused capacity of `dest` and memory is only
+ *  reallocated when the output does not fit.
+ *
+ * @param dest : Target dstring that will be appended to. Like `da_concat`
+ *  references to `dest` may be invalidated across the function call. Use the
+ *  return value of `dstr_append_format` as truth for the location of `dest`
+ *  after function completion.
+ * @param format : `sprintf` style format string.
+ * @param ... : va arg list for the format string.
+ *
+ * @return Pointer to the new location of the dstring upon successful function
+ *  completion. If `dstr_append_format` returns `NULL`, reallocation failed and
+ *  `dest` is left untouched.
+ */
+darray(char) dstr_append_format(darray(char) dest, const char* format, ...)
+    DA_WARN_UNUSED_RESULT;
+
+/**@function
+ * @brief Allocate a new dstring containing the `nparts` strings of `parts`
+ *  separated by `sep`. The total length is computed first so the result is
+ *  allocated once and each part is copied once.
+ *
+ * @param parts : Array of cstrings or dstrings to join.
+ * @param nparts : Number of strings in `parts`.
+ * @param sep : Separator placed between consecutive parts.
+ *
+ * @return Pointer to a new dstring on success. `NULL` on allocation failure.
+ */
+darray(char) dstr_join(const char* const* parts, size_t nparts,
+    const char* sep) DA_WARN_UNUSED_RESULT;
+
+/**@function
+ * @brief Replace the contents of `*dstr` with the next line of input from
+ *  `reader`, without its terminating newline. Bytes are copied once, from the
+ *  buffer of `reader` into `*dstr`, and the capacity of `*dstr` is reused
+ *  across calls.
+ *
+ * @param reader : Target reader.
+ * @param dstr : Pointer to the handle of an allocated dstring. `*dstr` may
+ *  change if it has to grow, and is always left a valid dstring.
+ *
+ * @return `true` if a line was read. The last line of the input need not end
+ *  with a newline. `false` at the end of the input, or on a read or allocation
+ *  failure as reported by `da_reader_failed`, in which case `*dstr` holds any
+ *  partial line that was read.
+ */
+bool dstr_read_line(struct da_reader* reader, darray(char)* dstr);
+
+/* A `struct dstr_builder` records pointers to the fragments appended to it
+ * without copying them, then copies every fragment into a dstring allocated at
+ * its final size by `dstr_builder_build`. Fragments must remain valid and
+ * unmodified until the dstring is built.
+ */
+struct _dstr_builder_piece
+{
+    const char* _data;
+    size_t _length;
+};
+
+struct dstr_builder
+{
+    darray(struct _dstr_builder_piece) _pieces; // NULL until first append.
+    size_t _length;
+};
+
+/**@function
+ * @brief Initialize `builder` with no fragments. Never allocates memory.
+ *
+ * @param builder : Uninitialized string builder.
+ */
+void dstr_builder_init(struct dstr_builder* builder);
+
+/**@function
+ * @brief Free the memory owned by `builder`. Appended fragments are not freed.
+ *  `builder` is left with no fragments and may be reused.
+ *
+ * @param builder : Target string builder.
+ */
+void dstr_builder_free(struct dstr_builder* builder);
+
+/**@function
+ * @brief Remove every fragment from `builder` while keeping its memory for
+ *  reuse.
+ *
+ * @param builder : Target string builder.
+ */
+void dstr_builder_clear(struct dstr_builder* builder);
+
+/**@function
+ * @brief Append the `len` characters at `src` to `builder`. The characters are
+ *  not copied until `dstr_builder_build` is called.
+ *
+ * @param builder : Target string builder.
+ * @param src : Start of the fragment.
+ * @param len : Number of characters in the fragment.
+ *
+ * @return `true` on success. `false` on allocation failure, in which case
+ *  `builder` is left untouched.
+ */
+bool dstr_builder_append(struct dstr_builder* builder, const char* src,
+    size_t len) DA_WARN_UNUSED_RESULT;
+
+/**@function
+ * @brief Append cstring `src` to `builder`. `src` may also be a dstring.
+ *
+ * @param builder : Target string builder.
+ * @param src : Fragment to append.
+ *
+ * @return `true` on success. `false` on allocation failure, in which case
+ *  `builder` is left untouched.
+ */
+bool dstr_builder_append_cstr(struct dstr_builder* builder, const char* src)
+    DA_WARN_UNUSED_RESULT;
+
+/**@function
+ * @brief Append dstring `src` to `builder`. Faster than
+ *  `dstr_builder_append_cstr` for dstrings.
+ *
+ * @param builder : Target string builder.
+ * @param src : Fragment to append.
+ *
+ * @return `true` on success. `false` on allocation failure, in which case
+ *  `builder` is left untouched.
+ */
+bool dstr_builder_append_dstr(struct dstr_builder* builder,
+    const darray(char) src) DA_WARN_UNUSED_RESULT;
+
+/**@function
+ * @brief Returns the length of the string `builder` would build. O(1).
+ *
+ * @param builder : Target string builder.
+ *
+ * @return Total length of the fragments of `builder`.
+ */
+size_t dstr_builder_length(const struct dstr_builder* builder);
+
+/**@function
+ * @brief Allocate a new dstring containing every fragment of `builder` in the
+ *  order they were appended. Exactly one allocation is made.
+ *
+ * @param builder : Target string builder.
+ *
+ * @return Pointer to a new dstring on success. `NULL` on allocation failure.
+ */
+darray(char) dstr_builder_build(const struct dstr_builder* builder)
+    DA_WARN_UNUSED_RESULT;
+
+/**@function
+ * @brief Append the decimal representation of `value` to dstring `dest`.
+ *  Digits are written directly into the unused capacity of `dest` without
+ *  going through `sprintf`.
+ *
+ * @param dest : Target dstring that will be appended to. Like `da_concat`
+ *  references to `dest` may be invalidated across the function call.
+ * @param value : Value to append.
+ *
+ * @return Pointer to the new location of the dstring upon successful function
+ *  completion. If `dstr_append_i64` returns `NULL`, reallocation failed and
+ *  `dest` is left untouched.
+ */
+darray(char) dstr_append_i64(darray(char) dest, int64_t value)
+    DA_WARN_UNUSED_RESULT;
+
+/**@function
+ * @brief Append the decimal representation of `value` to dstring `dest`.
+ *  Digits are written directly into the unused capacity of `dest` without
+ *  going through `sprintf`.
+ *
+ * @param dest : Target dstring that will be appended to. Like `da_concat`
+ *  references to `dest` may be invalidated across the function call.
+ * @param value : Value to append.
+ *
+ * @return Pointer to the new location of the dstring upon successful function
+ *  completion. If `dstr_append_u64` returns `NULL`, reallocation failed and
+ *  `dest` is left untouched.
+ */
+darray(char) dstr_append_u64(darray(char) dest, uint64_t value)
+    DA_WARN_UNUSED_RESULT;
+
+/**@function
+ * @brief Append a decimal representation of `value` to dstring `dest` that
+ *  parses back to exactly `value`. All but a tiny fraction of values are
+ *  written with the fewest digits possible. Positional notation is used for
+ *  moderate exponents and scientific notation otherwise (e.g. `0.1`, `123456`,
+ *  `1e+300`, `-inf`, `nan`).
+ *
+ * @param dest : Target dstring that will be appended to. Like `da_concat`
+ *  references to `dest` may be invalidated across the function call.
+ * @param value : Value to append.
+ *
+ * @return Pointer to the new location of the dstring upon successful function
+ *  completion. If `dstr_append_f64` returns `NULL`, reallocation failed and
+ *  `dest` is left untouched.
+ */
+darray(char) dstr_append_f64(darray(char) dest, double value)
+    DA_WARN_UNUSED_RESULT;
+
+/**@function
+ * @brief Parse a base 10 integer from the start of the `len` characters at
+ *  `src`. `src` may be a dstring or any range of characters within a string,
+ *  and does not need to be null terminated. An optional leading `+` or `-` is
+ *  accepted. Leading whitespace is not skipped.
+ *
+ * @param src : Start of the characters to parse.
+ * @param len : Number of characters available at `src`.
+ * @param value : Location where the parsed value is stored on success.
+ *
+ * @return Number of characters consumed. `0` if `src` does not start with an
+ *  integer or the integer is out of range, in which case `value` is left
+ *  untouched.
+ */
+size_t dstr_parse_i64(const char* src, size_t len, int64_t* value);
+
+/**@function
+ * @brief Parse a floating point number from the start of the `len` characters
+ *  at `src`. Accepts the same syntax as `strtod` without leading whitespace.
+ *  `src` may be a dstring or any range of characters within a string, and does
+ *  not need to be null terminated.
+ *
+ * @param src : Start of the characters to parse.
+ * @param len : Number of characters available at `src`.
+ * @param value : Location where the parsed value is stored on success.
+ *
+ * @return Number of characters consumed. `0` if `src` does not start with a
+ *  floating point number, in which case `value` is left untouched.
+ */
+size_t dstr_parse_f64(const char* src, size_t len, double* value);
+
 /**@function
  * @brief Comparison function. Currently functionally equivalent to `strcmp`.
  *
@@ -268,4 +499,314 @@ void dstr_transform_upper(darray(char) dstr);
  */
 darray(char) dstr_trim(darray(char) dstr) DA_WARN_UNUSED_RESULT;
 
+/////////////////////// SMALL STRING OPTIMIZED DSTRINGS ////////////////////////
+/* A `struct dstr_sso` holds strings of up to `DSTR_SSO_INLINE_CAPACITY`
+ * characters directly inside the struct without any heap allocation. Longer
+ * strings are stored in a regular heap allocated dstring owned by the struct.
+ *
+ * INLINE LAYOUT
+ * +------+------+-----+-------------+----------------------------------------+
+ * | c[0] | c[1] | ... | '\0' (pad)  | DSTR_SSO_INLINE_CAPACITY - length      |
+ * +------+------+-----+-------------+----------------------------------------+
+ * The last byte doubles as the null terminator when the string is full.
+ *
+ * HEAP LAYOUT
+ * +---------------------+-----------------------------+----------------------+
+ * | darray(char) handle | unused                      | DSTR_SSO_HEAP_TAG    |
+ * +---------------------+-----------------------------+----------------------+
+ */
+#define DSTR_SSO_SIZE 24
+#define DSTR_SSO_INLINE_CAPACITY (DSTR_SSO_SIZE - 1)
+#define DSTR_SSO_HEAP_TAG 0xFF
+
+struct dstr_sso
+{
+    union
+    {
+        char _inline[DSTR_SSO_SIZE];
+        darray(char) _heap;
+    } _u;
+};
+
+/**@function
+ * @brief Initialize `sso` as the empty string `""`. Never allocates memory.
+ *
+ * @param sso : Uninitialized small string optimized dstring.
+ */
+void dstr_sso_init(struct dstr_sso* sso);
+
+/**@function
+ * @brief Initialize `sso` as a copy of cstring `src`. `src` may also be a
+ *  dstring. Memory is only allocated if `src` is longer than
+ *  `DSTR_SSO_INLINE_CAPACITY` characters.
+ *
+ * @param sso : Uninitialized small string optimized dstring.
+ * @param src : string to copy.
+ *
+ * @return `true` on success. `false` on allocation failure, in which case
+ *  `sso` is initialized as the empty string.
+ */
+bool dstr_sso_from_cstr(struct dstr_sso* sso, const char* src)
+    DA_WARN_UNUSED_RESULT;
+
+/**@function
+ * @brief Initialize `sso` as a copy of dstring `src`. Faster than
+ *  `dstr_sso_from_cstr` when copying a dstring.
+ *
+ * @param sso : Uninitialized small string optimized dstring.
+ * @param src : dstring to copy.
+ *
+ * @return `true` on success. `false` on allocation failure, in which case
+ *  `sso` is initialized as the empty string.
+ */
+bool dstr_sso_from_dstr(struct dstr_sso* sso, const darray(char) src)
+    DA_WARN_UNUSED_RESULT;
+
+/**@function
+ * @brief Allocate a new dstring as a copy of `sso`.
+ *
+ * @param sso : Small string optimized dstring to copy.
+ *
+ * @return Pointer to a new dstring on success. `NULL` on allocation failure.
+ */
+darray(char) dstr_sso_to_dstr(const struct dstr_sso* sso)
+    DA_WARN_UNUSED_RESULT;
+
+/**@function
+ * @brief Convert `sso` into a dstring, transferring ownership of its contents
+ *  to the caller. If the contents of `sso` already live on the heap no copy is
+ *  made. `sso` is left as the empty string.
+ *
+ * @param sso : Target small string optimized dstring.
+ *
+ * @return Pointer to a dstring with the former contents of `sso` on success.
+ *  `NULL` on allocation failure, in which case `sso` is left untouched.
+ */
+darray(char) dstr_sso_release(struct dstr_sso* sso) DA_WARN_UNUSED_RESULT;
+
+/**@function
+ * @brief Free any heap memory owned by `sso`. `sso` is left as the empty
+ *  string and may be reused.
+ *
+ * @param sso : Target small string optimized dstring.
+ */
+void dstr_sso_free(struct dstr_sso* sso);
+
+/**@function
+ * @brief Reassign the contents of `sso` to the `len` characters at `src`.
+ *  Reallocates memory only when neccesary. `src` may point into `sso` itself.
+ *
+ * @param sso : Initialized small string optimized dstring.
+ * @param src : Start of the characters to copy.
+ * @param len : Number of characters to copy.
+ *
+ * @return `true` on success. `false` on allocation failure, in which case
+ *  `sso` is left untouched.
+ */
+bool dstr_sso_assign(struct dstr_sso* sso, const char* src, size_t len)
+    DA_WARN_UNUSED_RESULT;
+
+/**@function
+ * @brief Append the `len` characters at `src` to `sso`, moving the string to
+ *  the heap if it no longer fits inline. `src` may point into `sso` itself.
+ *
+ * @param sso : Initialized small string optimized dstring.
+ * @param src : Start of the characters to append.
+ * @param len : Number of characters to append.
+ *
+ * @return `true` on success. `false` on allocation failure, in which case
+ *  `sso` is left untouched.
+ */
+bool dstr_sso_append(struct dstr_sso* sso, const char* src, size_t len)
+    DA_WARN_UNUSED_RESULT;
+
+/**@function
+ * @brief Returns a pointer to the null terminated contents of `sso`. The
+ *  pointer is invalidated by any call that modifies `sso`.
+ *
+ * @param sso : Target small string optimized dstring.
+ *
+ * @return Null terminated contents of `sso`.
+ */
+const char* dstr_sso_cstr(const struct dstr_sso* sso);
+
+/**@function
+ * @brief Returns the length of `sso` without its null terminator. O(1).
+ *
+ * @param sso : Target small string optimized dstring.
+ *
+ * @return Length of `sso` without its null terminator.
+ */
+size_t dstr_sso_length(const struct dstr_sso* sso);
+
+/**@function
+ * @brief Returns `true` if the contents of `sso` are stored inline.
+ *
+ * @param sso : Target small string optimized dstring.
+ *
+ * @return `true` if `sso` owns no heap memory.
+ */
+bool dstr_sso_is_inline(const struct dstr_sso* sso);
+
+/**@function
+ * @brief Comparison function. Orders strings like `strcmp`, but embedded null
+ *  characters are compared as well.
+ *
+ * @param s1 : First small string optimized dstring.
+ * @param s2 : Second small string optimized dstring.
+ *
+ * @return `strcmp` style comparison of `s1` and `s2`.
+ */
+int dstr_sso_cmp(const struct dstr_sso* s1, const struct dstr_sso* s2);
+
+/**@function
+ * @brief Returns `true` if `s1` and `s2` have the same contents. Two inline
+ *  strings are compared with a single fixed-size `memcmp`.
+ *
+ * @param s1 : First small string optimized dstring.
+ * @param s2 : Second small string optimized dstring.
+ *
+ * @return `true` if `s1` and `s2` are equal.
+ */
+bool dstr_sso_equal(const struct dstr_sso* s1, const struct dstr_sso* s2);
+
+///////////////////////////// HASHING AND INTERNING ////////////////////////////
+/**@function
+ * @brief Compute a hash of the contents of `dstr`. If a hash has been cached in
+ *  the header of `dstr` it is returned without rehashing.
+ *
+ * @param dstr : Target dstring.
+ *
+ * @return Hash of the characters of `dstr`, excluding the null terminator. The
+ *  top 4 bits of the hash are always zero.
+ *
+ * @note Hash values are not stable across platforms or library versions and
+ *  must not be persisted.
+ */
+uint64_t dstr_hash(const darray(char) dstr);
+
+/**@function
+ * @brief Same as `dstr_hash`, but the result is cached in the header of `dstr`
+ *  so that later calls to `dstr_hash` and `dstr_hash_cached` are O(1).
+ *
+ * @param dstr : Target dstring.
+ *
+ * @return Hash of the characters of `dstr`, excluding the null terminator.
+ *
+ * @note Every darray and dstring function/macro that modifies `dstr` drops the
+ *  cached hash. Characters written directly through the handle are not
+ *  tracked, so call `dstr_invalidate_cache` after doing so.
+ * @note The hash is not cached while `dstr` is shared, since other owners may
+ *  be reading its header.
+ */
+uint64_t dstr_hash_cached(darray(char) dstr);
+
+/**@function
+ * @brief Drop everything cached in the header of `dstr` about its contents:
+ *  the hash stored by `dstr_hash_cached` and the validity recorded by
+ *  `dstr_utf8_validate`.
+ *
+ * @param dstr : Target dstring.
+ */
+void dstr_invalidate_cache(darray(char) dstr);
+
+/* A `struct dstr_intern_pool` owns one canonical dstring per distinct string
+ * passed to `dstr_intern`. Two strings interned in the same pool are equal if
+ * and only if their handles are equal.
+ */
+struct dstr_intern_pool
+{
+    darray(darray(char)) _slots; // Open addressing table. NULL when empty.
+    size_t _count;
+};
+
+/**@function
+ * @brief Initialize `pool` as an empty intern pool. Never allocates memory.
+ *
+ * @param pool : Uninitialized intern pool.
+ */
+void dstr_intern_pool_init(struct dstr_intern_pool* pool);
+
+/**@function
+ * @brief Free `pool` and every dstring interned in it. `pool` is left empty
+ *  and may be reused.
+ *
+ * @param pool : Target intern pool.
+ */
+void dstr_intern_pool_free(struct dstr_intern_pool* pool);
+
+/**@function
+ * @brief Returns the canonical dstring of `pool` with the contents of the
+ *  `len` characters at `src`, adding a copy to `pool` if none exists.
+ *
+ * @param pool : Target intern pool.
+ * @param src : Start of the characters to intern.
+ * @param len : Number of characters to intern.
+ *
+ * @return Interned dstring on success. `NULL` on allocation failure.
+ *
+ * @note The returned dstring is owned by `pool` and remains valid until
+ *  `dstr_intern_pool_free` is called. It must not be modified or freed. Its
+ *  hash is always cached.
+ */
+const darray(char) dstr_intern(struct dstr_intern_pool* pool, const char* src,
+    size_t len) DA_WARN_UNUSED_RESULT;
+
+/**@function
+ * @brief Returns the number of distinct strings interned in `pool`.
+ *
+ * @param pool : Target intern pool.
+ *
+ * @return Number of distinct strings in `pool`.
+ */
+size_t dstr_intern_pool_count(const struct dstr_intern_pool* pool);
+
+/**@function
+ * @brief Returns the number of heap bytes owned by `pool`, including its
+ *  lookup table and darray headers.
+ *
+ * @param pool : Target intern pool.
+ *
+ * @return Heap bytes owned by `pool`.
+ */
+size_t dstr_intern_pool_bytes(const struct dstr_intern_pool* pool);
+
+//////////////////////////////////// UTF-8 /////////////////////////////////////
+/**@function
+ * @brief Returns `true` if `dstr` is valid UTF-8. Overlong encodings,
+ *  surrogates, and codepoints above U+10FFFF are rejected. A successful result
+ *  is recorded in the header of `dstr` so that repeat checks are O(1) until
+ *  `dstr` is modified.
+ *
+ * @param dstr : Target dstring.
+ *
+ * @return `true` if `dstr` is valid UTF-8.
+ *
+ * @note The result is not recorded while `dstr` is shared, since other owners
+ *  may be reading its header.
+ */
+bool dstr_utf8_validate(darray(char) dstr);
+
+/**@function
+ * @brief Returns the number of codepoints in `dstr`. O(1) if `dstr` has been
+ *  validated and found to be ASCII.
+ *
+ * @param dstr : Target dstring. Must be valid UTF-8.
+ *
+ * @return Number of codepoints in `dstr`, excluding the null terminator.
+ */
+size_t dstr_utf8_count(const darray(char) dstr);
+
+/**@function
+ * @brief Returns the byte offset of the codepoint at codepoint index `index`
+ *  in `dstr` or `-1` if `dstr` contains `index` or fewer codepoints. O(1) if
+ *  `dstr` has been validated and found to be ASCII.
+ *
+ * @param dstr : Target dstring. Must be valid UTF-8.
+ * @param index : Codepoint index.
+ *
+ * @return Byte offset of codepoint `index` or `-1`.
+ */
+long dstr_utf8_index(const darray(char) dstr, size_t index);
+
 #endif // !_DSTRING_H_
@@ -4,6 +4,13 @@
 #include <EMUtest.h>
 #include "../darray.h"
 #include "../dstring.h"
+#include <fcntl.h>
+#include <limits.h>
+#include <math.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <wchar.h>
 
 #define INITIAL_NUM_ELEMS 5
 #define RESIZE_NUM_ELEMS 100
@@ -85,10 +92,163 @@ EMU_TEST(da_alloc_exact__and__da_free)
     EMU_END_TEST();
 }
 
+EMU_TEST(da_alloc__header)
+{
+    // The flags and the reference count fit in the existing header fields.
+    if (SIZE_MAX == UINT64_MAX && alignof(max_align_t) <= 32)
+    {
+        EMU_EXPECT_EQ_UINT(sizeof(struct _darray), 32);
+    }
+    EMU_EXPECT_NULL(da_alloc(1, (size_t)UINT32_MAX + 1));
+    EMU_EXPECT_NULL(da_alloc_exact(1, (size_t)UINT32_MAX + 1));
+    EMU_END_TEST();
+}
+
 EMU_GROUP(darray_alloc_and_free_functions)
 {
     EMU_ADD(da_alloc__and__da_free);
     EMU_ADD(da_alloc_exact__and__da_free);
+    EMU_ADD(da_alloc__header);
+    EMU_END_GROUP();
+}
+
+EMU_TEST(da_share__and__da_free)
+{
+    int* da = da_alloc(INITIAL_NUM_ELEMS, sizeof(int));
+    EMU_REQUIRE_NOT_NULL(da);
+    EMU_EXPECT_FALSE(da_is_shared(da));
+    int* snapshot = da_share(da);
+    EMU_EXPECT_TRUE(snapshot == da);
+    EMU_EXPECT_TRUE(da_is_shared(da));
+    EMU_EXPECT_TRUE(da_is_shared(snapshot));
+
+    da_free(da);
+    EMU_EXPECT_FALSE(da_is_shared(snapshot));
+    EMU_EXPECT_EQ_UINT(da_length(snapshot), INITIAL_NUM_ELEMS);
+    da_free(snapshot);
+    EMU_END_TEST();
+}
+
+EMU_TEST(da_share__copies_on_write)
+{
+    int* da = da_alloc(INITIAL_NUM_ELEMS, sizeof(int));
+    EMU_REQUIRE_NOT_NULL(da);
+    for (size_t i = 0; i < INITIAL_NUM_ELEMS; ++i)
+    {
+        da[i] = i;
+    }
+    int* snapshot = da_share(da);
+
+    da = da_push(da, 42);
+    EMU_REQUIRE_NOT_NULL(da);
+    EMU_EXPECT_TRUE(da != snapshot);
+    EMU_EXPECT_FALSE(da_is_shared(da));
+    EMU_EXPECT_FALSE(da_is_shared(snapshot));
+    EMU_EXPECT_EQ_UINT(da_length(da), INITIAL_NUM_ELEMS+1);
+    EMU_EXPECT_EQ_UINT(da_length(snapshot), INITIAL_NUM_ELEMS);
+    EMU_EXPECT_EQ_INT(da[INITIAL_NUM_ELEMS], 42);
+    for (size_t i = 0; i < INITIAL_NUM_ELEMS; ++i)
+    {
+        EMU_EXPECT_EQ_INT(da[i], i);
+        EMU_EXPECT_EQ_INT(snapshot[i], i);
+    }
+    da_free(snapshot);
+
+    // Functions that return a handle copy a shared darray. The copy keeps the
+    // capacity of the original where possible.
+    snapshot = da_share(da);
+    int* resized = da_resize(da, 3);
+    EMU_REQUIRE_NOT_NULL(resized);
+    EMU_EXPECT_EQ_UINT(da_length(resized), 3);
+    EMU_EXPECT_EQ_UINT(da_length(snapshot), INITIAL_NUM_ELEMS+1);
+    da_free(resized);
+    da = da_share(snapshot);
+    int* reserved = da_reserve(da, 0);
+    EMU_REQUIRE_NOT_NULL(reserved);
+    EMU_EXPECT_TRUE(reserved != snapshot);
+    EMU_EXPECT_EQ_UINT(da_capacity(reserved), da_capacity(snapshot));
+    da_free(reserved);
+    da_free(snapshot);
+    EMU_END_TEST();
+}
+
+EMU_TEST(da_unshare)
+{
+    int* da = da_alloc(INITIAL_NUM_ELEMS, sizeof(int));
+    EMU_REQUIRE_NOT_NULL(da);
+    for (size_t i = 0; i < INITIAL_NUM_ELEMS; ++i)
+    {
+        da[i] = i;
+    }
+    EMU_EXPECT_TRUE(da_unshare(da) == da);
+
+    int* snapshot = da_share(da);
+    da = da_unshare(da);
+    EMU_REQUIRE_NOT_NULL(da);
+    EMU_EXPECT_TRUE(da != snapshot);
+    da_swap(da, 0, 1);
+    EMU_EXPECT_EQ_INT(da[0], 1);
+    EMU_EXPECT_EQ_INT(snapshot[0], 0);
+    EMU_EXPECT_FALSE(da_is_shared(snapshot));
+
+    da_free(da);
+    da_free(snapshot);
+    EMU_END_TEST();
+}
+
+EMU_TEST(dstr_functions__copy_on_write)
+{
+    // Every dstring function that returns a handle copies a shared dstring
+    // before writing to it, leaving the other owner's contents intact.
+    darray(char) dstr = dstr_alloc_from_cstr(" hello ");
+    EMU_REQUIRE_NOT_NULL(dstr);
+    darray(char) snapshot;
+
+#define DSTR_CHECK_COPY_ON_WRITE(call, expected)                               \
+    snapshot = da_share(dstr);                                                 \
+    dstr = call;                                                               \
+    EMU_REQUIRE_NOT_NULL(dstr);                                                \
+    EMU_EXPECT_TRUE(dstr != snapshot);                                         \
+    EMU_EXPECT_STREQ(dstr, expected);                                          \
+    EMU_EXPECT_STREQ(snapshot, " hello ");                                     \
+    EMU_EXPECT_EQ_UINT(dstr_length(snapshot), 7);                              \
+    EMU_EXPECT_FALSE(da_is_shared(snapshot));                                  \
+    dstr_free(dstr);                                                           \
+    dstr = snapshot
+
+    DSTR_CHECK_COPY_ON_WRITE(dstr_append_format(dstr, "%d", 1), " hello 1");
+    DSTR_CHECK_COPY_ON_WRITE(dstr_reassign_empty(dstr), "");
+    DSTR_CHECK_COPY_ON_WRITE(dstr_reassign_from_cstr(dstr, "bye"), "bye");
+    DSTR_CHECK_COPY_ON_WRITE(dstr_reassign_from_dstr(dstr, dstr), " hello ");
+    DSTR_CHECK_COPY_ON_WRITE(dstr_reassign_from_format(dstr, "%d", 1), "1");
+    DSTR_CHECK_COPY_ON_WRITE(dstr_replace_all(dstr, "l", ""), " heo ");
+    DSTR_CHECK_COPY_ON_WRITE(dstr_replace_all_case(dstr, "LL", "r"),
+        " hero ");
+    DSTR_CHECK_COPY_ON_WRITE(dstr_trim(dstr), "hello");
+    DSTR_CHECK_COPY_ON_WRITE(dstr_concat_cstr(dstr, "!"), " hello !");
+    DSTR_CHECK_COPY_ON_WRITE(dstr_append_i64(dstr, -5), " hello -5");
+#undef DSTR_CHECK_COPY_ON_WRITE
+
+    // A failed format keeps the reference to the shared dstring. An emoji
+    // cannot be converted to a multibyte character in the "C" locale.
+    snapshot = da_share(dstr);
+    EMU_EXPECT_NULL(dstr_append_format(dstr, "%lc", (wint_t)0x1F600));
+    EMU_EXPECT_NULL(dstr_reassign_from_format(dstr, "%lc", (wint_t)0x1F600));
+    EMU_EXPECT_TRUE(da_is_shared(snapshot));
+    EMU_EXPECT_STREQ(dstr, " hello ");
+    dstr_free(snapshot);
+    EMU_EXPECT_FALSE(da_is_shared(dstr));
+
+    dstr_free(dstr);
+    EMU_END_TEST();
+}
+
+EMU_GROUP(da_share_functions)
+{
+    EMU_ADD(da_share__and__da_free);
+    EMU_ADD(da_share__copies_on_write);
+    EMU_ADD(da_unshare);
+    EMU_ADD(dstr_functions__copy_on_write);
     EMU_END_GROUP();
 }
 
@@ -566,195 +726,1989 @@ EMU_GROUP(da_foreach)
     EMU_END_GROUP();
 }
 
-EMU_TEST(container_style_type)
+#define FIND_NUM_ELEMS 1000
+
+EMU_TEST(da_find__and__da_find_last)
 {
-    int* da = da_alloc(INITIAL_NUM_ELEMS, sizeof(int));
-    darray(int) da2 = da; // check for no compiler warnings
+    short* da = da_alloc(FIND_NUM_ELEMS, sizeof(short));
+    EMU_REQUIRE_NOT_NULL(da);
+    for (size_t i = 0; i < FIND_NUM_ELEMS; ++i)
+    {
+        da[i] = i % 100;
+    }
+    short value = 42;
+    EMU_EXPECT_EQ_UINT(da_find(da, &value), 42);
+    EMU_EXPECT_EQ_UINT(da_find_last(da, &value), FIND_NUM_ELEMS - 58);
+    EMU_EXPECT_TRUE(da_contains(da, &value));
+    value = -1;
+    EMU_EXPECT_EQ_UINT(da_find(da, &value), FIND_NUM_ELEMS);
+    EMU_EXPECT_EQ_UINT(da_find_last(da, &value), FIND_NUM_ELEMS);
+    EMU_EXPECT_FALSE(da_contains(da, &value));
+
+    // Only the element in the tail after the last full SIMD vector matches.
+    da[FIND_NUM_ELEMS-1] = -1;
+    EMU_EXPECT_EQ_UINT(da_find(da, &value), FIND_NUM_ELEMS-1);
+    EMU_EXPECT_EQ_UINT(da_find_last(da, &value), FIND_NUM_ELEMS-1);
 
-    da_free(da2);
+    da_free(da);
     EMU_END_TEST();
 }
 
-EMU_GROUP(darray_functions)
+EMU_TEST(da_find_range)
 {
-    EMU_ADD(da_length);
-    EMU_ADD(da_capacity);
-    EMU_ADD(da_sizeof_elem);
-    EMU_ADD(darray_alloc_and_free_functions);
-    EMU_ADD(da_resize);
-    EMU_ADD(da_resize_exact);
-    EMU_ADD(da_reserve);
-    EMU_ADD(da_push);
-    EMU_ADD(da_pop);
-    EMU_ADD(da_insert);
-    EMU_ADD(da_insert_arr);
-    EMU_ADD(da_remove);
-    EMU_ADD(da_remove_arr);
-    EMU_ADD(da_swap);
-    EMU_ADD(da_concat);
-    EMU_ADD(da_fill);
-    EMU_ADD(da_foreach);
-    EMU_ADD(container_style_type);
-    EMU_END_GROUP();
-}
+    long long* da = da_alloc(FIND_NUM_ELEMS, sizeof(long long));
+    EMU_REQUIRE_NOT_NULL(da);
+    for (size_t i = 0; i < FIND_NUM_ELEMS; ++i)
+    {
+        da[i] = i % 10;
+    }
+    long long value = 3;
+    EMU_EXPECT_EQ_UINT(da_find_range(da, 0, FIND_NUM_ELEMS, &value), 3);
+    EMU_EXPECT_EQ_UINT(da_find_range(da, 4, FIND_NUM_ELEMS, &value), 13);
+    EMU_EXPECT_EQ_UINT(da_find_range(da, 504, 513, &value), 513);
+    EMU_EXPECT_EQ_UINT(da_find_range(da, 7, 7, &value), 7);
 
-EMU_TEST(dstr_alloc_empty__and__dstr_free);
-{
-    char* dstr = dstr_alloc_empty();
-    EMU_REQUIRE_NOT_NULL(dstr);
-    EMU_REQUIRE_GE_UINT(da_capacity(dstr), da_length(dstr));
-    EMU_REQUIRE_EQ_UINT(strlen(dstr), 0);
-    EMU_REQUIRE_STREQ(dstr, EMPTY_STR);
-    dstr_free(dstr);
+    da_free(da);
     EMU_END_TEST();
 }
 
-EMU_TEST(dstr_alloc_from_cstr__and__dstr_free);
+EMU_TEST(da_count)
 {
-    char* dstr = dstr_alloc_from_cstr(EMPTY_STR);
-    EMU_REQUIRE_NOT_NULL(dstr);
-    EMU_REQUIRE_GE_UINT(da_capacity(dstr), da_length(dstr));
-    EMU_REQUIRE_EQ_UINT(strlen(dstr), 0);
-    EMU_REQUIRE_STREQ(dstr, EMPTY_STR);
-    dstr_free(dstr);
-
-    dstr = dstr_alloc_from_cstr(TEST_STR0);
-    EMU_REQUIRE_NOT_NULL(dstr);
-    EMU_REQUIRE_GE_UINT(da_capacity(dstr), da_length(dstr));
-    EMU_REQUIRE_EQ_UINT(strlen(dstr), strlen(TEST_STR0));
-    EMU_REQUIRE_STREQ(dstr, TEST_STR0);
-    dstr_free(dstr);
-
-    dstr = dstr_alloc_from_cstr(TEST_STR1);
-    EMU_REQUIRE_NOT_NULL(dstr);
-    EMU_REQUIRE_GE_UINT(da_capacity(dstr), da_length(dstr));
-    EMU_REQUIRE_EQ_UINT(strlen(dstr), strlen(TEST_STR1));
-    EMU_REQUIRE_STREQ(dstr, TEST_STR1);
-    dstr_free(dstr);
+    int* ints = da_alloc(FIND_NUM_ELEMS, sizeof(int));
+    EMU_REQUIRE_NOT_NULL(ints);
+    for (size_t i = 0; i < FIND_NUM_ELEMS; ++i)
+    {
+        ints[i] = i % 3;
+    }
+    int value = 2;
+    EMU_EXPECT_EQ_UINT(da_count(ints, &value), FIND_NUM_ELEMS/3);
+    value = 3;
+    EMU_EXPECT_EQ_UINT(da_count(ints, &value), 0);
+
+    // Element sizes without a SIMD path are compared with memcmp.
+    struct {char c[3];}* triples = da_alloc(FIND_NUM_ELEMS, 3);
+    EMU_REQUIRE_NOT_NULL(triples);
+    for (size_t i = 0; i < FIND_NUM_ELEMS; ++i)
+    {
+        triples[i].c[0] = 'a';
+        triples[i].c[1] = 'b';
+        triples[i].c[2] = i % 5 == 0 ? 'c' : 'd';
+    }
+    EMU_EXPECT_EQ_UINT(da_count(triples, "abc"), FIND_NUM_ELEMS/5);
+    EMU_EXPECT_EQ_UINT(da_find(triples, "abd"), 1);
+    EMU_EXPECT_EQ_UINT(da_find_last(triples, "abc"), FIND_NUM_ELEMS - 5);
 
+    da_free(ints);
+    da_free(triples);
     EMU_END_TEST();
 }
 
-EMU_TEST(dstr_alloc_from_dstr__and__dstr_free);
+EMU_GROUP(da_find_functions)
 {
-    char* src = dstr_alloc_from_cstr(EMPTY_STR);
-    char* dest = dstr_alloc_from_dstr(src);
-    EMU_REQUIRE_NOT_NULL(dest);
-    EMU_REQUIRE_GE_UINT(da_capacity(dest), da_length(dest));
-    EMU_REQUIRE_EQ_UINT(strlen(dest), 0);
-    EMU_REQUIRE_STREQ(dest, EMPTY_STR);
-    dstr_free(src);
-    dstr_free(dest);
-
-    src = dstr_alloc_from_cstr(TEST_STR0);
-    dest = dstr_alloc_from_dstr(src);
-    EMU_REQUIRE_NOT_NULL(dest);
-    EMU_REQUIRE_GE_UINT(da_capacity(dest), da_length(dest));
-    EMU_REQUIRE_EQ_UINT(strlen(dest), strlen(TEST_STR0));
-    EMU_REQUIRE_STREQ(dest, TEST_STR0);
-    dstr_free(src);
-    dstr_free(dest);
+    EMU_ADD(da_find__and__da_find_last);
+    EMU_ADD(da_find_range);
+    EMU_ADD(da_count);
+    EMU_END_GROUP();
+}
 
-    src = dstr_alloc_from_cstr(TEST_STR1);
-    dest = dstr_alloc_from_dstr(src);
-    EMU_REQUIRE_NOT_NULL(dest);
-    EMU_REQUIRE_GE_UINT(da_capacity(dest), da_length(dest));
-    EMU_REQUIRE_EQ_UINT(strlen(dest), strlen(TEST_STR1));
-    EMU_REQUIRE_STREQ(dest, TEST_STR1);
-    dstr_free(src);
-    dstr_free(dest);
+EMU_TEST(container_style_type)
+{
+    int* da = da_alloc(INITIAL_NUM_ELEMS, sizeof(int));
+    darray(int) da2 = da; // check for no compiler warnings
 
+    da_free(da2);
     EMU_END_TEST();
 }
 
-EMU_TEST(dstr_alloc_from_format__and__dstr_free)
+#define SORT_NUM_ELEMS 1000
+
+struct sort_pair {int key; int order;};
+
+static int compare_ints(const void* a, const void* b)
 {
-    char* dstr = dstr_alloc_from_format("%d %s", 5, "foo");
-    EMU_REQUIRE_NOT_NULL(dstr);
-    EMU_REQUIRE_GE_UINT(da_capacity(dstr), da_length(dstr));
-    EMU_REQUIRE_EQ_UINT(strlen(dstr), 5);
-    EMU_REQUIRE_STREQ(dstr, "5 foo");
-    dstr_free(dstr);
-    EMU_END_TEST();
+    int x = *(const int*)a;
+    int y = *(const int*)b;
+    return (x > y) - (x < y);
 }
 
-EMU_GROUP(dstring_alloc_and_free_functions)
+static int compare_sort_pairs(const void* a, const void* b)
 {
-    EMU_ADD(dstr_alloc_empty__and__dstr_free);
-    EMU_ADD(dstr_alloc_from_cstr__and__dstr_free);
-    EMU_ADD(dstr_alloc_from_dstr__and__dstr_free);
-    EMU_ADD(dstr_alloc_from_format__and__dstr_free);
-    EMU_END_GROUP();
+    return compare_ints(&((const struct sort_pair*)a)->key,
+        &((const struct sort_pair*)b)->key);
 }
 
-#define FIRST_STR   "string"
-#define SHORTER_STR "str"
-#define LONGER_STR  "longer string"
-
-EMU_TEST(dstr_reassign_empty)
+EMU_TEST(da_sort)
 {
-    char* dstr = dstr_alloc_from_cstr(FIRST_STR);
-    dstr = dstr_reassign_empty(dstr);
-    EMU_REQUIRE_NOT_NULL(dstr);
-    EMU_REQUIRE_GE_UINT(da_capacity(dstr), da_length(dstr));
-    EMU_REQUIRE_EQ_UINT(strlen(dstr), 0);
-    EMU_REQUIRE_STREQ(dstr, EMPTY_STR);
-    dstr_free(dstr);
+    int* da = da_alloc(SORT_NUM_ELEMS, sizeof(int));
+    EMU_REQUIRE_NOT_NULL(da);
+    long sum = 0;
+    for (size_t i = 0; i < da_length(da); ++i)
+    {
+        da[i] = rand() % 100 - 50;
+        sum += da[i];
+    }
+    da_sort(da, compare_ints);
+    for (size_t i = 1; i < da_length(da); ++i)
+    {
+        EMU_EXPECT_GE_INT(da[i], da[i-1]);
+        sum -= da[i];
+    }
+    EMU_EXPECT_EQ_INT(sum, da[0]);
+
+    // Already sorted input and a single element.
+    da_sort(da, compare_ints);
+    for (size_t i = 1; i < da_length(da); ++i)
+    {
+        EMU_EXPECT_GE_INT(da[i], da[i-1]);
+    }
+    da = da_resize(da, 1);
+    da_sort(da, compare_ints);
+    EMU_EXPECT_EQ_UINT(da_length(da), 1);
+
+    da_free(da);
     EMU_END_TEST();
 }
 
-EMU_TEST(dstr_reassign_from_cstr)
+EMU_TEST(da_sort_stable)
 {
-    char* dstr = dstr_alloc_from_cstr(FIRST_STR);
-
-    dstr = dstr_reassign_from_cstr(dstr, SHORTER_STR);
-    EMU_REQUIRE_NOT_NULL(dstr);
-    EMU_REQUIRE_GE_UINT(da_capacity(dstr), da_length(dstr));
-    EMU_REQUIRE_EQ_UINT(strlen(dstr), strlen(SHORTER_STR));
-    EMU_REQUIRE_STREQ(dstr, SHORTER_STR);
-
-    dstr = dstr_reassign_from_cstr(dstr, LONGER_STR);
-    EMU_REQUIRE_NOT_NULL(dstr);
-    EMU_REQUIRE_GE_UINT(da_capacity(dstr), da_length(dstr));
-    EMU_REQUIRE_EQ_UINT(strlen(dstr), strlen(LONGER_STR));
-    EMU_REQUIRE_STREQ(dstr, LONGER_STR);
+    struct sort_pair* da = da_alloc(SORT_NUM_ELEMS, sizeof(struct sort_pair));
+    EMU_REQUIRE_NOT_NULL(da);
+    for (size_t i = 0; i < da_length(da); ++i)
+    {
+        da[i] = (struct sort_pair){.key = rand() % 10, .order = i};
+    }
+    da_sort_stable(da, compare_sort_pairs);
+    for (size_t i = 1; i < da_length(da); ++i)
+    {
+        EMU_EXPECT_GE_INT(da[i].key, da[i-1].key);
+        if (da[i].key == da[i-1].key)
+        {
+            EMU_EXPECT_GT_INT(da[i].order, da[i-1].order);
+        }
+    }
 
-    dstr_free(dstr);
+    da_free(da);
     EMU_END_TEST();
 }
 
-EMU_TEST(dstr_reassign_from_dstr)
+EMU_TEST(da_sort_parallel)
 {
-    char* dstr = dstr_alloc_from_cstr(FIRST_STR);
-    char* src;
-
-    src = dstr_alloc_from_cstr(SHORTER_STR);
-    dstr = dstr_reassign_from_dstr(dstr, src);
-    EMU_REQUIRE_NOT_NULL(dstr);
-    EMU_REQUIRE_GE_UINT(da_capacity(dstr), da_length(dstr));
-    EMU_REQUIRE_EQ_UINT(strlen(dstr), strlen(SHORTER_STR));
-    EMU_REQUIRE_STREQ(dstr, SHORTER_STR);
-    dstr_free(src);
+    // Large enough to be split between threads.
+    const size_t nelem = 300000;
+    int* da = da_alloc(nelem, sizeof(int));
+    EMU_REQUIRE_NOT_NULL(da);
+    long sum = 0;
+    for (size_t i = 0; i < da_length(da); ++i)
+    {
+        da[i] = rand() % 1000 - 500;
+        sum += da[i];
+    }
+    da_sort_parallel(da, compare_ints, 4);
+    EMU_EXPECT_EQ_UINT(da_length(da), nelem);
+    for (size_t i = 1; i < da_length(da); ++i)
+    {
+        EMU_EXPECT_GE_INT(da[i], da[i-1]);
+        sum -= da[i];
+    }
+    EMU_EXPECT_EQ_INT(sum, da[0]);
 
-    src = dstr_alloc_from_cstr(LONGER_STR);
-    dstr = dstr_reassign_from_dstr(dstr, src);
-    EMU_REQUIRE_NOT_NULL(dstr);
-    EMU_REQUIRE_GE_UINT(da_capacity(dstr), da_length(dstr));
-    EMU_REQUIRE_EQ_UINT(strlen(dstr), strlen(LONGER_STR));
-    EMU_REQUIRE_STREQ(dstr, LONGER_STR);
-    dstr_free(src);
+    // Sorts run on the pool and respect its thread limit.
+    da_parallel_set_max_threads(2);
+    for (size_t i = 0; i < da_length(da); ++i)
+    {
+        da[i] = rand() % 1000 - 500;
+    }
+    da_sort_parallel(da, compare_ints, 0);
+    da_parallel_set_max_threads(0);
+    for (size_t i = 1; i < da_length(da); ++i)
+    {
+        EMU_EXPECT_GE_INT(da[i], da[i-1]);
+    }
 
-    dstr_free(dstr);
+    da_free(da);
     EMU_END_TEST();
 }
 
-EMU_TEST(dstr_reassign_from_format)
+static void sort_parallel_nested(void* elem, size_t index, void* ctx)
 {
-    char* dstr = dstr_alloc_from_cstr(FIRST_STR);
+    (void)index;
+    (void)ctx;
+    da_sort_parallel(*(int**)elem, compare_ints, 0);
+}
+
+EMU_TEST(da_sort_parallel__nested)
+{
+    // Sorts started from a da_parallel_for body run on the calling thread.
+    const size_t nelem = 200000;
+    int** das = da_alloc(4, sizeof(int*));
+    EMU_REQUIRE_NOT_NULL(das);
+    for (size_t k = 0; k < da_length(das); ++k)
+    {
+        das[k] = da_alloc(nelem, sizeof(int));
+        EMU_REQUIRE_NOT_NULL(das[k]);
+        for (size_t i = 0; i < nelem; ++i)
+        {
+            das[k][i] = rand() % 1000 - 500;
+        }
+    }
+    da_parallel_for(das, sort_parallel_nested, NULL, 1);
+    for (size_t k = 0; k < da_length(das); ++k)
+    {
+        for (size_t i = 1; i < nelem; ++i)
+        {
+            EMU_EXPECT_GE_INT(das[k][i], das[k][i-1]);
+        }
+        da_free(das[k]);
+    }
+
+    da_free(das);
+    EMU_END_TEST();
+}
+
+EMU_TEST(da_sort_numeric__integers)
+{
+    int* ints = da_alloc(SORT_NUM_ELEMS, sizeof(int));
+    EMU_REQUIRE_NOT_NULL(ints);
+    for (size_t i = 0; i < da_length(ints); ++i)
+    {
+        ints[i] = rand() - RAND_MAX/2;
+    }
+    da_sort_numeric(ints);
+    for (size_t i = 1; i < da_length(ints); ++i)
+    {
+        EMU_EXPECT_GE_INT(ints[i], ints[i-1]);
+    }
+    da_free(ints);
+
+    unsigned char* bytes = da_alloc(SORT_NUM_ELEMS, sizeof(unsigned char));
+    EMU_REQUIRE_NOT_NULL(bytes);
+    for (size_t i = 0; i < da_length(bytes); ++i)
+    {
+        bytes[i] = rand();
+    }
+    da_sort_numeric(bytes);
+    for (size_t i = 1; i < da_length(bytes); ++i)
+    {
+        EMU_EXPECT_GE_UINT(bytes[i], bytes[i-1]);
+    }
+    da_free(bytes);
+
+    EMU_END_TEST();
+}
+
+EMU_TEST(da_sort_numeric__floating_point)
+{
+    double* dbls = da_alloc(SORT_NUM_ELEMS, sizeof(double));
+    EMU_REQUIRE_NOT_NULL(dbls);
+    for (size_t i = 0; i < da_length(dbls); ++i)
+    {
+        dbls[i] = (double)(rand() - RAND_MAX/2) / (rand() + 1);
+    }
+    dbls[0] = -INFINITY;
+    dbls[SORT_NUM_ELEMS/2] = INFINITY;
+    da_sort_numeric(dbls);
+    EMU_EXPECT_TRUE(dbls[0] == -INFINITY);
+    EMU_EXPECT_TRUE(dbls[SORT_NUM_ELEMS-1] == INFINITY);
+    for (size_t i = 1; i < da_length(dbls); ++i)
+    {
+        EMU_EXPECT_TRUE(dbls[i] >= dbls[i-1]);
+    }
+    da_free(dbls);
+
+    float* flts = da_alloc(4, sizeof(float));
+    EMU_REQUIRE_NOT_NULL(flts);
+    flts[0] = 2.5f; flts[1] = -0.5f; flts[2] = 0.0f; flts[3] = -7.0f;
+    da_sort_numeric(flts);
+    EMU_EXPECT_TRUE(flts[0] == -7.0f);
+    EMU_EXPECT_TRUE(flts[1] == -0.5f);
+    EMU_EXPECT_TRUE(flts[2] == 0.0f);
+    EMU_EXPECT_TRUE(flts[3] == 2.5f);
+    da_free(flts);
+
+    EMU_END_TEST();
+}
+
+EMU_GROUP(da_sort_functions)
+{
+    EMU_ADD(da_sort);
+    EMU_ADD(da_sort_stable);
+    EMU_ADD(da_sort_parallel);
+    EMU_ADD(da_sort_parallel__nested);
+    EMU_ADD(da_sort_numeric__integers);
+    EMU_ADD(da_sort_numeric__floating_point);
+    EMU_END_GROUP();
+}
+
+static int* alloc_int_darray(const int* src, size_t nelem)
+{
+    int* da = da_alloc(0, sizeof(int));
+    return da == NULL ? NULL : da_concat(da, src, nelem);
+}
+
+EMU_TEST(da_lower_bound__and__da_upper_bound)
+{
+    const int vals[] = {1, 3, 3, 3, 7, 9};
+    int* da = alloc_int_darray(vals, sizeof(vals)/sizeof(int));
+    EMU_REQUIRE_NOT_NULL(da);
+
+    int key = 3;
+    EMU_EXPECT_EQ_UINT(da_lower_bound(da, &key, compare_ints), 1);
+    EMU_EXPECT_EQ_UINT(da_upper_bound(da, &key, compare_ints), 4);
+    key = 0;
+    EMU_EXPECT_EQ_UINT(da_lower_bound(da, &key, compare_ints), 0);
+    EMU_EXPECT_EQ_UINT(da_upper_bound(da, &key, compare_ints), 0);
+    key = 8;
+    EMU_EXPECT_EQ_UINT(da_lower_bound(da, &key, compare_ints), 5);
+    EMU_EXPECT_EQ_UINT(da_upper_bound(da, &key, compare_ints), 5);
+    key = 10;
+    EMU_EXPECT_EQ_UINT(da_lower_bound(da, &key, compare_ints), 6);
+    EMU_EXPECT_EQ_UINT(da_upper_bound(da, &key, compare_ints), 6);
+
+    da = da_resize(da, 0);
+    EMU_EXPECT_EQ_UINT(da_lower_bound(da, &key, compare_ints), 0);
+
+    da_free(da);
+    EMU_END_TEST();
+}
+
+EMU_TEST(da_insert_sorted__and__da_unique)
+{
+    int* da = da_alloc(0, sizeof(int));
+    EMU_REQUIRE_NOT_NULL(da);
+    for (int i = 0; i < SORT_NUM_ELEMS; ++i)
+    {
+        int value = rand() % 50;
+        da = da_insert_sorted(da, &value, compare_ints);
+        EMU_REQUIRE_NOT_NULL(da);
+    }
+    EMU_EXPECT_EQ_UINT(da_length(da), SORT_NUM_ELEMS);
+    for (size_t i = 1; i < da_length(da); ++i)
+    {
+        EMU_EXPECT_GE_INT(da[i], da[i-1]);
+    }
+
+    da_unique(da, compare_ints);
+    EMU_EXPECT_LE_UINT(da_length(da), 50);
+    for (size_t i = 1; i < da_length(da); ++i)
+    {
+        EMU_EXPECT_GT_INT(da[i], da[i-1]);
+    }
+
+    da_free(da);
+    EMU_END_TEST();
+}
+
+EMU_TEST(da_merge__and__set_operations)
+{
+    const int vals_a[] = {1, 2, 2, 4, 6, 8, 8, 10};
+    const int vals_b[] = {2, 3, 4, 8, 11};
+    int* a = alloc_int_darray(vals_a, sizeof(vals_a)/sizeof(int));
+    int* b = alloc_int_darray(vals_b, sizeof(vals_b)/sizeof(int));
+    EMU_REQUIRE_NOT_NULL(a);
+    EMU_REQUIRE_NOT_NULL(b);
+
+    const int merged[] = {1, 2, 2, 2, 3, 4, 4, 6, 8, 8, 8, 10, 11};
+    int* result = da_merge(a, b, compare_ints);
+    EMU_REQUIRE_NOT_NULL(result);
+    EMU_REQUIRE_EQ_UINT(da_length(result), sizeof(merged)/sizeof(int));
+    EMU_EXPECT_EQ_INT(memcmp(result, merged, sizeof(merged)), 0);
+    da_free(result);
+
+    const int intersection[] = {2, 4, 8};
+    result = da_intersect(a, b, compare_ints);
+    EMU_REQUIRE_NOT_NULL(result);
+    EMU_REQUIRE_EQ_UINT(da_length(result), sizeof(intersection)/sizeof(int));
+    EMU_EXPECT_EQ_INT(memcmp(result, intersection, sizeof(intersection)), 0);
+    da_free(result);
+
+    const int difference[] = {1, 2, 6, 8, 10};
+    result = da_difference(a, b, compare_ints);
+    EMU_REQUIRE_NOT_NULL(result);
+    EMU_REQUIRE_EQ_UINT(da_length(result), sizeof(difference)/sizeof(int));
+    EMU_EXPECT_EQ_INT(memcmp(result, difference, sizeof(difference)), 0);
+    da_free(result);
+
+    da_unique(a, compare_ints);
+    result = da_intersect_numeric(a, b);
+    EMU_REQUIRE_NOT_NULL(result);
+    EMU_REQUIRE_EQ_UINT(da_length(result), sizeof(intersection)/sizeof(int));
+    EMU_EXPECT_EQ_INT(memcmp(result, intersection, sizeof(intersection)), 0);
+    da_free(result);
+
+    da_free(a);
+    da_free(b);
+    EMU_END_TEST();
+}
+
+EMU_TEST(da_intersect_numeric)
+{
+    // Long enough for the SIMD block loop. Multiples of 6 are shared.
+    long long* a = da_alloc(SORT_NUM_ELEMS, sizeof(long long));
+    long long* b = da_alloc(SORT_NUM_ELEMS, sizeof(long long));
+    EMU_REQUIRE_NOT_NULL(a);
+    EMU_REQUIRE_NOT_NULL(b);
+    for (long long i = 0; i < SORT_NUM_ELEMS; ++i)
+    {
+        a[i] = 3*i - 1200;
+        b[i] = 2*i - 1200;
+    }
+    long long* result = da_intersect_numeric(a, b);
+    EMU_REQUIRE_NOT_NULL(result);
+    EMU_EXPECT_EQ_UINT(da_length(result), (2*SORT_NUM_ELEMS - 2)/6 + 1);
+    for (size_t i = 0; i < da_length(result); ++i)
+    {
+        EMU_EXPECT_EQ_INT(result[i], 6*(long long)i - 1200);
+    }
+
+    da_free(result);
+    da_free(a);
+    da_free(b);
+    EMU_END_TEST();
+}
+
+EMU_GROUP(da_sorted_functions)
+{
+    EMU_ADD(da_lower_bound__and__da_upper_bound);
+    EMU_ADD(da_insert_sorted__and__da_unique);
+    EMU_ADD(da_merge__and__set_operations);
+    EMU_ADD(da_intersect_numeric);
+    EMU_END_GROUP();
+}
+
+EMU_TEST(da_sum_functions)
+{
+    int* ints = da_alloc(SORT_NUM_ELEMS, sizeof(int));
+    float* floats = da_alloc(SORT_NUM_ELEMS, sizeof(float));
+    double* doubles = da_alloc(SORT_NUM_ELEMS, sizeof(double));
+    EMU_REQUIRE_NOT_NULL(ints);
+    EMU_REQUIRE_NOT_NULL(floats);
+    EMU_REQUIRE_NOT_NULL(doubles);
+    for (int i = 0; i < SORT_NUM_ELEMS; ++i)
+    {
+        ints[i] = INT_MAX - i;
+        floats[i] = (float)(i - 500);
+        doubles[i] = i/2.0;
+    }
+    // INT_MAX*1000 - (0 + 1 + ... + 999) does not fit in an int.
+    EMU_EXPECT_EQ_INT(da_sum_int(ints),
+        (long long)INT_MAX*SORT_NUM_ELEMS - 999*1000/2);
+    EMU_EXPECT_TRUE(da_sum_float(floats) == -500.0);
+    EMU_EXPECT_TRUE(da_sum_double(doubles) == 999*1000/4.0);
+
+    ints = da_resize(ints, 0);
+    EMU_EXPECT_EQ_INT(da_sum_int(ints), 0);
+
+    da_free(ints);
+    da_free(floats);
+    da_free(doubles);
+    EMU_END_TEST();
+}
+
+EMU_TEST(da_minmax_functions)
+{
+    int* ints = da_alloc(SORT_NUM_ELEMS, sizeof(int));
+    double* doubles = da_alloc(SORT_NUM_ELEMS, sizeof(double));
+    EMU_REQUIRE_NOT_NULL(ints);
+    EMU_REQUIRE_NOT_NULL(doubles);
+    for (int i = 0; i < SORT_NUM_ELEMS; ++i)
+    {
+        ints[i] = (i*7919) % SORT_NUM_ELEMS;
+        doubles[i] = i % 3 == 0 ? NAN : (double)ints[i];
+    }
+    ints[123] = -5;
+    ints[456] = -5;
+    ints[789] = 5000;
+
+    int imin = 0, imax = 0;
+    EMU_EXPECT_TRUE(da_minmax_int(ints, &imin, &imax));
+    EMU_EXPECT_EQ_INT(imin, -5);
+    EMU_EXPECT_EQ_INT(imax, 5000);
+    EMU_EXPECT_EQ_UINT(da_argmin_int(ints), 123);
+    EMU_EXPECT_EQ_UINT(da_argmax_int(ints), 789);
+
+    // Every value from 0 to 999 appears once. 0, 997, 998, and 999 are at
+    // indices that hold NaN in `doubles`, which are skipped.
+    double dmin = 0, dmax = 0;
+    EMU_EXPECT_TRUE(da_minmax_double(doubles, &dmin, &dmax));
+    EMU_EXPECT_TRUE(dmin == 1.0);
+    EMU_EXPECT_TRUE(dmax == 996.0);
+    EMU_EXPECT_EQ_UINT(da_argmin_double(doubles), 679);
+    EMU_EXPECT_EQ_UINT(da_argmax_double(doubles), 284);
+
+    // No elements that are not NaN.
+    float* floats = da_alloc(3, sizeof(float));
+    EMU_REQUIRE_NOT_NULL(floats);
+    floats[0] = floats[1] = floats[2] = NAN;
+    float fmin = 1.0f, fmax = 2.0f;
+    EMU_EXPECT_FALSE(da_minmax_float(floats, &fmin, &fmax));
+    EMU_EXPECT_TRUE(fmin == 1.0f && fmax == 2.0f);
+    EMU_EXPECT_EQ_UINT(da_argmin_float(floats), 3);
+    EMU_EXPECT_EQ_UINT(da_argmax_float(floats), 3);
+
+    da_free(ints);
+    da_free(doubles);
+    da_free(floats);
+    EMU_END_TEST();
+}
+
+EMU_TEST(da_prefix_sum_functions)
+{
+    int* ints = da_alloc(SORT_NUM_ELEMS, sizeof(int));
+    float* floats = da_alloc(SORT_NUM_ELEMS, sizeof(float));
+    double* doubles = da_alloc(SORT_NUM_ELEMS, sizeof(double));
+    EMU_REQUIRE_NOT_NULL(ints);
+    EMU_REQUIRE_NOT_NULL(floats);
+    EMU_REQUIRE_NOT_NULL(doubles);
+    for (int i = 0; i < SORT_NUM_ELEMS; ++i)
+    {
+        ints[i] = i;
+        floats[i] = 1.0f;
+        doubles[i] = i % 2 ? -1.0 : 2.0;
+    }
+    da_prefix_sum_int(ints);
+    da_prefix_sum_float(floats);
+    da_prefix_sum_double(doubles);
+    for (int i = 0; i < SORT_NUM_ELEMS; ++i)
+    {
+        EMU_EXPECT_EQ_INT(ints[i], i*(i+1)/2);
+        EMU_EXPECT_TRUE(floats[i] == i + 1);
+        EMU_EXPECT_TRUE(doubles[i] == i/2 + 2 - i%2);
+    }
+
+    da_free(ints);
+    da_free(floats);
+    da_free(doubles);
+    EMU_END_TEST();
+}
+
+EMU_GROUP(da_reduction_functions)
+{
+    EMU_ADD(da_sum_functions);
+    EMU_ADD(da_minmax_functions);
+    EMU_ADD(da_prefix_sum_functions);
+    EMU_END_GROUP();
+}
+
+static void parallel_for_square(void* elem, size_t index, void* ctx)
+{
+    *(size_t*)elem = index*index + *(size_t*)ctx;
+}
+
+EMU_TEST(da_parallel_for)
+{
+    const size_t nelem = 100000;
+    size_t offset = 7;
+    size_t* da = da_alloc(nelem, sizeof(size_t));
+    EMU_REQUIRE_NOT_NULL(da);
+
+    da_parallel_set_max_threads(4);
+    da_parallel_for(da, parallel_for_square, &offset, 0);
+    for (size_t i = 0; i < nelem; ++i)
+    {
+        EMU_EXPECT_EQ_UINT(da[i], i*i + offset);
+    }
+
+    offset = 3;
+    da_parallel_for(da, parallel_for_square, &offset, 1);
+    for (size_t i = 0; i < nelem; ++i)
+    {
+        EMU_EXPECT_EQ_UINT(da[i], i*i + offset);
+    }
+    da_parallel_set_max_threads(0);
+
+    da_free(da);
+    EMU_END_TEST();
+}
+
+#define SOA_NUM_ELEMS 1000
+#define SOA_ID 0
+#define SOA_MASS 1
+#define SOA_TAG 2
+
+EMU_TEST(da_soa_alloc__and__da_soa_free)
+{
+    const size_t sizes[] = {sizeof(int), sizeof(double), sizeof(char)};
+    void** soa = da_soa_alloc(SOA_NUM_ELEMS, 3, sizes);
+    EMU_REQUIRE_NOT_NULL(soa);
+    EMU_EXPECT_EQ_UINT(da_soa_length(soa), SOA_NUM_ELEMS);
+    EMU_EXPECT_TRUE(da_soa_capacity(soa) >= SOA_NUM_ELEMS);
+    EMU_EXPECT_EQ_UINT(da_soa_ncols(soa), 3);
+    for (size_t k = 0; k < 3; ++k)
+    {
+        // Every column is a darray sharing the length and capacity of the
+        // da_soa.
+        EMU_EXPECT_EQ_UINT(da_length(soa[k]), SOA_NUM_ELEMS);
+        EMU_EXPECT_EQ_UINT(da_capacity(soa[k]), da_soa_capacity(soa));
+        EMU_EXPECT_EQ_UINT(da_sizeof_elem(soa[k]), sizes[k]);
+        EMU_EXPECT_EQ_UINT((uintptr_t)soa[k] % 64, 0);
+    }
+    int* ids = soa[SOA_ID];
+    double* masses = soa[SOA_MASS];
+    char* tags = soa[SOA_TAG];
+    for (int i = 0; i < SOA_NUM_ELEMS; ++i)
+    {
+        ids[i] = i;
+        masses[i] = 2.0;
+        tags[i] = 'a' + i % 26;
+    }
+    EMU_EXPECT_TRUE(da_sum_double(masses) == 2.0*SOA_NUM_ELEMS);
+    EMU_EXPECT_EQ_INT(ids[SOA_NUM_ELEMS-1], SOA_NUM_ELEMS-1);
+    EMU_EXPECT_EQ_INT(tags[27], 'b');
+
+    da_soa_free(soa);
+    EMU_END_TEST();
+}
+
+EMU_TEST(da_soa_push__and__da_soa_insert)
+{
+    const size_t sizes[] = {sizeof(int), sizeof(double), sizeof(char)};
+    void** soa = da_soa_alloc(0, 3, sizes);
+    EMU_REQUIRE_NOT_NULL(soa);
+    for (int i = 0; i < SOA_NUM_ELEMS; ++i)
+    {
+        double mass = i/2.0;
+        char tag = 'a' + i % 26;
+        const void* row[] = {&i, &mass, &tag};
+        soa = da_soa_push(soa, row);
+        EMU_REQUIRE_NOT_NULL(soa);
+    }
+    EMU_EXPECT_EQ_UINT(da_soa_length(soa), SOA_NUM_ELEMS);
+    EMU_EXPECT_EQ_UINT(da_length(soa[SOA_MASS]), SOA_NUM_ELEMS);
+    for (int i = 0; i < SOA_NUM_ELEMS; ++i)
+    {
+        EMU_EXPECT_EQ_INT(((int*)soa[SOA_ID])[i], i);
+        EMU_EXPECT_TRUE(((double*)soa[SOA_MASS])[i] == i/2.0);
+        EMU_EXPECT_EQ_INT(((char*)soa[SOA_TAG])[i], 'a' + i % 26);
+    }
+
+    int id = -1;
+    double mass = -1.0;
+    char tag = '!';
+    const void* row[] = {&id, &mass, &tag};
+    soa = da_soa_insert(soa, 10, row);
+    EMU_REQUIRE_NOT_NULL(soa);
+    soa = da_soa_insert(soa, 0, NULL);
+    EMU_REQUIRE_NOT_NULL(soa);
+    EMU_EXPECT_EQ_UINT(da_soa_length(soa), SOA_NUM_ELEMS + 2);
+    EMU_EXPECT_EQ_INT(((int*)soa[SOA_ID])[0], 0);
+    EMU_EXPECT_TRUE(((double*)soa[SOA_MASS])[0] == 0.0);
+    EMU_EXPECT_EQ_INT(((char*)soa[SOA_TAG])[0], 0);
+    EMU_EXPECT_EQ_INT(((int*)soa[SOA_ID])[10], 9);
+    EMU_EXPECT_EQ_INT(((int*)soa[SOA_ID])[11], -1);
+    EMU_EXPECT_TRUE(((double*)soa[SOA_MASS])[11] == -1.0);
+    EMU_EXPECT_EQ_INT(((char*)soa[SOA_TAG])[11], '!');
+    EMU_EXPECT_EQ_INT(((int*)soa[SOA_ID])[12], 10);
+
+    da_soa_free(soa);
+    EMU_END_TEST();
+}
+
+EMU_TEST(da_soa_remove)
+{
+    const size_t sizes[] = {sizeof(int), sizeof(double), sizeof(char)};
+    void** soa = da_soa_alloc(SOA_NUM_ELEMS, 3, sizes);
+    EMU_REQUIRE_NOT_NULL(soa);
+    for (int i = 0; i < SOA_NUM_ELEMS; ++i)
+    {
+        ((int*)soa[SOA_ID])[i] = i;
+        ((double*)soa[SOA_MASS])[i] = i;
+        ((char*)soa[SOA_TAG])[i] = i;
+    }
+    da_soa_remove(soa, 0);
+    da_soa_remove(soa, 499);
+    da_soa_remove(soa, da_soa_length(soa)-1);
+    EMU_EXPECT_EQ_UINT(da_soa_length(soa), SOA_NUM_ELEMS - 3);
+    EMU_EXPECT_EQ_UINT(da_length(soa[SOA_TAG]), SOA_NUM_ELEMS - 3);
+    EMU_EXPECT_EQ_INT(((int*)soa[SOA_ID])[0], 1);
+    EMU_EXPECT_EQ_INT(((int*)soa[SOA_ID])[498], 499);
+    EMU_EXPECT_TRUE(((double*)soa[SOA_MASS])[499] == 501.0);
+    EMU_EXPECT_EQ_INT(((char*)soa[SOA_TAG])[499], (char)501);
+    EMU_EXPECT_EQ_INT(((int*)soa[SOA_ID])[SOA_NUM_ELEMS-4], SOA_NUM_ELEMS-2);
+
+    da_soa_free(soa);
+    EMU_END_TEST();
+}
+
+EMU_TEST(da_soa_resize__and__da_soa_reserve)
+{
+    const size_t sizes[] = {sizeof(int), sizeof(double), sizeof(char)};
+    void** soa = da_soa_alloc(SOA_NUM_ELEMS, 3, sizes);
+    EMU_REQUIRE_NOT_NULL(soa);
+    for (int i = 0; i < SOA_NUM_ELEMS; ++i)
+    {
+        ((int*)soa[SOA_ID])[i] = i;
+        ((double*)soa[SOA_MASS])[i] = i;
+    }
+
+    soa = da_soa_reserve(soa, 5*SOA_NUM_ELEMS);
+    EMU_REQUIRE_NOT_NULL(soa);
+    EMU_EXPECT_EQ_UINT(da_soa_length(soa), SOA_NUM_ELEMS);
+    EMU_EXPECT_TRUE(da_soa_capacity(soa) >= 6*SOA_NUM_ELEMS);
+    EMU_EXPECT_EQ_UINT(da_capacity(soa[SOA_TAG]), da_soa_capacity(soa));
+
+    soa = da_soa_resize(soa, SOA_NUM_ELEMS/2);
+    EMU_REQUIRE_NOT_NULL(soa);
+    EMU_EXPECT_EQ_UINT(da_soa_length(soa), SOA_NUM_ELEMS/2);
+    EMU_EXPECT_EQ_UINT(da_length(soa[SOA_ID]), SOA_NUM_ELEMS/2);
+    for (int i = 0; i < SOA_NUM_ELEMS/2; ++i)
+    {
+        EMU_EXPECT_EQ_INT(((int*)soa[SOA_ID])[i], i);
+        EMU_EXPECT_TRUE(((double*)soa[SOA_MASS])[i] == i);
+    }
+
+    da_soa_free(soa);
+    EMU_END_TEST();
+}
+
+EMU_GROUP(da_soa_functions)
+{
+    EMU_ADD(da_soa_alloc__and__da_soa_free);
+    EMU_ADD(da_soa_push__and__da_soa_insert);
+    EMU_ADD(da_soa_remove);
+    EMU_ADD(da_soa_resize__and__da_soa_reserve);
+    EMU_END_GROUP();
+}
+
+#define SEG_NUM_ELEMS 1000
+
+EMU_TEST(da_seg_alloc__and__da_seg_free)
+{
+    void** seg = da_seg_alloc(SEG_NUM_ELEMS, sizeof(int), 100);
+    EMU_REQUIRE_NOT_NULL(seg);
+    EMU_EXPECT_EQ_UINT(da_seg_length(seg), SEG_NUM_ELEMS);
+    // Segment sizes are rounded up to a power of two.
+    EMU_EXPECT_EQ_UINT(da_capacity(seg[0]), 128);
+    EMU_EXPECT_EQ_UINT(da_length(seg), (SEG_NUM_ELEMS + 127)/128);
+    EMU_EXPECT_EQ_UINT(da_length(seg[da_length(seg)-1]), SEG_NUM_ELEMS % 128);
+    da_seg_free(seg);
+
+    seg = da_seg_alloc(0, sizeof(double), 0);
+    EMU_REQUIRE_NOT_NULL(seg);
+    EMU_EXPECT_EQ_UINT(da_seg_length(seg), 0);
+    EMU_EXPECT_EQ_UINT(da_length(seg), 1);
+    da_seg_free(seg);
+    EMU_END_TEST();
+}
+
+EMU_TEST(da_seg_push__and__da_seg_at)
+{
+    void** seg = da_seg_alloc(0, sizeof(int), 64);
+    EMU_REQUIRE_NOT_NULL(seg);
+    int* first = NULL;
+    for (int i = 0; i < SEG_NUM_ELEMS; ++i)
+    {
+        seg = da_seg_push(seg, &i);
+        EMU_REQUIRE_NOT_NULL(seg);
+        if (i == 0)
+        {
+            first = da_seg_at(seg, 0);
+        }
+    }
+    EMU_EXPECT_EQ_UINT(da_seg_length(seg), SEG_NUM_ELEMS);
+    // Pushing never moves existing elements.
+    EMU_EXPECT_TRUE(first == da_seg_at(seg, 0));
+    for (int i = 0; i < SEG_NUM_ELEMS; ++i)
+    {
+        EMU_EXPECT_EQ_INT(*(int*)da_seg_at(seg, i), i);
+    }
+    long long sum = 0;
+    for (size_t s = 0; s < da_length(seg); ++s)
+    {
+        sum += da_sum_int(seg[s]);
+    }
+    EMU_EXPECT_EQ_INT(sum, SEG_NUM_ELEMS*(SEG_NUM_ELEMS-1)/2);
+
+    da_seg_free(seg);
+    EMU_END_TEST();
+}
+
+EMU_TEST(da_seg_pop)
+{
+    void** seg = da_seg_alloc(SEG_NUM_ELEMS, sizeof(int), 64);
+    EMU_REQUIRE_NOT_NULL(seg);
+    for (int i = 0; i < SEG_NUM_ELEMS; ++i)
+    {
+        *(int*)da_seg_at(seg, i) = i;
+    }
+    for (int i = 0; i < SEG_NUM_ELEMS - 64; ++i)
+    {
+        da_seg_pop(seg);
+    }
+    EMU_EXPECT_EQ_UINT(da_seg_length(seg), 64);
+    EMU_EXPECT_EQ_UINT(da_length(seg), 1);
+    EMU_EXPECT_EQ_INT(*(int*)da_seg_at(seg, 63), 63);
+    for (int i = 0; i < 64; ++i)
+    {
+        da_seg_pop(seg);
+    }
+    EMU_EXPECT_EQ_UINT(da_seg_length(seg), 0);
+    EMU_EXPECT_EQ_UINT(da_length(seg), 1);
+
+    da_seg_free(seg);
+    EMU_END_TEST();
+}
+
+EMU_TEST(da_flatten)
+{
+    void** seg = da_seg_alloc(0, sizeof(short), 16);
+    EMU_REQUIRE_NOT_NULL(seg);
+    for (short i = 0; i < SEG_NUM_ELEMS; ++i)
+    {
+        seg = da_seg_push(seg, &i);
+        EMU_REQUIRE_NOT_NULL(seg);
+    }
+    short* da = da_flatten(seg);
+    EMU_REQUIRE_NOT_NULL(da);
+    EMU_EXPECT_EQ_UINT(da_length(da), SEG_NUM_ELEMS);
+    EMU_EXPECT_EQ_UINT(da_sizeof_elem(da), sizeof(short));
+    for (short i = 0; i < SEG_NUM_ELEMS; ++i)
+    {
+        EMU_EXPECT_EQ_INT(da[i], i);
+    }
+
+    da_free(da);
+    da_seg_free(seg);
+    EMU_END_TEST();
+}
+
+EMU_GROUP(da_seg_functions)
+{
+    EMU_ADD(da_seg_alloc__and__da_seg_free);
+    EMU_ADD(da_seg_push__and__da_seg_at);
+    EMU_ADD(da_seg_pop);
+    EMU_ADD(da_flatten);
+    EMU_END_GROUP();
+}
+
+// Sorted values with small gaps and, every 1000 values, a gap of 2^40.
+static uint64_t delta_test_value(size_t i)
+{
+    return 1000 + i*8 + i%7 + ((uint64_t)(i/1000) << 40);
+}
+
+EMU_TEST(da_delta_push__and__da_delta_decode)
+{
+    struct da_delta delta;
+    da_delta_init(&delta);
+    EMU_EXPECT_EQ_UINT(da_delta_length(&delta), 0);
+    uint64_t* values = da_delta_decode(&delta);
+    EMU_REQUIRE_NOT_NULL(values);
+    EMU_EXPECT_EQ_UINT(da_length(values), 0);
+    da_free(values);
+
+    size_t nvalues = 100*DA_DELTA_BLOCK_SIZE + 5;
+    for (size_t i = 0; i < nvalues; ++i)
+    {
+        EMU_REQUIRE_TRUE(da_delta_push(&delta, delta_test_value(i)));
+    }
+    EMU_EXPECT_EQ_UINT(da_delta_length(&delta), nvalues);
+    // Most gaps fit in 4 bits, and one block in eight has a gap of 2^40.
+    EMU_EXPECT_LT_UINT(da_delta_footprint(&delta),
+        nvalues*sizeof(uint64_t)/4);
+    values = da_delta_decode(&delta);
+    EMU_REQUIRE_NOT_NULL(values);
+    EMU_REQUIRE_EQ_UINT(da_length(values), nvalues);
+    EMU_EXPECT_EQ_UINT(da_capacity(values), nvalues);
+    size_t nmismatches = 0;
+    for (size_t i = 0; i < nvalues; ++i)
+    {
+        nmismatches += values[i] != delta_test_value(i);
+    }
+    EMU_EXPECT_EQ_UINT(nmismatches, 0);
+    da_free(values);
+    da_delta_free(&delta);
+    EMU_EXPECT_EQ_UINT(da_delta_length(&delta), 0);
+
+    // Unsorted values and full 64 bit differences round trip too.
+    uint64_t unsorted[] = {UINT64_MAX, 0, 5, 3, UINT64_MAX - 1, 1ULL << 63};
+    for (size_t i = 0; i < 2*DA_DELTA_BLOCK_SIZE; ++i)
+    {
+        EMU_REQUIRE_TRUE(da_delta_push(&delta, unsorted[i%6]));
+    }
+    values = da_delta_decode(&delta);
+    EMU_REQUIRE_NOT_NULL(values);
+    nmismatches = 0;
+    for (size_t i = 0; i < 2*DA_DELTA_BLOCK_SIZE; ++i)
+    {
+        nmismatches += values[i] != unsorted[i%6];
+    }
+    EMU_EXPECT_EQ_UINT(nmismatches, 0);
+    da_free(values);
+    da_delta_free(&delta);
+    EMU_END_TEST();
+}
+
+EMU_TEST(da_delta_iter)
+{
+    struct da_delta delta;
+    da_delta_init(&delta);
+    size_t nvalues = 4*DA_DELTA_BLOCK_SIZE + 17;
+    for (size_t i = 0; i < nvalues; ++i)
+    {
+        EMU_REQUIRE_TRUE(da_delta_push(&delta, delta_test_value(i)));
+    }
+
+    struct da_delta_iter iter;
+    da_delta_iter_init(&iter, &delta, 0);
+    uint64_t value;
+    size_t nvisited = 0;
+    size_t nmismatches = 0;
+    while (da_delta_iter_next(&iter, &value))
+    {
+        nmismatches += value != delta_test_value(nvisited);
+        nvisited += 1;
+    }
+    EMU_EXPECT_EQ_UINT(nvisited, nvalues);
+    EMU_EXPECT_EQ_UINT(nmismatches, 0);
+
+    // Seeking lands in packed blocks, the unpacked last block, and the end.
+    size_t targets[] = {3*DA_DELTA_BLOCK_SIZE + 1, 5, nvalues - 1,
+        DA_DELTA_BLOCK_SIZE, nvalues};
+    for (size_t t = 0; t < 5; ++t)
+    {
+        da_delta_iter_seek(&iter, targets[t]);
+        if (targets[t] == nvalues)
+        {
+            EMU_EXPECT_FALSE(da_delta_iter_next(&iter, &value));
+            continue;
+        }
+        EMU_REQUIRE_TRUE(da_delta_iter_next(&iter, &value));
+        EMU_EXPECT_EQ_UINT(value, delta_test_value(targets[t]));
+    }
+    // Block at a time iteration visits the same values.
+    const uint64_t* block;
+    size_t nblock;
+    da_delta_iter_init(&iter, &delta, 1);
+    nvisited = 1;
+    nmismatches = 0;
+    while ((nblock = da_delta_iter_next_block(&iter, &block)) != 0)
+    {
+        EMU_REQUIRE_TRUE(nblock <= DA_DELTA_BLOCK_SIZE);
+        for (size_t i = 0; i < nblock; ++i)
+        {
+            nmismatches += block[i] != delta_test_value(nvisited + i);
+        }
+        nvisited += nblock;
+    }
+    EMU_EXPECT_EQ_UINT(nvisited, nvalues);
+    EMU_EXPECT_EQ_UINT(nmismatches, 0);
+
+    da_delta_iter_init(&iter, &delta, nvalues - 2);
+    EMU_REQUIRE_TRUE(da_delta_iter_next(&iter, &value));
+    EMU_EXPECT_EQ_UINT(value, delta_test_value(nvalues - 2));
+
+    // Values pushed after the iterator was initialized are visited.
+    EMU_REQUIRE_TRUE(da_delta_push(&delta, delta_test_value(nvalues)));
+    EMU_REQUIRE_TRUE(da_delta_iter_next(&iter, &value));
+    EMU_REQUIRE_TRUE(da_delta_iter_next(&iter, &value));
+    EMU_EXPECT_EQ_UINT(value, delta_test_value(nvalues));
+    EMU_EXPECT_FALSE(da_delta_iter_next(&iter, &value));
+    da_delta_free(&delta);
+    EMU_END_TEST();
+}
+
+EMU_TEST(da_delta_lower_bound)
+{
+    struct da_delta delta;
+    da_delta_init(&delta);
+    EMU_EXPECT_EQ_UINT(da_delta_lower_bound(&delta, 10), 0);
+    size_t nvalues = 3000;
+    for (size_t i = 0; i < nvalues; ++i)
+    {
+        EMU_REQUIRE_TRUE(da_delta_push(&delta, delta_test_value(i)));
+    }
+    size_t nmismatches = 0;
+    for (size_t i = 0; i < nvalues; ++i)
+    {
+        nmismatches += da_delta_lower_bound(&delta, delta_test_value(i)) != i;
+        nmismatches +=
+            da_delta_lower_bound(&delta, delta_test_value(i) + 1) != i + 1;
+    }
+    EMU_EXPECT_EQ_UINT(nmismatches, 0);
+    EMU_EXPECT_EQ_UINT(da_delta_lower_bound(&delta, 0), 0);
+    EMU_EXPECT_EQ_UINT(da_delta_lower_bound(&delta, UINT64_MAX), nvalues);
+    da_delta_free(&delta);
+    EMU_END_TEST();
+}
+
+EMU_GROUP(da_delta_functions)
+{
+    EMU_ADD(da_delta_push__and__da_delta_decode);
+    EMU_ADD(da_delta_iter);
+    EMU_ADD(da_delta_lower_bound);
+    EMU_END_GROUP();
+}
+
+EMU_TEST(da_packed_push__and__da_packed_get)
+{
+    struct da_packed packed;
+    da_packed_init(&packed, 3);
+    EMU_EXPECT_EQ_UINT(da_packed_length(&packed), 0);
+    EMU_EXPECT_EQ_UINT(da_packed_width(&packed), 3);
+    size_t nvalues = 1000;
+    for (size_t i = 0; i < nvalues; ++i)
+    {
+        EMU_REQUIRE_TRUE(da_packed_push(&packed, i % 8));
+    }
+    EMU_EXPECT_EQ_UINT(da_packed_length(&packed), nvalues);
+    EMU_EXPECT_EQ_UINT(da_packed_width(&packed), 3);
+    EMU_EXPECT_LT_UINT(da_packed_footprint(&packed), nvalues);
+    size_t nmismatches = 0;
+    for (size_t i = 0; i < nvalues; ++i)
+    {
+        nmismatches += da_packed_get(&packed, i) != i % 8;
+    }
+    EMU_EXPECT_EQ_UINT(nmismatches, 0);
+
+    // Setting a value leaves its neighbours alone.
+    EMU_REQUIRE_TRUE(da_packed_set(&packed, 21, 0));
+    EMU_EXPECT_EQ_UINT(da_packed_get(&packed, 20), 4);
+    EMU_EXPECT_EQ_UINT(da_packed_get(&packed, 21), 0);
+    EMU_EXPECT_EQ_UINT(da_packed_get(&packed, 22), 6);
+    da_packed_free(&packed);
+    EMU_EXPECT_EQ_UINT(da_packed_length(&packed), 0);
+    EMU_END_TEST();
+}
+
+EMU_TEST(da_packed_widen)
+{
+    struct da_packed packed;
+    da_packed_init(&packed, 5);
+    size_t nvalues = 1000;
+    for (size_t i = 0; i < nvalues; ++i)
+    {
+        EMU_REQUIRE_TRUE(da_packed_push(&packed, i % 32));
+    }
+    // Values that do not fit widen every value.
+    EMU_REQUIRE_TRUE(da_packed_push(&packed, 1000));
+    EMU_EXPECT_EQ_UINT(da_packed_width(&packed), 10);
+    EMU_REQUIRE_TRUE(da_packed_set(&packed, 7, UINT64_MAX));
+    EMU_EXPECT_EQ_UINT(da_packed_width(&packed), 64);
+    EMU_EXPECT_TRUE(da_packed_widen(&packed, 12));
+    EMU_EXPECT_EQ_UINT(da_packed_width(&packed), 64);
+    size_t nmismatches = 0;
+    for (size_t i = 0; i < nvalues; ++i)
+    {
+        uint64_t expected = i == 7 ? UINT64_MAX : i % 32;
+        nmismatches += da_packed_get(&packed, i) != expected;
+    }
+    EMU_EXPECT_EQ_UINT(nmismatches, 0);
+    EMU_EXPECT_EQ_UINT(da_packed_get(&packed, nvalues), 1000);
+    da_packed_free(&packed);
+
+    da_packed_init(&packed, 1);
+    EMU_REQUIRE_TRUE(da_packed_widen(&packed, 7));
+    EMU_EXPECT_EQ_UINT(da_packed_width(&packed), 7);
+    da_packed_free(&packed);
+    EMU_END_TEST();
+}
+
+EMU_TEST(da_packed_unpack)
+{
+    struct da_packed packed;
+    da_packed_init(&packed, 1);
+    uint64_t* values = da_packed_unpack(&packed);
+    EMU_REQUIRE_NOT_NULL(values);
+    EMU_EXPECT_EQ_UINT(da_length(values), 0);
+    da_free(values);
+
+    unsigned widths[] = {1, 13, 33, 57, 58, 63, 64};
+    for (size_t w = 0; w < sizeof(widths)/sizeof(widths[0]); ++w)
+    {
+        da_packed_free(&packed);
+        da_packed_init(&packed, widths[w]);
+        uint64_t mask = widths[w] == 64
+            ? UINT64_MAX : ((uint64_t)1 << widths[w]) - 1;
+        size_t nvalues = 777;
+        for (size_t i = 0; i < nvalues; ++i)
+        {
+            EMU_REQUIRE_TRUE(
+                da_packed_push(&packed, (i*0x9E3779B97F4A7C15ULL) & mask));
+        }
+        EMU_REQUIRE_EQ_UINT(da_packed_width(&packed), widths[w]);
+        values = da_packed_unpack(&packed);
+        EMU_REQUIRE_NOT_NULL(values);
+        EMU_REQUIRE_EQ_UINT(da_length(values), nvalues);
+        size_t nmismatches = 0;
+        for (size_t i = 0; i < nvalues; ++i)
+        {
+            nmismatches += values[i] != ((i*0x9E3779B97F4A7C15ULL) & mask);
+        }
+        EMU_EXPECT_EQ_UINT(nmismatches, 0);
+        da_free(values);
+    }
+    da_packed_free(&packed);
+    EMU_END_TEST();
+}
+
+EMU_GROUP(da_packed_functions)
+{
+    EMU_ADD(da_packed_push__and__da_packed_get);
+    EMU_ADD(da_packed_widen);
+    EMU_ADD(da_packed_unpack);
+    EMU_END_GROUP();
+}
+
+EMU_TEST(da_atomic_append__and__da_seal)
+{
+    int* da = da_alloc_exact(0, sizeof(int));
+    EMU_REQUIRE_NOT_NULL(da);
+    da = da_reserve(da, 20);
+    EMU_REQUIRE_NOT_NULL(da);
+    size_t capacity = da_capacity(da);
+    for (int i = 0; i < (int)capacity; ++i)
+    {
+        EMU_EXPECT_TRUE(da_atomic_append(da, &i));
+    }
+    int value = -1;
+    EMU_EXPECT_FALSE(da_atomic_append(da, &value));
+    EMU_EXPECT_FALSE(da_seal(da));
+    EMU_EXPECT_EQ_UINT(da_length(da), capacity);
+    for (int i = 0; i < (int)capacity; ++i)
+    {
+        EMU_EXPECT_EQ_INT(da[i], i);
+    }
+
+    da = da_resize(da, 0);
+    EMU_REQUIRE_NOT_NULL(da);
+    EMU_EXPECT_TRUE(da_atomic_append(da, &value));
+    EMU_EXPECT_TRUE(da_seal(da));
+    EMU_EXPECT_EQ_UINT(da_length(da), 1);
+    EMU_EXPECT_EQ_INT(da[0], -1);
+
+    da_free(da);
+    EMU_END_TEST();
+}
+
+static void parallel_append(void* elem, size_t index, void* ctx)
+{
+    (void)index;
+    da_atomic_append(ctx, elem);
+}
+
+EMU_TEST(da_atomic_append__from_several_threads)
+{
+    const size_t nelem = 100000;
+    size_t* src = da_alloc(nelem, sizeof(size_t));
+    size_t* dest = da_alloc(0, sizeof(size_t));
+    EMU_REQUIRE_NOT_NULL(src);
+    EMU_REQUIRE_NOT_NULL(dest);
+    dest = da_reserve(dest, nelem);
+    EMU_REQUIRE_NOT_NULL(dest);
+    for (size_t i = 0; i < nelem; ++i)
+    {
+        src[i] = i;
+    }
+
+    da_parallel_set_max_threads(4);
+    da_parallel_for(src, parallel_append, dest, 0);
+    da_parallel_set_max_threads(0);
+    EMU_EXPECT_TRUE(da_seal(dest));
+    EMU_REQUIRE_EQ_UINT(da_length(dest), nelem);
+    da_sort_numeric(dest);
+    for (size_t i = 0; i < nelem; ++i)
+    {
+        EMU_EXPECT_EQ_UINT(dest[i], i);
+    }
+
+    da_free(src);
+    da_free(dest);
+    EMU_END_TEST();
+}
+
+static void parallel_collect(void* elem, size_t index, void* ctx)
+{
+    (void)index;
+    size_t** local = (size_t**)da_collector_local(ctx);
+    if (local != NULL)
+        *local = da_push(*local, *(size_t*)elem);
+}
+
+EMU_TEST(da_collector)
+{
+    struct da_collector collector;
+    da_collector_init(&collector, sizeof(int));
+    int* merged = da_collector_merge(&collector);
+    EMU_REQUIRE_NOT_NULL(merged);
+    EMU_EXPECT_EQ_UINT(da_length(merged), 0);
+    da_free(merged);
+
+    int** local = (int**)da_collector_local(&collector);
+    EMU_REQUIRE_NOT_NULL(local);
+    EMU_EXPECT_TRUE(local == (int**)da_collector_local(&collector));
+    for (int i = 0; i < INITIAL_NUM_ELEMS; ++i)
+    {
+        *local = da_push(*local, i);
+    }
+    merged = da_collector_merge(&collector);
+    EMU_REQUIRE_NOT_NULL(merged);
+    EMU_EXPECT_EQ_UINT(da_length(merged), INITIAL_NUM_ELEMS);
+    EMU_EXPECT_EQ_UINT(da_capacity(merged), INITIAL_NUM_ELEMS);
+    for (int i = 0; i < INITIAL_NUM_ELEMS; ++i)
+    {
+        EMU_EXPECT_EQ_INT(merged[i], i);
+    }
+    // Merging empties the per-thread darrays.
+    EMU_EXPECT_EQ_UINT(da_length(*local), 0);
+
+    da_free(merged);
+    da_collector_free(&collector);
+    EMU_END_TEST();
+}
+
+EMU_TEST(da_collector__from_several_threads)
+{
+    // Large enough for the merge to be copied in parallel.
+    const size_t nelem = 1000000;
+    size_t* src = da_alloc(nelem, sizeof(size_t));
+    EMU_REQUIRE_NOT_NULL(src);
+    for (size_t i = 0; i < nelem; ++i)
+    {
+        src[i] = i;
+    }
+    struct da_collector collector;
+    da_collector_init(&collector, sizeof(size_t));
+
+    da_parallel_set_max_threads(4);
+    da_parallel_for(src, parallel_collect, &collector, 0);
+    size_t* merged = da_collector_merge(&collector);
+    da_parallel_set_max_threads(0);
+    EMU_REQUIRE_NOT_NULL(merged);
+    EMU_REQUIRE_EQ_UINT(da_length(merged), nelem);
+    da_sort_numeric(merged);
+    size_t nmismatched = 0;
+    for (size_t i = 0; i < nelem; ++i)
+    {
+        nmismatched += merged[i] != i;
+    }
+    EMU_EXPECT_EQ_UINT(nmismatched, 0);
+
+    da_free(merged);
+    da_free(src);
+    da_collector_free(&collector);
+    EMU_END_TEST();
+}
+
+EMU_TEST(da_ring_enqueue__and__da_ring_dequeue)
+{
+    struct da_ring ring;
+    EMU_REQUIRE_TRUE(da_ring_init(&ring, 5, sizeof(int)));
+    EMU_EXPECT_EQ_UINT(da_capacity(ring._buf), 8);
+    EMU_EXPECT_EQ_UINT(da_ring_length(&ring), 0);
+
+    int src[10] = {0, 1, 2, 3, 4, 5, 6, 7, 8, 9};
+    int dest[10] = {0};
+    EMU_EXPECT_EQ_UINT(da_ring_enqueue(&ring, src, 6), 6);
+    EMU_EXPECT_EQ_UINT(da_ring_dequeue(&ring, dest, 4), 4);
+    EMU_EXPECT_EQ_INT(dest[3], 3);
+    // The next enqueue wraps around the end of the buffer and is cut short
+    // when the ring fills up.
+    EMU_EXPECT_EQ_UINT(da_ring_enqueue(&ring, src, 10), 6);
+    EMU_EXPECT_EQ_UINT(da_ring_length(&ring), 8);
+    EMU_EXPECT_EQ_UINT(da_ring_enqueue(&ring, src, 1), 0);
+    EMU_EXPECT_EQ_UINT(da_ring_dequeue(&ring, dest, 10), 8);
+    EMU_EXPECT_EQ_INT(dest[0], 4);
+    EMU_EXPECT_EQ_INT(dest[1], 5);
+    for (int i = 0; i < 6; ++i)
+    {
+        EMU_EXPECT_EQ_INT(dest[i+2], i);
+    }
+    EMU_EXPECT_EQ_UINT(da_ring_dequeue(&ring, dest, 1), 0);
+
+    da_ring_free(&ring);
+    EMU_END_TEST();
+}
+
+#define RING_NUM_ELEMS 100000
+
+static void* ring_produce(void* ring)
+{
+    for (size_t i = 0; i < RING_NUM_ELEMS; )
+    {
+        size_t batch[7];
+        size_t n = RING_NUM_ELEMS - i < 7 ? RING_NUM_ELEMS - i : 7;
+        for (size_t k = 0; k < n; ++k)
+        {
+            batch[k] = i + k;
+        }
+        size_t nenqueued = da_ring_enqueue(ring, batch, n);
+        if (nenqueued == 0)
+            sched_yield();
+        i += nenqueued;
+    }
+    return NULL;
+}
+
+EMU_TEST(da_ring__between_two_threads)
+{
+    static struct da_ring ring;
+    EMU_REQUIRE_TRUE(da_ring_init(&ring, 64, sizeof(size_t)));
+    pthread_t producer;
+    EMU_REQUIRE_EQ_INT(pthread_create(&producer, NULL, ring_produce, &ring), 0);
+    size_t nmismatched = 0;
+    for (size_t i = 0; i < RING_NUM_ELEMS; )
+    {
+        size_t batch[5];
+        size_t ndequeued = da_ring_dequeue(&ring, batch, 5);
+        if (ndequeued == 0)
+            sched_yield();
+        for (size_t k = 0; k < ndequeued; ++k)
+        {
+            nmismatched += batch[k] != i + k;
+        }
+        i += ndequeued;
+    }
+    pthread_join(producer, NULL);
+    EMU_EXPECT_EQ_UINT(nmismatched, 0);
+    EMU_EXPECT_EQ_UINT(da_ring_length(&ring), 0);
+
+    da_ring_free(&ring);
+    EMU_END_TEST();
+}
+
+EMU_GROUP(da_ring_functions)
+{
+    EMU_ADD(da_ring_enqueue__and__da_ring_dequeue);
+    EMU_ADD(da_ring__between_two_threads);
+    EMU_END_GROUP();
+}
+
+EMU_TEST(da_concurrent_push__and__da_concurrent_reclaim)
+{
+    static struct da_concurrent conc;
+    EMU_REQUIRE_TRUE(da_concurrent_init(&conc, 2, sizeof(int)));
+    size_t reader = da_concurrent_register(&conc);
+    EMU_REQUIRE_TRUE(reader < DA_CONCURRENT_MAX_READERS);
+
+    for (int i = 0; i < 2; ++i)
+    {
+        EMU_REQUIRE_TRUE(da_concurrent_push(&conc, &i));
+    }
+    const int* old = da_concurrent_read_begin(&conc, reader);
+    // Growing while the reader holds the old darray retires it without
+    // freeing it.
+    int value = 2;
+    EMU_REQUIRE_TRUE(da_concurrent_push(&conc, &value));
+    EMU_EXPECT_EQ_UINT(da_concurrent_reclaim(&conc), 1);
+    EMU_EXPECT_EQ_UINT(da_concurrent_length(old), 2);
+    EMU_EXPECT_EQ_INT(old[1], 1);
+    da_concurrent_read_end(&conc, reader);
+    EMU_EXPECT_EQ_UINT(da_concurrent_reclaim(&conc), 0);
+    for (int i = 3; i < 100; ++i)
+    {
+        EMU_REQUIRE_TRUE(da_concurrent_push(&conc, &i));
+    }
+
+    const int* cur = da_concurrent_read_begin(&conc, reader);
+    EMU_EXPECT_EQ_UINT(da_concurrent_length(cur), 100);
+    EMU_EXPECT_EQ_INT(cur[99], 99);
+    da_concurrent_read_end(&conc, reader);
+    da_concurrent_unregister(&conc, reader);
+
+    size_t nregistered = 0;
+    while (da_concurrent_register(&conc) != SIZE_MAX)
+    {
+        nregistered += 1;
+    }
+    EMU_EXPECT_EQ_UINT(nregistered, DA_CONCURRENT_MAX_READERS);
+
+    da_concurrent_free(&conc);
+    EMU_END_TEST();
+}
+
+#define CONCURRENT_NUM_READERS 4
+#define CONCURRENT_NUM_ELEMS 100000
+
+static struct da_concurrent concurrent_table;
+static int concurrent_done;
+
+// Check that every element a reader can see holds its own index.
+static void* concurrent_read(void* nmismatched)
+{
+    size_t reader = da_concurrent_register(&concurrent_table);
+    size_t last_length = 0;
+    while (!__atomic_load_n(&concurrent_done, __ATOMIC_ACQUIRE))
+    {
+        const size_t* darr =
+            da_concurrent_read_begin(&concurrent_table, reader);
+        size_t length = da_concurrent_length(darr);
+        *(size_t*)nmismatched += length < last_length;
+        for (size_t i = length - length/8; i < length; ++i)
+        {
+            *(size_t*)nmismatched += darr[i] != i;
+        }
+        last_length = length;
+        da_concurrent_read_end(&concurrent_table, reader);
+        sched_yield();
+    }
+    da_concurrent_unregister(&concurrent_table, reader);
+    return NULL;
+}
+
+EMU_TEST(da_concurrent__readers_and_writer)
+{
+    EMU_REQUIRE_TRUE(da_concurrent_init(&concurrent_table, 0, sizeof(size_t)));
+    concurrent_done = 0;
+    pthread_t readers[CONCURRENT_NUM_READERS];
+    size_t nmismatched[CONCURRENT_NUM_READERS] = {0};
+    for (size_t r = 0; r < CONCURRENT_NUM_READERS; ++r)
+    {
+        EMU_REQUIRE_EQ_INT(pthread_create(&readers[r], NULL, concurrent_read,
+            &nmismatched[r]), 0);
+    }
+    size_t nfailed = 0;
+    for (size_t i = 0; i < CONCURRENT_NUM_ELEMS; ++i)
+    {
+        nfailed += !da_concurrent_push(&concurrent_table, &i);
+    }
+    __atomic_store_n(&concurrent_done, 1, __ATOMIC_RELEASE);
+    for (size_t r = 0; r < CONCURRENT_NUM_READERS; ++r)
+    {
+        pthread_join(readers[r], NULL);
+        EMU_EXPECT_EQ_UINT(nmismatched[r], 0);
+    }
+    EMU_EXPECT_EQ_UINT(nfailed, 0);
+    EMU_EXPECT_EQ_UINT(da_concurrent_reclaim(&concurrent_table), 0);
+    EMU_EXPECT_EQ_UINT(da_length(concurrent_table._darr),
+        CONCURRENT_NUM_ELEMS);
+
+    da_concurrent_free(&concurrent_table);
+    EMU_END_TEST();
+}
+
+EMU_GROUP(da_concurrent_functions)
+{
+    EMU_ADD(da_concurrent_push__and__da_concurrent_reclaim);
+    EMU_ADD(da_concurrent__readers_and_writer);
+    EMU_END_GROUP();
+}
+
+#define FILE_TEST_PATH "darray_file.test.tmp"
+
+static int open_test_file(void)
+{
+    return open(FILE_TEST_PATH, O_RDWR | O_CREAT | O_TRUNC, 0600);
+}
+
+EMU_TEST(da_write_fd__and__da_read_fd)
+{
+    int fd = open_test_file();
+    EMU_REQUIRE_TRUE(fd >= 0);
+    int* ints = da_alloc(1000, sizeof(int));
+    for (int i = 0; i < 1000; ++i)
+    {
+        ints[i] = i*i;
+    }
+    char* empty = da_alloc(0, sizeof(char));
+    EMU_EXPECT_TRUE(da_write_fd(ints, fd, DA_FILE_CHECKSUM));
+    EMU_EXPECT_TRUE(da_write_fd(empty, fd, 0));
+
+    EMU_REQUIRE_EQ_INT(lseek(fd, 0, SEEK_SET), 0);
+    int* ints_read = da_read_fd(fd);
+    EMU_REQUIRE_NOT_NULL(ints_read);
+    EMU_EXPECT_EQ_UINT(da_length(ints_read), 1000);
+    EMU_EXPECT_EQ_UINT(da_capacity(ints_read), 1000);
+    EMU_EXPECT_EQ_UINT(da_sizeof_elem(ints_read), sizeof(int));
+    EMU_EXPECT_EQ_INT(memcmp(ints_read, ints, 1000*sizeof(int)), 0);
+    char* empty_read = da_read_fd(fd);
+    EMU_REQUIRE_NOT_NULL(empty_read);
+    EMU_EXPECT_EQ_UINT(da_length(empty_read), 0);
+    // Nothing is left to read.
+    EMU_EXPECT_NULL(da_read_fd(fd));
+
+    // Flip one byte of the data covered by the checksum.
+    char byte;
+    EMU_REQUIRE_EQ_INT(lseek(fd, 100, SEEK_SET), 100);
+    EMU_REQUIRE_EQ_INT(read(fd, &byte, 1), 1);
+    byte ^= 1;
+    EMU_REQUIRE_EQ_INT(lseek(fd, 100, SEEK_SET), 100);
+    EMU_REQUIRE_EQ_INT(write(fd, &byte, 1), 1);
+    EMU_REQUIRE_EQ_INT(lseek(fd, 0, SEEK_SET), 0);
+    EMU_EXPECT_NULL(da_read_fd(fd));
+
+    close(fd);
+    unlink(FILE_TEST_PATH);
+    da_free(ints);
+    da_free(empty);
+    da_free(ints_read);
+    da_free(empty_read);
+    EMU_END_TEST();
+}
+
+EMU_TEST(da_write_fd__checksum)
+{
+    // The checksum is a CRC-32C that never depends on `dstr_hash`.
+    int fd = open_test_file();
+    EMU_REQUIRE_TRUE(fd >= 0);
+    char* digits = da_alloc(0, sizeof(char));
+    digits = da_concat(digits, "123456789", 9);
+    EMU_REQUIRE_NOT_NULL(digits);
+    EMU_EXPECT_TRUE(da_write_fd(digits, fd, DA_FILE_CHECKSUM));
+    uint64_t checksum;
+    EMU_REQUIRE_EQ_INT(lseek(fd, 32, SEEK_SET), 32);
+    EMU_REQUIRE_EQ_INT(read(fd, &checksum, sizeof(checksum)),
+        sizeof(checksum));
+    EMU_EXPECT_EQ_UINT(checksum, 0xE3069283u);
+
+    close(fd);
+    unlink(FILE_TEST_PATH);
+    da_free(digits);
+    EMU_END_TEST();
+}
+
+EMU_TEST(da_write_many_fd__and__da_read_many_fd)
+{
+    int fd = open_test_file();
+    EMU_REQUIRE_TRUE(fd >= 0);
+    void** darrs = da_alloc(3, sizeof(void*));
+    darrs[0] = da_alloc(10, sizeof(double));
+    darrs[1] = da_alloc(0, sizeof(int));
+    darrs[2] = dstr_alloc_from_cstr(TEST_STR1);
+    for (size_t i = 0; i < 10; ++i)
+    {
+        ((double*)darrs[0])[i] = i/4.0;
+    }
+    EMU_EXPECT_TRUE(da_write_many_fd(darrs, fd, DA_FILE_CHECKSUM));
+
+    EMU_REQUIRE_EQ_INT(lseek(fd, 0, SEEK_SET), 0);
+    void** darrs_read = da_read_many_fd(fd);
+    EMU_REQUIRE_NOT_NULL(darrs_read);
+    EMU_REQUIRE_EQ_UINT(da_length(darrs_read), 3);
+    for (size_t i = 0; i < 3; ++i)
+    {
+        EMU_EXPECT_EQ_UINT(da_length(darrs_read[i]), da_length(darrs[i]));
+        EMU_EXPECT_EQ_UINT(da_sizeof_elem(darrs_read[i]),
+            da_sizeof_elem(darrs[i]));
+        EMU_EXPECT_EQ_INT(memcmp(darrs_read[i], darrs[i],
+            da_length(darrs[i])*da_sizeof_elem(darrs[i])), 0);
+    }
+
+    // A container cut short is rejected as a whole.
+    char contents[512];
+    EMU_REQUIRE_EQ_INT(lseek(fd, 0, SEEK_SET), 0);
+    ssize_t size = read(fd, contents, sizeof(contents));
+    EMU_REQUIRE_TRUE(size > 0 && size < (ssize_t)sizeof(contents));
+    close(fd);
+    fd = open_test_file();
+    EMU_REQUIRE_TRUE(fd >= 0);
+    EMU_REQUIRE_EQ_INT(write(fd, contents, (size_t)size - 1), size - 1);
+    EMU_REQUIRE_EQ_INT(lseek(fd, 0, SEEK_SET), 0);
+    EMU_EXPECT_NULL(da_read_many_fd(fd));
+
+    close(fd);
+    unlink(FILE_TEST_PATH);
+    for (size_t i = 0; i < 3; ++i)
+    {
+        da_free(darrs[i]);
+        da_free(darrs_read[i]);
+    }
+    da_free(darrs);
+    da_free(darrs_read);
+    EMU_END_TEST();
+}
+
+EMU_TEST(da_map_file__read_write)
+{
+    unlink(FILE_TEST_PATH);
+    EMU_EXPECT_NULL(da_map_file(FILE_TEST_PATH, sizeof(int), DA_MAP_READ_ONLY));
+    int* da = da_map_file(FILE_TEST_PATH, sizeof(int), DA_MAP_CREATE);
+    EMU_REQUIRE_NOT_NULL(da);
+    EMU_EXPECT_EQ_UINT(da_length(da), 0);
+    EMU_EXPECT_EQ_UINT(da_sizeof_elem(da), sizeof(int));
+    // Growing extends the file and the mapping.
+    for (int i = 0; i < 10000 && da != NULL; ++i)
+    {
+        da = da_push(da, i);
+    }
+    EMU_REQUIRE_NOT_NULL(da);
+    EMU_EXPECT_TRUE(da_sync(da));
+    size_t capacity = da_capacity(da);
+    EMU_EXPECT_TRUE(da_unmap(da));
+
+    // A file can be mapped again as long as the element size matches.
+    EMU_EXPECT_NULL(da_map_file(FILE_TEST_PATH, sizeof(short),
+        DA_MAP_READ_WRITE));
+    da = da_map_file(FILE_TEST_PATH, sizeof(int), DA_MAP_READ_WRITE);
+    EMU_REQUIRE_NOT_NULL(da);
+    EMU_EXPECT_EQ_UINT(da_length(da), 10000);
+    EMU_EXPECT_EQ_UINT(da_capacity(da), capacity);
+    EMU_EXPECT_EQ_INT(da[9999], 9999);
+    da = da_resize_exact(da, 10);
+    EMU_REQUIRE_NOT_NULL(da);
+    da_free(da);
+
+    da = da_map_file(FILE_TEST_PATH, sizeof(int), DA_MAP_READ_WRITE);
+    EMU_REQUIRE_NOT_NULL(da);
+    EMU_EXPECT_EQ_UINT(da_length(da), 10);
+    EMU_EXPECT_EQ_UINT(da_capacity(da), 10);
+    EMU_EXPECT_EQ_INT(da[9], 9);
+    EMU_EXPECT_TRUE(da_unmap(da));
+    EMU_END_TEST();
+}
+
+EMU_TEST(da_map_file__read_only)
+{
+    int* da = da_map_file(FILE_TEST_PATH, sizeof(int), DA_MAP_READ_ONLY);
+    EMU_REQUIRE_NOT_NULL(da);
+    EMU_EXPECT_EQ_UINT(da_length(da), 10);
+    EMU_EXPECT_EQ_INT(da[5], 5);
+    // Changes stay in this process and the darray cannot be resized.
+    da[5] = -5;
+    EMU_EXPECT_NULL(da_reserve(da, 100));
+    EMU_EXPECT_TRUE(da_sync(da));
+    EMU_EXPECT_TRUE(da_unmap(da));
+    EMU_EXPECT_FALSE(da_unmap(da));
+
+    da = da_map_file(FILE_TEST_PATH, sizeof(int), DA_MAP_READ_ONLY);
+    EMU_REQUIRE_NOT_NULL(da);
+    EMU_EXPECT_EQ_INT(da[5], 5);
+    // A shared mapped darray is copied to the heap before it is modified.
+    int* copy = da_share(da);
+    copy = da_push(copy, 10);
+    EMU_REQUIRE_NOT_NULL(copy);
+    EMU_EXPECT_EQ_UINT(da_length(copy), 11);
+    EMU_EXPECT_FALSE(da_unmap(copy));
+    da_free(copy);
+    // Unmapping a shared darray only releases the reference of the handle.
+    copy = da_share(da);
+    EMU_EXPECT_TRUE(da_unmap(copy));
+    EMU_EXPECT_EQ_INT(da[5], 5);
+    EMU_EXPECT_TRUE(da_unmap(da));
+
+    unlink(FILE_TEST_PATH);
+    EMU_END_TEST();
+}
+
+EMU_TEST(dstr_read_line)
+{
+    int fd = open_test_file();
+    EMU_REQUIRE_TRUE(fd >= 0);
+    // A line longer than the reader's buffer spans several refills.
+    size_t long_length = DA_READER_BUFFER_SIZE + DA_READER_BUFFER_SIZE/2;
+    char* long_line = da_alloc(long_length, sizeof(char));
+    for (size_t i = 0; i < long_length; ++i)
+        long_line[i] = (char)('a' + i%26);
+    const char* head = "first\n\nthird line\n";
+    EMU_REQUIRE_EQ_INT(write(fd, head, strlen(head)), (int)strlen(head));
+    EMU_REQUIRE_EQ_INT(write(fd, long_line, long_length), (int)long_length);
+    EMU_REQUIRE_EQ_INT(write(fd, "\nlast", 5), 5);
+    EMU_REQUIRE_EQ_INT(lseek(fd, 0, SEEK_SET), 0);
+
+    struct da_reader reader;
+    EMU_REQUIRE_TRUE(da_reader_init(&reader, fd));
+    darray(char) line = dstr_alloc_from_cstr("left over contents");
+    EMU_REQUIRE_NOT_NULL(line);
+    EMU_REQUIRE_TRUE(dstr_read_line(&reader, &line));
+    EMU_EXPECT_STREQ(line, "first");
+    EMU_EXPECT_EQ_UINT(dstr_length(line), 5);
+    EMU_REQUIRE_TRUE(dstr_read_line(&reader, &line));
+    EMU_EXPECT_STREQ(line, "");
+    EMU_REQUIRE_TRUE(dstr_read_line(&reader, &line));
+    EMU_EXPECT_STREQ(line, "third line");
+    EMU_REQUIRE_TRUE(dstr_read_line(&reader, &line));
+    EMU_REQUIRE_EQ_UINT(dstr_length(line), long_length);
+    EMU_EXPECT_EQ_INT(memcmp(line, long_line, long_length), 0);
+    EMU_EXPECT_EQ_INT(line[long_length], '\0');
+    // The capacity of the dstring is reused for shorter lines.
+    darray(char) before = line;
+    size_t capacity = da_capacity(line);
+    EMU_REQUIRE_TRUE(dstr_read_line(&reader, &line));
+    EMU_EXPECT_STREQ(line, "last");
+    EMU_EXPECT_TRUE(line == before);
+    EMU_EXPECT_EQ_UINT(da_capacity(line), capacity);
+    EMU_EXPECT_FALSE(dstr_read_line(&reader, &line));
+    EMU_EXPECT_STREQ(line, "");
+    EMU_EXPECT_FALSE(da_reader_failed(&reader));
+
+    // A shared dstring is copied rather than overwritten.
+    darray(char) shared = dstr_alloc_from_cstr("shared");
+    EMU_REQUIRE_NOT_NULL(shared);
+    darray(char) owner = da_share(shared);
+    EMU_REQUIRE_EQ_INT(lseek(fd, 0, SEEK_SET), 0);
+    da_reader_free(&reader);
+    EMU_REQUIRE_TRUE(da_reader_init(&reader, fd));
+    EMU_REQUIRE_TRUE(dstr_read_line(&reader, &shared));
+    EMU_EXPECT_STREQ(shared, "first");
+    EMU_EXPECT_STREQ(owner, "shared");
+
+    da_reader_free(&reader);
+    close(fd);
+    unlink(FILE_TEST_PATH);
+    da_free(long_line);
+    da_free(line);
+    da_free(shared);
+    da_free(owner);
+    EMU_END_TEST();
+}
+
+EMU_TEST(da_read_chunk)
+{
+    int fd = open_test_file();
+    EMU_REQUIRE_TRUE(fd >= 0);
+    // Enough ints that some chunks are read past the reader's buffer.
+    size_t nints = DA_READER_BUFFER_SIZE;
+    int* ints = da_alloc(nints, sizeof(int));
+    for (size_t i = 0; i < nints; ++i)
+        ints[i] = (int)i;
+    size_t nbytes = nints*sizeof(int);
+    EMU_REQUIRE_EQ_INT(write(fd, ints, nbytes), (int)nbytes);
+    // Trailing bytes that do not make up a whole int are dropped.
+    EMU_REQUIRE_EQ_INT(write(fd, "ab", 2), 2);
+    EMU_REQUIRE_EQ_INT(lseek(fd, 0, SEEK_SET), 0);
+
+    struct da_reader reader;
+    EMU_REQUIRE_TRUE(da_reader_init(&reader, fd));
+    int* chunk = da_alloc(0, sizeof(int));
+    EMU_REQUIRE_NOT_NULL(chunk);
+    size_t sizes[] = {7, 1000, DA_READER_BUFFER_SIZE/2, 3};
+    size_t nread = 0;
+    size_t nmismatches = 0;
+    for (size_t s = 0; nread < nints; s = (s + 1) % 4)
+    {
+        size_t n = da_read_chunk(&reader, (void**)&chunk, sizes[s]);
+        size_t expected = nints - nread < sizes[s] ? nints - nread : sizes[s];
+        EMU_REQUIRE_EQ_UINT(n, expected);
+        EMU_REQUIRE_EQ_UINT(da_length(chunk), n);
+        for (size_t i = 0; i < n; ++i)
+            nmismatches += chunk[i] != (int)(nread + i);
+        nread += n;
+    }
+    EMU_EXPECT_EQ_UINT(nmismatches, 0);
+    EMU_EXPECT_EQ_UINT(da_read_chunk(&reader, (void**)&chunk, 10), 0);
+    EMU_EXPECT_EQ_UINT(da_length(chunk), 0);
+    EMU_EXPECT_FALSE(da_reader_failed(&reader));
+
+    da_reader_free(&reader);
+    close(fd);
+    unlink(FILE_TEST_PATH);
+    da_free(ints);
+    da_free(chunk);
+    EMU_END_TEST();
+}
+
+EMU_GROUP(da_file_functions)
+{
+    EMU_ADD(da_write_fd__and__da_read_fd);
+    EMU_ADD(da_write_fd__checksum);
+    EMU_ADD(da_write_many_fd__and__da_read_many_fd);
+    EMU_ADD(da_map_file__read_write);
+    EMU_ADD(da_map_file__read_only);
+    EMU_ADD(dstr_read_line);
+    EMU_ADD(da_read_chunk);
+    EMU_END_GROUP();
+}
+
+EMU_GROUP(darray_functions)
+{
+    EMU_ADD(da_length);
+    EMU_ADD(da_capacity);
+    EMU_ADD(da_sizeof_elem);
+    EMU_ADD(darray_alloc_and_free_functions);
+    EMU_ADD(da_share_functions);
+    EMU_ADD(da_resize);
+    EMU_ADD(da_resize_exact);
+    EMU_ADD(da_reserve);
+    EMU_ADD(da_push);
+    EMU_ADD(da_pop);
+    EMU_ADD(da_insert);
+    EMU_ADD(da_insert_arr);
+    EMU_ADD(da_remove);
+    EMU_ADD(da_remove_arr);
+    EMU_ADD(da_swap);
+    EMU_ADD(da_concat);
+    EMU_ADD(da_fill);
+    EMU_ADD(da_foreach);
+    EMU_ADD(da_find_functions);
+    EMU_ADD(da_parallel_for);
+    EMU_ADD(da_atomic_append__and__da_seal);
+    EMU_ADD(da_atomic_append__from_several_threads);
+    EMU_ADD(da_collector);
+    EMU_ADD(da_collector__from_several_threads);
+    EMU_ADD(da_ring_functions);
+    EMU_ADD(da_concurrent_functions);
+    EMU_ADD(da_sort_functions);
+    EMU_ADD(da_sorted_functions);
+    EMU_ADD(da_reduction_functions);
+    EMU_ADD(da_soa_functions);
+    EMU_ADD(da_seg_functions);
+    EMU_ADD(da_delta_functions);
+    EMU_ADD(da_packed_functions);
+    EMU_ADD(da_file_functions);
+    EMU_ADD(container_style_type);
+    EMU_END_GROUP();
+}
+
+EMU_TEST(dstr_alloc_empty__and__dstr_free);
+{
+    char* dstr = dstr_alloc_empty();
+    EMU_REQUIRE_NOT_NULL(dstr);
+    EMU_REQUIRE_GE_UINT(da_capacity(dstr), da_length(dstr));
+    EMU_REQUIRE_EQ_UINT(strlen(dstr), 0);
+    EMU_REQUIRE_STREQ(dstr, EMPTY_STR);
+    dstr_free(dstr);
+    EMU_END_TEST();
+}
+
+EMU_TEST(dstr_alloc_from_cstr__and__dstr_free);
+{
+    char* dstr = dstr_alloc_from_cstr(EMPTY_STR);
+    EMU_REQUIRE_NOT_NULL(dstr);
+    EMU_REQUIRE_GE_UINT(da_capacity(dstr), da_length(dstr));
+    EMU_REQUIRE_EQ_UINT(strlen(dstr), 0);
+    EMU_REQUIRE_STREQ(dstr, EMPTY_STR);
+    dstr_free(dstr);
+
+    dstr = dstr_alloc_from_cstr(TEST_STR0);
+    EMU_REQUIRE_NOT_NULL(dstr);
+    EMU_REQUIRE_GE_UINT(da_capacity(dstr), da_length(dstr));
+    EMU_REQUIRE_EQ_UINT(strlen(dstr), strlen(TEST_STR0));
+    EMU_REQUIRE_STREQ(dstr, TEST_STR0);
+    dstr_free(dstr);
+
+    dstr = dstr_alloc_from_cstr(TEST_STR1);
+    EMU_REQUIRE_NOT_NULL(dstr);
+    EMU_REQUIRE_GE_UINT(da_capacity(dstr), da_length(dstr));
+    EMU_REQUIRE_EQ_UINT(strlen(dstr), strlen(TEST_STR1));
+    EMU_REQUIRE_STREQ(dstr, TEST_STR1);
+    dstr_free(dstr);
+
+    EMU_END_TEST();
+}
+
+EMU_TEST(dstr_alloc_from_dstr__and__dstr_free);
+{
+    char* src = dstr_alloc_from_cstr(EMPTY_STR);
+    char* dest = dstr_alloc_from_dstr(src);
+    EMU_REQUIRE_NOT_NULL(dest);
+    EMU_REQUIRE_GE_UINT(da_capacity(dest), da_length(dest));
+    EMU_REQUIRE_EQ_UINT(strlen(dest), 0);
+    EMU_REQUIRE_STREQ(dest, EMPTY_STR);
+    dstr_free(src);
+    dstr_free(dest);
+
+    src = dstr_alloc_from_cstr(TEST_STR0);
+    dest = dstr_alloc_from_dstr(src);
+    EMU_REQUIRE_NOT_NULL(dest);
+    EMU_REQUIRE_GE_UINT(da_capacity(dest), da_length(dest));
+    EMU_REQUIRE_EQ_UINT(strlen(dest), strlen(TEST_STR0));
+    EMU_REQUIRE_STREQ(dest, TEST_STR0);
+    dstr_free(src);
+    dstr_free(dest);
+
+    src = dstr_alloc_from_cstr(TEST_STR1);
+    dest = dstr_alloc_from_dstr(src);
+    EMU_REQUIRE_NOT_NULL(dest);
+    EMU_REQUIRE_GE_UINT(da_capacity(dest), da_length(dest));
+    EMU_REQUIRE_EQ_UINT(strlen(dest), strlen(TEST_STR1));
+    EMU_REQUIRE_STREQ(dest, TEST_STR1);
+    dstr_free(src);
+    dstr_free(dest);
+
+    EMU_END_TEST();
+}
+
+EMU_TEST(dstr_alloc_from_format__and__dstr_free)
+{
+    char* dstr = dstr_alloc_from_format("%d %s", 5, "foo");
+    EMU_REQUIRE_NOT_NULL(dstr);
+    EMU_REQUIRE_GE_UINT(da_capacity(dstr), da_length(dstr));
+    EMU_REQUIRE_EQ_UINT(strlen(dstr), 5);
+    EMU_REQUIRE_STREQ(dstr, "5 foo");
+    dstr_free(dstr);
+
+    // Output larger than the internal formatting buffer.
+    dstr = dstr_alloc_from_format("%0300d", 7);
+    EMU_REQUIRE_NOT_NULL(dstr);
+    EMU_REQUIRE_EQ_UINT(dstr_length(dstr), 300);
+    EMU_REQUIRE_EQ_UINT(strlen(dstr), 300);
+    EMU_EXPECT_EQ_INT(dstr[299], '7');
+    dstr_free(dstr);
+    EMU_END_TEST();
+}
+
+EMU_GROUP(dstring_alloc_and_free_functions)
+{
+    EMU_ADD(dstr_alloc_empty__and__dstr_free);
+    EMU_ADD(dstr_alloc_from_cstr__and__dstr_free);
+    EMU_ADD(dstr_alloc_from_dstr__and__dstr_free);
+    EMU_ADD(dstr_alloc_from_format__and__dstr_free);
+    EMU_END_GROUP();
+}
+
+#define FIRST_STR   "string"
+#define SHORTER_STR "str"
+#define LONGER_STR  "longer string"
+
+EMU_TEST(dstr_reassign_empty)
+{
+    char* dstr = dstr_alloc_from_cstr(FIRST_STR);
+    dstr = dstr_reassign_empty(dstr);
+    EMU_REQUIRE_NOT_NULL(dstr);
+    EMU_REQUIRE_GE_UINT(da_capacity(dstr), da_length(dstr));
+    EMU_REQUIRE_EQ_UINT(strlen(dstr), 0);
+    EMU_REQUIRE_STREQ(dstr, EMPTY_STR);
+    dstr_free(dstr);
+    EMU_END_TEST();
+}
+
+EMU_TEST(dstr_reassign_from_cstr)
+{
+    char* dstr = dstr_alloc_from_cstr(FIRST_STR);
+
+    dstr = dstr_reassign_from_cstr(dstr, SHORTER_STR);
+    EMU_REQUIRE_NOT_NULL(dstr);
+    EMU_REQUIRE_GE_UINT(da_capacity(dstr), da_length(dstr));
+    EMU_REQUIRE_EQ_UINT(strlen(dstr), strlen(SHORTER_STR));
+    EMU_REQUIRE_STREQ(dstr, SHORTER_STR);
+
+    dstr = dstr_reassign_from_cstr(dstr, LONGER_STR);
+    EMU_REQUIRE_NOT_NULL(dstr);
+    EMU_REQUIRE_GE_UINT(da_capacity(dstr), da_length(dstr));
+    EMU_REQUIRE_EQ_UINT(strlen(dstr), strlen(LONGER_STR));
+    EMU_REQUIRE_STREQ(dstr, LONGER_STR);
+
+    dstr_free(dstr);
+    EMU_END_TEST();
+}
+
+EMU_TEST(dstr_reassign_from_dstr)
+{
+    char* dstr = dstr_alloc_from_cstr(FIRST_STR);
+    char* src;
+
+    src = dstr_alloc_from_cstr(SHORTER_STR);
+    dstr = dstr_reassign_from_dstr(dstr, src);
+    EMU_REQUIRE_NOT_NULL(dstr);
+    EMU_REQUIRE_GE_UINT(da_capacity(dstr), da_length(dstr));
+    EMU_REQUIRE_EQ_UINT(strlen(dstr), strlen(SHORTER_STR));
+    EMU_REQUIRE_STREQ(dstr, SHORTER_STR);
+    dstr_free(src);
+
+    src = dstr_alloc_from_cstr(LONGER_STR);
+    dstr = dstr_reassign_from_dstr(dstr, src);
+    EMU_REQUIRE_NOT_NULL(dstr);
+    EMU_REQUIRE_GE_UINT(da_capacity(dstr), da_length(dstr));
+    EMU_REQUIRE_EQ_UINT(strlen(dstr), strlen(LONGER_STR));
+    EMU_REQUIRE_STREQ(dstr, LONGER_STR);
+    dstr_free(src);
+
+    dstr_free(dstr);
+    EMU_END_TEST();
+}
+
+EMU_TEST(dstr_reassign_from_format)
+{
+    char* dstr = dstr_alloc_from_cstr(FIRST_STR);
     dstr = dstr_reassign_from_format(dstr, "%d %s", 5, "foo");
     EMU_REQUIRE_NOT_NULL(dstr);
     EMU_REQUIRE_GE_UINT(da_capacity(dstr), da_length(dstr));
     EMU_REQUIRE_EQ_UINT(strlen(dstr), 5);
+
+    dstr = dstr_reassign_from_format(dstr, "%s %s", LONGER_STR, TEST_STR1);
+    EMU_REQUIRE_NOT_NULL(dstr);
+    EMU_REQUIRE_GE_UINT(da_capacity(dstr), da_length(dstr));
+    EMU_REQUIRE_EQ_UINT(dstr_length(dstr), strlen(LONGER_STR " " TEST_STR1));
+    EMU_REQUIRE_STREQ(dstr, LONGER_STR " " TEST_STR1);
     dstr_free(dstr);
     EMU_END_TEST();
 }
@@ -786,6 +2740,13 @@ EMU_TEST(dstr_concat_cstr)
     EMU_REQUIRE_NOT_NULL(dstr);
     EMU_REQUIRE_EQ_UINT(strlen(dstr), strlen(TEST_STR0 TEST_STR1));
     EMU_REQUIRE_STREQ(dstr, TEST_STR0 TEST_STR1);
+    EMU_EXPECT_EQ_UINT(dstr_length(dstr), strlen(TEST_STR0 TEST_STR1));
+
+    // `src` may point into `dest`.
+    dstr = dstr_concat_cstr(dstr, dstr + strlen(TEST_STR0));
+    EMU_REQUIRE_NOT_NULL(dstr);
+    EMU_EXPECT_STREQ(dstr, TEST_STR0 TEST_STR1 TEST_STR1);
+    EMU_EXPECT_EQ_UINT(dstr_length(dstr), strlen(TEST_STR0 TEST_STR1 TEST_STR1));
     dstr_free(dstr);
     EMU_END_TEST();
 }
@@ -798,15 +2759,219 @@ EMU_TEST(dstr_concat_dstr)
     EMU_REQUIRE_NOT_NULL(dest);
     EMU_REQUIRE_EQ_UINT(strlen(dest), strlen(TEST_STR0 TEST_STR1));
     EMU_REQUIRE_STREQ(dest, TEST_STR0 TEST_STR1);
+    EMU_EXPECT_EQ_UINT(dstr_length(dest), strlen(TEST_STR0 TEST_STR1));
+
+    dest = dstr_concat_dstr(dest, dest);
+    EMU_REQUIRE_NOT_NULL(dest);
+    EMU_EXPECT_STREQ(dest, TEST_STR0 TEST_STR1 TEST_STR0 TEST_STR1);
+    EMU_EXPECT_EQ_UINT(dstr_length(dest),
+        strlen(TEST_STR0 TEST_STR1 TEST_STR0 TEST_STR1));
     dstr_free(dest);
     dstr_free(src);
     EMU_END_TEST();
 }
 
+EMU_TEST(dstr_append_format)
+{
+    char* dest = dstr_alloc_from_cstr(TEST_STR0);
+    dest = dstr_append_format(dest, " %d %s", 5, "foo");
+    EMU_REQUIRE_NOT_NULL(dest);
+    EMU_EXPECT_STREQ(dest, TEST_STR0 " 5 foo");
+    EMU_EXPECT_EQ_UINT(dstr_length(dest), strlen(TEST_STR0 " 5 foo"));
+
+    // Output larger than the remaining capacity forces growth.
+    dest = dstr_append_format(dest, "%s%s%s", TEST_STR1, TEST_STR1, TEST_STR1);
+    EMU_REQUIRE_NOT_NULL(dest);
+    EMU_EXPECT_STREQ(dest, TEST_STR0 " 5 foo" TEST_STR1 TEST_STR1 TEST_STR1);
+    EMU_EXPECT_EQ_UINT(dstr_length(dest),
+        strlen(TEST_STR0 " 5 foo" TEST_STR1 TEST_STR1 TEST_STR1));
+    EMU_REQUIRE_GE_UINT(da_capacity(dest), da_length(dest));
+
+    dest = dstr_append_format(dest, "%s", EMPTY_STR);
+    EMU_REQUIRE_NOT_NULL(dest);
+    EMU_EXPECT_EQ_UINT(dstr_length(dest),
+        strlen(TEST_STR0 " 5 foo" TEST_STR1 TEST_STR1 TEST_STR1));
+
+    dstr_free(dest);
+    EMU_END_TEST();
+}
+
+#define NUM_JOIN_PARTS 100
+
+EMU_TEST(dstr_join)
+{
+    const char* parts[] = {"GET", "/index.html", "HTTP/1.1"};
+    char* dstr = dstr_join(parts, 3, " ");
+    EMU_REQUIRE_NOT_NULL(dstr);
+    EMU_EXPECT_STREQ(dstr, "GET /index.html HTTP/1.1");
+    EMU_EXPECT_EQ_UINT(dstr_length(dstr), strlen("GET /index.html HTTP/1.1"));
+    dstr_free(dstr);
+
+    dstr = dstr_join(parts, 3, EMPTY_STR);
+    EMU_REQUIRE_NOT_NULL(dstr);
+    EMU_EXPECT_STREQ(dstr, "GET/index.htmlHTTP/1.1");
+    dstr_free(dstr);
+
+    dstr = dstr_join(parts, 0, ", ");
+    EMU_REQUIRE_NOT_NULL(dstr);
+    EMU_EXPECT_STREQ(dstr, EMPTY_STR);
+    EMU_EXPECT_EQ_UINT(dstr_length(dstr), 0);
+    dstr_free(dstr);
+
+    // More parts than lengths remembered between passes.
+    const char* many[NUM_JOIN_PARTS];
+    for (int i = 0; i < NUM_JOIN_PARTS; ++i)
+        many[i] = i % 2 == 0 ? "ab" : "c";
+    dstr = dstr_join(many, NUM_JOIN_PARTS, ",");
+    EMU_REQUIRE_NOT_NULL(dstr);
+    EMU_EXPECT_EQ_UINT(dstr_length(dstr),
+        (NUM_JOIN_PARTS/2)*3 + NUM_JOIN_PARTS-1);
+    EMU_EXPECT_STREQ(dstr + dstr_length(dstr) - 4, "ab,c");
+    dstr_free(dstr);
+
+    EMU_END_TEST();
+}
+
+EMU_TEST(dstr_builder)
+{
+    struct dstr_builder builder;
+    dstr_builder_init(&builder);
+    EMU_EXPECT_EQ_UINT(dstr_builder_length(&builder), 0);
+    char* dstr = dstr_builder_build(&builder);
+    EMU_REQUIRE_NOT_NULL(dstr);
+    EMU_EXPECT_STREQ(dstr, EMPTY_STR);
+    dstr_free(dstr);
+
+    char* name = dstr_alloc_from_cstr("world");
+    for (int i = 0; i < NUM_JOIN_PARTS; ++i)
+    {
+        dstr_builder_clear(&builder);
+        EMU_REQUIRE_EQ(dstr_builder_append_cstr(&builder, "hello, "), true);
+        EMU_REQUIRE_EQ(dstr_builder_append_dstr(&builder, name), true);
+        EMU_REQUIRE_EQ(dstr_builder_append(&builder, "!!!", 1), true);
+    }
+    EMU_EXPECT_EQ_UINT(dstr_builder_length(&builder),
+        strlen("hello, world!"));
+    dstr = dstr_builder_build(&builder);
+    EMU_REQUIRE_NOT_NULL(dstr);
+    EMU_EXPECT_STREQ(dstr, "hello, world!");
+    EMU_EXPECT_EQ_UINT(dstr_length(dstr), strlen("hello, world!"));
+    dstr_free(dstr);
+    dstr_free(name);
+
+    dstr_builder_free(&builder);
+    EMU_EXPECT_EQ_UINT(dstr_builder_length(&builder), 0);
+    EMU_END_TEST();
+}
+
 EMU_GROUP(dstr_concat_functions)
 {
     EMU_ADD(dstr_concat_cstr);
     EMU_ADD(dstr_concat_dstr);
+    EMU_ADD(dstr_append_format);
+    EMU_ADD(dstr_join);
+    EMU_ADD(dstr_builder);
+    EMU_END_GROUP();
+}
+
+EMU_TEST(dstr_append_i64)
+{
+    char* dstr = dstr_alloc_from_cstr(TEST_STR0);
+    dstr = dstr_append_i64(dstr, -1234567890123);
+    EMU_REQUIRE_NOT_NULL(dstr);
+    EMU_EXPECT_STREQ(dstr, TEST_STR0 "-1234567890123");
+    EMU_EXPECT_EQ_UINT(dstr_length(dstr), strlen(TEST_STR0 "-1234567890123"));
+
+    dstr = dstr_reassign_empty(dstr);
+    dstr = dstr_append_i64(dstr, INT64_MIN);
+    EMU_EXPECT_STREQ(dstr, "-9223372036854775808");
+    dstr = dstr_reassign_empty(dstr);
+    dstr = dstr_append_i64(dstr, 0);
+    EMU_EXPECT_STREQ(dstr, "0");
+
+    dstr_free(dstr);
+    EMU_END_TEST();
+}
+
+EMU_TEST(dstr_append_u64)
+{
+    char* dstr = dstr_alloc_empty();
+    dstr = dstr_append_u64(dstr, UINT64_MAX);
+    EMU_REQUIRE_NOT_NULL(dstr);
+    EMU_EXPECT_STREQ(dstr, "18446744073709551615");
+    EMU_EXPECT_EQ_UINT(dstr_length(dstr), strlen("18446744073709551615"));
+    dstr_free(dstr);
+    EMU_END_TEST();
+}
+
+EMU_TEST(dstr_append_f64)
+{
+    const double values[] = {0.1, -2.5, 1e300, 5e-324, 123456789.0, 1.0/3.0};
+    const char* strs[] = {"0.1", "-2.5", "1e+300", "5e-324", "123456789",
+        "0.3333333333333333"};
+    char* dstr = dstr_alloc_empty();
+    for (size_t i = 0; i < sizeof(values)/sizeof(values[0]); ++i)
+    {
+        dstr = dstr_reassign_empty(dstr);
+        dstr = dstr_append_f64(dstr, values[i]);
+        EMU_REQUIRE_NOT_NULL(dstr);
+        EMU_EXPECT_STREQ(dstr, strs[i]);
+        EMU_EXPECT_EQ_UINT(dstr_length(dstr), strlen(strs[i]));
+        EMU_EXPECT_EQ(strtod(dstr, NULL), values[i]);
+    }
+    dstr_free(dstr);
+    EMU_END_TEST();
+}
+
+EMU_TEST(dstr_parse_i64)
+{
+    int64_t value = 0;
+    char* dstr = dstr_alloc_from_cstr("-9223372036854775808,42");
+    EMU_EXPECT_EQ_UINT(dstr_parse_i64(dstr, dstr_length(dstr), &value), 20);
+    EMU_EXPECT_EQ(value, INT64_MIN);
+    EMU_EXPECT_EQ_UINT(dstr_parse_i64(dstr+21, dstr_length(dstr)-21, &value),
+        2);
+    EMU_EXPECT_EQ(value, 42);
+    // Only the first 3 characters of the view are considered.
+    EMU_EXPECT_EQ_UINT(dstr_parse_i64(dstr+1, 3, &value), 3);
+    EMU_EXPECT_EQ(value, 922);
+
+    value = 7;
+    EMU_EXPECT_EQ_UINT(dstr_parse_i64("9223372036854775808", 19, &value), 0);
+    EMU_EXPECT_EQ_UINT(dstr_parse_i64("-", 1, &value), 0);
+    EMU_EXPECT_EQ_UINT(dstr_parse_i64("x1", 2, &value), 0);
+    EMU_EXPECT_EQ(value, 7);
+
+    dstr_free(dstr);
+    EMU_END_TEST();
+}
+
+EMU_TEST(dstr_parse_f64)
+{
+    const char* strs[] = {"0.1", "-2.5e3", "1e300", "3.14159265358979323846",
+        "inf"};
+    double value;
+    for (size_t i = 0; i < sizeof(strs)/sizeof(strs[0]); ++i)
+    {
+        EMU_EXPECT_EQ_UINT(dstr_parse_f64(strs[i], strlen(strs[i]), &value),
+            strlen(strs[i]));
+        EMU_EXPECT_EQ(value, strtod(strs[i], NULL));
+    }
+    EMU_EXPECT_EQ_UINT(dstr_parse_f64("12.5,7", 6, &value), 4);
+    EMU_EXPECT_EQ(value, 12.5);
+    EMU_EXPECT_EQ_UINT(dstr_parse_f64("12.5", 2, &value), 2);
+    EMU_EXPECT_EQ(value, 12.0);
+    EMU_EXPECT_EQ_UINT(dstr_parse_f64("foo", 3, &value), 0);
+    EMU_END_TEST();
+}
+
+EMU_GROUP(dstr_numeric_functions)
+{
+    EMU_ADD(dstr_append_i64);
+    EMU_ADD(dstr_append_u64);
+    EMU_ADD(dstr_append_f64);
+    EMU_ADD(dstr_parse_i64);
+    EMU_ADD(dstr_parse_f64);
     EMU_END_GROUP();
 }
 
@@ -917,6 +3082,15 @@ EMU_TEST(dstr_transform_lower)
     EMU_EXPECT_STREQ(dstr, "mixed case123");
     dstr_free(dstr);
 
+    // Long enough to go through the vectorized path, including a chunk with
+    // non-ASCII bytes.
+    dstr = dstr_alloc_from_cstr(
+        "THE QUICK BROWN FOX JUMPS OVER THE LAZY DOG [\xC3\x89T\xC3\x89] @Z`");
+    dstr_transform_lower(dstr);
+    EMU_EXPECT_STREQ(dstr,
+        "the quick brown fox jumps over the lazy dog [\xC3\x89t\xC3\x89] @z`");
+    dstr_free(dstr);
+
     EMU_END_TEST();
 }
 
@@ -932,6 +3106,13 @@ EMU_TEST(dstr_transform_upper)
     EMU_EXPECT_STREQ(dstr, "MIXED CASE123");
     dstr_free(dstr);
 
+    dstr = dstr_alloc_from_cstr(
+        "the quick brown fox jumps over the lazy dog [\xC3\xA9t\xC3\xA9] `a{");
+    dstr_transform_upper(dstr);
+    EMU_EXPECT_STREQ(dstr,
+        "THE QUICK BROWN FOX JUMPS OVER THE LAZY DOG [\xC3\xA9T\xC3\xA9] `A{");
+    dstr_free(dstr);
+
     EMU_END_TEST();
 }
 
@@ -947,20 +3128,423 @@ EMU_TEST(dstr_trim)
     char* dstr = dstr_alloc_from_cstr(" \t\n\v\f\rfoo \t\n\v\f\r");
     dstr = dstr_trim(dstr);
     EMU_EXPECT_STREQ(dstr, "foo");
+    EMU_EXPECT_EQ_UINT(dstr_length(dstr), strlen("foo"));
+    dstr_free(dstr);
+
+    dstr = dstr_alloc_from_cstr(
+        "                    foo bar                        ");
+    dstr = dstr_trim(dstr);
+    EMU_EXPECT_STREQ(dstr, "foo bar");
+    EMU_EXPECT_EQ_UINT(dstr_length(dstr), strlen("foo bar"));
+    dstr_free(dstr);
+
+    dstr = dstr_alloc_from_cstr("no whitespace");
+    dstr = dstr_trim(dstr);
+    EMU_EXPECT_STREQ(dstr, "no whitespace");
+    dstr_free(dstr);
+
+    dstr = dstr_alloc_from_cstr(" \t\n\v\f\r \t\n\v\f\r \t\n\v\f\r");
+    dstr = dstr_trim(dstr);
+    EMU_EXPECT_STREQ(dstr, EMPTY_STR);
+    EMU_EXPECT_EQ_UINT(dstr_length(dstr), 0);
+    dstr_free(dstr);
+
+    dstr = dstr_alloc_empty();
+    dstr = dstr_trim(dstr);
+    EMU_EXPECT_STREQ(dstr, EMPTY_STR);
+    dstr_free(dstr);
+    EMU_END_TEST();
+}
+
+#define SSO_SHORT_STR "user:12345"
+#define SSO_FULL_STR  "abcdefghijklmnopqrstuvw"
+#define SSO_LONG_STR  "this string is too long to be stored inline"
+
+EMU_TEST(dstr_sso_init__and__dstr_sso_free)
+{
+    struct dstr_sso sso;
+    dstr_sso_init(&sso);
+    EMU_EXPECT_EQ_UINT(dstr_sso_length(&sso), 0);
+    EMU_EXPECT_STREQ(dstr_sso_cstr(&sso), EMPTY_STR);
+    EMU_EXPECT_EQ(dstr_sso_is_inline(&sso), true);
+    dstr_sso_free(&sso);
+    EMU_EXPECT_EQ_UINT(dstr_sso_length(&sso), 0);
+    EMU_END_TEST();
+}
+
+EMU_TEST(dstr_sso_from_cstr)
+{
+    struct dstr_sso sso;
+
+    EMU_REQUIRE_EQ(dstr_sso_from_cstr(&sso, SSO_SHORT_STR), true);
+    EMU_EXPECT_EQ(dstr_sso_is_inline(&sso), true);
+    EMU_EXPECT_EQ_UINT(dstr_sso_length(&sso), strlen(SSO_SHORT_STR));
+    EMU_EXPECT_STREQ(dstr_sso_cstr(&sso), SSO_SHORT_STR);
+    dstr_sso_free(&sso);
+
+    EMU_REQUIRE_EQ(dstr_sso_from_cstr(&sso, SSO_FULL_STR), true);
+    EMU_EXPECT_EQ(dstr_sso_is_inline(&sso), true);
+    EMU_EXPECT_EQ_UINT(dstr_sso_length(&sso), DSTR_SSO_INLINE_CAPACITY);
+    EMU_EXPECT_STREQ(dstr_sso_cstr(&sso), SSO_FULL_STR);
+    dstr_sso_free(&sso);
+
+    EMU_REQUIRE_EQ(dstr_sso_from_cstr(&sso, SSO_LONG_STR), true);
+    EMU_EXPECT_EQ(dstr_sso_is_inline(&sso), false);
+    EMU_EXPECT_EQ_UINT(dstr_sso_length(&sso), strlen(SSO_LONG_STR));
+    EMU_EXPECT_STREQ(dstr_sso_cstr(&sso), SSO_LONG_STR);
+    dstr_sso_free(&sso);
+
+    EMU_END_TEST();
+}
+
+EMU_TEST(dstr_sso_append)
+{
+    struct dstr_sso sso;
+    dstr_sso_init(&sso);
+
+    EMU_REQUIRE_EQ(dstr_sso_append(&sso, "abc", 3), true);
+    EMU_REQUIRE_EQ(dstr_sso_append(&sso, "def", 3), true);
+    EMU_EXPECT_EQ(dstr_sso_is_inline(&sso), true);
+    EMU_EXPECT_STREQ(dstr_sso_cstr(&sso), "abcdef");
+
+    // Appending a string to itself promotes it to the heap.
+    for (int i = 0; i < 3; ++i)
+    {
+        EMU_REQUIRE_EQ(dstr_sso_append(&sso, dstr_sso_cstr(&sso),
+            dstr_sso_length(&sso)), true);
+    }
+    EMU_EXPECT_EQ(dstr_sso_is_inline(&sso), false);
+    EMU_EXPECT_EQ_UINT(dstr_sso_length(&sso), 48);
+    EMU_EXPECT_STREQ(dstr_sso_cstr(&sso),
+        "abcdefabcdefabcdefabcdefabcdefabcdefabcdefabcdef");
+
+    // Reassigning a short string moves it back inline.
+    EMU_REQUIRE_EQ(dstr_sso_assign(&sso, dstr_sso_cstr(&sso)+3, 3), true);
+    EMU_EXPECT_EQ(dstr_sso_is_inline(&sso), true);
+    EMU_EXPECT_STREQ(dstr_sso_cstr(&sso), "def");
+
+    dstr_sso_free(&sso);
+    EMU_END_TEST();
+}
+
+EMU_TEST(dstr_sso_dstr_conversion)
+{
+    struct dstr_sso sso;
+    char* dstr = dstr_alloc_from_cstr(SSO_SHORT_STR);
+    EMU_REQUIRE_EQ(dstr_sso_from_dstr(&sso, dstr), true);
+    EMU_EXPECT_STREQ(dstr_sso_cstr(&sso), SSO_SHORT_STR);
+    dstr_free(dstr);
+
+    dstr = dstr_sso_to_dstr(&sso);
+    EMU_REQUIRE_NOT_NULL(dstr);
+    EMU_EXPECT_STREQ(dstr, SSO_SHORT_STR);
+    EMU_EXPECT_EQ_UINT(dstr_length(dstr), strlen(SSO_SHORT_STR));
+    dstr_free(dstr);
+
+    dstr = dstr_sso_release(&sso);
+    EMU_REQUIRE_NOT_NULL(dstr);
+    EMU_EXPECT_STREQ(dstr, SSO_SHORT_STR);
+    EMU_EXPECT_EQ_UINT(dstr_sso_length(&sso), 0);
+    dstr_free(dstr);
+
+    // Releasing a heap string hands over the existing dstring.
+    EMU_REQUIRE_EQ(dstr_sso_from_cstr(&sso, SSO_LONG_STR), true);
+    const char* heap = dstr_sso_cstr(&sso);
+    dstr = dstr_sso_release(&sso);
+    EMU_EXPECT_EQ(dstr, heap);
+    EMU_EXPECT_STREQ(dstr, SSO_LONG_STR);
+    EMU_EXPECT_EQ(dstr_sso_is_inline(&sso), true);
+    dstr_free(dstr);
+
+    EMU_END_TEST();
+}
+
+EMU_TEST(dstr_sso_cmp__and__dstr_sso_equal)
+{
+    struct dstr_sso a, b, c, d;
+    EMU_REQUIRE_EQ(dstr_sso_from_cstr(&a, "abc"), true);
+    EMU_REQUIRE_EQ(dstr_sso_from_cstr(&b, "abd"), true);
+    EMU_REQUIRE_EQ(dstr_sso_from_cstr(&c, SSO_LONG_STR), true);
+    EMU_REQUIRE_EQ(dstr_sso_from_cstr(&d, SSO_LONG_STR), true);
+
+    EMU_EXPECT_EQ(dstr_sso_cmp(&a, &b) < 0, true);
+    EMU_EXPECT_EQ(dstr_sso_cmp(&b, &a) > 0, true);
+    EMU_EXPECT_EQ_INT(dstr_sso_cmp(&c, &d), 0);
+    EMU_EXPECT_EQ(dstr_sso_cmp(&a, &c) < 0, true);
+
+    EMU_EXPECT_EQ(dstr_sso_equal(&a, &a), true);
+    EMU_EXPECT_EQ(dstr_sso_equal(&a, &b), false);
+    EMU_EXPECT_EQ(dstr_sso_equal(&c, &d), true);
+    EMU_EXPECT_EQ(dstr_sso_equal(&a, &c), false);
+
+    // A string that was longer before must still compare equal.
+    EMU_REQUIRE_EQ(dstr_sso_assign(&b, "abcdefgh", 8), true);
+    EMU_REQUIRE_EQ(dstr_sso_assign(&b, "abc", 3), true);
+    EMU_EXPECT_EQ(dstr_sso_equal(&a, &b), true);
+
+    dstr_sso_free(&a);
+    dstr_sso_free(&b);
+    dstr_sso_free(&c);
+    dstr_sso_free(&d);
+    EMU_END_TEST();
+}
+
+EMU_GROUP(dstr_sso_functions)
+{
+    EMU_ADD(dstr_sso_init__and__dstr_sso_free);
+    EMU_ADD(dstr_sso_from_cstr);
+    EMU_ADD(dstr_sso_append);
+    EMU_ADD(dstr_sso_dstr_conversion);
+    EMU_ADD(dstr_sso_cmp__and__dstr_sso_equal);
+    EMU_END_GROUP();
+}
+
+#define HASH_STR_A "the quick brown fox"
+#define HASH_STR_B "the quick brown fog"
+
+EMU_TEST(dstr_hash)
+{
+    char* a = dstr_alloc_from_cstr(HASH_STR_A);
+    char* a_copy = dstr_alloc_from_cstr(HASH_STR_A);
+    char* b = dstr_alloc_from_cstr(HASH_STR_B);
+    a_copy = da_reserve(a_copy, 100);
+    EMU_EXPECT_EQ(dstr_hash(a), dstr_hash(a_copy));
+    EMU_EXPECT_TRUE(dstr_hash(a) != dstr_hash(b));
+
+    // Long strings go through the block based path.
+    char* long_a = dstr_alloc_empty();
+    char* long_b = dstr_alloc_empty();
+    for (int i = 0; i < 200; ++i)
+    {
+        long_a = dstr_append_format(long_a, "%s", HASH_STR_A);
+        long_b = dstr_append_format(long_b, "%s", HASH_STR_A);
+    }
+    EMU_EXPECT_EQ(dstr_hash(long_a), dstr_hash(long_b));
+    long_b[dstr_length(long_b)-1] = '!';
+    EMU_EXPECT_TRUE(dstr_hash(long_a) != dstr_hash(long_b));
+
+    dstr_free(a);
+    dstr_free(a_copy);
+    dstr_free(b);
+    dstr_free(long_a);
+    dstr_free(long_b);
+    EMU_END_TEST();
+}
+
+EMU_TEST(dstr_hash_cached)
+{
+    char* dstr = dstr_alloc_from_cstr(HASH_STR_A);
+    uint64_t hash = dstr_hash_cached(dstr);
+    EMU_EXPECT_EQ(hash, dstr_hash(dstr));
+    EMU_EXPECT_EQ(hash, dstr_hash_cached(dstr));
+
+    // Mutating calls drop the cached hash.
+    dstr_transform_upper(dstr);
+    char* expected = dstr_alloc_from_cstr(dstr);
+    EMU_EXPECT_EQ(dstr_hash_cached(dstr), dstr_hash(expected));
+    dstr = dstr_append_format(dstr, "!");
+    expected = dstr_append_format(expected, "!");
+    EMU_EXPECT_EQ(dstr_hash_cached(dstr), dstr_hash(expected));
+    da_pop(dstr);
+    da_pop(dstr);
+    dstr[dstr_length(dstr)] = '\0';
+    expected = dstr_reassign_from_cstr(expected, dstr);
+    EMU_EXPECT_EQ(dstr_hash_cached(dstr), dstr_hash(expected));
+
+    // Direct writes require an explicit invalidation.
+    dstr[0] = 'x';
+    expected[0] = 'x';
+    dstr_invalidate_cache(dstr);
+    EMU_EXPECT_EQ(dstr_hash_cached(dstr), dstr_hash(expected));
+
+    // Nothing is cached in the header of a shared dstring.
+    dstr_invalidate_cache(dstr);
+    char* snapshot = da_share(dstr);
+    EMU_EXPECT_EQ(dstr_hash_cached(dstr), dstr_hash(expected));
+    da_free(snapshot);
+    dstr[0] = 'y';
+    expected[0] = 'y';
+    EMU_EXPECT_EQ(dstr_hash_cached(dstr), dstr_hash(expected));
+
+    dstr_free(dstr);
+    dstr_free(expected);
+    EMU_END_TEST();
+}
+
+#define NUM_INTERN_STRS 1000
+
+EMU_TEST(dstr_intern)
+{
+    struct dstr_intern_pool pool;
+    dstr_intern_pool_init(&pool);
+    EMU_EXPECT_EQ_UINT(dstr_intern_pool_count(&pool), 0);
+    EMU_EXPECT_EQ_UINT(dstr_intern_pool_bytes(&pool), 0);
+
+    const char* a = dstr_intern(&pool, HASH_STR_A, strlen(HASH_STR_A));
+    const char* b = dstr_intern(&pool, HASH_STR_B, strlen(HASH_STR_B));
+    EMU_REQUIRE_NOT_NULL(a);
+    EMU_REQUIRE_NOT_NULL(b);
+    EMU_EXPECT_STREQ(a, HASH_STR_A);
+    EMU_EXPECT_EQ_UINT(dstr_length(a), strlen(HASH_STR_A));
+    EMU_EXPECT_TRUE(a != b);
+    EMU_EXPECT_EQ(dstr_intern(&pool, HASH_STR_A, strlen(HASH_STR_A)), a);
+    char* a_dstr = dstr_alloc_from_cstr(HASH_STR_A);
+    EMU_EXPECT_EQ(dstr_hash(a), dstr_hash(a_dstr));
+    dstr_free(a_dstr);
+
+    // Prefixes are distinct strings.
+    const char* prefix = dstr_intern(&pool, HASH_STR_A, 3);
+    EMU_REQUIRE_NOT_NULL(prefix);
+    EMU_EXPECT_STREQ(prefix, "the");
+    EMU_EXPECT_EQ_UINT(dstr_intern_pool_count(&pool), 3);
+
+    // Handles remain canonical as the pool grows.
+    const char* handles[NUM_INTERN_STRS];
+    char buf[32];
+    for (int i = 0; i < NUM_INTERN_STRS; ++i)
+    {
+        int len = sprintf(buf, "key:%d", i);
+        handles[i] = dstr_intern(&pool, buf, len);
+        EMU_REQUIRE_NOT_NULL(handles[i]);
+    }
+    for (int i = 0; i < NUM_INTERN_STRS; ++i)
+    {
+        int len = sprintf(buf, "key:%d", i);
+        EMU_EXPECT_EQ(dstr_intern(&pool, buf, len), handles[i]);
+    }
+    EMU_EXPECT_EQ(dstr_intern(&pool, HASH_STR_A, strlen(HASH_STR_A)), a);
+    EMU_EXPECT_EQ_UINT(dstr_intern_pool_count(&pool), NUM_INTERN_STRS+3);
+    EMU_EXPECT_TRUE(dstr_intern_pool_bytes(&pool) > 0);
+
+    dstr_intern_pool_free(&pool);
+    EMU_EXPECT_EQ_UINT(dstr_intern_pool_count(&pool), 0);
+    EMU_END_TEST();
+}
+
+EMU_GROUP(dstr_hash_functions)
+{
+    EMU_ADD(dstr_hash);
+    EMU_ADD(dstr_hash_cached);
+    EMU_ADD(dstr_intern);
+    EMU_END_GROUP();
+}
+
+#define UTF8_STR "na\xC3\xAFve caf\xC3\xA9 \xE2\x82\xAC" "5 \xF0\x9F\x98\x80"
+#define UTF8_STR_NUM_CODEPOINTS 15
+#define UTF8_PADDING "0123456789abcdef0123456789abcde" // 31 bytes
+
+EMU_TEST(dstr_utf8_validate)
+{
+    const char* valid[] = {
+        EMPTY_STR,
+        TEST_STR1,
+        UTF8_STR,
+        UTF8_PADDING UTF8_STR UTF8_PADDING,
+        "\xED\x9F\xBF",         // U+D7FF
+        "\xF4\x8F\xBF\xBF"      // U+10FFFF
+    };
+    const char* invalid[] = {
+        "\x80",                   // Stray continuation.
+        "\xC0\xAF",               // Overlong.
+        "\xE0\x9F\xBF",           // Overlong.
+        "\xED\xA0\x80",           // Surrogate.
+        "\xF4\x90\x80\x80",       // Above U+10FFFF.
+        "\xFF",
+        "caf\xC3",                // Truncated.
+        UTF8_PADDING "\xE2\x82",  // Truncated across a 32 byte boundary.
+        UTF8_PADDING UTF8_PADDING "\xC3\x28" UTF8_PADDING
+    };
+    for (size_t i = 0; i < sizeof(valid)/sizeof(valid[0]); ++i)
+    {
+        char* dstr = dstr_alloc_from_cstr(valid[i]);
+        EMU_EXPECT_TRUE(dstr_utf8_validate(dstr));
+        EMU_EXPECT_TRUE(dstr_utf8_validate(dstr));
+        dstr_free(dstr);
+    }
+    for (size_t i = 0; i < sizeof(invalid)/sizeof(invalid[0]); ++i)
+    {
+        char* dstr = dstr_alloc_from_cstr(invalid[i]);
+        EMU_EXPECT_FALSE(dstr_utf8_validate(dstr));
+        dstr_free(dstr);
+    }
+
+    // Modifying a validated dstring drops the recorded result.
+    char* dstr = dstr_alloc_from_cstr(UTF8_STR);
+    EMU_REQUIRE_TRUE(dstr_utf8_validate(dstr));
+    dstr = dstr_concat_cstr(dstr, "\xC3");
+    EMU_EXPECT_FALSE(dstr_utf8_validate(dstr));
+    da_pop(dstr);
+    dstr[dstr_length(dstr)] = '\0';
+    EMU_EXPECT_TRUE(dstr_utf8_validate(dstr));
+    dstr[0] = (char)0x80;
+    dstr_invalidate_cache(dstr);
+    EMU_EXPECT_FALSE(dstr_utf8_validate(dstr));
+    dstr_free(dstr);
+
+    // Nothing is recorded in the header of a shared dstring.
+    dstr = dstr_alloc_from_cstr(UTF8_STR);
+    char* snapshot = da_share(dstr);
+    EMU_EXPECT_TRUE(dstr_utf8_validate(dstr));
+    da_free(snapshot);
+    dstr[0] = (char)0x80;
+    EMU_EXPECT_FALSE(dstr_utf8_validate(dstr));
+    dstr_free(dstr);
+
+    EMU_END_TEST();
+}
+
+EMU_TEST(dstr_utf8_count__and__dstr_utf8_index)
+{
+    char* dstr = dstr_alloc_from_cstr(UTF8_STR);
+    EMU_EXPECT_EQ_UINT(dstr_utf8_count(dstr), UTF8_STR_NUM_CODEPOINTS);
+    EMU_EXPECT_EQ_INT(dstr_utf8_index(dstr, 0), 0);
+    EMU_EXPECT_EQ_INT(dstr_utf8_index(dstr, 3), 4);
+    EMU_EXPECT_EQ_INT(dstr_utf8_index(dstr, UTF8_STR_NUM_CODEPOINTS-1),
+        dstr_length(dstr)-4);
+    EMU_EXPECT_EQ_INT(dstr_utf8_index(dstr, UTF8_STR_NUM_CODEPOINTS), -1);
+    dstr_free(dstr);
+
+    dstr = dstr_alloc_from_cstr(UTF8_PADDING UTF8_STR UTF8_PADDING);
+    EMU_EXPECT_EQ_UINT(dstr_utf8_count(dstr),
+        2*strlen(UTF8_PADDING) + UTF8_STR_NUM_CODEPOINTS);
+    EMU_EXPECT_EQ_INT(
+        dstr_utf8_index(dstr, strlen(UTF8_PADDING)+UTF8_STR_NUM_CODEPOINTS),
+        strlen(UTF8_PADDING UTF8_STR));
+    dstr_free(dstr);
+
+    // Validated ASCII dstrings take the O(1) path.
+    dstr = dstr_alloc_from_cstr(TEST_STR1);
+    EMU_REQUIRE_TRUE(dstr_utf8_validate(dstr));
+    EMU_EXPECT_EQ_UINT(dstr_utf8_count(dstr), strlen(TEST_STR1));
+    EMU_EXPECT_EQ_INT(dstr_utf8_index(dstr, 5), 5);
+    EMU_EXPECT_EQ_INT(dstr_utf8_index(dstr, strlen(TEST_STR1)), -1);
+    dstr_free(dstr);
+
     EMU_END_TEST();
 }
 
+EMU_GROUP(dstr_utf8_functions)
+{
+    EMU_ADD(dstr_utf8_validate);
+    EMU_ADD(dstr_utf8_count__and__dstr_utf8_index);
+    EMU_END_GROUP();
+}
+
 EMU_GROUP(dstring_functions)
 {
     EMU_ADD(dstring_alloc_and_free_functions);
     EMU_ADD(dstring_reassignment_functions);
     EMU_ADD(dstr_length);
     EMU_ADD(dstr_concat_functions);
+    EMU_ADD(dstr_numeric_functions);
     EMU_ADD(dstr_cmp_functions);
     EMU_ADD(dstr_find_functions);
     EMU_ADD(dstr_replace_functions);
     EMU_ADD(dstr_transform_functions);
     EMU_ADD(dstr_trim);
+    EMU_ADD(dstr_sso_functions);
+    EMU_ADD(dstr_hash_functions);
+    EMU_ADD(dstr_utf8_functions);
     EMU_END_GROUP();
 }
 
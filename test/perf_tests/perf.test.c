@@ -1,5 +1,12 @@
+// pthread_rwlock_t is only declared from POSIX.1-2001 on.
+#define _POSIX_C_SOURCE 200112L
 #include "perf.test.h"
 #include "../../darray.h"
+#include "../../dstring.h"
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
 
 int* arr;
 int* darr;
@@ -225,3 +232,1878 @@ void swap_rand(void)
     swap_rand_helper(nelem, MED_SIZE);
     swap_rand_helper(nelem, LARGE_SIZE);
 }
+
+// NUMBER TO STRING ////////////////////////////////////////////////////////////
+void number_to_string_helper(size_t max_sz)
+{
+    char buf[NUM_SLOT_SIZE];
+    char* dstr = dstr_alloc_empty();
+    int* ints = da_alloc(max_sz, sizeof(int));
+    double* dbls = da_alloc(max_sz, sizeof(double));
+    for (size_t i = 0; i < max_sz; ++i)
+    {
+        ints[i] = rand() - RAND_MAX/2;
+        dbls[i] = (double)rand() / (rand() + 1);
+    }
+
+    begin = clock();
+    for (size_t i = 0; i < max_sz; ++i)
+    {
+        snprintf(buf, sizeof(buf), "%d", ints[i]);
+    }
+    end = clock();
+    print_results("snprintf %d", max_sz, begin, end);
+
+    begin = clock();
+    for (size_t i = 0; i < max_sz; ++i)
+    {
+        dstr = dstr_reassign_empty(dstr);
+        dstr = dstr_append_i64(dstr, ints[i]);
+    }
+    end = clock();
+    print_results("dstr_append_i64", max_sz, begin, end);
+
+    begin = clock();
+    for (size_t i = 0; i < max_sz; ++i)
+    {
+        snprintf(buf, sizeof(buf), "%.17g", dbls[i]);
+    }
+    end = clock();
+    print_results("snprintf %.17g", max_sz, begin, end);
+
+    begin = clock();
+    for (size_t i = 0; i < max_sz; ++i)
+    {
+        dstr = dstr_reassign_empty(dstr);
+        dstr = dstr_append_f64(dstr, dbls[i]);
+    }
+    end = clock();
+    print_results("dstr_append_f64", max_sz, begin, end);
+
+    da_free(ints);
+    da_free(dbls);
+    dstr_free(dstr);
+}
+
+void number_to_string(void)
+{
+    puts("CONVERT NUMBERS TO STRINGS");
+    number_to_string_helper(SMALL_SIZE);
+    number_to_string_helper(MED_SIZE);
+    number_to_string_helper(LARGE_SIZE/10);
+}
+
+// STRING TO NUMBER ////////////////////////////////////////////////////////////
+void string_to_number_helper(size_t max_sz)
+{
+    char* ints = da_alloc(max_sz*NUM_SLOT_SIZE, sizeof(char));
+    char* dbls = da_alloc(max_sz*NUM_SLOT_SIZE, sizeof(char));
+    for (size_t i = 0; i < max_sz; ++i)
+    {
+        snprintf(ints+i*NUM_SLOT_SIZE, NUM_SLOT_SIZE, "%d",
+            rand() - RAND_MAX/2);
+        snprintf(dbls+i*NUM_SLOT_SIZE, NUM_SLOT_SIZE, "%.17g",
+            (double)rand() / (rand() + 1));
+    }
+
+    begin = clock();
+    for (size_t i = 0; i < max_sz; ++i)
+    {
+        strtoll(ints+i*NUM_SLOT_SIZE, NULL, 10);
+    }
+    end = clock();
+    print_results("strtoll", max_sz, begin, end);
+
+    begin = clock();
+    for (size_t i = 0; i < max_sz; ++i)
+    {
+        int64_t value;
+        dstr_parse_i64(ints+i*NUM_SLOT_SIZE, NUM_SLOT_SIZE, &value);
+    }
+    end = clock();
+    print_results("dstr_parse_i64", max_sz, begin, end);
+
+    begin = clock();
+    for (size_t i = 0; i < max_sz; ++i)
+    {
+        strtod(dbls+i*NUM_SLOT_SIZE, NULL);
+    }
+    end = clock();
+    print_results("strtod", max_sz, begin, end);
+
+    begin = clock();
+    for (size_t i = 0; i < max_sz; ++i)
+    {
+        double value;
+        dstr_parse_f64(dbls+i*NUM_SLOT_SIZE, NUM_SLOT_SIZE, &value);
+    }
+    end = clock();
+    print_results("dstr_parse_f64", max_sz, begin, end);
+
+    da_free(ints);
+    da_free(dbls);
+}
+
+void string_to_number(void)
+{
+    puts("PARSE NUMBERS FROM STRINGS");
+    string_to_number_helper(SMALL_SIZE);
+    string_to_number_helper(MED_SIZE);
+    string_to_number_helper(LARGE_SIZE/10);
+}
+
+// SHORT KEYS //////////////////////////////////////////////////////////////////
+void short_keys_helper(size_t max_sz)
+{
+    char* text = da_alloc(max_sz*NUM_SLOT_SIZE, sizeof(char));
+    for (size_t i = 0; i < max_sz; ++i)
+    {
+        snprintf(text+i*NUM_SLOT_SIZE, NUM_SLOT_SIZE, KEY_FORMAT,
+            rand() % (int)max_sz);
+    }
+    size_t nequal;
+    size_t nallocs;
+
+    darray(char)* dstrs = da_alloc(max_sz, sizeof(darray(char)));
+    begin = clock();
+    for (size_t i = 0; i < max_sz; ++i)
+    {
+        dstrs[i] = dstr_alloc_from_cstr(text+i*NUM_SLOT_SIZE);
+    }
+    nequal = 0;
+    for (size_t i = 1; i < max_sz; ++i)
+    {
+        nequal += dstr_cmp(dstrs[i-1], dstrs[i]) == 0;
+    }
+    for (size_t i = 0; i < max_sz; ++i)
+    {
+        dstr_free(dstrs[i]);
+    }
+    end = clock();
+    nallocs = max_sz;
+    da_free(dstrs);
+    print_results("dstring", max_sz, begin, end);
+    print_allocations("dstring", nallocs);
+
+    struct dstr_sso* ssos = da_alloc(max_sz, sizeof(struct dstr_sso));
+    nallocs = 0;
+    begin = clock();
+    for (size_t i = 0; i < max_sz; ++i)
+    {
+        if (!dstr_sso_from_cstr(&ssos[i], text+i*NUM_SLOT_SIZE))
+            exit(EXIT_FAILURE);
+        nallocs += !dstr_sso_is_inline(&ssos[i]);
+    }
+    nequal = 0;
+    for (size_t i = 1; i < max_sz; ++i)
+    {
+        nequal += dstr_sso_equal(&ssos[i-1], &ssos[i]);
+    }
+    for (size_t i = 0; i < max_sz; ++i)
+    {
+        dstr_sso_free(&ssos[i]);
+    }
+    end = clock();
+    da_free(ssos);
+    print_results("dstr_sso", max_sz, begin, end);
+    print_allocations("dstr_sso", nallocs);
+
+    da_free(text);
+}
+
+void short_keys(void)
+{
+    puts("BUILD, COMPARE, AND FREE SHORT KEYS");
+    short_keys_helper(MED_SIZE);
+    short_keys_helper(LARGE_SIZE/10);
+}
+
+// INTERN KEYS /////////////////////////////////////////////////////////////////
+#define DA_FOOTPRINT(darr) \
+    (sizeof(struct _darray) + da_capacity(darr)*da_sizeof_elem(darr))
+
+void intern_keys_helper(size_t max_sz)
+{
+    char* text = da_alloc(max_sz*NUM_SLOT_SIZE, sizeof(char));
+    for (size_t i = 0; i < max_sz; ++i)
+    {
+        snprintf(text+i*NUM_SLOT_SIZE, NUM_SLOT_SIZE, INTERN_KEY_FORMAT,
+            rand() % INTERN_DISTINCT_KEYS);
+    }
+    size_t nequal;
+    size_t dstring_bytes;
+    size_t intern_bytes;
+
+    darray(char)* dstrs = da_alloc(max_sz, sizeof(darray(char)));
+    begin = clock();
+    for (size_t i = 0; i < max_sz; ++i)
+    {
+        dstrs[i] = dstr_alloc_from_cstr(text+i*NUM_SLOT_SIZE);
+    }
+    nequal = 0;
+    for (size_t i = 1; i < max_sz; ++i)
+    {
+        nequal += dstr_cmp(dstrs[i-1], dstrs[i]) == 0;
+    }
+    end = clock();
+    dstring_bytes = DA_FOOTPRINT(dstrs);
+    for (size_t i = 0; i < max_sz; ++i)
+    {
+        dstring_bytes += DA_FOOTPRINT(dstrs[i]);
+        dstr_free(dstrs[i]);
+    }
+    da_free(dstrs);
+    print_results("dstring", max_sz, begin, end);
+
+    const char** interned = da_alloc(max_sz, sizeof(const char*));
+    struct dstr_intern_pool pool;
+    dstr_intern_pool_init(&pool);
+    begin = clock();
+    for (size_t i = 0; i < max_sz; ++i)
+    {
+        const char* key = text+i*NUM_SLOT_SIZE;
+        interned[i] = dstr_intern(&pool, key, strlen(key));
+    }
+    nequal = 0;
+    for (size_t i = 1; i < max_sz; ++i)
+    {
+        nequal += interned[i-1] == interned[i];
+    }
+    end = clock();
+    intern_bytes = DA_FOOTPRINT(interned) + dstr_intern_pool_bytes(&pool);
+    dstr_intern_pool_free(&pool);
+    da_free(interned);
+    print_results("dstr_intern", max_sz, begin, end);
+
+    print_memory("dstring", dstring_bytes);
+    print_memory("dstr_intern", intern_bytes);
+    print_memory("saved", dstring_bytes - intern_bytes);
+
+    da_free(text);
+}
+
+void intern_keys(void)
+{
+    puts("BUILD AND COMPARE REPETITIVE KEYS (INTERNED VS. ONE ALLOCATION PER KEY)");
+    intern_keys_helper(MED_SIZE);
+    intern_keys_helper(LARGE_SIZE/100);
+}
+
+// JOIN FRAGMENTS //////////////////////////////////////////////////////////////
+void join_fragments_helper(size_t max_sz)
+{
+    char* text = da_alloc(FRAGMENTS_PER_RESPONSE*NUM_SLOT_SIZE, sizeof(char));
+    const char* fragments[FRAGMENTS_PER_RESPONSE];
+    for (size_t i = 0; i < FRAGMENTS_PER_RESPONSE; ++i)
+    {
+        char* slot = text+i*NUM_SLOT_SIZE;
+        snprintf(slot, NUM_SLOT_SIZE, "<td>%d</td>", rand() % 100000);
+        fragments[i] = slot;
+    }
+    size_t total_len;
+
+    total_len = 0;
+    begin = clock();
+    for (size_t i = 0; i < max_sz; ++i)
+    {
+        char* dstr = dstr_alloc_empty();
+        for (size_t f = 0; f < FRAGMENTS_PER_RESPONSE; ++f)
+        {
+            dstr = dstr_concat_cstr(dstr, fragments[f]);
+        }
+        total_len += dstr_length(dstr);
+        dstr_free(dstr);
+    }
+    end = clock();
+    print_results("dstr_concat_cstr", max_sz, begin, end);
+
+    total_len = 0;
+    begin = clock();
+    for (size_t i = 0; i < max_sz; ++i)
+    {
+        char* dstr = dstr_join(fragments, FRAGMENTS_PER_RESPONSE, "");
+        total_len += dstr_length(dstr);
+        dstr_free(dstr);
+    }
+    end = clock();
+    print_results("dstr_join", max_sz, begin, end);
+
+    struct dstr_builder builder;
+    dstr_builder_init(&builder);
+    total_len = 0;
+    begin = clock();
+    for (size_t i = 0; i < max_sz; ++i)
+    {
+        dstr_builder_clear(&builder);
+        for (size_t f = 0; f < FRAGMENTS_PER_RESPONSE; ++f)
+        {
+            if (!dstr_builder_append_cstr(&builder, fragments[f]))
+                exit(EXIT_FAILURE);
+        }
+        char* dstr = dstr_builder_build(&builder);
+        total_len += dstr_length(dstr);
+        dstr_free(dstr);
+    }
+    end = clock();
+    dstr_builder_free(&builder);
+    print_results("dstr_builder", max_sz, begin, end);
+
+    da_free(text);
+}
+
+void join_fragments(void)
+{
+    printf("JOIN %d FRAGMENTS PER RESPONSE\n", FRAGMENTS_PER_RESPONSE);
+    join_fragments_helper(MED_SIZE/10);
+    join_fragments_helper(MED_SIZE);
+}
+
+// UTF-8 VALIDATE //////////////////////////////////////////////////////////////
+void utf8_validate_helper(size_t max_sz)
+{
+    char* dstr = dstr_alloc_empty();
+    while (dstr_length(dstr) < max_sz)
+    {
+        dstr = dstr_concat_cstr(dstr,
+            utf8_text_pieces[rand() % NUM_UTF8_TEXT_PIECES]);
+    }
+    size_t nbytes = UTF8_VALIDATION_PASSES*dstr_length(dstr);
+    size_t nvalid;
+
+    nvalid = 0;
+    begin = clock();
+    for (size_t i = 0; i < UTF8_VALIDATION_PASSES; ++i)
+    {
+        dstr_invalidate_cache(dstr);
+        nvalid += dstr_utf8_validate(dstr);
+    }
+    end = clock();
+    if (nvalid != UTF8_VALIDATION_PASSES)
+        exit(EXIT_FAILURE);
+    print_results("dstr_utf8", nbytes, begin, end);
+
+    nvalid = 0;
+    begin = clock();
+    for (size_t i = 0; i < UTF8_VALIDATION_PASSES; ++i)
+    {
+        nvalid += dstr_utf8_validate(dstr);
+    }
+    end = clock();
+    print_results("dstr_utf8 cached", nbytes, begin, end);
+
+    dstr_free(dstr);
+}
+
+void utf8_validate(void)
+{
+    printf("VALIDATE UTF-8 (%d PASSES, ELEMENTS ARE BYTES)\n",
+        UTF8_VALIDATION_PASSES);
+    utf8_validate_helper(MED_SIZE*10);
+    utf8_validate_helper(LARGE_SIZE/10);
+}
+
+// SORT INTS ///////////////////////////////////////////////////////////////////
+void sort_ints_helper(size_t max_sz)
+{
+    int* data = malloc(max_sz*sizeof(int));
+    for (size_t i = 0; i < max_sz; ++i)
+    {
+        data[i] = rand() - RAND_MAX/2;
+    }
+
+    arr = malloc(max_sz*sizeof(int));
+    memcpy(arr, data, max_sz*sizeof(int));
+    begin = clock();
+    qsort(arr, max_sz, sizeof(int), compare_ints);
+    end = clock();
+    free(arr);
+    print_results("qsort", max_sz, begin, end);
+
+    darr = da_alloc(max_sz, sizeof(int));
+    memcpy(darr, data, max_sz*sizeof(int));
+    begin = clock();
+    da_sort(darr, compare_ints);
+    end = clock();
+    print_results("da_sort", max_sz, begin, end);
+
+    memcpy(darr, data, max_sz*sizeof(int));
+    begin = clock();
+    da_sort_stable(darr, compare_ints);
+    end = clock();
+    print_results("da_sort_stable", max_sz, begin, end);
+
+    memcpy(darr, data, max_sz*sizeof(int));
+    begin = clock();
+    da_sort_numeric(darr);
+    end = clock();
+    da_free(darr);
+    print_results("da_sort_numeric", max_sz, begin, end);
+
+    free(data);
+}
+
+void sort_ints(void)
+{
+    puts("SORT RANDOM INTS");
+    sort_ints_helper(MED_SIZE);
+    sort_ints_helper(LARGE_SIZE/10);
+}
+
+// SORT RECORDS ////////////////////////////////////////////////////////////////
+void sort_records_helper(size_t max_sz)
+{
+    struct sort_record* data = malloc(max_sz*sizeof(struct sort_record));
+    for (size_t i = 0; i < max_sz; ++i)
+    {
+        data[i] = (struct sort_record){rand(), i, (double)rand()};
+    }
+
+    struct sort_record* recs = malloc(max_sz*sizeof(struct sort_record));
+    memcpy(recs, data, max_sz*sizeof(struct sort_record));
+    begin = clock();
+    qsort(recs, max_sz, sizeof(struct sort_record), compare_records);
+    end = clock();
+    free(recs);
+    print_results("qsort", max_sz, begin, end);
+
+    recs = da_alloc(max_sz, sizeof(struct sort_record));
+    memcpy(recs, data, max_sz*sizeof(struct sort_record));
+    begin = clock();
+    da_sort(recs, compare_records);
+    end = clock();
+    print_results("da_sort", max_sz, begin, end);
+
+    memcpy(recs, data, max_sz*sizeof(struct sort_record));
+    begin = clock();
+    da_sort_stable(recs, compare_records);
+    end = clock();
+    da_free(recs);
+    print_results("da_sort_stable", max_sz, begin, end);
+
+    free(data);
+}
+
+void sort_records(void)
+{
+    printf("SORT RANDOM %zu BYTE RECORDS BY KEY\n", sizeof(struct sort_record));
+    sort_records_helper(MED_SIZE);
+    sort_records_helper(LARGE_SIZE/10);
+}
+
+// SORT PARALLEL ///////////////////////////////////////////////////////////////
+void sort_parallel_helper(size_t max_sz)
+{
+    int* data = malloc(max_sz*sizeof(int));
+    for (size_t i = 0; i < max_sz; ++i)
+    {
+        data[i] = rand() - RAND_MAX/2;
+    }
+    size_t max_threads = sysconf(_SC_NPROCESSORS_ONLN);
+    char label[NUM_SLOT_SIZE];
+
+    darr = da_alloc(max_sz, sizeof(int));
+    for (size_t nthreads = 1; ; nthreads *= 2)
+    {
+        if (nthreads > max_threads)
+            nthreads = max_threads;
+        memcpy(darr, data, max_sz*sizeof(int));
+        begin = wall_clock();
+        da_sort_parallel(darr, compare_ints, nthreads);
+        end = wall_clock();
+        snprintf(label, sizeof(label), "%zu thread%s", nthreads,
+            nthreads == 1 ? "" : "s");
+        print_results(label, max_sz, begin, end);
+        if (nthreads == max_threads)
+            break;
+    }
+    da_free(darr);
+
+    free(data);
+}
+
+void sort_parallel(void)
+{
+    printf("SORT RANDOM INTS WITH da_sort_parallel (%ld ONLINE CPUS)\n",
+        sysconf(_SC_NPROCESSORS_ONLN));
+    sort_parallel_helper(LARGE_SIZE/10);
+    sort_parallel_helper(LARGE_SIZE);
+}
+
+// SORTED LOOKUP ///////////////////////////////////////////////////////////////
+void sorted_lookup_helper(size_t max_sz)
+{
+    darr = da_alloc(max_sz, sizeof(int));
+    for (size_t i = 0; i < max_sz; ++i)
+    {
+        darr[i] = 2*i;
+    }
+    int* keys = malloc(NUM_LOOKUPS*sizeof(int));
+    for (size_t i = 0; i < NUM_LOOKUPS; ++i)
+    {
+        keys[i] = rand() % (2*max_sz);
+    }
+    size_t nfound;
+
+    nfound = 0;
+    begin = clock();
+    for (size_t i = 0; i < NUM_LOOKUPS; ++i)
+    {
+        nfound += bsearch(&keys[i], darr, max_sz, sizeof(int), compare_ints)
+            != NULL;
+    }
+    end = clock();
+    print_results("bsearch", NUM_LOOKUPS, begin, end);
+
+    size_t nfound_bsearch = nfound;
+    nfound = 0;
+    begin = clock();
+    for (size_t i = 0; i < NUM_LOOKUPS; ++i)
+    {
+        size_t index = da_lower_bound(darr, &keys[i], compare_ints);
+        nfound += index < max_sz && darr[index] == keys[i];
+    }
+    end = clock();
+    if (nfound != nfound_bsearch)
+        exit(EXIT_FAILURE);
+    print_results("da_lower_bound", NUM_LOOKUPS, begin, end);
+
+    free(keys);
+    da_free(darr);
+}
+
+void sorted_lookup(void)
+{
+    printf("LOOK UP %d RANDOM KEYS IN A SORTED ARRAY\n", NUM_LOOKUPS);
+    sorted_lookup_helper(MED_SIZE);
+    sorted_lookup_helper(LARGE_SIZE/10);
+}
+
+// SORTED INTERSECT ////////////////////////////////////////////////////////////
+void sorted_intersect_helper(size_t len_a, size_t len_b)
+{
+    // Unique ascending keys with random gaps, each array covering the same
+    // range of values.
+    int* a = da_alloc(len_a, sizeof(int));
+    int* b = da_alloc(len_b, sizeof(int));
+    for (size_t i = 0, key = 0; i < len_a; ++i)
+    {
+        key += 1 + rand() % (len_a < len_b ? 2*len_b/len_a : 2);
+        a[i] = key;
+    }
+    for (size_t i = 0, key = 0; i < len_b; ++i)
+    {
+        key += 1 + rand() % (len_b < len_a ? 2*len_a/len_b : 2);
+        b[i] = key;
+    }
+    int* result;
+
+    begin = clock();
+    result = da_intersect(a, b, compare_ints);
+    end = clock();
+    printf("%*s%zu x %zu elements, %zu in common\n", INDENT_SPACES, "",
+        len_a, len_b, da_length(result));
+    da_free(result);
+    print_results("da_intersect", len_a + len_b, begin, end);
+
+    begin = clock();
+    result = da_intersect_numeric(a, b);
+    end = clock();
+    da_free(result);
+    print_results("da_intersect_num", len_a + len_b, begin, end);
+
+    da_free(a);
+    da_free(b);
+}
+
+void sorted_intersect(void)
+{
+    puts("INTERSECT SORTED INT ARRAYS");
+    sorted_intersect_helper(LARGE_SIZE/10, LARGE_SIZE/10);
+    sorted_intersect_helper(SMALL_SIZE*10, LARGE_SIZE/10);
+}
+
+// FILL PARALLEL ///////////////////////////////////////////////////////////////
+void fill_heavy(void* elem, size_t index, void* ctx)
+{
+    (void)ctx;
+    *(int*)elem = heavy_value(index);
+}
+
+void fill_parallel_helper(size_t max_sz)
+{
+    size_t max_threads = sysconf(_SC_NPROCESSORS_ONLN);
+    char label[NUM_SLOT_SIZE];
+
+    darr = da_alloc(max_sz, sizeof(int));
+    begin = wall_clock();
+    da_foreach(darr, iter)
+    {
+        *iter = heavy_value(iter - darr);
+    }
+    end = wall_clock();
+    print_results(DARR_FE, max_sz, begin, end);
+
+    for (size_t nthreads = 1; ; nthreads *= 2)
+    {
+        if (nthreads > max_threads)
+            nthreads = max_threads;
+        da_parallel_set_max_threads(nthreads);
+        begin = wall_clock();
+        da_parallel_for(darr, fill_heavy, NULL, 0);
+        end = wall_clock();
+        snprintf(label, sizeof(label), "%zu thread%s", nthreads,
+            nthreads == 1 ? "" : "s");
+        print_results(label, max_sz, begin, end);
+        if (nthreads == max_threads)
+            break;
+    }
+    da_parallel_set_max_threads(0);
+    da_free(darr);
+}
+
+void fill_parallel(void)
+{
+    printf("FILL A PRE-SIZED ARRAY WITH da_parallel_for (%ld ONLINE CPUS)\n",
+        sysconf(_SC_NPROCESSORS_ONLN));
+    fill_parallel_helper(MED_SIZE*10);
+    fill_parallel_helper(LARGE_SIZE/10);
+}
+
+// FIND ////////////////////////////////////////////////////////////////////////
+void find_helper(size_t max_sz)
+{
+    darr = da_alloc(max_sz, sizeof(int));
+    for (size_t i = 0; i < max_sz; ++i)
+    {
+        darr[i] = 2*i;
+    }
+    int* keys = malloc(NUM_LOOKUPS*sizeof(int));
+    for (size_t i = 0; i < NUM_LOOKUPS; ++i)
+    {
+        keys[i] = rand() % (4*max_sz);
+    }
+    printf("%*s%zu element array\n", INDENT_SPACES, "", max_sz);
+
+    size_t nfound = 0;
+    begin = clock();
+    for (size_t i = 0; i < NUM_LOOKUPS; ++i)
+    {
+        for (size_t j = 0; j < max_sz; ++j)
+        {
+            if (darr[j] == keys[i])
+            {
+                nfound += 1;
+                break;
+            }
+        }
+    }
+    end = clock();
+    print_results("loop", NUM_LOOKUPS, begin, end);
+
+    size_t nfound_da = 0;
+    begin = clock();
+    for (size_t i = 0; i < NUM_LOOKUPS; ++i)
+    {
+        nfound_da += da_contains(darr, &keys[i]);
+    }
+    end = clock();
+    if (nfound_da != nfound)
+        exit(EXIT_FAILURE);
+    print_results("da_contains", NUM_LOOKUPS, begin, end);
+
+    free(keys);
+    da_free(darr);
+}
+
+void find(void)
+{
+    printf("CHECK %d RANDOM KEYS FOR MEMBERSHIP IN AN UNSORTED ARRAY\n",
+        NUM_LOOKUPS);
+    find_helper(SMALL_SIZE/5);
+    find_helper(SMALL_SIZE*10);
+}
+
+// REDUCTIONS //////////////////////////////////////////////////////////////////
+volatile double reduce_sink;
+
+void reduce_ints_helper(size_t max_sz, size_t passes)
+{
+    int* src = da_alloc(max_sz, sizeof(int));
+    int* ints = da_alloc(max_sz, sizeof(int));
+    for (size_t i = 0; i < max_sz; ++i)
+    {
+        src[i] = rand() - RAND_MAX/2;
+    }
+    memcpy(ints, src, max_sz*sizeof(int));
+    printf("%*sint, %zu passes\n", INDENT_SPACES, "", passes);
+
+    begin = wall_clock();
+    for (size_t pass = 0; pass < passes; ++pass)
+    {
+        long long sum = 0;
+        for (size_t i = 0; i < max_sz; ++i)
+        {
+            sum += ints[i];
+        }
+        reduce_sink = sum;
+    }
+    end = wall_clock();
+    print_results("loop sum", max_sz, begin, end);
+    begin = wall_clock();
+    for (size_t pass = 0; pass < passes; ++pass)
+    {
+        reduce_sink = da_sum_int(ints);
+    }
+    end = wall_clock();
+    print_results("da_sum_int", max_sz, begin, end);
+
+    begin = wall_clock();
+    for (size_t pass = 0; pass < passes; ++pass)
+    {
+        int min = ints[0], max = ints[0];
+        for (size_t i = 1; i < max_sz; ++i)
+        {
+            min = ints[i] < min ? ints[i] : min;
+            max = ints[i] > max ? ints[i] : max;
+        }
+        reduce_sink = max - min;
+    }
+    end = wall_clock();
+    print_results("loop minmax", max_sz, begin, end);
+    begin = wall_clock();
+    for (size_t pass = 0; pass < passes; ++pass)
+    {
+        int min, max;
+        da_minmax_int(ints, &min, &max);
+        reduce_sink = max - min;
+    }
+    end = wall_clock();
+    print_results("da_minmax_int", max_sz, begin, end);
+
+    begin = wall_clock();
+    for (size_t pass = 0; pass < passes; ++pass)
+    {
+        size_t argmax = 0;
+        for (size_t i = 1; i < max_sz; ++i)
+        {
+            argmax = ints[i] > ints[argmax] ? i : argmax;
+        }
+        reduce_sink = argmax;
+    }
+    end = wall_clock();
+    print_results("loop argmax", max_sz, begin, end);
+    begin = wall_clock();
+    for (size_t pass = 0; pass < passes; ++pass)
+    {
+        reduce_sink = da_argmax_int(ints);
+    }
+    end = wall_clock();
+    print_results("da_argmax_int", max_sz, begin, end);
+
+    clock_t elapsed = 0;
+    for (size_t pass = 0; pass < passes; ++pass)
+    {
+        memcpy(ints, src, max_sz*sizeof(int));
+        begin = wall_clock();
+        unsigned sum = 0;
+        for (size_t i = 0; i < max_sz; ++i)
+        {
+            sum += (unsigned)ints[i];
+            ints[i] = (int)sum;
+        }
+        end = wall_clock();
+        elapsed += end - begin;
+    }
+    print_results("loop prefix sum", max_sz, 0, elapsed);
+    elapsed = 0;
+    for (size_t pass = 0; pass < passes; ++pass)
+    {
+        memcpy(ints, src, max_sz*sizeof(int));
+        begin = wall_clock();
+        da_prefix_sum_int(ints);
+        end = wall_clock();
+        elapsed += end - begin;
+    }
+    print_results("da_prefix_sum_int", max_sz, 0, elapsed);
+
+    da_free(ints);
+    da_free(src);
+}
+
+void reduce_doubles_helper(size_t max_sz, size_t passes)
+{
+    double* src = da_alloc(max_sz, sizeof(double));
+    double* doubles = da_alloc(max_sz, sizeof(double));
+    for (size_t i = 0; i < max_sz; ++i)
+    {
+        src[i] = (double)rand() / RAND_MAX;
+    }
+    memcpy(doubles, src, max_sz*sizeof(double));
+    printf("%*sdouble, %zu passes\n", INDENT_SPACES, "", passes);
+
+    begin = wall_clock();
+    for (size_t pass = 0; pass < passes; ++pass)
+    {
+        double sum = 0;
+        for (size_t i = 0; i < max_sz; ++i)
+        {
+            sum += doubles[i];
+        }
+        reduce_sink = sum;
+    }
+    end = wall_clock();
+    print_results("loop sum", max_sz, begin, end);
+    begin = wall_clock();
+    for (size_t pass = 0; pass < passes; ++pass)
+    {
+        reduce_sink = da_sum_double(doubles);
+    }
+    end = wall_clock();
+    print_results("da_sum_double", max_sz, begin, end);
+
+    begin = wall_clock();
+    for (size_t pass = 0; pass < passes; ++pass)
+    {
+        double min = doubles[0], max = doubles[0];
+        for (size_t i = 1; i < max_sz; ++i)
+        {
+            min = doubles[i] < min ? doubles[i] : min;
+            max = doubles[i] > max ? doubles[i] : max;
+        }
+        reduce_sink = max - min;
+    }
+    end = wall_clock();
+    print_results("loop minmax", max_sz, begin, end);
+    begin = wall_clock();
+    for (size_t pass = 0; pass < passes; ++pass)
+    {
+        double min, max;
+        da_minmax_double(doubles, &min, &max);
+        reduce_sink = max - min;
+    }
+    end = wall_clock();
+    print_results("da_minmax_double", max_sz, begin, end);
+
+    begin = wall_clock();
+    for (size_t pass = 0; pass < passes; ++pass)
+    {
+        size_t argmax = 0;
+        for (size_t i = 1; i < max_sz; ++i)
+        {
+            argmax = doubles[i] > doubles[argmax] ? i : argmax;
+        }
+        reduce_sink = argmax;
+    }
+    end = wall_clock();
+    print_results("loop argmax", max_sz, begin, end);
+    begin = wall_clock();
+    for (size_t pass = 0; pass < passes; ++pass)
+    {
+        reduce_sink = da_argmax_double(doubles);
+    }
+    end = wall_clock();
+    print_results("da_argmax_double", max_sz, begin, end);
+
+    clock_t elapsed = 0;
+    for (size_t pass = 0; pass < passes; ++pass)
+    {
+        memcpy(doubles, src, max_sz*sizeof(double));
+        begin = wall_clock();
+        double sum = 0;
+        for (size_t i = 0; i < max_sz; ++i)
+        {
+            doubles[i] = sum += doubles[i];
+        }
+        end = wall_clock();
+        elapsed += end - begin;
+    }
+    print_results("loop prefix sum", max_sz, 0, elapsed);
+    elapsed = 0;
+    for (size_t pass = 0; pass < passes; ++pass)
+    {
+        memcpy(doubles, src, max_sz*sizeof(double));
+        begin = wall_clock();
+        da_prefix_sum_double(doubles);
+        end = wall_clock();
+        elapsed += end - begin;
+    }
+    print_results("da_prefix_sum_double", max_sz, 0, elapsed);
+
+    da_free(doubles);
+    da_free(src);
+}
+
+void reduce(void)
+{
+    puts("REDUCE AND SCAN NUMERIC ARRAYS");
+    reduce_ints_helper(MED_SIZE*10, 100);
+    reduce_ints_helper(LARGE_SIZE, 1);
+    reduce_doubles_helper(MED_SIZE*10, 100);
+    reduce_doubles_helper(LARGE_SIZE, 1);
+}
+
+// STRUCTURE OF ARRAYS /////////////////////////////////////////////////////////
+volatile double scan_sink;
+
+void scan_field_helper(size_t max_sz, size_t passes)
+{
+    struct particle* aos = da_alloc(max_sz, sizeof(struct particle));
+    const size_t sizes[PARTICLE_NUM_FIELDS] = {
+        sizeof(double), sizeof(double), sizeof(double),
+        sizeof(double), sizeof(double), sizeof(double),
+        sizeof(float), sizeof(int)
+    };
+    void** soa = da_soa_alloc(max_sz, PARTICLE_NUM_FIELDS, sizes);
+    for (size_t i = 0; i < max_sz; ++i)
+    {
+        struct particle p = {
+            .x = i, .y = i, .z = i, .vx = 1, .vy = 1, .vz = 1,
+            .mass = (float)rand() / RAND_MAX, .id = (int)i
+        };
+        aos[i] = p;
+        const void* row[PARTICLE_NUM_FIELDS] = {
+            &p.x, &p.y, &p.z, &p.vx, &p.vy, &p.vz, &p.mass, &p.id
+        };
+        for (size_t k = 0; k < PARTICLE_NUM_FIELDS; ++k)
+        {
+            memcpy((char*)soa[k] + i*sizes[k], row[k], sizes[k]);
+        }
+    }
+    float* masses = soa[6];
+    printf("%*s%zu particles, %zu passes\n", INDENT_SPACES, "", max_sz, passes);
+
+    begin = clock();
+    for (size_t pass = 0; pass < passes; ++pass)
+    {
+        double sum = 0;
+        for (size_t i = 0; i < max_sz; ++i)
+        {
+            sum += aos[i].mass;
+        }
+        scan_sink = sum;
+    }
+    end = clock();
+    print_results("AoS loop", max_sz, begin, end);
+
+    begin = clock();
+    for (size_t pass = 0; pass < passes; ++pass)
+    {
+        double sum = 0;
+        for (size_t i = 0; i < max_sz; ++i)
+        {
+            sum += masses[i];
+        }
+        scan_sink = sum;
+    }
+    end = clock();
+    print_results("SoA loop", max_sz, begin, end);
+
+    begin = clock();
+    for (size_t pass = 0; pass < passes; ++pass)
+    {
+        scan_sink = da_sum_float(masses);
+    }
+    end = clock();
+    print_results("SoA da_sum_float", max_sz, begin, end);
+
+    da_soa_free(soa);
+    da_free(aos);
+}
+
+void scan_field(void)
+{
+    puts("SUM ONE FIELD OF AN ARRAY OF STRUCTS AND A STRUCTURE OF ARRAYS");
+    scan_field_helper(MED_SIZE, 1000);
+    scan_field_helper(MED_SIZE*10, 100);
+}
+
+// SEGMENTED DARRAYS ///////////////////////////////////////////////////////////
+void fill_segmented_helper(size_t max_sz)
+{
+    darr = (int*)da_alloc(0, sizeof(int));
+    begin = clock();
+    for (size_t i = 0; i < max_sz; ++i)
+    {
+        darr = da_push(darr, (int)i);
+    }
+    end = clock();
+    da_free(darr);
+    print_results(DARR, max_sz, begin, end);
+
+    void** seg = da_seg_alloc(0, sizeof(int), 0);
+    begin = clock();
+    for (size_t i = 0; i < max_sz; ++i)
+    {
+        int value = (int)i;
+        seg = da_seg_push(seg, &value);
+    }
+    end = clock();
+    da_seg_free(seg);
+    print_results("da_seg", max_sz, begin, end);
+}
+
+void fill_segmented(void)
+{
+    puts("FILLING A DARRAY AND A SEGMENTED DARRAY VIA PUSH BACK");
+    fill_segmented_helper(MED_SIZE);
+    fill_segmented_helper(LARGE_SIZE);
+}
+
+// SNAPSHOT ////////////////////////////////////////////////////////////////////
+volatile double snapshot_sink;
+
+// Take NUM_SNAPSHOTS snapshots of a darray of statistics, exporting each one
+// by summing it, and update one statistic after every export.
+void snapshot_helper(size_t max_sz)
+{
+    double* stats = da_alloc(max_sz, sizeof(double));
+    for (size_t i = 0; i < max_sz; ++i)
+    {
+        stats[i] = i;
+    }
+
+    begin = clock();
+    for (size_t n = 0; n < NUM_SNAPSHOTS; ++n)
+    {
+        double* snap = da_alloc(da_length(stats), sizeof(double));
+        memcpy(snap, stats, da_length(stats)*sizeof(double));
+        snapshot_sink = da_sum_double(snap);
+        da_free(snap);
+        stats[n % max_sz] += 1;
+    }
+    end = clock();
+    print_results("copy", max_sz, begin, end);
+
+    begin = clock();
+    for (size_t n = 0; n < NUM_SNAPSHOTS; ++n)
+    {
+        double* snap = da_share(stats);
+        snapshot_sink = da_sum_double(snap);
+        da_free(snap);
+        stats = da_unshare(stats);
+        stats[n % max_sz] += 1;
+    }
+    end = clock();
+    print_results("da_share", max_sz, begin, end);
+
+    // Updating while the snapshot is still held copies the darray.
+    begin = clock();
+    for (size_t n = 0; n < NUM_SNAPSHOTS; ++n)
+    {
+        double* snap = da_share(stats);
+        stats = da_unshare(stats);
+        stats[n % max_sz] += 1;
+        snapshot_sink = da_sum_double(snap);
+        da_free(snap);
+    }
+    end = clock();
+    print_results("da_share (held)", max_sz, begin, end);
+
+    da_free(stats);
+}
+
+void snapshot(void)
+{
+    printf("TAKE %d SNAPSHOTS OF A DARRAY\n", NUM_SNAPSHOTS);
+    snapshot_helper(MED_SIZE);
+    snapshot_helper(MED_SIZE*10);
+}
+
+// COLLECT PARALLEL ////////////////////////////////////////////////////////////
+pthread_mutex_t collect_lock = PTHREAD_MUTEX_INITIALIZER;
+int* collected;
+
+void collect_locked(void* elem, size_t index, void* ctx)
+{
+    (void)elem;
+    (void)ctx;
+    pthread_mutex_lock(&collect_lock);
+    collected = da_push(collected, (int)index);
+    pthread_mutex_unlock(&collect_lock);
+}
+
+void collect_atomic(void* elem, size_t index, void* ctx)
+{
+    (void)elem;
+    (void)ctx;
+    int value = (int)index;
+    da_atomic_append(collected, &value);
+}
+
+void collect_local(void* elem, size_t index, void* ctx)
+{
+    (void)elem;
+    int** local = (int**)da_collector_local(ctx);
+    *local = da_push(*local, (int)index);
+}
+
+void collect_parallel_helper(size_t max_sz, size_t nthreads)
+{
+    darr = da_alloc(max_sz, sizeof(int));
+    da_parallel_set_max_threads(nthreads);
+
+    collected = da_alloc(0, sizeof(int));
+    collected = da_reserve(collected, max_sz);
+    begin = wall_clock();
+    da_parallel_for(darr, collect_locked, NULL, 0);
+    end = wall_clock();
+    da_free(collected);
+    print_results("mutex da_push", max_sz, begin, end);
+
+    collected = da_alloc(0, sizeof(int));
+    collected = da_reserve(collected, max_sz);
+    begin = wall_clock();
+    da_parallel_for(darr, collect_atomic, NULL, 0);
+    da_seal(collected);
+    end = wall_clock();
+    da_free(collected);
+    print_results("da_atomic_append", max_sz, begin, end);
+
+    struct da_collector collector;
+    da_collector_init(&collector, sizeof(int));
+    begin = wall_clock();
+    da_parallel_for(darr, collect_local, &collector, 0);
+    collected = da_collector_merge(&collector);
+    end = wall_clock();
+    da_free(collected);
+    da_collector_free(&collector);
+    print_results("da_collector", max_sz, begin, end);
+
+    da_parallel_set_max_threads(0);
+    da_free(darr);
+}
+
+void collect_parallel(void)
+{
+    long online = sysconf(_SC_NPROCESSORS_ONLN);
+    size_t nthreads = online < 2 ? 2 : online;
+    printf("COLLECT RESULTS FROM %zu THREADS INTO ONE ARRAY\n", nthreads);
+    collect_parallel_helper(MED_SIZE*10, nthreads);
+    collect_parallel_helper(LARGE_SIZE/10, nthreads);
+}
+
+// RING QUEUE //////////////////////////////////////////////////////////////////
+// Bounded queue of ints guarded by a mutex and two condition variables, the way
+// pipeline threads exchanged items before `struct da_ring`.
+struct locked_queue
+{
+    pthread_mutex_t lock;
+    pthread_cond_t not_empty;
+    pthread_cond_t not_full;
+    int* buf;
+    size_t head;
+    size_t tail;
+};
+
+void locked_queue_init(struct locked_queue* queue)
+{
+    pthread_mutex_init(&queue->lock, NULL);
+    pthread_cond_init(&queue->not_empty, NULL);
+    pthread_cond_init(&queue->not_full, NULL);
+    queue->buf = da_alloc(RING_CAPACITY, sizeof(int));
+    queue->head = queue->tail = 0;
+}
+
+void locked_queue_free(struct locked_queue* queue)
+{
+    pthread_mutex_destroy(&queue->lock);
+    pthread_cond_destroy(&queue->not_empty);
+    pthread_cond_destroy(&queue->not_full);
+    da_free(queue->buf);
+}
+
+void locked_queue_push(struct locked_queue* queue, int value)
+{
+    pthread_mutex_lock(&queue->lock);
+    while (queue->tail - queue->head == RING_CAPACITY)
+        pthread_cond_wait(&queue->not_full, &queue->lock);
+    queue->buf[queue->tail++ % RING_CAPACITY] = value;
+    pthread_cond_signal(&queue->not_empty);
+    pthread_mutex_unlock(&queue->lock);
+}
+
+int locked_queue_pop(struct locked_queue* queue)
+{
+    pthread_mutex_lock(&queue->lock);
+    while (queue->tail == queue->head)
+        pthread_cond_wait(&queue->not_empty, &queue->lock);
+    int value = queue->buf[queue->head++ % RING_CAPACITY];
+    pthread_cond_signal(&queue->not_full);
+    pthread_mutex_unlock(&queue->lock);
+    return value;
+}
+
+// Spin until all `nelem` elements have been enqueued or dequeued, yielding so
+// that the other side can run when both share a core.
+void ring_send(struct da_ring* ring, const int* src, size_t nelem)
+{
+    size_t sent = 0;
+    while ((sent += da_ring_enqueue(ring, src + sent, nelem - sent)) < nelem)
+        sched_yield();
+}
+
+void ring_recv(struct da_ring* ring, int* dest, size_t nelem)
+{
+    size_t received = 0;
+    while ((received += da_ring_dequeue(ring, dest + received,
+        nelem - received)) < nelem)
+        sched_yield();
+}
+
+struct da_ring rings[2];
+struct locked_queue queues[2];
+size_t ring_nelem;
+size_t ring_batch;
+volatile long long ring_sink;
+
+void* ring_produce(void* arg)
+{
+    (void)arg;
+    int batch[RING_BATCH];
+    for (size_t i = 0; i < ring_nelem; i += ring_batch)
+    {
+        size_t n = ring_nelem - i < ring_batch ? ring_nelem - i : ring_batch;
+        for (size_t k = 0; k < n; ++k)
+        {
+            batch[k] = (int)(i + k);
+        }
+        ring_send(&rings[0], batch, n);
+    }
+    return NULL;
+}
+
+void* queue_produce(void* arg)
+{
+    (void)arg;
+    for (size_t i = 0; i < ring_nelem; ++i)
+    {
+        locked_queue_push(&queues[0], (int)i);
+    }
+    return NULL;
+}
+
+// Send every element received on the first ring or queue back on the second.
+void* ring_echo(void* arg)
+{
+    (void)arg;
+    int value;
+    for (size_t i = 0; i < ring_nelem; ++i)
+    {
+        ring_recv(&rings[0], &value, 1);
+        ring_send(&rings[1], &value, 1);
+    }
+    return NULL;
+}
+
+void* queue_echo(void* arg)
+{
+    (void)arg;
+    for (size_t i = 0; i < ring_nelem; ++i)
+    {
+        locked_queue_push(&queues[1], locked_queue_pop(&queues[0]));
+    }
+    return NULL;
+}
+
+// Move `max_sz` ints from a producer thread to this thread.
+void ring_throughput_helper(size_t max_sz)
+{
+    pthread_t producer;
+    int batch[RING_BATCH];
+    long long sum;
+    ring_nelem = max_sz;
+
+    locked_queue_init(&queues[0]);
+    sum = 0;
+    begin = wall_clock();
+    pthread_create(&producer, NULL, queue_produce, NULL);
+    for (size_t i = 0; i < max_sz; ++i)
+    {
+        sum += locked_queue_pop(&queues[0]);
+    }
+    pthread_join(producer, NULL);
+    end = wall_clock();
+    ring_sink = sum;
+    locked_queue_free(&queues[0]);
+    print_results("mutex queue", max_sz, begin, end);
+
+    size_t batch_sizes[] = {1, RING_BATCH};
+    const char* labels[] = {"da_ring", "da_ring (batch)"};
+    for (size_t b = 0; b < 2; ++b)
+    {
+        da_ring_init(&rings[0], RING_CAPACITY, sizeof(int));
+        ring_batch = batch_sizes[b];
+        sum = 0;
+        begin = wall_clock();
+        pthread_create(&producer, NULL, ring_produce, NULL);
+        for (size_t i = 0; i < max_sz; i += ring_batch)
+        {
+            size_t n = max_sz - i < ring_batch ? max_sz - i : ring_batch;
+            ring_recv(&rings[0], batch, n);
+            for (size_t k = 0; k < n; ++k)
+            {
+                sum += batch[k];
+            }
+        }
+        pthread_join(producer, NULL);
+        end = wall_clock();
+        ring_sink = sum;
+        da_ring_free(&rings[0]);
+        print_results(labels[b], max_sz, begin, end);
+    }
+}
+
+// Bounce one int at a time between this thread and an echo thread.
+void ring_latency_helper(size_t num_round_trips)
+{
+    pthread_t echo;
+    ring_nelem = num_round_trips;
+
+    locked_queue_init(&queues[0]);
+    locked_queue_init(&queues[1]);
+    begin = wall_clock();
+    pthread_create(&echo, NULL, queue_echo, NULL);
+    for (size_t i = 0; i < num_round_trips; ++i)
+    {
+        locked_queue_push(&queues[0], (int)i);
+        ring_sink = locked_queue_pop(&queues[1]);
+    }
+    pthread_join(echo, NULL);
+    end = wall_clock();
+    locked_queue_free(&queues[0]);
+    locked_queue_free(&queues[1]);
+    print_results("mutex queue", num_round_trips, begin, end);
+
+    da_ring_init(&rings[0], RING_CAPACITY, sizeof(int));
+    da_ring_init(&rings[1], RING_CAPACITY, sizeof(int));
+    begin = wall_clock();
+    pthread_create(&echo, NULL, ring_echo, NULL);
+    for (size_t i = 0; i < num_round_trips; ++i)
+    {
+        int value = (int)i;
+        ring_send(&rings[0], &value, 1);
+        ring_recv(&rings[1], &value, 1);
+        ring_sink = value;
+    }
+    pthread_join(echo, NULL);
+    end = wall_clock();
+    da_ring_free(&rings[0]);
+    da_ring_free(&rings[1]);
+    print_results("da_ring", num_round_trips, begin, end);
+}
+
+void ring_queue(void)
+{
+    puts("PASS INTS FROM A PRODUCER THREAD TO A CONSUMER THREAD");
+    ring_throughput_helper(MED_SIZE*10);
+    ring_throughput_helper(LARGE_SIZE/10);
+    puts("ROUND TRIPS OF ONE INT BETWEEN TWO THREADS");
+    ring_latency_helper(NUM_ROUND_TRIPS);
+    puts(RESULTS_MAY_VARY);
+}
+
+// READ MOSTLY /////////////////////////////////////////////////////////////////
+pthread_rwlock_t table_lock = PTHREAD_RWLOCK_INITIALIZER;
+int* locked_table;
+struct da_concurrent concurrent_table;
+volatile long long lookup_sink;
+
+// Each reader makes NUM_LOOKUPS/NUM_TABLE_READERS lookups at scattered
+// indices while the writer appends to the table.
+void* locked_lookup(void* arg)
+{
+    (void)arg;
+    long long sum = 0;
+    for (size_t i = 0; i < NUM_LOOKUPS/NUM_TABLE_READERS; ++i)
+    {
+        pthread_rwlock_rdlock(&table_lock);
+        sum += locked_table[i*2654435761u % da_length(locked_table)];
+        pthread_rwlock_unlock(&table_lock);
+    }
+    lookup_sink = sum;
+    return NULL;
+}
+
+void* concurrent_lookup(void* arg)
+{
+    (void)arg;
+    long long sum = 0;
+    size_t reader = da_concurrent_register(&concurrent_table);
+    for (size_t i = 0; i < NUM_LOOKUPS/NUM_TABLE_READERS; ++i)
+    {
+        const int* table = da_concurrent_read_begin(&concurrent_table, reader);
+        sum += table[i*2654435761u % da_concurrent_length(table)];
+        da_concurrent_read_end(&concurrent_table, reader);
+    }
+    da_concurrent_unregister(&concurrent_table, reader);
+    lookup_sink = sum;
+    return NULL;
+}
+
+// Look up a table of `max_sz` ints from NUM_TABLE_READERS threads while this
+// thread appends another `max_sz` ints to it.
+void read_mostly_helper(size_t max_sz)
+{
+    pthread_t readers[NUM_TABLE_READERS];
+
+    locked_table = da_alloc(max_sz, sizeof(int));
+    for (size_t i = 0; i < max_sz; ++i)
+    {
+        locked_table[i] = (int)i;
+    }
+    begin = wall_clock();
+    for (size_t r = 0; r < NUM_TABLE_READERS; ++r)
+    {
+        pthread_create(&readers[r], NULL, locked_lookup, NULL);
+    }
+    for (size_t i = 0; i < max_sz; ++i)
+    {
+        pthread_rwlock_wrlock(&table_lock);
+        locked_table = da_push(locked_table, (int)i);
+        pthread_rwlock_unlock(&table_lock);
+    }
+    for (size_t r = 0; r < NUM_TABLE_READERS; ++r)
+    {
+        pthread_join(readers[r], NULL);
+    }
+    end = wall_clock();
+    da_free(locked_table);
+    print_results("rwlock", max_sz, begin, end);
+
+    da_concurrent_init(&concurrent_table, max_sz, sizeof(int));
+    for (int i = 0; i < (int)max_sz; ++i)
+    {
+        da_concurrent_push(&concurrent_table, &i);
+    }
+    begin = wall_clock();
+    for (size_t r = 0; r < NUM_TABLE_READERS; ++r)
+    {
+        pthread_create(&readers[r], NULL, concurrent_lookup, NULL);
+    }
+    for (int i = 0; i < (int)max_sz; ++i)
+    {
+        da_concurrent_push(&concurrent_table, &i);
+    }
+    for (size_t r = 0; r < NUM_TABLE_READERS; ++r)
+    {
+        pthread_join(readers[r], NULL);
+    }
+    end = wall_clock();
+    da_concurrent_free(&concurrent_table);
+    print_results("da_concurrent", max_sz, begin, end);
+}
+
+void read_mostly(void)
+{
+    printf("%d LOOKUPS FROM %d THREADS WHILE ONE THREAD APPENDS\n",
+        NUM_LOOKUPS, NUM_TABLE_READERS);
+    read_mostly_helper(MED_SIZE);
+    read_mostly_helper(MED_SIZE*10);
+    puts(RESULTS_MAY_VARY);
+}
+
+// SAVE AND LOAD ///////////////////////////////////////////////////////////////
+// Write `max_sz` doubles to a temporary file and read them back, element by
+// element through stdio and in one call with darray file functions.
+void save_and_load_helper(size_t max_sz)
+{
+    double* data = da_alloc(max_sz, sizeof(double));
+    for (size_t i = 0; i < max_sz; ++i)
+    {
+        data[i] = i;
+    }
+    FILE* file = tmpfile();
+    int fd = fileno(file);
+
+    begin = wall_clock();
+    for (size_t i = 0; i < max_sz; ++i)
+    {
+        fwrite(&data[i], sizeof(double), 1, file);
+    }
+    fflush(file);
+    end = wall_clock();
+    print_results("fwrite loop", max_sz, begin, end);
+
+    rewind(file);
+    double* loaded = da_alloc(max_sz, sizeof(double));
+    begin = wall_clock();
+    for (size_t i = 0; i < max_sz; ++i)
+    {
+        if (fread(&loaded[i], sizeof(double), 1, file) != 1)
+            break;
+    }
+    end = wall_clock();
+    da_free(loaded);
+    print_results("fread loop", max_sz, begin, end);
+
+    unsigned flags[] = {0, DA_FILE_CHECKSUM};
+    const char* write_labels[] = {"da_write_fd", "da_write_fd+hash"};
+    const char* read_labels[] = {"da_read_fd", "da_read_fd+hash"};
+    for (size_t f = 0; f < 2; ++f)
+    {
+        lseek(fd, 0, SEEK_SET);
+        begin = wall_clock();
+        da_write_fd(data, fd, flags[f]);
+        end = wall_clock();
+        print_results(write_labels[f], max_sz, begin, end);
+
+        lseek(fd, 0, SEEK_SET);
+        begin = wall_clock();
+        loaded = da_read_fd(fd);
+        end = wall_clock();
+        da_free(loaded);
+        print_results(read_labels[f], max_sz, begin, end);
+    }
+
+    fclose(file);
+    da_free(data);
+}
+
+// Save NUM_SAVED_DARRAYS darrays that hold `max_sz` doubles in total.
+void save_many_helper(size_t max_sz)
+{
+    void** darrs = da_alloc(NUM_SAVED_DARRAYS, sizeof(void*));
+    for (size_t i = 0; i < NUM_SAVED_DARRAYS; ++i)
+    {
+        darrs[i] = da_alloc(max_sz/NUM_SAVED_DARRAYS, sizeof(double));
+        memset(darrs[i], 0, max_sz/NUM_SAVED_DARRAYS*sizeof(double));
+    }
+    FILE* file = tmpfile();
+    int fd = fileno(file);
+
+    begin = wall_clock();
+    for (size_t i = 0; i < NUM_SAVED_DARRAYS; ++i)
+    {
+        da_write_fd(darrs[i], fd, 0);
+    }
+    end = wall_clock();
+    print_results("da_write_fd", max_sz, begin, end);
+
+    lseek(fd, 0, SEEK_SET);
+    begin = wall_clock();
+    da_write_many_fd(darrs, fd, 0);
+    end = wall_clock();
+    print_results("da_write_many_fd", max_sz, begin, end);
+
+    lseek(fd, 0, SEEK_SET);
+    begin = wall_clock();
+    void** loaded = da_read_many_fd(fd);
+    end = wall_clock();
+    print_results("da_read_many_fd", max_sz, begin, end);
+
+    for (size_t i = 0; i < NUM_SAVED_DARRAYS; ++i)
+    {
+        da_free(darrs[i]);
+        da_free(loaded[i]);
+    }
+    da_free(darrs);
+    da_free(loaded);
+    fclose(file);
+}
+
+void save_and_load(void)
+{
+    puts("SAVE A DARRAY OF DOUBLES TO A FILE AND LOAD IT BACK");
+    save_and_load_helper(MED_SIZE*10);
+    save_and_load_helper(LARGE_SIZE);
+    printf("SAVE %d DARRAYS OF DOUBLES TO ONE FILE\n", NUM_SAVED_DARRAYS);
+    save_many_helper(MED_SIZE*10);
+    save_many_helper(LARGE_SIZE/10);
+    puts(RESULTS_MAY_VARY);
+}
+
+// MAP STARTUP /////////////////////////////////////////////////////////////////
+#define MAP_STARTUP_PATH "perf_tests_darr.tmp"
+#define SAVED_STARTUP_PATH "perf_tests_darr_saved.tmp"
+
+// Start up from a saved lookup table of `max_sz` ints, either by reading the
+// whole table or by mapping it and touching only the entries that are used.
+void map_startup_helper(size_t max_sz)
+{
+    int* table = da_map_file(MAP_STARTUP_PATH, sizeof(int), DA_MAP_CREATE);
+    begin = wall_clock();
+    for (size_t i = 0; i < max_sz; ++i)
+    {
+        table = da_push(table, (int)i);
+    }
+    da_sync(table);
+    end = wall_clock();
+    print_results("da_push (mapped)", max_sz, begin, end);
+    da_unmap(table);
+
+    // The same table saved with da_write_fd has to be read in full.
+    table = da_map_file(MAP_STARTUP_PATH, sizeof(int), DA_MAP_READ_ONLY);
+    int fd = open(SAVED_STARTUP_PATH, O_RDWR | O_CREAT | O_TRUNC, 0600);
+    da_write_fd(table, fd, 0);
+    da_unmap(table);
+    long long sum = 0;
+    begin = wall_clock();
+    lseek(fd, 0, SEEK_SET);
+    table = da_read_fd(fd);
+    for (size_t i = 0; i < NUM_LOOKUPS; ++i)
+    {
+        sum += table[i*2654435761u % max_sz];
+    }
+    end = wall_clock();
+    da_free(table);
+    close(fd);
+    unlink(SAVED_STARTUP_PATH);
+    lookup_sink = sum;
+    print_results("da_read_fd", max_sz, begin, end);
+
+    sum = 0;
+    begin = wall_clock();
+    table = da_map_file(MAP_STARTUP_PATH, sizeof(int), DA_MAP_READ_ONLY);
+    for (size_t i = 0; i < NUM_LOOKUPS; ++i)
+    {
+        sum += table[i*2654435761u % max_sz];
+    }
+    end = wall_clock();
+    da_unmap(table);
+    lookup_sink = sum;
+    print_results("da_map_file", max_sz, begin, end);
+
+    begin = wall_clock();
+    table = da_map_file(MAP_STARTUP_PATH, sizeof(int), DA_MAP_READ_ONLY);
+    lookup_sink = da_sum_int(table);
+    end = wall_clock();
+    da_unmap(table);
+    print_results("da_map_file+scan", max_sz, begin, end);
+
+    unlink(MAP_STARTUP_PATH);
+}
+
+void map_startup(void)
+{
+    printf("LOAD A SAVED TABLE AND MAKE %d LOOKUPS\n", NUM_LOOKUPS);
+    map_startup_helper(MED_SIZE*10);
+    map_startup_helper(LARGE_SIZE);
+    puts(RESULTS_MAY_VARY);
+}
+
+// READ LINES //////////////////////////////////////////////////////////////////
+// Write a log of `max_sz` lines to a temporary file and read it back a line at
+// a time, through stdio into a buffer that is then copied to a dstring, and
+// straight into a dstring with dstr_read_line.
+void read_lines_helper(size_t max_sz)
+{
+    FILE* file = tmpfile();
+    int fd = fileno(file);
+    for (size_t i = 0; i < max_sz; ++i)
+    {
+        fprintf(file, "2026-10-18 12:00:00 INFO request %zu served in %zu "
+            "ms\n", i, i % 1000);
+    }
+    fflush(file);
+
+    char buffer[256];
+    darray(char) line = dstr_alloc_empty();
+    size_t total = 0;
+    rewind(file);
+    begin = wall_clock();
+    while (fgets(buffer, sizeof(buffer), file) != NULL)
+    {
+        line = dstr_reassign_from_cstr(line, buffer);
+        total += dstr_length(line);
+    }
+    end = wall_clock();
+    lookup_sink = total;
+    print_results("fgets+reassign", max_sz, begin, end);
+
+    struct da_reader reader;
+    total = 0;
+    lseek(fd, 0, SEEK_SET);
+    begin = wall_clock();
+    da_reader_init(&reader, fd);
+    while (dstr_read_line(&reader, &line))
+    {
+        total += dstr_length(line);
+    }
+    da_reader_free(&reader);
+    end = wall_clock();
+    lookup_sink = total;
+    print_results("dstr_read_line", max_sz, begin, end);
+
+    dstr_free(line);
+    fclose(file);
+}
+
+void read_lines(void)
+{
+    puts("READ A LOG FILE ONE LINE AT A TIME");
+    read_lines_helper(MED_SIZE);
+    read_lines_helper(MED_SIZE*10);
+    puts(RESULTS_MAY_VARY);
+}
+
+// COMPRESSED IDS //////////////////////////////////////////////////////////////
+int compare_uint64s(const void* a, const void* b)
+{
+    uint64_t lhs = *(const uint64_t*)a;
+    uint64_t rhs = *(const uint64_t*)b;
+    return (lhs > rhs) - (lhs < rhs);
+}
+
+// Store `max_sz` sorted IDs with gaps of up to 200 in a darray and in a
+// da_delta, then compare their size, scans, and lookups.
+void compressed_ids_helper(size_t max_sz)
+{
+    uint64_t* ids = da_alloc(0, sizeof(uint64_t));
+    struct da_delta delta;
+    da_delta_init(&delta);
+    uint64_t id = 0;
+    for (size_t i = 0; i < max_sz; ++i)
+    {
+        id += 1 + rand() % 200;
+        ids = da_push(ids, id);
+        da_delta_push(&delta, id);
+    }
+
+    uint64_t sum = 0;
+    begin = wall_clock();
+    for (size_t i = 0; i < max_sz; ++i)
+    {
+        sum += ids[i];
+    }
+    end = wall_clock();
+    lookup_sink = sum;
+    print_results("darray scan", max_sz, begin, end);
+
+    struct da_delta_iter iter;
+    uint64_t value;
+    sum = 0;
+    begin = wall_clock();
+    da_delta_iter_init(&iter, &delta, 0);
+    while (da_delta_iter_next(&iter, &value))
+    {
+        sum += value;
+    }
+    end = wall_clock();
+    lookup_sink = sum;
+    print_results("da_delta_iter", max_sz, begin, end);
+
+    const uint64_t* block;
+    size_t nblock;
+    sum = 0;
+    begin = wall_clock();
+    da_delta_iter_init(&iter, &delta, 0);
+    while ((nblock = da_delta_iter_next_block(&iter, &block)) != 0)
+    {
+        for (size_t i = 0; i < nblock; ++i)
+        {
+            sum += block[i];
+        }
+    }
+    end = wall_clock();
+    lookup_sink = sum;
+    print_results("da_delta blocks", max_sz, begin, end);
+    print_throughput("da_delta blocks", max_sz*sizeof(uint64_t), begin, end);
+
+    begin = wall_clock();
+    uint64_t* decoded = da_delta_decode(&delta);
+    end = wall_clock();
+    da_free(decoded);
+    print_results("da_delta_decode", max_sz, begin, end);
+    print_throughput("da_delta_decode", max_sz*sizeof(uint64_t), begin, end);
+
+    size_t nfound = 0;
+    begin = wall_clock();
+    for (size_t i = 0; i < NUM_LOOKUPS; ++i)
+    {
+        uint64_t key = (i*2654435761u) % (id + 1);
+        size_t index = da_lower_bound(ids, &key, compare_uint64s);
+        nfound += index < max_sz && ids[index] == key;
+    }
+    end = wall_clock();
+    lookup_sink = nfound;
+    print_results("da_lower_bound", NUM_LOOKUPS, begin, end);
+
+    nfound = 0;
+    begin = wall_clock();
+    for (size_t i = 0; i < NUM_LOOKUPS; ++i)
+    {
+        uint64_t key = (i*2654435761u) % (id + 1);
+        nfound += da_delta_lower_bound(&delta, key) != max_sz;
+    }
+    end = wall_clock();
+    lookup_sink = nfound;
+    print_results("da_delta lookup", NUM_LOOKUPS, begin, end);
+
+    print_memory("darray", DA_FOOTPRINT(ids));
+    print_memory("da_delta", da_delta_footprint(&delta));
+
+    da_delta_free(&delta);
+    da_free(ids);
+}
+
+void compressed_ids(void)
+{
+    puts("STORE, SCAN, AND LOOK UP SORTED 64 BIT IDS (COMPRESSED VS. PLAIN)");
+    compressed_ids_helper(MED_SIZE*10);
+    compressed_ids_helper(LARGE_SIZE/10);
+    puts(RESULTS_MAY_VARY);
+}
+
+// PACKED COLUMN ///////////////////////////////////////////////////////////////
+// Store a column of `max_sz` values of PACKED_COLUMN_BITS bits in a darray of
+// uint32_t and in a da_packed, then compare their size, random reads, and
+// unpacking. Finally store one value that needs twice the bits.
+void packed_column_helper(size_t max_sz)
+{
+    uint32_t* column = da_alloc(max_sz, sizeof(uint32_t));
+    struct da_packed packed;
+    da_packed_init(&packed, PACKED_COLUMN_BITS);
+    for (size_t i = 0; i < max_sz; ++i)
+    {
+        column[i] = rand() % (1 << PACKED_COLUMN_BITS);
+        da_packed_push(&packed, column[i]);
+    }
+
+    uint64_t sum = 0;
+    begin = wall_clock();
+    for (size_t i = 0; i < NUM_LOOKUPS; ++i)
+    {
+        sum += column[(i*2654435761u) % max_sz];
+    }
+    end = wall_clock();
+    lookup_sink = sum;
+    print_results("darray get", NUM_LOOKUPS, begin, end);
+
+    sum = 0;
+    begin = wall_clock();
+    for (size_t i = 0; i < NUM_LOOKUPS; ++i)
+    {
+        sum += da_packed_get(&packed, (i*2654435761u) % max_sz);
+    }
+    end = wall_clock();
+    lookup_sink = sum;
+    print_results("da_packed_get", NUM_LOOKUPS, begin, end);
+
+    begin = wall_clock();
+    uint64_t* unpacked = da_packed_unpack(&packed);
+    end = wall_clock();
+    print_results("da_packed_unpack", max_sz, begin, end);
+    print_throughput("da_packed_unpack", max_sz*sizeof(uint64_t), begin,
+        end);
+    da_free(unpacked);
+
+    print_memory("darray", DA_FOOTPRINT(column));
+    print_memory("da_packed", da_packed_footprint(&packed));
+
+    begin = wall_clock();
+    da_packed_set(&packed, 0, 1 << (2*PACKED_COLUMN_BITS - 1));
+    end = wall_clock();
+    print_results("da_packed widen", max_sz, begin, end);
+
+    da_packed_free(&packed);
+    da_free(column);
+}
+
+void packed_column(void)
+{
+    printf("STORE AND READ A COLUMN OF %d BIT VALUES (PACKED VS. UINT32_T)\n",
+        PACKED_COLUMN_BITS);
+    packed_column_helper(MED_SIZE*10);
+    packed_column_helper(LARGE_SIZE/10);
+    puts(RESULTS_MAY_VARY);
+}
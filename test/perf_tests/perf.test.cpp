@@ -1,6 +1,47 @@
 #include "perf.test.h"
 #include <vector>
+#include <deque>
 #include <algorithm>
+#include <iterator>
+#include <numeric>
+#include <type_traits>
+#include <cstddef>
+#include <new>
+#include <iomanip>
+#include <sstream>
+#include <string>
+#include <unordered_set>
+#include <memory>
+#include <fstream>
+
+// Count calls to the global operator new and the number of bytes currently
+// allocated through it so that allocation counts and memory use can be
+// reported. The size of each block is stored in front of it. The operators are
+// kept out of line so that GCC does not flag the offset block as a mismatched
+// allocation where they are inlined into the standard containers.
+static size_t num_allocations = 0;
+static size_t num_live_bytes = 0;
+
+__attribute__((noinline)) void* operator new(size_t size)
+{
+    ++num_allocations;
+    std::max_align_t* block =
+        (std::max_align_t*)malloc(sizeof(std::max_align_t) + size);
+    if (block == NULL)
+        throw std::bad_alloc();
+    *(size_t*)block = size;
+    num_live_bytes += size;
+    return block + 1;
+}
+
+__attribute__((noinline)) void operator delete(void* ptr) noexcept
+{
+    if (ptr == NULL)
+        return;
+    std::max_align_t* block = (std::max_align_t*)ptr - 1;
+    num_live_bytes -= *(size_t*)block;
+    free(block);
+}
 
 // FILL ////////////////////////////////////////////////////////////////////////
 void fill_pre_sized_helper(size_t max_sz)
@@ -189,3 +230,1003 @@ void swap_rand(void)
     swap_rand_helper(nelem, MED_SIZE);
     swap_rand_helper(nelem, LARGE_SIZE);
 }
+
+// NUMBER TO STRING ////////////////////////////////////////////////////////////
+void number_to_string_helper(size_t max_sz)
+{
+    std::vector<int> ints(max_sz);
+    std::vector<double> dbls(max_sz);
+    for (size_t i = 0; i < max_sz; ++i)
+    {
+        ints[i] = rand() - RAND_MAX/2;
+        dbls[i] = (double)rand() / (rand() + 1);
+    }
+    std::string str;
+
+    begin = clock();
+    for (size_t i = 0; i < max_sz; ++i)
+    {
+        str = std::to_string(ints[i]);
+    }
+    end = clock();
+    print_results("std::to_string", max_sz, begin, end);
+
+    std::ostringstream oss;
+    oss << std::setprecision(17);
+    begin = clock();
+    for (size_t i = 0; i < max_sz; ++i)
+    {
+        oss.str("");
+        oss << dbls[i];
+    }
+    end = clock();
+    print_results("std::ostringstream", max_sz, begin, end);
+}
+
+void number_to_string(void)
+{
+    puts("CONVERT NUMBERS TO STRINGS");
+    number_to_string_helper(SMALL_SIZE);
+    number_to_string_helper(MED_SIZE);
+    number_to_string_helper(LARGE_SIZE/10);
+}
+
+// STRING TO NUMBER ////////////////////////////////////////////////////////////
+void string_to_number_helper(size_t max_sz)
+{
+    std::vector<std::string> ints(max_sz);
+    std::vector<std::string> dbls(max_sz);
+    std::ostringstream oss;
+    oss << std::setprecision(17);
+    for (size_t i = 0; i < max_sz; ++i)
+    {
+        ints[i] = std::to_string(rand() - RAND_MAX/2);
+        oss.str("");
+        oss << (double)rand() / (rand() + 1);
+        dbls[i] = oss.str();
+    }
+
+    begin = clock();
+    for (size_t i = 0; i < max_sz; ++i)
+    {
+        std::stoll(ints[i]);
+    }
+    end = clock();
+    print_results("std::stoll", max_sz, begin, end);
+
+    begin = clock();
+    for (size_t i = 0; i < max_sz; ++i)
+    {
+        std::stod(dbls[i]);
+    }
+    end = clock();
+    print_results("std::stod", max_sz, begin, end);
+}
+
+void string_to_number(void)
+{
+    puts("PARSE NUMBERS FROM STRINGS");
+    string_to_number_helper(SMALL_SIZE);
+    string_to_number_helper(MED_SIZE);
+    string_to_number_helper(LARGE_SIZE/10);
+}
+
+// SHORT KEYS //////////////////////////////////////////////////////////////////
+void short_keys_helper(size_t max_sz)
+{
+    std::vector<char> text(max_sz*NUM_SLOT_SIZE);
+    for (size_t i = 0; i < max_sz; ++i)
+    {
+        snprintf(&text[i*NUM_SLOT_SIZE], NUM_SLOT_SIZE, KEY_FORMAT,
+            rand() % (int)max_sz);
+    }
+    std::vector<std::string> strs;
+    strs.reserve(max_sz);
+    size_t nequal;
+
+    size_t nallocs = num_allocations;
+    begin = clock();
+    for (size_t i = 0; i < max_sz; ++i)
+    {
+        strs.emplace_back(&text[i*NUM_SLOT_SIZE]);
+    }
+    nequal = 0;
+    for (size_t i = 1; i < max_sz; ++i)
+    {
+        nequal += strs[i-1] == strs[i];
+    }
+    strs.clear();
+    end = clock();
+    nallocs = num_allocations - nallocs;
+    print_results("std::string", max_sz, begin, end);
+    print_allocations("std::string", nallocs);
+}
+
+void short_keys(void)
+{
+    puts("BUILD, COMPARE, AND FREE SHORT KEYS");
+    short_keys_helper(MED_SIZE);
+    short_keys_helper(LARGE_SIZE/10);
+}
+
+// INTERN KEYS /////////////////////////////////////////////////////////////////
+void intern_keys_helper(size_t max_sz)
+{
+    std::vector<char> text(max_sz*NUM_SLOT_SIZE);
+    for (size_t i = 0; i < max_sz; ++i)
+    {
+        snprintf(&text[i*NUM_SLOT_SIZE], NUM_SLOT_SIZE, INTERN_KEY_FORMAT,
+            rand() % INTERN_DISTINCT_KEYS);
+    }
+    size_t nequal;
+    size_t string_bytes;
+    size_t intern_bytes;
+    size_t live_bytes;
+
+    live_bytes = num_live_bytes;
+    {
+        std::vector<std::string> strs;
+        strs.reserve(max_sz);
+        begin = clock();
+        for (size_t i = 0; i < max_sz; ++i)
+        {
+            strs.emplace_back(&text[i*NUM_SLOT_SIZE]);
+        }
+        nequal = 0;
+        for (size_t i = 1; i < max_sz; ++i)
+        {
+            nequal += strs[i-1] == strs[i];
+        }
+        end = clock();
+        string_bytes = num_live_bytes - live_bytes;
+    }
+    print_results("std::string", max_sz, begin, end);
+
+    live_bytes = num_live_bytes;
+    {
+        std::unordered_set<std::string> pool;
+        std::vector<const std::string*> interned;
+        interned.reserve(max_sz);
+        begin = clock();
+        for (size_t i = 0; i < max_sz; ++i)
+        {
+            interned.push_back(&*pool.emplace(&text[i*NUM_SLOT_SIZE]).first);
+        }
+        nequal = 0;
+        for (size_t i = 1; i < max_sz; ++i)
+        {
+            nequal += interned[i-1] == interned[i];
+        }
+        end = clock();
+        intern_bytes = num_live_bytes - live_bytes;
+    }
+    print_results("std::unordered_set", max_sz, begin, end);
+
+    print_memory("std::string", string_bytes);
+    print_memory("std::unordered_set", intern_bytes);
+    print_memory("saved", string_bytes - intern_bytes);
+}
+
+void intern_keys(void)
+{
+    puts("BUILD AND COMPARE REPETITIVE KEYS (INTERNED VS. ONE ALLOCATION PER KEY)");
+    intern_keys_helper(MED_SIZE);
+    intern_keys_helper(LARGE_SIZE/100);
+}
+
+// JOIN FRAGMENTS //////////////////////////////////////////////////////////////
+void join_fragments_helper(size_t max_sz)
+{
+    std::vector<std::string> fragments(FRAGMENTS_PER_RESPONSE);
+    char buf[NUM_SLOT_SIZE];
+    for (size_t i = 0; i < FRAGMENTS_PER_RESPONSE; ++i)
+    {
+        snprintf(buf, NUM_SLOT_SIZE, "<td>%d</td>", rand() % 100000);
+        fragments[i] = buf;
+    }
+    size_t total_len;
+
+    total_len = 0;
+    begin = clock();
+    for (size_t i = 0; i < max_sz; ++i)
+    {
+        std::string str;
+        for (size_t f = 0; f < FRAGMENTS_PER_RESPONSE; ++f)
+        {
+            str += fragments[f];
+        }
+        total_len += str.size();
+    }
+    end = clock();
+    print_results("std::string +=", max_sz, begin, end);
+
+    total_len = 0;
+    begin = clock();
+    for (size_t i = 0; i < max_sz; ++i)
+    {
+        size_t len = 0;
+        for (size_t f = 0; f < FRAGMENTS_PER_RESPONSE; ++f)
+        {
+            len += fragments[f].size();
+        }
+        std::string str;
+        str.reserve(len);
+        for (size_t f = 0; f < FRAGMENTS_PER_RESPONSE; ++f)
+        {
+            str += fragments[f];
+        }
+        total_len += str.size();
+    }
+    end = clock();
+    print_results("std::string (reserve)", max_sz, begin, end);
+}
+
+void join_fragments(void)
+{
+    printf("JOIN %d FRAGMENTS PER RESPONSE\n", FRAGMENTS_PER_RESPONSE);
+    join_fragments_helper(MED_SIZE/10);
+    join_fragments_helper(MED_SIZE);
+}
+
+// UTF-8 VALIDATE //////////////////////////////////////////////////////////////
+// Typical byte at a time validation loop.
+static bool utf8_valid(const std::string& str)
+{
+    const unsigned char* s = (const unsigned char*)str.data();
+    size_t len = str.size();
+    size_t i = 0;
+    while (i < len)
+    {
+        unsigned char c = s[i];
+        size_t ncont;
+        unsigned char lo = 0x80, hi = 0xBF;
+        if (c < 0x80) { i += 1; continue; }
+        else if (c >= 0xC2 && c <= 0xDF) ncont = 1;
+        else if (c >= 0xE0 && c <= 0xEF) ncont = 2;
+        else if (c >= 0xF0 && c <= 0xF4) ncont = 3;
+        else return false;
+        if (c == 0xE0) lo = 0xA0;
+        else if (c == 0xED) hi = 0x9F;
+        else if (c == 0xF0) lo = 0x90;
+        else if (c == 0xF4) hi = 0x8F;
+        if (len-i-1 < ncont || s[i+1] < lo || s[i+1] > hi)
+            return false;
+        for (size_t k = 2; k <= ncont; ++k)
+        {
+            if ((s[i+k] & 0xC0) != 0x80)
+                return false;
+        }
+        i += ncont + 1;
+    }
+    return true;
+}
+
+void utf8_validate_helper(size_t max_sz)
+{
+    std::string str;
+    while (str.size() < max_sz)
+    {
+        str += utf8_text_pieces[rand() % NUM_UTF8_TEXT_PIECES];
+    }
+    size_t nbytes = UTF8_VALIDATION_PASSES*str.size();
+    size_t nvalid;
+
+    nvalid = 0;
+    begin = clock();
+    for (size_t i = 0; i < UTF8_VALIDATION_PASSES; ++i)
+    {
+        nvalid += utf8_valid(str);
+    }
+    end = clock();
+    if (nvalid != UTF8_VALIDATION_PASSES)
+        exit(EXIT_FAILURE);
+    print_results("scalar loop", nbytes, begin, end);
+}
+
+void utf8_validate(void)
+{
+    printf("VALIDATE UTF-8 (%d PASSES, ELEMENTS ARE BYTES)\n",
+        UTF8_VALIDATION_PASSES);
+    utf8_validate_helper(MED_SIZE*10);
+    utf8_validate_helper(LARGE_SIZE/10);
+}
+
+// SORT INTS ///////////////////////////////////////////////////////////////////
+void sort_ints_helper(size_t max_sz)
+{
+    std::vector<int> data(max_sz);
+    for (size_t i = 0; i < max_sz; ++i)
+    {
+        data[i] = rand() - RAND_MAX/2;
+    }
+    std::vector<int> vec;
+
+    vec = data;
+    begin = clock();
+    std::sort(vec.begin(), vec.end());
+    end = clock();
+    print_results("std::sort", max_sz, begin, end);
+
+    vec = data;
+    begin = clock();
+    std::stable_sort(vec.begin(), vec.end());
+    end = clock();
+    print_results("std::stable_sort", max_sz, begin, end);
+}
+
+void sort_ints(void)
+{
+    puts("SORT RANDOM INTS");
+    sort_ints_helper(MED_SIZE);
+    sort_ints_helper(LARGE_SIZE/10);
+}
+
+// SORT RECORDS ////////////////////////////////////////////////////////////////
+void sort_records_helper(size_t max_sz)
+{
+    std::vector<sort_record> data(max_sz);
+    for (size_t i = 0; i < max_sz; ++i)
+    {
+        data[i] = sort_record{(unsigned)rand(), (unsigned)i, (double)rand()};
+    }
+    auto by_key = [](const sort_record& a, const sort_record& b)
+    {
+        return a.key < b.key;
+    };
+    std::vector<sort_record> vec;
+
+    vec = data;
+    begin = clock();
+    std::sort(vec.begin(), vec.end(), by_key);
+    end = clock();
+    print_results("std::sort", max_sz, begin, end);
+
+    vec = data;
+    begin = clock();
+    std::stable_sort(vec.begin(), vec.end(), by_key);
+    end = clock();
+    print_results("std::stable_sort", max_sz, begin, end);
+}
+
+void sort_records(void)
+{
+    printf("SORT RANDOM %zu BYTE RECORDS BY KEY\n", sizeof(sort_record));
+    sort_records_helper(MED_SIZE);
+    sort_records_helper(LARGE_SIZE/10);
+}
+
+// SORT PARALLEL ///////////////////////////////////////////////////////////////
+void sort_parallel_helper(size_t max_sz)
+{
+    std::vector<int> vec(max_sz);
+    for (size_t i = 0; i < max_sz; ++i)
+    {
+        vec[i] = rand() - RAND_MAX/2;
+    }
+
+    begin = wall_clock();
+    std::sort(vec.begin(), vec.end());
+    end = wall_clock();
+    print_results("std::sort", max_sz, begin, end);
+}
+
+void sort_parallel(void)
+{
+    puts("SORT RANDOM INTS (SINGLE THREADED REFERENCE)");
+    sort_parallel_helper(LARGE_SIZE/10);
+    sort_parallel_helper(LARGE_SIZE);
+}
+
+// SORTED LOOKUP ///////////////////////////////////////////////////////////////
+void sorted_lookup_helper(size_t max_sz)
+{
+    std::vector<int> vec(max_sz);
+    for (size_t i = 0; i < max_sz; ++i)
+    {
+        vec[i] = 2*i;
+    }
+    std::vector<int> keys(NUM_LOOKUPS);
+    for (size_t i = 0; i < NUM_LOOKUPS; ++i)
+    {
+        keys[i] = rand() % (2*max_sz);
+    }
+
+    size_t nfound = 0;
+    begin = clock();
+    for (size_t i = 0; i < NUM_LOOKUPS; ++i)
+    {
+        auto it = std::lower_bound(vec.begin(), vec.end(), keys[i]);
+        nfound += it != vec.end() && *it == keys[i];
+    }
+    end = clock();
+    if (nfound > NUM_LOOKUPS)
+        exit(EXIT_FAILURE);
+    print_results("std::lower_bound", NUM_LOOKUPS, begin, end);
+}
+
+void sorted_lookup(void)
+{
+    printf("LOOK UP %d RANDOM KEYS IN A SORTED ARRAY\n", NUM_LOOKUPS);
+    sorted_lookup_helper(MED_SIZE);
+    sorted_lookup_helper(LARGE_SIZE/10);
+}
+
+// SORTED INTERSECT ////////////////////////////////////////////////////////////
+void sorted_intersect_helper(size_t len_a, size_t len_b)
+{
+    std::vector<int> a(len_a);
+    std::vector<int> b(len_b);
+    for (size_t i = 0, key = 0; i < len_a; ++i)
+    {
+        key += 1 + rand() % (len_a < len_b ? 2*len_b/len_a : 2);
+        a[i] = key;
+    }
+    for (size_t i = 0, key = 0; i < len_b; ++i)
+    {
+        key += 1 + rand() % (len_b < len_a ? 2*len_a/len_b : 2);
+        b[i] = key;
+    }
+    std::vector<int> result;
+    result.reserve(len_a < len_b ? len_a : len_b);
+
+    begin = clock();
+    std::set_intersection(a.begin(), a.end(), b.begin(), b.end(),
+        std::back_inserter(result));
+    end = clock();
+    printf("%*s%zu x %zu elements, %zu in common\n", INDENT_SPACES, "",
+        len_a, len_b, result.size());
+    print_results("std::set_intersection", len_a + len_b, begin, end);
+}
+
+void sorted_intersect(void)
+{
+    puts("INTERSECT SORTED INT ARRAYS");
+    sorted_intersect_helper(LARGE_SIZE/10, LARGE_SIZE/10);
+    sorted_intersect_helper(SMALL_SIZE*10, LARGE_SIZE/10);
+}
+
+// FILL PARALLEL ///////////////////////////////////////////////////////////////
+void fill_parallel_helper(size_t max_sz)
+{
+    std::vector<int> vec(max_sz);
+    begin = wall_clock();
+    for (size_t i = 0; i < max_sz; ++i)
+    {
+        vec[i] = heavy_value(i);
+    }
+    end = wall_clock();
+    print_results(VECTOR, max_sz, begin, end);
+}
+
+void fill_parallel(void)
+{
+    puts("FILL A PRE-SIZED VECTOR (SINGLE THREADED REFERENCE)");
+    fill_parallel_helper(MED_SIZE*10);
+    fill_parallel_helper(LARGE_SIZE/10);
+}
+
+// FIND ////////////////////////////////////////////////////////////////////////
+void find_helper(size_t max_sz)
+{
+    std::vector<int> vec(max_sz);
+    for (size_t i = 0; i < max_sz; ++i)
+    {
+        vec[i] = 2*i;
+    }
+    std::vector<int> keys(NUM_LOOKUPS);
+    for (size_t i = 0; i < NUM_LOOKUPS; ++i)
+    {
+        keys[i] = rand() % (4*max_sz);
+    }
+    printf("%*s%zu element vector\n", INDENT_SPACES, "", max_sz);
+
+    size_t nfound = 0;
+    begin = clock();
+    for (size_t i = 0; i < NUM_LOOKUPS; ++i)
+    {
+        nfound += std::find(vec.begin(), vec.end(), keys[i]) != vec.end();
+    }
+    end = clock();
+    if (nfound > NUM_LOOKUPS)
+        exit(EXIT_FAILURE);
+    print_results("std::find", NUM_LOOKUPS, begin, end);
+}
+
+void find(void)
+{
+    printf("CHECK %d RANDOM KEYS FOR MEMBERSHIP IN AN UNSORTED VECTOR\n",
+        NUM_LOOKUPS);
+    find_helper(SMALL_SIZE/5);
+    find_helper(SMALL_SIZE*10);
+}
+
+// REDUCTIONS //////////////////////////////////////////////////////////////////
+volatile double reduce_sink;
+
+template<typename T>
+void reduce_helper(const char* type, size_t max_sz, size_t passes,
+    T (*value)(size_t))
+{
+    std::vector<T> src(max_sz);
+    for (size_t i = 0; i < max_sz; ++i)
+    {
+        src[i] = value(i);
+    }
+    std::vector<T> vec = src;
+    printf("%*s%s, %zu passes\n", INDENT_SPACES, "", type, passes);
+
+    begin = wall_clock();
+    for (size_t pass = 0; pass < passes; ++pass)
+    {
+        reduce_sink = std::accumulate(vec.begin(), vec.end(),
+            (typename std::conditional<std::is_integral<T>::value,
+                long long, double>::type)0);
+    }
+    end = wall_clock();
+    print_results("std::accumulate", max_sz, begin, end);
+
+    begin = wall_clock();
+    for (size_t pass = 0; pass < passes; ++pass)
+    {
+        auto minmax = std::minmax_element(vec.begin(), vec.end());
+        reduce_sink = *minmax.second - *minmax.first;
+    }
+    end = wall_clock();
+    print_results("std::minmax_element", max_sz, begin, end);
+
+    begin = wall_clock();
+    for (size_t pass = 0; pass < passes; ++pass)
+    {
+        reduce_sink = std::max_element(vec.begin(), vec.end()) - vec.begin();
+    }
+    end = wall_clock();
+    print_results("std::max_element", max_sz, begin, end);
+
+    clock_t elapsed = 0;
+    for (size_t pass = 0; pass < passes; ++pass)
+    {
+        vec = src;
+        begin = wall_clock();
+        std::partial_sum(vec.begin(), vec.end(), vec.begin());
+        end = wall_clock();
+        elapsed += end - begin;
+    }
+    print_results("std::partial_sum", max_sz, 0, elapsed);
+}
+
+int random_int(size_t)
+{
+    return rand() - RAND_MAX/2;
+}
+
+double random_double(size_t)
+{
+    return (double)rand() / RAND_MAX;
+}
+
+void reduce(void)
+{
+    puts("REDUCE AND SCAN NUMERIC VECTORS");
+    reduce_helper<int>("int", MED_SIZE*10, 100, random_int);
+    reduce_helper<int>("int", LARGE_SIZE, 1, random_int);
+    reduce_helper<double>("double", MED_SIZE*10, 100, random_double);
+    reduce_helper<double>("double", LARGE_SIZE, 1, random_double);
+}
+
+// STRUCTURE OF ARRAYS /////////////////////////////////////////////////////////
+volatile double scan_sink;
+
+struct particles
+{
+    std::vector<double> x, y, z;
+    std::vector<double> vx, vy, vz;
+    std::vector<float> mass;
+    std::vector<int> id;
+};
+
+void scan_field_helper(size_t max_sz, size_t passes)
+{
+    std::vector<particle> aos;
+    particles soa;
+    for (size_t i = 0; i < max_sz; ++i)
+    {
+        particle p = {
+            (double)i, (double)i, (double)i, 1, 1, 1,
+            (float)rand() / RAND_MAX, (int)i
+        };
+        aos.push_back(p);
+        soa.x.push_back(p.x);
+        soa.y.push_back(p.y);
+        soa.z.push_back(p.z);
+        soa.vx.push_back(p.vx);
+        soa.vy.push_back(p.vy);
+        soa.vz.push_back(p.vz);
+        soa.mass.push_back(p.mass);
+        soa.id.push_back(p.id);
+    }
+    printf("%*s%zu particles, %zu passes\n", INDENT_SPACES, "", max_sz, passes);
+
+    begin = clock();
+    for (size_t pass = 0; pass < passes; ++pass)
+    {
+        double sum = 0;
+        for (const particle& p : aos)
+        {
+            sum += p.mass;
+        }
+        scan_sink = sum;
+    }
+    end = clock();
+    print_results("AoS range-for", max_sz, begin, end);
+
+    begin = clock();
+    for (size_t pass = 0; pass < passes; ++pass)
+    {
+        scan_sink = std::accumulate(soa.mass.begin(), soa.mass.end(), 0.0);
+    }
+    end = clock();
+    print_results("SoA std::accumulate", max_sz, begin, end);
+}
+
+void scan_field(void)
+{
+    puts("SUM ONE FIELD OF A VECTOR OF STRUCTS AND A STRUCT OF VECTORS");
+    scan_field_helper(MED_SIZE, 1000);
+    scan_field_helper(MED_SIZE*10, 100);
+}
+
+// SEGMENTED CONTAINERS ////////////////////////////////////////////////////////
+void fill_segmented_helper(size_t max_sz)
+{
+    std::vector<int> vec;
+    begin = clock();
+    for (size_t i = 0; i < max_sz; ++i)
+    {
+        vec.push_back((int)i);
+    }
+    end = clock();
+    print_results(VECTOR, max_sz, begin, end);
+
+    std::deque<int> deq;
+    begin = clock();
+    for (size_t i = 0; i < max_sz; ++i)
+    {
+        deq.push_back((int)i);
+    }
+    end = clock();
+    print_results("std::deque", max_sz, begin, end);
+}
+
+void fill_segmented(void)
+{
+    puts("FILLING A VECTOR AND A DEQUE VIA PUSH BACK");
+    fill_segmented_helper(MED_SIZE);
+    fill_segmented_helper(LARGE_SIZE);
+}
+
+// SNAPSHOT ////////////////////////////////////////////////////////////////////
+volatile double snapshot_sink;
+
+// Take NUM_SNAPSHOTS snapshots of a vector of statistics, exporting each one
+// by summing it, and update one statistic after every export.
+void snapshot_helper(size_t max_sz)
+{
+    std::vector<double> stats(max_sz);
+    for (size_t i = 0; i < max_sz; ++i)
+    {
+        stats[i] = i;
+    }
+
+    begin = clock();
+    for (size_t n = 0; n < NUM_SNAPSHOTS; ++n)
+    {
+        std::vector<double> snap = stats;
+        snapshot_sink = std::accumulate(snap.begin(), snap.end(), 0.0);
+        stats[n % max_sz] += 1;
+    }
+    end = clock();
+    print_results("vector copy", max_sz, begin, end);
+
+    // Copy-on-write through std::shared_ptr.
+    std::shared_ptr<std::vector<double>> shared =
+        std::make_shared<std::vector<double>>(stats);
+    begin = clock();
+    for (size_t n = 0; n < NUM_SNAPSHOTS; ++n)
+    {
+        std::shared_ptr<const std::vector<double>> snap = shared;
+        snapshot_sink = std::accumulate(snap->begin(), snap->end(), 0.0);
+        snap.reset();
+        if (shared.use_count() > 1)
+            shared = std::make_shared<std::vector<double>>(*shared);
+        (*shared)[n % max_sz] += 1;
+    }
+    end = clock();
+    print_results("shared_ptr", max_sz, begin, end);
+}
+
+void snapshot(void)
+{
+    printf("TAKE %d SNAPSHOTS OF A VECTOR\n", NUM_SNAPSHOTS);
+    snapshot_helper(MED_SIZE);
+    snapshot_helper(MED_SIZE*10);
+}
+
+// COLLECT PARALLEL ////////////////////////////////////////////////////////////
+void collect_parallel_helper(size_t max_sz)
+{
+    std::vector<int> vec;
+    vec.reserve(max_sz);
+    begin = wall_clock();
+    for (size_t i = 0; i < max_sz; ++i)
+    {
+        vec.push_back((int)i);
+    }
+    end = wall_clock();
+    print_results(VECTOR, max_sz, begin, end);
+}
+
+void collect_parallel(void)
+{
+    puts("COLLECT RESULTS INTO ONE VECTOR (SINGLE THREADED REFERENCE)");
+    collect_parallel_helper(MED_SIZE*10);
+    collect_parallel_helper(LARGE_SIZE/10);
+}
+
+// RING QUEUE //////////////////////////////////////////////////////////////////
+volatile long long ring_sink;
+
+// Pass ints through a deque in batches of RING_CAPACITY.
+void ring_throughput_helper(size_t max_sz)
+{
+    std::deque<int> queue;
+    long long sum = 0;
+    begin = wall_clock();
+    for (size_t i = 0; i < max_sz; i += RING_CAPACITY)
+    {
+        size_t n = max_sz - i < RING_CAPACITY ? max_sz - i : RING_CAPACITY;
+        for (size_t k = 0; k < n; ++k)
+        {
+            queue.push_back((int)(i + k));
+        }
+        for (size_t k = 0; k < n; ++k)
+        {
+            sum += queue.front();
+            queue.pop_front();
+        }
+    }
+    end = wall_clock();
+    ring_sink = sum;
+    print_results("std::deque", max_sz, begin, end);
+}
+
+void ring_queue(void)
+{
+    puts("PASS INTS THROUGH A DEQUE (SINGLE THREADED REFERENCE)");
+    ring_throughput_helper(MED_SIZE*10);
+    ring_throughput_helper(LARGE_SIZE/10);
+}
+
+// READ MOSTLY /////////////////////////////////////////////////////////////////
+volatile long long lookup_sink;
+
+// Interleave the lookups with appending another `max_sz` ints to the table.
+void read_mostly_helper(size_t max_sz)
+{
+    std::vector<int> table(max_sz);
+    for (size_t i = 0; i < max_sz; ++i)
+    {
+        table[i] = (int)i;
+    }
+    long long sum = 0;
+    size_t lookups_per_push = NUM_LOOKUPS/max_sz;
+    begin = wall_clock();
+    for (size_t i = 0; i < NUM_LOOKUPS; ++i)
+    {
+        sum += table[i*2654435761u % table.size()];
+        if (i % lookups_per_push == 0 && table.size() < 2*max_sz)
+            table.push_back((int)i);
+    }
+    end = wall_clock();
+    lookup_sink = sum;
+    print_results(VECTOR, max_sz, begin, end);
+}
+
+void read_mostly(void)
+{
+    printf("%d LOOKUPS WHILE APPENDING (SINGLE THREADED REFERENCE)\n",
+        NUM_LOOKUPS);
+    read_mostly_helper(MED_SIZE);
+    read_mostly_helper(MED_SIZE*10);
+}
+
+// SAVE AND LOAD ///////////////////////////////////////////////////////////////
+#define SAVE_AND_LOAD_PATH "perf_tests_vector.tmp"
+
+// Write `max_sz` doubles to a file with one call and read them back.
+void save_and_load_helper(size_t max_sz)
+{
+    std::vector<double> data(max_sz);
+    for (size_t i = 0; i < max_sz; ++i)
+    {
+        data[i] = i;
+    }
+
+    begin = wall_clock();
+    {
+        std::ofstream out(SAVE_AND_LOAD_PATH, std::ios::binary);
+        out.write((const char*)data.data(), max_sz*sizeof(double));
+    }
+    end = wall_clock();
+    print_results("std::ofstream", max_sz, begin, end);
+
+    begin = wall_clock();
+    {
+        std::ifstream in(SAVE_AND_LOAD_PATH, std::ios::binary);
+        std::vector<double> loaded(max_sz);
+        in.read((char*)loaded.data(), max_sz*sizeof(double));
+    }
+    end = wall_clock();
+    print_results("std::ifstream", max_sz, begin, end);
+
+    std::remove(SAVE_AND_LOAD_PATH);
+}
+
+void save_and_load(void)
+{
+    puts("SAVE A VECTOR OF DOUBLES TO A FILE AND LOAD IT BACK");
+    save_and_load_helper(MED_SIZE*10);
+    save_and_load_helper(LARGE_SIZE);
+}
+
+// MAP STARTUP /////////////////////////////////////////////////////////////////
+// Read a saved table of `max_sz` ints in full and make NUM_LOOKUPS lookups.
+void map_startup_helper(size_t max_sz)
+{
+    std::vector<int> table(max_sz);
+    for (size_t i = 0; i < max_sz; ++i)
+    {
+        table[i] = (int)i;
+    }
+    {
+        std::ofstream out(SAVE_AND_LOAD_PATH, std::ios::binary);
+        out.write((const char*)table.data(), max_sz*sizeof(int));
+    }
+
+    long long sum = 0;
+    begin = wall_clock();
+    {
+        std::ifstream in(SAVE_AND_LOAD_PATH, std::ios::binary);
+        std::vector<int> loaded(max_sz);
+        in.read((char*)loaded.data(), max_sz*sizeof(int));
+        for (size_t i = 0; i < NUM_LOOKUPS; ++i)
+        {
+            sum += loaded[i*2654435761u % max_sz];
+        }
+    }
+    end = wall_clock();
+    lookup_sink = sum;
+    print_results("std::ifstream", max_sz, begin, end);
+
+    std::remove(SAVE_AND_LOAD_PATH);
+}
+
+void map_startup(void)
+{
+    printf("LOAD A SAVED TABLE AND MAKE %d LOOKUPS\n", NUM_LOOKUPS);
+    map_startup_helper(MED_SIZE*10);
+    map_startup_helper(LARGE_SIZE);
+}
+
+// READ LINES //////////////////////////////////////////////////////////////////
+// Write a log of `max_sz` lines to a file and read it back with std::getline.
+void read_lines_helper(size_t max_sz)
+{
+    {
+        std::ofstream out(SAVE_AND_LOAD_PATH);
+        for (size_t i = 0; i < max_sz; ++i)
+        {
+            out << "2026-10-18 12:00:00 INFO request " << i << " served in "
+                << i % 1000 << " ms\n";
+        }
+    }
+
+    size_t total = 0;
+    begin = wall_clock();
+    {
+        std::ifstream in(SAVE_AND_LOAD_PATH);
+        std::string line;
+        while (std::getline(in, line))
+        {
+            total += line.size();
+        }
+    }
+    end = wall_clock();
+    lookup_sink = total;
+    print_results("std::getline", max_sz, begin, end);
+
+    std::remove(SAVE_AND_LOAD_PATH);
+}
+
+void read_lines(void)
+{
+    puts("READ A LOG FILE ONE LINE AT A TIME");
+    read_lines_helper(MED_SIZE);
+    read_lines_helper(MED_SIZE*10);
+}
+
+// COMPRESSED IDS //////////////////////////////////////////////////////////////
+// Store `max_sz` sorted IDs with gaps of up to 200 in a vector, then scan them
+// and look them up.
+void compressed_ids_helper(size_t max_sz)
+{
+    std::vector<uint64_t> ids;
+    uint64_t id = 0;
+    for (size_t i = 0; i < max_sz; ++i)
+    {
+        id += 1 + rand() % 200;
+        ids.push_back(id);
+    }
+
+    uint64_t sum = 0;
+    begin = wall_clock();
+    for (size_t i = 0; i < max_sz; ++i)
+    {
+        sum += ids[i];
+    }
+    end = wall_clock();
+    lookup_sink = sum;
+    print_results("vector scan", max_sz, begin, end);
+
+    size_t nfound = 0;
+    begin = wall_clock();
+    for (size_t i = 0; i < NUM_LOOKUPS; ++i)
+    {
+        uint64_t key = (i*2654435761u) % (id + 1);
+        auto it = std::lower_bound(ids.begin(), ids.end(), key);
+        nfound += it != ids.end() && *it == key;
+    }
+    end = wall_clock();
+    lookup_sink = nfound;
+    print_results("std::lower_bound", NUM_LOOKUPS, begin, end);
+
+    print_memory("std::vector", sizeof(ids) + ids.capacity()*sizeof(uint64_t));
+}
+
+void compressed_ids(void)
+{
+    puts("STORE, SCAN, AND LOOK UP SORTED 64 BIT IDS");
+    compressed_ids_helper(MED_SIZE*10);
+    compressed_ids_helper(LARGE_SIZE/10);
+}
+
+// PACKED COLUMN ///////////////////////////////////////////////////////////////
+// Store a column of `max_sz` values of PACKED_COLUMN_BITS bits in a vector of
+// uint32_t and read it at random.
+void packed_column_helper(size_t max_sz)
+{
+    std::vector<uint32_t> column(max_sz);
+    for (size_t i = 0; i < max_sz; ++i)
+    {
+        column[i] = rand() % (1 << PACKED_COLUMN_BITS);
+    }
+
+    uint64_t sum = 0;
+    begin = wall_clock();
+    for (size_t i = 0; i < NUM_LOOKUPS; ++i)
+    {
+        sum += column[(i*2654435761u) % max_sz];
+    }
+    end = wall_clock();
+    lookup_sink = sum;
+    print_results("vector get", NUM_LOOKUPS, begin, end);
+
+    print_memory("std::vector",
+        sizeof(column) + column.capacity()*sizeof(uint32_t));
+}
+
+void packed_column(void)
+{
+    printf("STORE AND READ A COLUMN OF %d BIT VALUES\n", PACKED_COLUMN_BITS);
+    packed_column_helper(MED_SIZE*10);
+    packed_column_helper(LARGE_SIZE/10);
+}
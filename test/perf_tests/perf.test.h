@@ -15,6 +15,41 @@
 #define SMALL_SIZE 100
 #define MED_SIZE   100000
 #define LARGE_SIZE 100000000
+#define NUM_SLOT_SIZE 32
+#define KEY_FORMAT "user:%08d"
+#define INTERN_KEY_FORMAT "/api/v1/resource/%06d"
+#define INTERN_DISTINCT_KEYS 1000
+#define FRAGMENTS_PER_RESPONSE 200
+#define UTF8_VALIDATION_PASSES 100
+#define NUM_LOOKUPS 1000000
+#define PACKED_COLUMN_BITS 12
+#define NUM_SNAPSHOTS 1000
+#define RING_CAPACITY 1024
+#define RING_BATCH 64
+#define NUM_ROUND_TRIPS 100000
+#define NUM_TABLE_READERS 8
+#define NUM_SAVED_DARRAYS 1000
+static const char* const utf8_text_pieces[] = {
+    "plain ascii ", "caf\xC3\xA9 ", "\xE4\xB8\xAD\xE6\x96\x87 ", "\xF0\x9F\x98\x80 "
+};
+#define NUM_UTF8_TEXT_PIECES 4
+
+struct sort_record
+{
+    unsigned key;
+    unsigned id;
+    double value;
+};
+
+// Row of the structure of arrays benchmark. Only `mass` is scanned.
+struct particle
+{
+    double x, y, z;
+    double vx, vy, vz;
+    float mass;
+    int id;
+};
+#define PARTICLE_NUM_FIELDS 8
 
 #ifdef __cplusplus
 #   define MAX_WIDTH_TYPE_STR VECTOR_RF
@@ -25,6 +60,16 @@
 
 #define INDENT_SPACES 2
 
+// Wall clock time in clock() ticks. Used instead of clock() by benchmarks that
+// run on several threads, where clock() adds up the CPU time of every thread.
+clock_t wall_clock(void)
+{
+    struct timespec ts;
+    timespec_get(&ts, TIME_UTC);
+    return (clock_t)(ts.tv_sec*(double)CLOCKS_PER_SEC
+        + ts.tv_nsec*(CLOCKS_PER_SEC/1e9));
+}
+
 long clock_to_msec(clock_t c)
 {
     return (((double)c) * 1000) / CLOCKS_PER_SEC;
@@ -41,6 +86,65 @@ void print_results(const char* type, size_t nelements, clock_t begin,
         clock_to_msec(end-begin));
 }
 
+int compare_ints(const void* a, const void* b)
+{
+    int x = *(const int*)a;
+    int y = *(const int*)b;
+    return (x > y) - (x < y);
+}
+
+int compare_records(const void* a, const void* b)
+{
+    unsigned x = ((const struct sort_record*)a)->key;
+    unsigned y = ((const struct sort_record*)b)->key;
+    return (x > y) - (x < y);
+}
+
+// Per element work for the parallel fill benchmark. Costs between 16 and 79
+// rounds of a xorshift generator depending on the index, so that the cost of
+// equal sized chunks of elements varies.
+int heavy_value(size_t index)
+{
+    unsigned x = (unsigned)index * 2654435761u + 1;
+    for (size_t round = 0; round < 16 + index % 64; ++round)
+    {
+        x ^= x << 13;
+        x ^= x >> 17;
+        x ^= x << 5;
+    }
+    return (int)x;
+}
+
+void print_allocations(const char* type, size_t nallocs)
+{
+    printf("%*s%-*s : %10zu allocations\n",
+        INDENT_SPACES,
+        "", /* for indent %*s */
+        WIDTH_OF_MAX_WIDTH_TYPE_STR,
+        type, nallocs);
+}
+
+void print_memory(const char* type, size_t bytes)
+{
+    printf("%*s%-*s : %10zu bytes\n",
+        INDENT_SPACES,
+        "", /* for indent %*s */
+        WIDTH_OF_MAX_WIDTH_TYPE_STR,
+        type, bytes);
+}
+
+// Print the rate at which `bytes` bytes were produced in GB/s.
+void print_throughput(const char* type, size_t bytes, clock_t begin,
+    clock_t end)
+{
+    double seconds = (double)(end-begin) / CLOCKS_PER_SEC;
+    printf("%*s%-*s : %10.2f GB/s\n",
+        INDENT_SPACES,
+        "", /* for indent %*s */
+        WIDTH_OF_MAX_WIDTH_TYPE_STR,
+        type, seconds > 0 ? bytes / seconds / 1e9 : 0.0);
+}
+
 void fill_pre_sized(void);
 void fill_push_back(void);
 void insert_front(void);
@@ -48,6 +152,31 @@ void insert_rand(void);
 void remove_front(void);
 void remove_rand(void);
 void swap_rand(void);
+void number_to_string(void);
+void string_to_number(void);
+void short_keys(void);
+void intern_keys(void);
+void join_fragments(void);
+void utf8_validate(void);
+void sort_ints(void);
+void sort_records(void);
+void sort_parallel(void);
+void sorted_lookup(void);
+void sorted_intersect(void);
+void fill_parallel(void);
+void find(void);
+void reduce(void);
+void scan_field(void);
+void fill_segmented(void);
+void snapshot(void);
+void collect_parallel(void);
+void ring_queue(void);
+void read_mostly(void);
+void save_and_load(void);
+void map_startup(void);
+void read_lines(void);
+void compressed_ids(void);
+void packed_column(void);
 
 int main(void)
 {
@@ -61,7 +190,32 @@ int main(void)
     insert_rand();    putchar('\n');
     remove_front();   putchar('\n');
     remove_rand();    putchar('\n');
-    swap_rand();
+    swap_rand();        putchar('\n');
+    number_to_string(); putchar('\n');
+    string_to_number(); putchar('\n');
+    short_keys(); putchar('\n');
+    intern_keys(); putchar('\n');
+    join_fragments(); putchar('\n');
+    utf8_validate(); putchar('\n');
+    sort_ints();     putchar('\n');
+    sort_records();  putchar('\n');
+    sort_parallel(); putchar('\n');
+    sorted_lookup(); putchar('\n');
+    sorted_intersect(); putchar('\n');
+    fill_parallel(); putchar('\n');
+    find(); putchar('\n');
+    reduce(); putchar('\n');
+    scan_field(); putchar('\n');
+    fill_segmented(); putchar('\n');
+    snapshot(); putchar('\n');
+    collect_parallel(); putchar('\n');
+    ring_queue(); putchar('\n');
+    read_mostly(); putchar('\n');
+    save_and_load(); putchar('\n');
+    map_startup(); putchar('\n');
+    read_lines(); putchar('\n');
+    compressed_ids(); putchar('\n');
+    packed_column();
     puts(HR40 HR40);
     return EXIT_SUCCESS;
 }